@@ -0,0 +1,231 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BGEN_INDEX_HPP
+#define BGEN_INDEX_HPP
+
+#include "misc.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <ios>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*!
+ * \brief Sidecar index of a bgen file, storing the identifying data and the
+ * location of the genotype block of each variant. Once generated, the variant
+ * information can be obtained without scanning the bgen file. The index is
+ * keyed on the size, modification time, header and tail of the bgen file and
+ * is ignored once the bgen file changes
+ */
+namespace bgen_index
+{
+constexpr std::string_view magic = "PRSICE_BGEN_INDEX";
+constexpr unsigned long long version = 1;
+// magic, version, key, number of variants and length of the index
+constexpr size_t header_size = magic.size() + 4 * sizeof(unsigned long long);
+inline std::string index_name(const std::string& cache_dir,
+                              const std::string& bgen_name)
+{
+    return misc::cache_file(cache_dir, bgen_name, ".prsice.idx");
+}
+/*!
+ * \brief Generate the key of the bgen file without reading the whole file
+ * \param bgen_name is the name of the bgen file
+ * \param header_length is the number of bytes at the start of the file that
+ * contain the header and sample block
+ * \return the key
+ */
+inline unsigned long long key(const std::string& bgen_name,
+                              const size_t header_length)
+{
+    misc::Hasher hasher;
+    hasher.add(version).add_file_stat(bgen_name);
+    std::ifstream bgen(bgen_name.c_str(), std::ios::binary);
+    if (!bgen.is_open())
+    { throw std::runtime_error("Error: Cannot open file - " + bgen_name); }
+    bgen.seekg(0, bgen.end);
+    const size_t file_size = static_cast<size_t>(bgen.tellg());
+    bgen.seekg(0, bgen.beg);
+    // the header of the bgen and the last few variants
+    const size_t max_read = 1 << 20, tail = 1 << 16;
+    std::vector<char> buffer(std::min({header_length, file_size, max_read}));
+    bgen.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    hasher.add(buffer.data(), static_cast<size_t>(bgen.gcount()));
+    buffer.resize(std::min(file_size, tail));
+    bgen.clear();
+    bgen.seekg(static_cast<std::streamoff>(file_size - buffer.size()));
+    bgen.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    hasher.add(buffer.data(), static_cast<size_t>(bgen.gcount()));
+    return hasher.value();
+}
+
+class Reader
+{
+public:
+    Reader() : m_buffer(1 << 20) {}
+    /*!
+     * \brief Open the index
+     * \param name is the name of the index
+     * \param key is the key of the bgen file
+     * \param num_variant is the number of variant in the bgen file
+     * \return true if the index exists and matches the bgen file
+     */
+    bool open(const std::string& name, const unsigned long long key,
+              const unsigned long long num_variant)
+    {
+        m_index.rdbuf()->pubsetbuf(
+            m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+        m_index.open(name.c_str(), std::ios::binary);
+        if (!m_index.is_open()) return false;
+        m_index.seekg(0, m_index.end);
+        const unsigned long long file_length =
+            static_cast<unsigned long long>(m_index.tellg());
+        m_index.seekg(0, m_index.beg);
+        std::string file_magic(magic.size(), '\0');
+        unsigned long long header[4];
+        m_index.read(&file_magic[0],
+                     static_cast<std::streamsize>(file_magic.size()));
+        m_index.read(reinterpret_cast<char*>(header), sizeof(header));
+        // incomplete index has a length of 0
+        if (!m_index || file_magic != magic || header[0] != version
+            || header[1] != key || header[2] != num_variant
+            || header[3] != file_length)
+        {
+            m_index.close();
+            return false;
+        }
+        return true;
+    }
+    void read(std::string& snp_id, std::string& rs_id, std::string& chr,
+              uint32_t& loc, std::string& a1, std::string& a2,
+              std::streampos& byte_pos)
+    {
+        unsigned long long pos;
+        m_index.read(reinterpret_cast<char*>(&pos), sizeof(pos));
+        m_index.read(reinterpret_cast<char*>(&loc), sizeof(loc));
+        read_str(snp_id);
+        read_str(rs_id);
+        read_str(chr);
+        read_str(a1);
+        read_str(a2);
+        if (!m_index)
+        { throw std::runtime_error("Error: Bgen index file is truncated"); }
+        byte_pos = static_cast<std::streamoff>(pos);
+    }
+
+private:
+    std::vector<char> m_buffer;
+    std::ifstream m_index;
+    void read_str(std::string& str)
+    {
+        uint32_t length = 0;
+        m_index.read(reinterpret_cast<char*>(&length), sizeof(length));
+        str.resize(length);
+        m_index.read(&str[0], length);
+    }
+};
+
+class Writer
+{
+public:
+    Writer() : m_buffer(1 << 20) {}
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    ~Writer()
+    {
+        // index not completed, remove the partial file
+        if (m_index.is_open())
+        {
+            m_index.close();
+            std::remove(m_tmp_name.c_str());
+        }
+    }
+    /*!
+     * \brief Start writing the index. The index is written to a temporary
+     * file and is only renamed once completed
+     * \return false if the index cannot be written
+     */
+    bool open(const std::string& name, const unsigned long long key,
+              const unsigned long long num_variant)
+    {
+        m_name = name;
+        m_tmp_name = misc::tmp_file(name);
+        m_index.rdbuf()->pubsetbuf(
+            m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+        m_index.open(m_tmp_name.c_str(), std::ios::binary);
+        if (!m_index.is_open()) return false;
+        // length is filled in once the index is completed
+        const unsigned long long header[4] = {version, key, num_variant, 0};
+        m_index.write(magic.data(), static_cast<std::streamsize>(magic.size()));
+        m_index.write(reinterpret_cast<const char*>(header), sizeof(header));
+        return static_cast<bool>(m_index);
+    }
+    bool is_open() const { return m_index.is_open(); }
+    void write(const std::string& snp_id, const std::string& rs_id,
+               const std::string& chr, const uint32_t loc,
+               const std::string& a1, const std::string& a2,
+               const std::streampos& byte_pos)
+    {
+        const unsigned long long pos = static_cast<unsigned long long>(
+            static_cast<std::streamoff>(byte_pos));
+        m_index.write(reinterpret_cast<const char*>(&pos), sizeof(pos));
+        m_index.write(reinterpret_cast<const char*>(&loc), sizeof(loc));
+        write_str(snp_id);
+        write_str(rs_id);
+        write_str(chr);
+        write_str(a1);
+        write_str(a2);
+    }
+    /*!
+     * \brief Complete the index
+     * \return false if we failed to write the index
+     */
+    bool close()
+    {
+        const unsigned long long length =
+            static_cast<unsigned long long>(m_index.tellp());
+        m_index.seekp(static_cast<std::streamoff>(
+            header_size - sizeof(unsigned long long)));
+        m_index.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        m_index.close();
+        if (!m_index || std::rename(m_tmp_name.c_str(), m_name.c_str()) != 0)
+        {
+            std::remove(m_tmp_name.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<char> m_buffer;
+    std::ofstream m_index;
+    std::string m_name;
+    std::string m_tmp_name;
+    void write_str(const std::string& str)
+    {
+        const uint32_t length = static_cast<uint32_t>(str.size());
+        m_index.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        m_index.write(str.data(), length);
+    }
+};
+}
+
+#endif // BGEN_INDEX_HPP
@@ -0,0 +1,115 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BGZFSTREAM_HPP
+#define BGZFSTREAM_HPP
+
+#include <cstdint>
+#include <future>
+#include <istream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Stream buffer for BGZF (bgzip) compressed files. BGZF files are
+ * series of independent gzip blocks with their compressed size stored in the
+ * header, which allow us to inflate them in parallel. A batch of blocks is
+ * read and inflated in the background while the previous batch is being
+ * consumed by the parser, and the output is always returned in file order
+ */
+class BGZFReader : public std::streambuf
+{
+public:
+    /*!
+     * \brief Constructor of BGZFReader
+     * \param source is the BGZF compressed input, opened in binary mode
+     * \param file_name is the name of the input, used for error messages
+     * \param thread is the number of thread used for inflating the blocks
+     */
+    BGZFReader(std::unique_ptr<std::istream> source,
+               const std::string& file_name, const size_t thread);
+    virtual ~BGZFReader();
+    BGZFReader(const BGZFReader&) = delete;
+    BGZFReader& operator=(const BGZFReader&) = delete;
+    bool is_open() const { return m_file != nullptr; }
+    /*!
+     * \brief Check if the input is BGZF compressed by checking the header of
+     * the first block
+     * \param head is the start of the input, at least header_size() bytes
+     * \return true if the input is BGZF compressed
+     */
+    static bool is_bgzf(const std::string& head);
+    static size_t header_size() { return m_header_size; }
+
+protected:
+    /*!
+     * \brief Return the next inflated batch. Throw std::runtime_error if the
+     * file is corrupted or truncated, such that a damaged file is never read
+     * as a shorter but valid file
+     */
+    int_type underflow() override;
+
+private:
+    struct Batch
+    {
+        std::vector<char> data;
+        bool last = false;
+        bool error = false;
+    };
+    // size of the BGZF header, including the BC extra field
+    static const size_t m_header_size = 18;
+    // size of the CRC32 and ISIZE footer
+    static const size_t m_footer_size = 8;
+    // maximum size of a block once inflated
+    static const size_t m_max_block_size = 65536;
+    // maximum number of blocks each thread process per batch
+    static const size_t m_block_per_thread = 64;
+    std::unique_ptr<std::istream> m_file;
+    std::future<Batch> m_next;
+    std::vector<char> m_current;
+    std::string m_file_name;
+    size_t m_thread = 1;
+    // if the last block read is the EOF marker
+    bool m_eof_marker = false;
+    static bool valid_header(const unsigned char* header);
+    static bool inflate_block(const char* block, const size_t block_size,
+                              char* dest, const size_t dest_size);
+    Batch read_batch();
+};
+
+/*!
+ * \brief Input stream wrapper of the BGZFReader. Errors from the reader are
+ * rethrown instead of only setting the badbit
+ */
+class BGZFStream : public std::istream
+{
+public:
+    BGZFStream(std::unique_ptr<std::istream> source,
+               const std::string& file_name, const size_t thread)
+        : std::istream(nullptr), m_buffer(std::move(source), file_name, thread)
+    {
+        rdbuf(&m_buffer);
+        exceptions(std::ios::badbit);
+        if (!m_buffer.is_open()) setstate(std::ios::failbit);
+    }
+
+private:
+    BGZFReader m_buffer;
+};
+
+#endif // BGZFSTREAM_HPP
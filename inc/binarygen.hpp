@@ -17,10 +17,15 @@
 #ifndef BinaryGEN_H
 #define BinaryGEN_H
 
+#include "bgen_index.hpp"
 #include "bgen_lib.hpp"
 #include "genotype.hpp"
+#include "hardcall_cache.hpp"
 #include "reporter.hpp"
+#include <array>
+#include <exception>
 #include <stdexcept>
+#include <thread>
 #include <zlib.h>
 
 /**
@@ -50,6 +55,14 @@ protected:
     typedef std::vector<std::vector<double>> Data;
     std::vector<genfile::bgen::Context> m_context_map;
     std::vector<genfile::byte_t> m_buffer1, m_buffer2;
+    // FileRead handle of each genotype file, for read_genotype_concurrent
+    std::vector<size_t> m_file_handles;
+    // hard call cache of each genotype file, used when m_target_plink or
+    // m_ref_plink is set
+    std::vector<std::string> m_cache_names;
+    std::vector<size_t> m_cache_handles;
+    // hard call files written with --no-cache, removed by the destructor
+    std::vector<std::string> m_inter_names;
     bool m_target_plink = false;
     bool m_ref_plink = false;
     bool m_has_external_sample = false;
@@ -97,12 +110,11 @@ protected:
         if (m_ref_plink)
         {
             // when m_ref_plink is set, it suggest we are using the
-            // intermediate, which is a binary plink format. Therefore we can
-            // directly read in the binary data to genotype, this should already
-            // be well formated when we write it into the file
-            // intermediate file, so don't need .bgen
-            std::string file_name = m_genotype_file_names[file_idx];
-            m_genotype_file.read(file_name, byte_pos, unfiltered_sample_ct4,
+            // hard call cache, which is a binary plink format. Therefore we
+            // can directly read in the binary data to genotype, this should
+            // already be well formated when we write it into the file
+            m_genotype_file.read(m_cache_names[file_idx], byte_pos,
+                                 unfiltered_sample_ct4,
                                  reinterpret_cast<char*>(genotype));
         }
         // if not, we will try to parse the binary GEN format into a plink
@@ -112,6 +124,40 @@ protected:
             throw std::runtime_error("Error: Cannot read the bgen file!");
         }
     }
+    void read_genotype_scratch(uintptr_t* genotype,
+                               const std::streampos byte_pos,
+                               const size_t file_idx,
+                               GenotypeScratch& scratch) const
+    {
+        if (m_ref_plink)
+        {
+            const uintptr_t unfiltered_sample_ct4 =
+                (m_unfiltered_sample_ct + 3) / 4;
+            m_genotype_file.pread(m_cache_handles.at(file_idx), byte_pos,
+                                  unfiltered_sample_ct4,
+                                  reinterpret_cast<char*>(genotype));
+            return;
+        }
+        PLINK_generator setter(&m_calculate_prs, genotype, m_hard_threshold,
+                               m_dose_threshold);
+        genfile::bgen::read_genotype_data_block(
+            m_genotype_file, m_file_handles.at(file_idx),
+            m_context_map[file_idx], &scratch.buffer1, byte_pos);
+        parse_genotype_block(m_context_map[file_idx], scratch.buffer1,
+                             &scratch.buffer2, setter);
+    }
+    void open_genotype_files()
+    {
+        m_file_handles.resize(m_genotype_file_names.size());
+        for (size_t i = 0; i < m_genotype_file_names.size(); ++i)
+        {
+            m_file_handles[i] =
+                m_genotype_file.open(m_genotype_file_names[i] + ".bgen");
+        }
+        m_cache_handles.resize(m_cache_names.size());
+        for (size_t i = 0; i < m_cache_names.size(); ++i)
+        { m_cache_handles[i] = m_genotype_file.open(m_cache_names[i]); }
+    }
 
     /*!
      * \brief We modify the load_and_collapse_incl function from PLINK to read
@@ -158,9 +204,9 @@ protected:
         // on our side
         std::string file_name = m_genotype_file_names[file_idx] + ".bgen";
         // WARNING: Problem here
-        genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
-            m_genotype_file, file_name, context, setter, &m_buffer1, &m_buffer2,
-            byte_pos);
+        genfile::bgen::read_genotype_data_block(m_genotype_file, file_name,
+                                                context, &m_buffer1, byte_pos);
+        parse_genotype_block(context, m_buffer1, &m_buffer2, setter);
         // output from load_raw should have already copied all samples
         // to the front without the need of subseting
         // mainbuf should contains the information
@@ -170,6 +216,48 @@ protected:
         return 0;
     }
 
+    /*!
+     * \brief Genotype of a SNP used for scoring. The raw genotype block is
+     * read in SNP order, decoded on the worker threads and then added to the
+     * PRS in SNP order
+     */
+    struct DecodedSNP
+    {
+        // compressed genotype block, empty if no decoding is required
+        std::vector<genfile::byte_t> block;
+        // hard coded genotype
+        std::vector<uintptr_t> genotype;
+        // weighted dosage and missingness of each sample
+        std::vector<double> dosage;
+        std::vector<uint8_t> missing;
+        size_t file_idx = 0;
+        size_t homcom_ct = 0;
+        size_t het_ct = 0;
+        size_t homrar_ct = 0;
+        size_t missing_ct = 0;
+        double info_score = 0;
+        double expected = 0;
+        int ploidy = 2;
+    };
+    /*!
+     * \brief Read the genotype blocks of the SNPs in order, decode them on
+     * the worker pool, then pass them to fold in SNP order. The result is
+     * therefore the same regardless of the number of thread
+     *
+     * \param snps is the SNP vector indexed by start_idx to end_idx
+     * \param read is called on the calling thread to read in the SNP
+     * \param decode is called on the worker threads to decode the SNP. Must
+     * not modify any shared state
+     * \param fold is called on the calling thread with the decoded SNP
+     * \param slot_size is the approximated memory used by each DecodedSNP
+     */
+    template <typename Read, typename Decode, typename Fold>
+    void decode_in_order(std::vector<SNP>& snps,
+                         const std::vector<size_t>::const_iterator& start_idx,
+                         const std::vector<size_t>::const_iterator& end_idx,
+                         const size_t slot_size, Read&& read, Decode&& decode,
+                         Fold&& fold);
+    void read_block(const SNP& snp, DecodedSNP& decoded);
     void read_score(std::vector<PRS>& prs_list,
                     const std::vector<size_t>::const_iterator& start_idx,
                     const std::vector<size_t>::const_iterator& end_idx,
@@ -183,63 +271,130 @@ protected:
                       const std::vector<size_t>::const_iterator& end_idx,
                       bool reset_zero);
 
+    /*!
+     * \brief Convert the probability stored in the bgen file to double, the
+     * same way as the bgen library does
+     * \tparam T is the type used to store the probability, either uint8_t or
+     * uint16_t
+     * \param value is the little endian probability
+     */
+    template <typename T>
+    static double to_probability(const genfile::byte_t* value)
+    {
+        static_assert(sizeof(T) == 1 || sizeof(T) == 2,
+                      "Only 8 or 16 bits probabilities are supported");
+        if constexpr (sizeof(T) == 1) { return probability_table()[*value]; }
+        else
+        {
+            const uint16_t prob =
+                static_cast<uint16_t>(value[0] | (value[1] << 8));
+            return static_cast<double>(prob) / 65535.0;
+        }
+    }
+    static const std::array<double, 256>& probability_table()
+    {
+        static const std::array<double, 256> table = [] {
+            std::array<double, 256> res;
+            for (size_t i = 0; i < res.size(); ++i)
+            { res[i] = static_cast<double>(i) / 255.0; }
+            return res;
+        }();
+        return table;
+    }
+    /*!
+     * \brief Parse the uncompressed probability data of a SNP. Layout 2
+     * unphased diploid bi-allelic data stored with 8 or 16 bits, which is
+     * what most imputed data uses, is decoded by the setter's
+     * decode_diploid. Everything else goes through the per value callbacks
+     * of the bgen library
+     * \param context is the context of the bgen file
+     * \param data is the uncompressed probability data
+     * \param setter is the setter
+     */
+    template <typename Setter>
+    static void parse_probability(const genfile::bgen::Context& context,
+                                  const std::vector<genfile::byte_t>& data,
+                                  Setter& setter)
+    {
+        const genfile::byte_t* begin = data.data();
+        const genfile::byte_t* end = begin + data.size();
+        if ((context.flags & genfile::bgen::e_Layout)
+            != genfile::bgen::e_Layout2)
+        {
+            genfile::bgen::parse_probability_data(begin, end, context, setter);
+            return;
+        }
+        genfile::bgen::v12::GenotypeDataBlock pack(context, begin, end);
+        if (pack.numberOfAlleles == 2 && pack.ploidyExtent[0] == 2
+            && pack.ploidyExtent[1] == 2 && !pack.phased)
+        {
+            switch (pack.bits)
+            {
+            case 8: setter.template decode_diploid<uint8_t>(pack); return;
+            case 16: setter.template decode_diploid<uint16_t>(pack); return;
+            }
+        }
+        genfile::bgen::v12::parse_probability_data(pack, setter);
+    }
+    /*!
+     * \brief Uncompress and parse the genotype block of a SNP
+     * \param context is the context of the bgen file
+     * \param block is the genotype block read from the bgen file
+     * \param buffer is the buffer for the uncompressed data
+     * \param setter is the setter
+     */
+    template <typename Setter>
+    static void parse_genotype_block(const genfile::bgen::Context& context,
+                                     const std::vector<genfile::byte_t>& block,
+                                     std::vector<genfile::byte_t>* buffer,
+                                     Setter& setter)
+    {
+        genfile::bgen::uncompress_probability_data(context, block, buffer);
+        parse_probability(context, *buffer, setter);
+    }
+
     /*
      * Different structures use for reading in the bgen info
      */
-    // TODO: Use ref MAf for dosage score too
-    struct PRS_Interpreter
+    /*!
+     * \brief Dosage_Decoder is the structure used by BGEN library to parse the
+     * probability data for dosage scoring. It stores the weighted dosage of
+     * each required sample, which is then added to the PRS by PRS_Interpreter.
+     * As it does not touch the PRS, multiple decoders can run at once
+     */
+    struct Dosage_Decoder
     {
-        ~PRS_Interpreter() {}
         /*!
-         * \brief PRS_Interpreter is the structure used by BGEN library to parse
-         * the probability data
+         * \brief Construct the decoder
          *
-         * \param sample_prs is the vector where we store the results
          * \param sample_inclusion is the vector telling us if the sample is
          * required
-         *
-         * \param missing contain the method of missingness handling
+         * \param dosage is where we store the weighted dosage of each required
+         * sample
+         * \param missing is where we store whether the sample is missing
          */
-        PRS_Interpreter(std::vector<PRS>* sample_prs,
-                        std::vector<uintptr_t>* sample_inclusion,
-                        MISSING_SCORE missing)
-            : m_sample_prs(sample_prs), m_sample_inclusion(sample_inclusion)
+        Dosage_Decoder(const std::vector<uintptr_t>* sample_inclusion,
+                       std::vector<double>* dosage,
+                       std::vector<uint8_t>* missing)
+            : m_sample_inclusion(sample_inclusion)
+            , m_dosage(dosage)
+            , m_missing(missing)
         {
-            m_miss_count = m_ploidy * (missing != MISSING_SCORE::SET_ZERO);
-            // to account for the missingness, we need to calculate the mean of
-            // the PRS before we can assign the missing value to the sample. As
-            // a result of that, we need a vector to store the index of the
-            // missing sample. The maximum possible number of missing sample is
-            // the number of sample, thus we can reserve the required size
-            m_setzero = (missing == MISSING_SCORE::SET_ZERO);
-            m_centre = (missing == MISSING_SCORE::CENTER);
         }
         /*!
-         * \brief As we will reuse this struct in our analysis, we need to
-         * constantly feed in different statistics and to inform this struct
-         * whether we want to reset the PRS
+         * \brief Set the weighting of the genotypes of the current SNP
          *
-         * \param stat is the effect size of the SNP
          * \param homcom_weight is the weight of the homozygous common variant
          * \param het_weight is the weight of heterozygous
          * \param homrar_weight is the weight of homozygous rare variant
          * \param flipped represent whether we want to flip this SNP
-         * \param not_first inform us if we want to construct a new score or not
          */
-        void set_stat(const double& stat, const double& homcom_weight,
-                      const double& het_weight, const double& homrar_weight,
-                      const bool flipped, const bool not_first)
+        void set_weight(const double& homcom_weight, const double& het_weight,
+                        const double& homrar_weight, const bool flipped)
         {
-            // don't use external expected as that doesn't take into account of
-            // the weighting
-            m_missing.clear();
-            m_stat = stat;
             m_homcom_weight = homcom_weight;
             m_het_weight = het_weight;
             m_homrar_weight = homrar_weight;
-            m_not_first = not_first;
-            m_cal_expected = 0;
-            rs.clear();
             // to match the encoding in PLINK format, we "unflip" SNPs here
             // otherwise our polygenic score will be going to an opposite
             // direction
@@ -248,16 +403,6 @@ protected:
                 // immediately flip the weight at the beginning
                 std::swap(m_homcom_weight, m_homrar_weight);
             }
-            m_adj_score = 0;
-            m_miss_score = 0;
-            m_miss_count = 0;
-            if (!m_setzero)
-            {
-                // this is the only one that depends on ploidy
-                m_miss_count = 2;
-                // again, mean_impute is stable, branch prediction should be ok
-                // 0 if we don't have the expected score
-            }
         }
         /*!
          * \brief This function is called by BGEN whenever a new SNP is
@@ -265,10 +410,8 @@ protected:
          */
         void initialise(std::size_t, std::size_t)
         {
-            // we will reset the IDs
-            // m_prs_sample_i represent the sample index of the result PRS
-            // vector which does not contain samples that are removed
-            m_prs_sample_i = 0;
+            m_dosage->clear();
+            m_missing->clear();
         }
         /*!
          * \brief Another function mandated by bgen library that we don't use
@@ -286,11 +429,6 @@ protected:
         {
             // a flag to indicate if this is a missing sample
             m_is_missing = false;
-            // a flag to indicate this is the first genotype of the sample
-            // we set this to account for the off chance where the set_value
-            // isn't called in the expected order (though in that case, our
-            // m_entry_i might also be wrong)
-            m_start_geno = false;
             // we store the weighted sum of the genotypes to obtain the final
             // dosage
             m_sum = 0.0;
@@ -299,13 +437,14 @@ protected:
             // by a sum of probability = 0
             m_sum_prob = 0.0;
             // if the byte is set, then we want this sample
-            return IS_SET(m_sample_inclusion->data(), i);
+            m_include = IS_SET(m_sample_inclusion->data(), i);
+            return m_include;
         }
         void set_number_of_entries(std::size_t ploidy, std::size_t,
                                    genfile::OrderType phased,
                                    genfile::ValueType)
         {
-            m_ploidy = ploidy;
+            m_ploidy = static_cast<int>(ploidy);
             m_phased = phased;
         }
 
@@ -346,89 +485,88 @@ protected:
         void set_value(uint32_t, genfile::MissingValue) { m_is_missing = true; }
         /*!
          * \brief This function is called whenever all probability for a sample
-         * are read. We can then perform assignment to the sample
+         * are read. We can then store the dosage of the sample
          */
         void sample_completed()
         {
-            auto&& sample_prs = (*m_sample_prs)[m_prs_sample_i];
-
-            if (misc::logically_equal(m_sum_prob, 0.0) || m_is_missing)
-            {
-                m_missing.push_back(m_prs_sample_i);
-                sample_prs.num_snp =
-                    sample_prs.num_snp * m_not_first + m_miss_count;
-            }
-            // this is not a missing sample and we can either add the prs or
-            // assign the PRS
-            else
-            {
-                // this is not the first SNP in the region, we will add
-                sample_prs.num_snp =
-                    sample_prs.num_snp * m_not_first + m_ploidy;
-                sample_prs.prs =
-                    sample_prs.prs * m_not_first + m_sum * m_stat - m_adj_score;
-                rs.push(m_sum);
-            }
-            // go to next sample that we need (not the bgen index)
-            ++m_prs_sample_i;
+            // bgen library also call this for samples that we don't want
+            if (!m_include) return;
+            m_dosage->push_back(m_sum);
+            m_missing->push_back(misc::logically_equal(m_sum_prob, 0.0)
+                                 || m_is_missing);
         }
+        void finalise() {}
         /*!
-         * \brief once we finish reading the whole SNP, we can then start
-         * processing samples with missing data. This requires us to calculate
-         * the expected value and use that as the PRS of the samples
+         * \brief Decode unphased diploid bi-allelic data without going
+         * through the per value callbacks. Gives the same result as the
+         * callbacks. All samples are first decoded into the output without
+         * any branch, such that the loop can be vectorised, then the
+         * included samples are moved to the front
+         * \tparam T is the type used to store each probability
+         * \param pack is the genotype data block
          */
-        void finalise()
+        template <typename T>
+        void decode_diploid(const genfile::bgen::v12::GenotypeDataBlock& pack)
         {
-            if (m_centre) { m_adj_score = m_stat * rs.mean(); }
-            if (!m_setzero)
+            const size_t num_sample = pack.numberOfSamples;
+            if (pack.end < pack.buffer + 2 * sizeof(T) * num_sample)
+            { throw genfile::bgen::BGenError(); }
+            // the vectors are reused for every SNP, so this doesn't allocate
+            m_dosage->resize(num_sample);
+            m_missing->resize(num_sample);
+            m_ploidy = 2;
+            double* dosage = m_dosage->data();
+            uint8_t* missing = m_missing->data();
+            const genfile::byte_t* value = pack.buffer;
+            for (size_t i = 0; i < num_sample; ++i)
             {
-                m_miss_count = 2;
-                m_miss_score = m_stat * rs.mean();
+                const double homcom =
+                    to_probability<T>(value + 2 * sizeof(T) * i);
+                const double het =
+                    to_probability<T>(value + (2 * i + 1) * sizeof(T));
+                // Clamp the value to 0 to avoid small -ve values
+                const double homrar = std::max(1.0 - homcom - het, 0.0);
+                double sum = 0.0;
+                sum += m_homcom_weight * homcom;
+                sum += m_het_weight * het;
+                sum += m_homrar_weight * homrar;
+                double sum_prob = 0.0;
+                sum_prob += homcom;
+                sum_prob += het;
+                sum_prob += homrar;
+                // the probabilities are never negative, so this is the same
+                // as misc::logically_equal(sum_prob, 0.0)
+                const bool is_missing =
+                    (pack.ploidy[i] & 0x80) != 0 || sum_prob == 0.0;
+                dosage[i] = is_missing ? 0.0 : sum;
+                missing[i] = is_missing;
             }
-
-            // only need to do this if we don't have the expected information
-            size_t cur_idx = 0;
-            for (size_t i = 0; i < m_sample_prs->size(); ++i)
+            size_t num_included = 0;
+            for (size_t i = 0; i < num_sample; ++i)
             {
-                if (cur_idx < m_missing.size() && i == m_missing[cur_idx])
-                {
-                    (*m_sample_prs)[i].prs =
-                        (*m_sample_prs)[i].prs * m_not_first + m_miss_score;
-                    ++cur_idx;
-                }
-                else if (m_centre)
-                {
-                    // if it is not missing and we want the centre the score
-                    // we will need to minus the adjusted score which was 0
-                    // before this run
-                    (*m_sample_prs)[i].prs -= m_adj_score;
-                }
+                if (!IS_SET(m_sample_inclusion->data(), i)) continue;
+                dosage[num_included] = dosage[i];
+                missing[num_included] = missing[i];
+                ++num_included;
             }
+            m_dosage->resize(num_included);
+            m_missing->resize(num_included);
         }
+        int ploidy() const { return m_ploidy; }
 
     private:
-        std::vector<PRS>* m_sample_prs;
-        std::vector<uintptr_t>* m_sample_inclusion;
-        std::vector<size_t> m_missing;
-        misc::RunningStat rs;
+        const std::vector<uintptr_t>* m_sample_inclusion;
+        std::vector<double>* m_dosage;
+        std::vector<uint8_t>* m_missing;
         genfile::OrderType m_phased = genfile::OrderType::ePerUnorderedGenotype;
-        double m_stat = 0.0;
         double m_sum = 0.0;
         double m_sum_prob = 0.0;
         double m_homcom_weight = 0;
         double m_het_weight = 0.1;
         double m_homrar_weight = 1;
-        double m_miss_score = 0.0;
-        double m_adj_score = 0.0;
-        double m_cal_expected = 0.0;
-        uint32_t m_prs_sample_i = 0;
-        int m_miss_count = 0;
         int m_ploidy = 2;
-        bool m_not_first = false;
         bool m_is_missing = false;
-        bool m_start_geno = false;
-        bool m_setzero = false;
-        bool m_centre = false;
+        bool m_include = false;
     };
 
     /*!
@@ -439,7 +577,8 @@ protected:
      */
     struct PLINK_generator
     {
-        PLINK_generator(std::vector<uintptr_t>* sample, uintptr_t* genotype,
+        PLINK_generator(const std::vector<uintptr_t>* sample,
+                        uintptr_t* genotype,
                         double hard_threshold, double dose_threshold)
             : m_sample(sample)
             , m_genotype(genotype)
@@ -630,6 +769,41 @@ protected:
             return (rs.var() / p_all);
         }
         double expected() const { return rs.mean(); }
+        /*!
+         * \brief Decode unphased diploid bi-allelic data without going
+         * through the per value callbacks. Gives the same result as the
+         * callbacks
+         * \tparam T is the type used to store each probability
+         * \param pack is the genotype data block
+         */
+        template <typename T>
+        void decode_diploid(const genfile::bgen::v12::GenotypeDataBlock& pack)
+        {
+            const size_t num_sample = pack.numberOfSamples;
+            if (pack.end < pack.buffer + 2 * sizeof(T) * num_sample)
+            { throw genfile::bgen::BGenError(); }
+            initialise(num_sample, 2);
+            m_phased = genfile::OrderType::ePerUnorderedGenotype;
+            const genfile::byte_t* value = pack.buffer;
+            for (size_t i = 0; i < num_sample; ++i, value += 2 * sizeof(T))
+            {
+                if (set_sample(i))
+                {
+                    if (pack.ploidy[i] & 0x80) { m_missing = true; }
+                    else
+                    {
+                        m_prob[0] = to_probability<T>(value);
+                        m_prob[1] = to_probability<T>(value + sizeof(T));
+                        // Clamp the value to 0 to avoid small -ve values
+                        m_prob[2] = std::max(1.0 - m_prob[0] - m_prob[1], 0.0);
+                        m_exp_value += 0.0 * m_prob[0];
+                        m_exp_value += 1.0 * m_prob[1];
+                        m_exp_value += 2.0 * m_prob[2];
+                    }
+                }
+                sample_completed();
+            }
+        }
         void get_count(size_t& homcom_ct, size_t& het_ct, size_t& homrar_ct,
                        size_t& missing_ct) const
         {
@@ -642,7 +816,7 @@ protected:
 
     private:
         // is the sample inclusion vector, if bit is set, sample is required
-        std::vector<uintptr_t>* m_sample;
+        const std::vector<uintptr_t>* m_sample;
         std::vector<double> m_prob;
         // is the genotype vector
         uintptr_t* m_genotype;
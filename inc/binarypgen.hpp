@@ -0,0 +1,177 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BINARYPGEN
+#define BINARYPGEN
+
+#include "commander.hpp"
+#include "genotype.hpp"
+#include "misc.hpp"
+#include "pgen.hpp"
+#include "reporter.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*!
+ * \brief Genotype stored in the PLINK 2 format (.pgen, .pvar and .psam). The
+ * ALT allele of the .pvar file is used as A1. Hard calls are used for LD
+ * calculation and for PRS when --hard is set, otherwise the dosages are used
+ */
+class BinaryPgen : public Genotype
+{
+public:
+    BinaryPgen() {}
+    BinaryPgen(const GenoFile& geno, const Phenotype& pheno,
+               const std::string& delim, Reporter* reporter);
+    ~BinaryPgen();
+
+protected:
+    // index of each .pgen file
+    std::vector<pgen::Index> m_pgen_index;
+    // FileRead handle of each .pgen file, npos if not yet opened
+    std::vector<size_t> m_pgen_handles;
+    // dosage of the current variant, used by read_score
+    std::vector<uint16_t> m_dosage;
+    std::vector<double> m_sample_dosage;
+    std::vector<uint8_t> m_sample_missing;
+    /*!
+     * \brief Hard calls of the last record that isn't LD compressed, such
+     * that the LD base doesn't need to be decoded again when the genotypes
+     * are read in order
+     */
+    struct LDBase
+    {
+        size_t file_idx = ~size_t(0);
+        uint32_t variant = 0;
+        std::vector<uintptr_t> genotype;
+    };
+    LDBase m_ldbase;
+    /*!
+     * \brief Variants of a single .pvar file
+     */
+    struct PvarBatch
+    {
+        std::vector<std::string> rs, chr, a1, a2;
+        std::vector<unsigned long long> loc;
+        // index of the variant in the .pgen file
+        std::vector<uint32_t> variant;
+        std::unordered_map<size_t, std::string> invalid_loc;
+        uint32_t num_variant = 0;
+        size_t num_not_biallelic = 0;
+    };
+    std::vector<Sample_ID> gen_sample_vector();
+    void
+    gen_snp_vector(const std::vector<IITree<size_t, size_t>>& exclusion_regions,
+                   const std::string& out_prefix, Genotype* target = nullptr);
+    bool calc_freq_gen_inter(const QCFiltering& filter_info, const std::string&,
+                             Genotype* target = nullptr,
+                             bool force_cal = false);
+    /*!
+     * \brief Read the .pvar file of a genotype file. Variants without
+     * exactly one ALT allele are skipped
+     * \param idx is the index of the genotype file
+     * \param batch is the output
+     */
+    void load_pvar(const size_t idx, PvarBatch& batch) const;
+    size_t pgen_handle(const size_t file_idx)
+    {
+        if (m_pgen_handles.size() != m_genotype_file_names.size())
+        { m_pgen_handles.assign(m_genotype_file_names.size(), FileRead::npos); }
+        size_t& handle = m_pgen_handles[file_idx];
+        if (handle == FileRead::npos)
+        {
+            handle =
+                m_genotype_file.open(m_genotype_file_names[file_idx] + ".pgen");
+        }
+        return handle;
+    }
+    void open_genotype_files()
+    {
+        for (size_t i = 0; i < m_genotype_file_names.size(); ++i)
+        { pgen_handle(i); }
+    }
+    /*!
+     * \brief Decode the hard calls (and dosages) of a variant
+     * \param file_idx is the index of the genotype file
+     * \param byte_pos is the index of the variant in the .pgen file
+     * \param scratch is the buffer for the raw records
+     * \param genotype is the output hard calls, in pgen encoding
+     * \param dosage is the output dosages, nullptr if not required
+     * \param ldbase is the cache of the LD base, nullptr if it shouldn't be
+     * used
+     */
+    void decode_variant(const size_t file_idx, const std::streampos byte_pos,
+                        GenotypeScratch& scratch, uintptr_t* genotype,
+                        std::vector<uint16_t>* dosage, LDBase* ldbase) const;
+    /*!
+     * \brief Extract the founders from the PLINK binary genotypes
+     */
+    void subset_founder(const uintptr_t* raw,
+                        uintptr_t* __restrict genotype) const
+    {
+        if (m_unfiltered_sample_ct != m_founder_ct)
+        {
+            copy_quaterarr_nonempty_subset(
+                raw, m_sample_for_ld.data(),
+                static_cast<uint32_t>(m_unfiltered_sample_ct),
+                static_cast<uint32_t>(m_founder_ct), genotype);
+        }
+        else
+        {
+            std::copy(raw, raw + QUATERCT_TO_WORDCT(m_unfiltered_sample_ct),
+                      genotype);
+        }
+    }
+    inline void read_genotype(uintptr_t* __restrict genotype,
+                              const std::streampos byte_pos,
+                              const size_t& file_idx)
+    {
+        pgen_handle(file_idx);
+        auto scratch = m_scratch_pool.acquire();
+        decode_variant(file_idx, byte_pos, *scratch, m_tmp_genotype.data(),
+                       nullptr, &m_ldbase);
+        pgen::to_plink1(m_tmp_genotype.data(),
+                        static_cast<uint32_t>(m_unfiltered_sample_ct));
+        subset_founder(m_tmp_genotype.data(), genotype);
+    }
+    void read_genotype_scratch(uintptr_t* genotype,
+                               const std::streampos byte_pos,
+                               const size_t file_idx,
+                               GenotypeScratch& scratch) const
+    {
+        scratch.tmp_genotype.resize(m_tmp_genotype.size(), 0);
+        decode_variant(file_idx, byte_pos, scratch,
+                       scratch.tmp_genotype.data(), nullptr, nullptr);
+        pgen::to_plink1(scratch.tmp_genotype.data(),
+                        static_cast<uint32_t>(m_unfiltered_sample_ct));
+        subset_founder(scratch.tmp_genotype.data(), genotype);
+    }
+    void read_score(std::vector<PRS>& prs_list,
+                    const std::vector<size_t>::const_iterator& start_idx,
+                    const std::vector<size_t>::const_iterator& end_idx,
+                    bool reset_zero, bool ultra = false);
+    void hard_code_score(std::vector<PRS>& prs_list,
+                         const std::vector<size_t>::const_iterator& start_idx,
+                         const std::vector<size_t>::const_iterator& end_idx,
+                         bool reset_zero, bool ultra = false);
+    void dosage_score(std::vector<PRS>& prs_list,
+                      const std::vector<size_t>::const_iterator& start_idx,
+                      const std::vector<size_t>::const_iterator& end_idx,
+                      bool reset_zero);
+};
+
+#endif
@@ -21,8 +21,12 @@
 #include "commander.hpp"
 #include "genotype.hpp"
 #include "misc.hpp"
+#include "prefetcher.hpp"
 #include "reporter.hpp"
+#include <exception>
 #include <functional>
+#include <string_view>
+#include <unordered_map>
 class BinaryPlink : public Genotype
 {
 public:
@@ -48,7 +52,46 @@ public:
 protected:
     std::vector<uintptr_t> m_sample_mask;
     std::streampos m_prev_loc = 0;
+    // FileRead handle of each .bed file, npos if not yet opened
+    std::vector<size_t> m_bed_handles;
+    /*!
+     * \brief Variants of a single .bim file. Files are loaded in parallel and
+     * merged in file order by gen_snp_vector
+     */
+    struct BimBatch
+    {
+        std::vector<std::string> rs, chr, a1, a2;
+        std::vector<unsigned long long> loc;
+        // coordinates that cannot be parsed, indexed by the variant. Only
+        // an error if the variant is used
+        std::unordered_map<size_t, std::string> invalid_loc;
+        std::string warning;
+        std::exception_ptr error;
+        uintptr_t bed_offset = 0;
+    };
+    static constexpr std::string_view m_bim_cache_magic = "PRSICE_BIM_CACHE";
+    static constexpr unsigned long long m_bim_cache_version = 1;
     std::vector<Sample_ID> gen_sample_vector();
+    /*!
+     * \brief Read the .bim file and check the .bed file, or read from the
+     * cache if the files didn't change. Errors are stored in the batch such
+     * that they are thrown in file order
+     * \param idx is the index of the genotype file
+     * \param batch is the output
+     */
+    void load_bim(const size_t idx, BimBatch& batch);
+    /*!
+     * \brief Generate the key of the .bim cache from the size, modification
+     * time and the first and last block of the .bim and .bed file. The
+     * content is needed as the modification time only has a resolution of
+     * a second
+     */
+    unsigned long long bim_cache_key(const std::string& prefix) const;
+    bool load_bim_cache(const std::string& cache_file,
+                        const unsigned long long key, BimBatch& batch) const;
+    bool save_bim_cache(const std::string& cache_file,
+                        const unsigned long long key,
+                        const BimBatch& batch) const;
     void
     gen_snp_vector(const std::vector<IITree<size_t, size_t>>& exclusion_regions,
                    const std::string& out_prefix, Genotype* target = nullptr);
@@ -58,6 +101,32 @@ protected:
     void check_bed(const std::string& bed_name, size_t num_marker,
                    uintptr_t& bed_offset);
     std::unordered_set<std::string> get_founder_info(std::ifstream& famfile);
+    /*!
+     * \brief Return the FileRead handle of the .bed file, such that we don't
+     * need to construct the file name for every SNP
+     * \param file_idx is the index of the genotype file
+     * \return the handle of the .bed file
+     */
+    size_t bed_handle(const size_t file_idx)
+    {
+        if (m_bed_handles.size() != m_genotype_file_names.size())
+        { m_bed_handles.assign(m_genotype_file_names.size(), FileRead::npos); }
+        size_t& handle = m_bed_handles[file_idx];
+        if (handle == FileRead::npos)
+        {
+            handle =
+                m_genotype_file.open(m_genotype_file_names[file_idx] + ".bed");
+        }
+        return handle;
+    }
+    /*!
+     * \brief Start reading the .bed rows ahead on a separate thread
+     * \param requests is the list of rows, in the order they will be read
+     * \return the prefetcher, or nullptr if there are too few rows for the
+     * read ahead to be worthwhile
+     */
+    std::unique_ptr<Prefetcher>
+    prefetch_bed(std::vector<Prefetcher::Request>&& requests);
     inline void read_genotype(uintptr_t* __restrict genotype,
                               const std::streampos byte_pos,
                               const size_t& file_idx)
@@ -73,13 +142,45 @@ protected:
         // now we start reading / parsing the binary from the file
         assert(unfiltered_sample_ct);
 
-        m_genotype_file.read(m_genotype_file_names[file_idx] + ".bed", byte_pos,
+        m_genotype_file.read(bed_handle(file_idx), byte_pos,
                              unfiltered_sample_ct4,
                              reinterpret_cast<char*>(m_tmp_genotype.data()));
+        subset_genotype(m_tmp_genotype, final_mask, genotype);
+    }
+    void read_genotype_scratch(uintptr_t* genotype,
+                               const std::streampos byte_pos,
+                               const size_t file_idx,
+                               GenotypeScratch& scratch) const
+    {
+        const uintptr_t final_mask =
+            get_final_mask(static_cast<uint32_t>(m_founder_ct));
+        const uintptr_t unfiltered_sample_ct4 =
+            (m_unfiltered_sample_ct + 3) / 4;
+        scratch.tmp_genotype.resize(m_tmp_genotype.size(), 0);
+        m_genotype_file.pread(
+            m_bed_handles.at(file_idx), byte_pos, unfiltered_sample_ct4,
+            reinterpret_cast<char*>(scratch.tmp_genotype.data()));
+        subset_genotype(scratch.tmp_genotype, final_mask, genotype);
+    }
+    void open_genotype_files()
+    {
+        for (size_t i = 0; i < m_genotype_file_names.size(); ++i)
+        { bed_handle(i); }
+    }
+    /*!
+     * \brief Extract the required samples from the raw .bed row
+     * \param raw is the raw .bed row
+     * \param final_mask is the mask to remove the trailing bytes
+     * \param genotype is the output
+     */
+    void subset_genotype(const std::vector<uintptr_t>& raw,
+                         const uintptr_t final_mask,
+                         uintptr_t* __restrict genotype) const
+    {
         if (m_unfiltered_sample_ct == m_founder_ct)
         {
             copy_quaterarr_nonempty_subset(
-                m_tmp_genotype.data(), m_sample_for_ld.data(),
+                raw.data(), m_sample_for_ld.data(),
                 static_cast<uint32_t>(m_unfiltered_sample_ct),
                 static_cast<uint32_t>(m_founder_ct), genotype);
         }
@@ -87,8 +188,7 @@ protected:
         {
             // not sure why the genotype = m_tmp_genotype.data() worked before
             // but not now.
-            for (size_t i = 0; i < m_tmp_genotype.size(); ++i)
-            { *genotype++ = m_tmp_genotype[i]; }
+            for (size_t i = 0; i < raw.size(); ++i) { *genotype++ = raw[i]; }
             // genotype = m_tmp_genotype.data();
             genotype[(m_unfiltered_sample_ct - 1) / BITCT2] &= final_mask;
         }
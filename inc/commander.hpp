@@ -77,6 +77,17 @@ public:
         return !m_clump_info.no_clump || m_prs_info.use_ref_maf;
     }
     bool use_inter() const { return m_allow_inter; }
+    /*!
+     * \brief Directory of the genotype caches, which default to the directory
+     * of the output prefix
+     * \return the directory, empty if the caches are disabled
+     */
+    std::string cache_dir() const
+    {
+        if (m_no_cache) return "";
+        if (!m_cache_dir.empty()) return m_cache_dir;
+        return misc::dir_name(m_out_prefix);
+    }
     std::string delim() const { return m_id_delim; }
     std::string out() const { return m_out_prefix; }
     std::string exclusion_range() const { return m_exclusion_range; }
@@ -91,21 +102,34 @@ public:
     std::string exclude_file() const { return m_exclude_file; }
     std::string extract_file() const { return m_extract_file; }
     bool keep_ambig() const { return m_keep_ambig; }
+    bool match_by_pos() const { return m_match_by_pos; }
+    size_t read_gap() const { return m_read_gap; }
     bool nonfounders() const { return m_include_nonfounders; }
     bool ultra_aggressive() const { return m_ultra_aggressive; }
+    std::string shard_chr() const { return m_shard_chr; }
+    const std::vector<std::string>& merge_shard() const
+    {
+        return m_merge_shard;
+    }
 
 protected:
-    const std::vector<std::string> supported_types = {"bed", "ped", "bgen"};
+    const std::vector<std::string> supported_types = {"bed", "ped", "bgen",
+                                                      "pgen"};
     std::string m_id_delim = " ";
     std::string m_out_prefix = "PRSice";
     std::string m_exclusion_range = "";
     std::string m_exclude_file = "";
     std::string m_extract_file = "";
+    std::string m_shard_chr = "";
+    std::string m_cache_dir = "";
     std::string m_help_message;
     size_t m_memory = 1e10;
+    size_t m_read_gap = 1 << 16;
     int m_allow_inter = false;
+    int m_no_cache = false;
     int m_include_nonfounders = false;
     int m_keep_ambig = false;
+    int m_match_by_pos = false;
     int m_print_all_scores = false;
     int m_print_snp = false;
     int m_ultra_aggressive = false;
@@ -126,6 +150,7 @@ protected:
     Phenotype m_pheno_info;
     PThresholding m_p_thresholds;
 
+    std::vector<std::string> m_merge_shard;
     std::map<std::string, std::string> m_parameter_log;
     std::string m_error_message = "";
     ////////////////////////////////////////////
@@ -0,0 +1,274 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COUNT_CACHE_HPP
+#define COUNT_CACHE_HPP
+
+#include "misc.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <ios>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*!
+ * \brief Cache of the genotype counts of a genotype file, such that the MAF
+ * and missingness filtering doesn't need to read the genotypes again. The
+ * name of the cache is keyed on the sample inclusion and founder masks, and
+ * its content is keyed on the size and modification time of the genotype
+ * file. Also contains the parser of the PLINK 2 count files
+ */
+namespace count_cache
+{
+constexpr std::string_view magic = "PRSICE_COUNT_CACHE";
+constexpr unsigned long long version = 1;
+// magic, version, key and number of variants
+constexpr size_t header_size = magic.size() + 3 * sizeof(unsigned long long);
+/*!
+ * \brief Generate the key of the samples used for the counts
+ * \param num_sample is the number of sample in the genotype file
+ * \param sample_include is the bit array of included samples
+ * \param founder_include is the bit array of founders
+ * \return the key
+ */
+inline unsigned long long
+setting_key(const size_t num_sample,
+            const std::vector<uintptr_t>& sample_include,
+            const std::vector<uintptr_t>& founder_include)
+{
+    misc::Hasher hasher;
+    hasher.add(version).add(num_sample).add(sample_include).add(
+        founder_include);
+    return hasher.value();
+}
+inline unsigned long long file_key(const std::string& genotype_name)
+{
+    // the size of a .bed file is fixed by its dimensions, also hash both ends
+    // of the file to detect a rewrite within the same modification time
+    misc::Hasher hasher;
+    hasher.add(version)
+        .add(misc::canonical_path(genotype_name))
+        .add_file_stat(genotype_name)
+        .add_file_ends(genotype_name);
+    return hasher.value();
+}
+inline std::string cache_name(const std::string& cache_dir,
+                              const std::string& genotype_name,
+                              const unsigned long long setting_key)
+{
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", setting_key);
+    return misc::cache_file(cache_dir, genotype_name,
+                            std::string(".prsice.") + key + ".count");
+}
+
+/*!
+ * \brief Counts of a variant, using all samples and using only the founders
+ */
+struct Entry
+{
+    // location of the variant in the genotype file
+    unsigned long long pos = 0;
+    uint32_t ll_ct = 0;
+    uint32_t lh_ct = 0;
+    uint32_t hh_ct = 0;
+    uint32_t ll_ctf = 0;
+    uint32_t lh_ctf = 0;
+    uint32_t hh_ctf = 0;
+    // keep the entry free of padding, as it is written as is
+    uint64_t reserved = 0;
+};
+
+class Cache
+{
+public:
+    /*!
+     * \brief Load the cache. An existing cache is only used if it matches
+     * the genotype file
+     * \param name is the name of the cache
+     * \param key is the key of the genotype file
+     */
+    void open(const std::string& name, const unsigned long long key)
+    {
+        m_name = name;
+        m_key = key;
+        m_modified = false;
+        if (!load())
+        {
+            m_entries.clear();
+            m_lookup.clear();
+        }
+    }
+    const std::string& name() const { return m_name; }
+    size_t size() const { return m_entries.size(); }
+    /*!
+     * \brief Find a variant in the cache
+     * \param pos is the location of the variant in the genotype file
+     * \return the entry of the variant, nullptr if it isn't cached
+     */
+    const Entry* find(const std::streampos& pos) const
+    {
+        auto&& found = m_lookup.find(to_pos(pos));
+        return found == m_lookup.end() ? nullptr : &m_entries[found->second];
+    }
+    void add(const Entry& entry)
+    {
+        m_lookup[entry.pos] = m_entries.size();
+        m_entries.push_back(entry);
+        m_modified = true;
+    }
+    static unsigned long long to_pos(const std::streampos& pos)
+    {
+        return static_cast<unsigned long long>(
+            static_cast<std::streamoff>(pos));
+    }
+    /*!
+     * \brief Write the cache if new variants were added. The cache is written
+     * to a temporary file first, such that an interrupted run won't leave
+     * behind a corrupted cache
+     * \return false if we failed to write the cache
+     */
+    bool close()
+    {
+        if (!m_modified) return true;
+        const std::string tmp = misc::tmp_file(m_name);
+        std::ofstream cache(tmp.c_str(), std::ios::binary);
+        if (!cache.is_open()) return false;
+        const unsigned long long header[3] = {version, m_key,
+                                              m_entries.size()};
+        cache.write(magic.data(), static_cast<std::streamsize>(magic.size()));
+        cache.write(reinterpret_cast<const char*>(header), sizeof(header));
+        cache.write(
+            reinterpret_cast<const char*>(m_entries.data()),
+            static_cast<std::streamsize>(m_entries.size() * sizeof(Entry)));
+        cache.close();
+        if (!cache || std::rename(tmp.c_str(), m_name.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        m_modified = false;
+        return true;
+    }
+
+private:
+    std::vector<Entry> m_entries;
+    std::unordered_map<unsigned long long, size_t> m_lookup;
+    std::string m_name;
+    unsigned long long m_key = 0;
+    bool m_modified = false;
+    bool load()
+    {
+        std::ifstream cache(m_name.c_str(), std::ios::binary);
+        if (!cache.is_open()) return false;
+        cache.seekg(0, cache.end);
+        const unsigned long long file_length =
+            static_cast<unsigned long long>(cache.tellg());
+        cache.seekg(0, cache.beg);
+        std::string file_magic(magic.size(), '\0');
+        unsigned long long header[3];
+        cache.read(&file_magic[0],
+                   static_cast<std::streamsize>(file_magic.size()));
+        cache.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!cache || file_magic != magic || header[0] != version
+            || header[1] != m_key
+            || file_length != header_size + header[2] * sizeof(Entry))
+        { return false; }
+        m_entries.resize(header[2]);
+        cache.read(reinterpret_cast<char*>(m_entries.data()),
+                   static_cast<std::streamsize>(m_entries.size()
+                                                * sizeof(Entry)));
+        if (!cache) return false;
+        m_lookup.clear();
+        for (size_t i = 0; i < m_entries.size(); ++i)
+        { m_lookup[m_entries[i].pos] = i; }
+        return true;
+    }
+};
+
+/*!
+ * \brief Columns of a PLINK 2 .gcount (--geno-counts) or .acount (--freq
+ * counts) file. npos if the column is absent
+ */
+struct Columns
+{
+    static constexpr size_t npos = ~size_t(0);
+    size_t id = npos;
+    size_t ref = npos;
+    size_t alt = npos;
+    size_t hom_ref = npos;
+    size_t het = npos;
+    size_t two_alt = npos;
+    size_t hap_ref = npos;
+    size_t hap_alt = npos;
+    size_t missing = npos;
+    size_t alt_ct = npos;
+    size_t obs_ct = npos;
+    size_t num_col = 0;
+    bool genotype_counts() const
+    {
+        return hom_ref != npos && het != npos && two_alt != npos;
+    }
+    bool allele_counts() const { return alt_ct != npos && obs_ct != npos; }
+    bool valid() const
+    {
+        return id != npos && ref != npos && alt != npos
+               && (genotype_counts() || allele_counts());
+    }
+};
+/*!
+ * \brief Find the columns from the header of a PLINK 2 count file
+ * \param header is the header line, starting with #
+ * \return the columns
+ */
+inline Columns parse_header(std::string_view header)
+{
+    Columns columns;
+    if (!header.empty() && header.front() == '#') header.remove_prefix(1);
+    const std::vector<std::string_view> token = misc::tokenize(header);
+    columns.num_col = token.size();
+    for (size_t i = 0; i < token.size(); ++i)
+    {
+        if (token[i] == "ID") columns.id = i;
+        else if (token[i] == "REF")
+            columns.ref = i;
+        else if (token[i] == "ALT")
+            columns.alt = i;
+        else if (token[i] == "HOM_REF_CT")
+            columns.hom_ref = i;
+        else if (token[i] == "HET_REF_ALT_CTS")
+            columns.het = i;
+        else if (token[i] == "TWO_ALT_GENO_CTS")
+            columns.two_alt = i;
+        else if (token[i] == "HAP_REF_CT")
+            columns.hap_ref = i;
+        else if (token[i] == "HAP_ALT_CTS")
+            columns.hap_alt = i;
+        else if (token[i] == "MISSING_CT")
+            columns.missing = i;
+        else if (token[i] == "ALT_CTS")
+            columns.alt_ct = i;
+        else if (token[i] == "OBS_CT")
+            columns.obs_ct = i;
+    }
+    return columns;
+}
+}
+
+#endif // COUNT_CACHE_HPP
@@ -20,17 +20,24 @@
 
 #include "IITree.h"
 #include "commander.hpp"
+#include "count_cache.hpp"
 #include "misc.hpp"
 #include "plink_common.hpp"
 #include "reporter.hpp"
+#include "scratch_pool.hpp"
 #include "snp.hpp"
 #include "storage.hpp"
+#include "string_index.hpp"
+#include "worker_pool.hpp"
 #include <Eigen/Dense>
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cctype>
 #include <cstdio>
 #include <cstring>
 #include <deque>
+#include <exception>
 #include <fstream>
 #include <functional>
 #include <memory>
@@ -50,6 +57,15 @@
 
 #define MULTIPLEX_LD 1920
 #define MULTIPLEX_2LD (MULTIPLEX_LD * 2)
+/*!
+ * \brief Decode scratch of one genotype read. Each concurrent reader takes its
+ * own from the pool instead of sharing m_tmp_genotype and the bgen buffers
+ */
+struct GenotypeScratch
+{
+    std::vector<uintptr_t> tmp_genotype;
+    std::vector<uint8_t> buffer1, buffer2;
+};
 class Genotype
 {
 public:
@@ -110,6 +126,24 @@ public:
     {
         return m_existed_snps.size();
     }
+    /*!
+     * \brief Copy the hot fields of m_existed_snps into m_variants. The
+     * table is cleared whenever m_existed_snps is reordered or shrunk, and
+     * must be rebuilt before use
+     */
+    void build_variant_table();
+    /*!
+     * \brief Generate m_position_index from m_existed_snps
+     */
+    void build_position_index();
+    /*!
+     * \brief Find the SNP with the same chromosome, coordinate and alleles
+     * (allowing for strand flip and allele swap)
+     * \return index of the SNP in m_existed_snps, StringIndex::npos if not
+     * found
+     */
+    size_t find_by_position(const size_t chr, const size_t loc,
+                            std::string_view ref, std::string_view alt) const;
     /*!
      * \brief Function to re-propagate the m_existed_snps_index after reading
      * the reference panel
@@ -117,8 +151,9 @@ public:
     void update_snp_index()
     {
         m_existed_snps_index.clear();
+        m_existed_snps_index.reserve(m_existed_snps.size());
         for (size_t i_snp = 0; i_snp < m_existed_snps.size(); ++i_snp)
-        { m_existed_snps_index[m_existed_snps[i_snp].rs()] = i_snp; }
+        { m_existed_snps_index.insert(m_existed_snps[i_snp].rs(), i_snp); }
     }
     /*!
      * \brief Return the number of sample we wish to perform PRS on
@@ -177,14 +212,9 @@ public:
                 }
             }
         }
-        try
-        {
-            return misc::Convertor::convert<int32_t>(std::string(str));
-        }
-        catch (const std::runtime_error&)
-        {
-            return -1;
-        }
+        int32_t chr_code;
+        if (!misc::parse_value(str, chr_code)) return -1;
+        return chr_code;
     }
 
 
@@ -201,17 +231,8 @@ public:
         if (filter_count.size() != +FILTER_COUNT::MAX)
         { filter_count.resize(+FILTER_COUNT::MAX, 0); }
         double value = 1;
-        try
-        {
-            value = misc::Convertor::convert<double>(
-                std::string(token[base_file.column_index[index]]).c_str());
-        }
-        catch (...)
-        {
-            ++filter_count[type];
-            return false;
-        }
-        if (value < threshold)
+        if (!misc::parse_value(token[base_file.column_index[index]], value)
+            || value < threshold)
         {
             ++filter_count[type];
             return false;
@@ -248,17 +269,8 @@ public:
     {
         loc = ~size_t(0);
         if (!base_file.has_column[+BASE_INDEX::BP]) return true;
-        try
-        {
-            loc = misc::Convertor::convert<size_t>(
-                std::string(token[base_file.column_index[+BASE_INDEX::BP]])
-                    .c_str());
-        }
-        catch (...)
-        {
-            return false;
-        }
-        return true;
+        return misc::parse_value(token[base_file.column_index[+BASE_INDEX::BP]],
+                                 loc);
     }
     void init_sample_vectors()
     {
@@ -461,7 +473,7 @@ public:
         const BaseFile& base_file, const QCFiltering& base_qc,
         const PThresholding& threshold_info,
         const std::vector<IITree<size_t, size_t>>& exclusion_regions,
-        const std::streampos file_length, const bool gz_input,
+        const std::streampos file_length, const bool stream_input,
         std::unique_ptr<std::istream> input);
     void print_base_stat(const std::vector<size_t>& filter_count,
                          const std::unordered_set<std::string>& dup_index,
@@ -485,6 +497,38 @@ public:
                    const std::vector<size_t>::const_iterator& end_index,
                    double& cur_threshold, uint32_t& num_snp_included,
                    const bool first_run);
+    /*!
+     * \brief Calculate the PRS of all regions and thresholds and write the
+     * per-sample sums and SNP counts to \<out\>.shard such that the scores
+     * of each chromosome shard can later be merged
+     * \param out is the output prefix
+     * \param region_membership contains the SNP index of each region
+     * \param region_names is the name of each region
+     */
+    void save_partial_score(
+        const std::string& out,
+        const std::vector<std::vector<size_t>>& region_membership,
+        const std::vector<std::string>& region_names);
+    /*!
+     * \brief Open the partial score files generated by save_partial_score.
+     * Samples must have been loaded and must match those of the shards
+     * \param shard_files is the name of the partial score files
+     * \return the name of each region
+     */
+    std::vector<std::string>
+    load_partial_score(const std::vector<std::string>& shard_files);
+    bool has_partial_score() const { return !m_partial_shards.empty(); }
+    /*!
+     * \brief Sum the partial scores of all shards for the \p threshold_idx th
+     * threshold of the region. Thresholds must be requested in order
+     * \param region_idx is the index of the region
+     * \param threshold_idx is the index of the threshold
+     * \param cur_threshold return the p-value threshold
+     * \param num_snp_included return the number of SNPs included
+     * \return false if there are no more thresholds
+     */
+    bool get_partial_score(const size_t region_idx, const size_t threshold_idx,
+                           double& cur_threshold, uint32_t& num_snp_included);
     static bool within_region(const std::vector<IITree<size_t, size_t>>& cr,
                               const size_t chr, const size_t loc)
     {
@@ -497,7 +541,7 @@ public:
 
 
     static void construct_flag(
-        const std::string& rs,
+        std::string_view rs,
         const std::vector<IITree<size_t, size_t>>& gene_sets,
         const std::unordered_map<std::string, std::vector<size_t>>& snp_in_sets,
         std::vector<uintptr_t>& flag, const size_t required_size,
@@ -523,7 +567,7 @@ public:
             }
         }
         if (snp_in_sets.empty() || rs.empty()) return;
-        auto&& snp_idx = snp_in_sets.find(rs);
+        auto&& snp_idx = snp_in_sets.find(std::string(rs));
         if (snp_idx != snp_in_sets.end())
         {
             for (auto&& i : snp_idx->second) { SET_BIT(i, flag.data()); }
@@ -546,6 +590,16 @@ public:
         m_keep_ambig = keep;
         return *this;
     }
+    Genotype& match_by_pos(bool use_pos)
+    {
+        m_match_by_pos = use_pos;
+        return *this;
+    }
+    Genotype& read_gap(size_t gap)
+    {
+        m_genotype_file.coalesce(FileRead::default_span, gap);
+        return *this;
+    }
     Genotype& reference()
     {
         m_is_ref = true;
@@ -556,10 +610,25 @@ public:
         m_intermediate = use;
         return *this;
     }
+    /*!
+     * \brief Set the directory of the genotype caches (bgen and bim index,
+     * counts and hard calls). Caches are not used if dir is empty
+     */
+    Genotype& cache_dir(const std::string& dir)
+    {
+        m_cache_dir = dir;
+        return *this;
+    }
+    Genotype& set_thread(const size_t num_thread)
+    {
+        m_thread = std::max(num_thread, size_t(1));
+        return *this;
+    }
     Genotype& set_prs_instruction(const CalculatePRS& prs)
     {
         m_has_prs_instruction = true;
         m_prs_calculation = prs;
+        m_thread = static_cast<size_t>(std::max(prs.thread, 1));
         return *this;
     }
     void snp_extraction(const std::string& extract_snps,
@@ -602,20 +671,72 @@ public:
 
     void load_genotype_to_memory();
     bool genotyped_stored() const { return m_genotype_stored; }
+    /*!
+     * \brief Open all genotype files, such that read_genotype_concurrent can
+     * be called from multiple threads. Must be called again if the genotype
+     * files change (e.g. after generating the hard call cache)
+     */
+    void prepare_concurrent_read() { open_genotype_files(); }
+    /*!
+     * \brief Thread safe version of read_genotype. The file is read with
+     * FileRead::pread and the decode scratch is taken from m_scratch_pool,
+     * so multiple threads can read from the same object at once
+     * \param genotype is the output PLINK binary
+     * \param byte_pos is the location of the SNP in the file
+     * \param file_idx is the index of the genotype file
+     */
+    void read_genotype_concurrent(uintptr_t* genotype,
+                                  const std::streampos byte_pos,
+                                  const size_t file_idx) const
+    {
+        auto scratch = m_scratch_pool.acquire();
+        read_genotype_scratch(genotype, byte_pos, file_idx, *scratch);
+    }
 
 protected:
     // friend with all child class so that they can also access the
     // protected elements
     friend class BinaryPlink;
     friend class BinaryGen;
+    friend class BinaryPgen;
     // vector storing all the genotype files
     // std::vector<Sample> m_sample_names;
     FileRead m_genotype_file;
+    // decode scratch of the worker threads and read_genotype_concurrent
+    mutable ScratchPool<GenotypeScratch> m_scratch_pool;
+    // started on first use, such that we don't start new threads for every
+    // window of SNPs
+    std::unique_ptr<WorkerPool> m_worker_pool;
+    // IDs and alleles of m_existed_snps. Only written by the main thread
+    StringArena m_string_arena;
     std::vector<SNP> m_existed_snps;
-    std::unordered_map<std::string, size_t> m_existed_snps_index;
+    // hot fields of m_existed_snps. Only valid after build_variant_table
+    VariantTable m_variants;
+    // keys are the IDs stored in m_string_arena. Also contains the IDs of
+    // filtered base SNPs (with StringIndex::npos as value) until the genotype
+    // files are read, such that the same index is used for the duplication
+    // check of the base and the matching of the target and reference
+    StringIndex m_existed_snps_index;
+    // sorted SNP::position_key of m_existed_snps and their index. Only used
+    // when matching by position
+    std::vector<std::pair<uint64_t, size_t>> m_position_index;
     std::unordered_set<std::string> m_sample_selection_list;
     std::unordered_set<std::string> m_snp_selection_list;
     std::vector<std::set<double>> m_set_thresholds;
+    struct PartialShard
+    {
+        std::string name;
+        std::ifstream file;
+        // thresholds and file offset of each region
+        std::vector<std::vector<double>> thresholds;
+        std::vector<unsigned long long> offset;
+        // the current partial score of this shard
+        std::vector<PRS> current;
+        size_t next = 0;
+        unsigned long long num_snp = 0;
+    };
+    std::vector<PartialShard> m_partial_shards;
+    std::vector<std::vector<double>> m_partial_thresholds;
     std::vector<Sample_ID> m_sample_id;
     std::vector<PRS> m_prs_info;
     std::vector<std::string> m_genotype_file_names;
@@ -638,6 +759,10 @@ protected:
     std::string m_delim;
     std::string m_keep_file;
     std::string m_remove_file;
+    // PLINK 2 count file, used instead of the genotypes for QC
+    std::string m_freq_count_file;
+    // directory of the genotype caches, empty if caches are disabled
+    std::string m_cache_dir;
     double m_mean_score = 0.0;
     double m_score_sd = 0.0;
     double m_hard_threshold = 0.0;
@@ -676,12 +801,20 @@ protected:
     bool m_is_ref = false;
     bool m_keep_nonfounder = false;
     bool m_keep_ambig = false;
+    bool m_match_by_pos = false;
     bool m_remove_sample = true;
     bool m_exclude_snp = true;
     bool m_hard_coded = false;
     bool m_expect_reference = false;
     bool m_memory_initialized = false;
     bool m_very_small_thresholds = false;
+    static constexpr std::string_view m_base_cache_magic = "PRSICE_BASE_CACHE";
+    static constexpr unsigned long long m_base_cache_version = 1;
+    static constexpr std::string_view m_partial_magic = "PRSICE_PARTIAL";
+    static constexpr unsigned long long m_partial_version = 1;
+    // below this number of samples, building the byte score table of a SNP
+    // cost more than it saves
+    static constexpr size_t m_min_sample_for_table = 1024;
     bool m_vector_initialized = false;
     Reporter* m_reporter = nullptr;
     CalculatePRS m_prs_calculation;
@@ -694,6 +827,7 @@ protected:
         m_ignore_fid = pheno.ignore_fid;
         m_keep_file = geno.keep;
         m_remove_file = geno.remove;
+        m_freq_count_file = geno.freq_count;
         m_delim = delim;
         m_reporter = reporter;
         init_chr(geno.num_autosome);
@@ -748,6 +882,70 @@ protected:
                         const std::string& a1, const std::string& a2,
                         const size_t chr_num, const size_t loc);
 
+    /*!
+     * \brief Parse result of a single base file line. Worker threads fill
+     * these without touching any shared state, and transverse_base_file
+     * merges them back in input order
+     */
+    struct BaseRecord
+    {
+        std::string rs_id;
+        std::string ref_allele;
+        std::string alt_allele;
+        std::string error;
+        double pvalue = 2.0;
+        double stat = 0.0;
+        double pthres = 0.0;
+        size_t chr = 0;
+        size_t loc = 0;
+        size_t filter = +FILTER_COUNT::MAX;
+        unsigned long long category = 0;
+        bool empty = false;
+        bool column_error = false;
+        bool selected = true;
+        bool ambiguous = false;
+        bool very_small = false;
+    };
+    /*!
+     * \brief Parse lines [start, end) of a base file batch into records.
+     * Duplication check is left to the caller as it depends on the order
+     * of the whole file
+     */
+    void parse_base_chunk(
+        std::vector<std::string>& lines, const size_t start, const size_t end,
+        const BaseFile& base_file, const QCFiltering& base_qc,
+        const PThresholding& threshold_info,
+        const std::vector<IITree<size_t, size_t>>& exclusion_regions,
+        const double max_threshold, std::vector<BaseRecord>& records);
+    /*!
+     * \brief Generate the key of the base cache. Any change to the base file
+     * content or parameters that affect the base filtering will change the
+     * key
+     * \return the hash of the base file and filtering parameters
+     */
+    unsigned long long base_cache_key(
+        const BaseFile& base_file, const QCFiltering& base_qc,
+        const PThresholding& threshold_info,
+        const std::vector<IITree<size_t, size_t>>& exclusion_regions);
+    /*!
+     * \brief Load the filtered base SNPs from the cache file
+     * \param cache_file is the name of the cache
+     * \param key is the expected key of the cache
+     * \param filter_count stores the filter counts of the cached run
+     * \param dup_rs stores the duplicated SNPs of the cached run
+     * \return true if the cache is valid and loaded
+     */
+    bool load_base_cache(const std::string& cache_file,
+                         const unsigned long long key,
+                         std::vector<size_t>& filter_count,
+                         std::unordered_set<std::string>& dup_rs);
+    /*!
+     * \brief Write the filtered base SNPs to the cache file
+     */
+    void save_base_cache(const std::string& cache_file,
+                         const unsigned long long key,
+                         const std::vector<size_t>& filter_count,
+                         const std::unordered_set<std::string>& dup_rs);
     bool parse_rs_id(const std::vector<std::string_view>& token,
                      const BaseFile& base_file,
                      std::unordered_set<std::string>& processed_idx,
@@ -792,11 +990,7 @@ protected:
     {
         if (filter_count.size() != +FILTER_COUNT::MAX)
         { filter_count.resize(+FILTER_COUNT::MAX, 0); }
-        try
-        {
-            pvalue = misc::Convertor::convert<double>(std::string(p_value_str));
-        }
-        catch (...)
+        if (!misc::parse_value(p_value_str, pvalue))
         {
             ++filter_count[+FILTER_COUNT::NOT_CONVERT];
             return false;
@@ -818,28 +1012,20 @@ protected:
     {
         if (filter_count.size() != +FILTER_COUNT::MAX)
         { filter_count.resize(+FILTER_COUNT::MAX, 0); }
-        try
+        if (!misc::parse_value(stat_str, stat)
+            || (odd_ratio && misc::logically_equal(stat, 0.0)))
         {
-            stat = misc::Convertor::convert<double>(std::string(stat_str));
-            if (odd_ratio && misc::logically_equal(stat, 0.0))
-            {
-                ++filter_count[+FILTER_COUNT::NOT_CONVERT];
-                return false;
-            }
-            else if (odd_ratio && stat < 0.0)
-            {
-                ++filter_count[+FILTER_COUNT::NEGATIVE];
-                return false;
-            }
-            else if (odd_ratio)
-                stat = log(stat);
-            return true;
+            ++filter_count[+FILTER_COUNT::NOT_CONVERT];
+            return false;
         }
-        catch (...)
+        else if (odd_ratio && stat < 0.0)
         {
-            ++filter_count[+FILTER_COUNT::NOT_CONVERT];
+            ++filter_count[+FILTER_COUNT::NEGATIVE];
             return false;
         }
+        else if (odd_ratio)
+            stat = log(stat);
+        return true;
     }
     /*!
      * \brief Calculate the threshold bin based on the p-value and bound
@@ -964,6 +1150,165 @@ protected:
     {
         return false;
     }
+    /*!
+     * \brief Genotype counts of a SNP among the included samples and among
+     * the founders, used for the MAF and missingness filtering
+     */
+    struct MarkerCounts
+    {
+        uint32_t ll_ct = 0, lh_ct = 0, hh_ct = 0;
+        uint32_t ll_ctf = 0, lh_ctf = 0, hh_ctf = 0;
+    };
+    /*!
+     * \brief Where the counts of a SNP come from. Allele counts can only be
+     * used for the filtering, the genotype counts are still calculated when
+     * the genotypes are read
+     */
+    enum class CountSource
+    {
+        READ,
+        CACHE,
+        GENOTYPE,
+        ALLELE
+    };
+    /*!
+     * \brief Find the counts of SNPs that don't need to be read from the
+     * genotype files, either from the --freq-count file or from the count
+     * cache of the genotype files
+     * \param genotype contains the SNPs
+     * \param suffix is the suffix of the genotype files, used to name the
+     * cache
+     * \param caches is the count cache of each genotype file
+     * \param counts is the known counts of each SNP
+     * \return the source of the counts of each SNP
+     */
+    std::vector<CountSource>
+    load_known_counts(Genotype* genotype, const std::string& suffix,
+                      std::vector<count_cache::Cache>& caches,
+                      std::vector<MarkerCounts>& counts);
+    /*!
+     * \brief Read the counts from a PLINK 2 .gcount or .acount file. SNPs are
+     * matched by their ID and alleles
+     * \param genotype contains the SNPs
+     * \param counts is the imported counts of each SNP
+     * \param source is set for the SNPs found in the file
+     */
+    void import_freq_count(Genotype* genotype,
+                           std::vector<MarkerCounts>& counts,
+                           std::vector<CountSource>& source);
+    /*!
+     * \brief Add the counts read from the genotype file to the count cache
+     * of the file containing the SNP
+     * \param count is the counts of the SNP
+     * \param snp is the SNP
+     * \param caches is the count cache of each genotype file
+     */
+    void cache_counts(const MarkerCounts& count, const SNP& snp,
+                      std::vector<count_cache::Cache>& caches) const;
+    /*!
+     * \brief Filter a SNP by its MAF and genotype missingness
+     * \param filter_info contains the QC thresholds
+     * \param count is the counts of the SNP
+     * \param source is where the counts come from
+     * \param snp is the SNP
+     * \return true if the SNP is retained
+     */
+    bool filter_by_counts(const QCFiltering& filter_info,
+                          const MarkerCounts& count, const CountSource source,
+                          SNP& snp);
+    void close_count_caches(std::vector<count_cache::Cache>& caches);
+    /*!
+     * \brief Report a cache that cannot be read or written. The run
+     * continues without the cache, and only the first failure of the run is
+     * reported as the cause is usually shared by all caches
+     * \param message is the warning
+     */
+    void cache_warning(const std::string& message) const;
+    /*!
+     * \brief Return the worker pool with m_thread threads
+     */
+    WorkerPool& worker_pool()
+    {
+        if (!m_worker_pool || m_worker_pool->num_thread() != m_thread)
+        { m_worker_pool.reset(new WorkerPool(m_thread)); }
+        return *m_worker_pool;
+    }
+    /*!
+     * \brief Process the SNPs in windows with the worker pool. read and fold
+     * are called on the calling thread in SNP order, and compute on the
+     * workers. The next window is read while the current one is computed,
+     * and a window is folded while the next one is computed. As the order of
+     * read and fold is fixed, the result is the same regardless of the number
+     * of thread
+     *
+     * \param num_snp is the number of SNPs
+     * \param slot_size is the approximated memory used by each Slot
+     * \param per_thread is the number of SNPs per thread in each window
+     * \param read is called as read(idx, slot)
+     * \param compute is called as compute(start, end, slot) for a contiguous
+     * range of SNPs from start to end (exclusive), where slot is the Slot of
+     * start, such that the reads within a range remain sequential. With a
+     * single thread, the ranges are computed in SNP order. Must not modify
+     * any shared state
+     * \param fold is called as fold(idx, slot)
+     */
+    template <typename Slot, typename Read, typename Compute, typename Fold>
+    void process_in_order(const size_t num_snp, const size_t slot_size,
+                          const size_t per_thread, Read&& read,
+                          Compute&& compute, Fold&& fold)
+    {
+        if (num_snp == 0) return;
+        WorkerPool& pool = worker_pool();
+        const size_t num_thread = pool.num_thread();
+        // limit the two windows to around 256MB
+        const size_t max_window =
+            (size_t(1) << 27) / std::max(slot_size, size_t(1));
+        const size_t window =
+            std::max(size_t(1), std::min({num_thread * per_thread,
+                                          max_window, num_snp}));
+        std::array<std::vector<Slot>, 2> slots = {std::vector<Slot>(window),
+                                                  std::vector<Slot>(window)};
+        auto read_window = [&](const size_t start, std::vector<Slot>& slot) {
+            const size_t cur_size = std::min(window, num_snp - start);
+            for (size_t i = 0; i < cur_size; ++i) read(start + i, slot[i]);
+        };
+        auto start_window = [&](const size_t start, std::vector<Slot>& slot) {
+            const size_t cur_size = std::min(window, num_snp - start);
+            // a few ranges per thread to balance the load, and such that the
+            // calling thread can help once it finished folding
+            const size_t num_task = std::min(cur_size, num_thread * 4);
+            const size_t step = (cur_size + num_task - 1) / num_task;
+            pool.start(num_task, [&, start, cur_size, step](size_t task) {
+                const size_t begin = std::min(cur_size, task * step);
+                const size_t end = std::min(cur_size, begin + step);
+                if (begin < end)
+                { compute(start + begin, start + end, &slot[begin]); }
+            });
+        };
+        size_t cur = 0;
+        try
+        {
+            read_window(0, slots[cur]);
+            start_window(0, slots[cur]);
+            for (size_t start = 0; start < num_snp; start += window)
+            {
+                const size_t next = start + window;
+                if (next < num_snp) read_window(next, slots[cur ^ 1]);
+                pool.wait();
+                if (next < num_snp) start_window(next, slots[cur ^ 1]);
+                const size_t cur_size = std::min(window, num_snp - start);
+                for (size_t i = 0; i < cur_size; ++i)
+                { fold(start + i, slots[cur][i]); }
+                cur ^= 1;
+            }
+        }
+        catch (...)
+        {
+            // the workers might still be using the slots
+            pool.drain();
+            throw;
+        }
+    }
 
     void update_index_tot(const uintptr_t founder_ctl2,
                           const uintptr_t founder_ctv2,
@@ -1040,89 +1385,337 @@ protected:
         return -1;
     }
 
-    void update_sample_prs(PRS& sample_prs, const uint32_t geno,
-                           const std::vector<double>& scores,
-                           const std::vector<size_t>& counts)
+    /*!
+     * \brief Add the score of a SNP to the PRS of a single sample
+     *
+     * \tparam first is true if this is the first SNP, where we reset the PRS
+     * \tparam missing is the missingness handling method. With SET_ZERO, the
+     * missing genotypes are not counted towards the number of SNPs
+     * \param sample_prs is the PRS of the sample
+     * \param geno is the (inverted) 2 bit genotype of the sample
+     * \param scores contain the score of each genotype
+     * \param ploidy is the ploidy of the SNP
+     */
+    template <bool first, MISSING_SCORE missing>
+    static void load_sample_prs(PRS& sample_prs, const uintptr_t geno,
+                                const std::array<double, 4>& scores,
+                                const size_t ploidy)
     {
-        sample_prs.num_snp += counts[geno];
-        sample_prs.prs += scores[geno];
+        // genotype 2 is missing, and only contribute to the SNP count if we
+        // impute or centre the score
+        const size_t num_snp = (missing == MISSING_SCORE::SET_ZERO)
+                                   ? ploidy * (geno != 2)
+                                   : ploidy;
+        if constexpr (first)
+        {
+            sample_prs.num_snp = num_snp;
+            sample_prs.prs = scores[geno];
+        }
+        else
+        {
+            sample_prs.num_snp += num_snp;
+            sample_prs.prs += scores[geno];
+        }
     }
-    void initialize_sample_prs(PRS& sample_prs, const uint32_t geno,
-                               const std::vector<double>& scores,
-                               const std::vector<size_t>& counts)
+    /*!
+     * \brief Add the score of a SNP to the PRS of all samples. Genotypes are
+     * expanded a word at a time and each sample looks up its score from the
+     * score table of the SNP, the PRS of samples after m_sample_ct are left
+     * untouched
+     *
+     * \param genotype is the PLINK 2 bit genotype of the included samples
+     * \param prs_list contain the PRS of each sample
+     * \param scores contain the score of each genotype
+     * \param ploidy is the ploidy of the SNP
+     */
+    template <bool first, MISSING_SCORE missing>
+    void process_sample_prs(const std::vector<uintptr_t>& genotype,
+                            std::vector<PRS>& prs_list,
+                            const std::array<double, 4>& scores,
+                            const size_t ploidy)
     {
-        sample_prs.num_snp = counts[geno];
-        sample_prs.prs = scores[geno];
+        const uintptr_t* lbptr = genotype.data();
+        PRS* sample_prs = prs_list.data();
+        const size_t num_word = m_sample_ct / BITCT2;
+        for (size_t word = 0; word < num_word; ++word)
+        {
+            // ulii contain the numeric representation of the current
+            // genotype block
+            uintptr_t ulii = ~(*lbptr++);
+            for (uint32_t ujj = 0; ujj < BITCT2; ++ujj, ulii >>= 2)
+            {
+                load_sample_prs<first, missing>(*sample_prs++, ulii & 3,
+                                                scores, ploidy);
+            }
+        }
+        // the remaining samples of the last genotype block
+        const uint32_t remain = m_sample_ct & (BITCT2 - 1);
+        if (!remain) return;
+        uintptr_t ulii = ~(*lbptr);
+        for (uint32_t ujj = 0; ujj < remain; ++ujj, ulii >>= 2)
+        {
+            load_sample_prs<first, missing>(*sample_prs++, ulii & 3, scores,
+                                            ploidy);
+        }
     }
-    template <class T>
-    void process_sample_prs(std::vector<uintptr_t>& genotype,
+
+    /*!
+     * \brief Same as process_sample_prs, but the genotypes are expanded a
+     * byte (4 samples) at a time. The score and SNP count of the 4 samples of
+     * every possible byte are tabulated for the SNP first, such that each
+     * sample only need an addition
+     *
+     * \param genotype is the PLINK 2 bit genotype of the included samples
+     * \param prs_list contain the PRS of each sample
+     * \param scores contain the score of each genotype
+     * \param ploidy is the ploidy of the SNP
+     */
+    template <bool first, MISSING_SCORE missing>
+    void process_sample_prs_table(const std::vector<uintptr_t>& genotype,
+                                  std::vector<PRS>& prs_list,
+                                  const std::array<double, 4>& scores,
+                                  const size_t ploidy)
+    {
+        // only SET_ZERO need the count table, the other methods always add
+        // the ploidy
+        constexpr bool count_table = (missing == MISSING_SCORE::SET_ZERO);
+        std::array<std::array<double, 4>, 256> byte_score;
+        std::array<std::array<uint32_t, 4>, 256> byte_num_snp;
+        for (uint32_t byte = 0; byte < 256; ++byte)
+        {
+            for (uint32_t k = 0; k < 4; ++k)
+            {
+                const uint32_t geno = (byte >> (2 * k)) & 3;
+                byte_score[byte][k] = scores[geno];
+                if constexpr (count_table)
+                {
+                    byte_num_snp[byte][k] =
+                        static_cast<uint32_t>(ploidy * (geno != 2));
+                }
+            }
+        }
+        const uintptr_t* lbptr = genotype.data();
+        PRS* sample_prs = prs_list.data();
+        const size_t num_word = m_sample_ct / BITCT2;
+        for (size_t word = 0; word < num_word; ++word)
+        {
+            uintptr_t ulii = ~(*lbptr++);
+            for (uint32_t ujj = 0; ujj < sizeof(uintptr_t);
+                 ++ujj, ulii >>= 8, sample_prs += 4)
+            {
+                const auto& score = byte_score[ulii & 255];
+                const auto& num_snp = byte_num_snp[ulii & 255];
+                for (uint32_t k = 0; k < 4; ++k)
+                {
+                    const size_t cur_num = count_table ? num_snp[k] : ploidy;
+                    if constexpr (first)
+                    {
+                        sample_prs[k].prs = score[k];
+                        sample_prs[k].num_snp = cur_num;
+                    }
+                    else
+                    {
+                        sample_prs[k].prs += score[k];
+                        sample_prs[k].num_snp += cur_num;
+                    }
+                }
+            }
+        }
+        const uint32_t remain = m_sample_ct & (BITCT2 - 1);
+        if (!remain) return;
+        uintptr_t ulii = ~(*lbptr);
+        for (uint32_t ujj = 0; ujj < remain; ++ujj, ulii >>= 2)
+        {
+            load_sample_prs<first, missing>(*sample_prs++, ulii & 3, scores,
+                                            ploidy);
+        }
+    }
+
+    template <MISSING_SCORE missing>
+    void process_sample_prs(const std::vector<uintptr_t>& genotype,
                             std::vector<PRS>& prs_list,
-                            const std::vector<double>& scores,
-                            const std::vector<size_t>& counts, T load_prs)
-    {
-        uintptr_t* lbptr = genotype.data();
-        uintptr_t ulii;
-        uint32_t uii;
-        uint32_t ujj;
-        uint32_t ukk;
-        uii = 0;
-        ulii = 0;
-        do
+                            const std::array<double, 4>& scores,
+                            const size_t ploidy, const bool not_first)
+    {
+        if (m_sample_ct >= m_min_sample_for_table)
         {
-            // ulii contain the numeric representation of the current
-            // genotype
-            ulii = ~(*lbptr++);
-            if (uii + BITCT2 > m_unfiltered_sample_ct)
+            if (not_first)
             {
-                // this is PLINK, not sure exactly what this is about
-                ulii &= (ONELU << ((m_unfiltered_sample_ct & (BITCT2 - 1)) * 2))
-                        - ONELU;
+                process_sample_prs_table<false, missing>(genotype, prs_list,
+                                                         scores, ploidy);
             }
-            // ujj sample index of the current genotype block
-            ujj = 0;
-            while (ujj < BITCT)
+            else
             {
-                // go through the whole genotype block
-                // ukk is the current genotype
-                ukk = (ulii >> ujj) & 3;
-                // and the sample index can be calculated as uii+(ujj/2)
-                if (uii + (ujj / 2) >= m_sample_ct) { break; }
-                auto& sample_prs = prs_list[uii + (ujj / 2)];
-                // now we will get all genotypes (0, 1, 2, 3)
-                (this->*load_prs)(sample_prs, ukk, scores, counts);
-                // ulii &= ~((3 * ONELU) << ujj);
-                // as each sample is represented by two byte, we will add 2
-                // to the index
-                ujj += 2;
+                process_sample_prs_table<true, missing>(genotype, prs_list,
+                                                        scores, ploidy);
             }
-            // uii is the number of samples we have finished so far
-            uii += BITCT2;
-        } while (uii < m_sample_ct);
+        }
+        else if (not_first)
+        {
+            process_sample_prs<false, missing>(genotype, prs_list, scores,
+                                               ploidy);
+        }
+        else
+        {
+            process_sample_prs<true, missing>(genotype, prs_list, scores,
+                                              ploidy);
+        }
     }
 
-    void read_prs(std::vector<uintptr_t>& genotype, std::vector<PRS>& prs_list,
-                  const size_t ploidy, const double stat,
-                  const double adj_score, const double miss_score,
-                  const size_t miss_count, const double homcom_weight,
+    void read_prs(const std::vector<uintptr_t>& genotype,
+                  std::vector<PRS>& prs_list, const size_t ploidy,
+                  const double stat, const double adj_score,
+                  const double miss_score, const double homcom_weight,
                   const double het_weight, const double homrar_weight,
                   const bool not_first)
     {
-        std::vector<double> scores = {homcom_weight * stat - adj_score,
-                                      het_weight * stat - adj_score, miss_score,
-                                      homrar_weight * stat - adj_score};
-        std::vector<size_t> counts = {ploidy, ploidy, miss_count, ploidy};
-        if (not_first)
+        // the inverted PLINK genotypes are 0 for homozygous common, 1 for
+        // heterozygous, 2 for missing and 3 for homozygous rare
+        const std::array<double, 4> scores = {
+            homcom_weight * stat - adj_score, het_weight * stat - adj_score,
+            miss_score, homrar_weight * stat - adj_score};
+        // the missingness handling is fixed for the whole run, so the same
+        // kernel is used for every SNP. Other than SET_ZERO, the methods only
+        // differ in the scores
+        if (m_prs_calculation.missing_score == MISSING_SCORE::SET_ZERO)
         {
-            process_sample_prs(genotype, prs_list, scores, counts,
-                               &Genotype::update_sample_prs);
+            process_sample_prs<MISSING_SCORE::SET_ZERO>(
+                genotype, prs_list, scores, ploidy, not_first);
         }
         else
         {
-            process_sample_prs(genotype, prs_list, scores, counts,
-                               &Genotype::initialize_sample_prs);
+            process_sample_prs<MISSING_SCORE::MEAN_IMPUTE>(
+                genotype, prs_list, scores, ploidy, not_first);
         }
     }
 
+    // TODO: Use ref MAf for dosage score too
+    struct PRS_Interpreter
+    {
+        ~PRS_Interpreter() {}
+        /*!
+         * \brief PRS_Interpreter add the weighted dosages of a SNP to the PRS
+         * of each sample
+         *
+         * \param sample_prs is the vector where we store the results
+         * \param missing contain the method of missingness handling
+         */
+        PRS_Interpreter(std::vector<PRS>* sample_prs, MISSING_SCORE missing)
+            : m_sample_prs(sample_prs)
+        {
+            // to account for the missingness, we need to calculate the mean of
+            // the PRS before we can assign the missing value to the sample. As
+            // a result of that, we need a vector to store the index of the
+            // missing sample.
+            m_setzero = (missing == MISSING_SCORE::SET_ZERO);
+            m_centre = (missing == MISSING_SCORE::CENTER);
+        }
+        /*!
+         * \brief As we will reuse this struct in our analysis, we need to
+         * constantly feed in different statistics and to inform this struct
+         * whether we want to reset the PRS
+         *
+         * \param stat is the effect size of the SNP
+         * \param not_first inform us if we want to construct a new score or not
+         */
+        void set_stat(const double& stat, const bool not_first)
+        {
+            // don't use external expected as that doesn't take into account of
+            // the weighting
+            m_missing.clear();
+            m_stat = stat;
+            m_not_first = not_first;
+            rs.clear();
+            m_adj_score = 0;
+            m_miss_score = 0;
+            m_miss_count = 0;
+            if (!m_setzero)
+            {
+                // this is the only one that depends on ploidy
+                m_miss_count = 2;
+                // again, mean_impute is stable, branch prediction should be ok
+                // 0 if we don't have the expected score
+            }
+        }
+        /*!
+         * \brief Add the SNP to the PRS of all samples
+         *
+         * \param dosage is the weighted dosage of each sample
+         * \param missing indicate if the sample is missing
+         * \param ploidy is the ploidy of the SNP
+         */
+        void add(const std::vector<double>& dosage,
+                 const std::vector<uint8_t>& missing, const int ploidy)
+        {
+            for (size_t i = 0; i < dosage.size(); ++i)
+            {
+                auto&& sample_prs = (*m_sample_prs)[i];
+                if (missing[i])
+                {
+                    m_missing.push_back(i);
+                    sample_prs.num_snp =
+                        sample_prs.num_snp * m_not_first + m_miss_count;
+                }
+                // this is not a missing sample and we can either add the prs
+                // or assign the PRS
+                else
+                {
+                    // this is not the first SNP in the region, we will add
+                    sample_prs.num_snp =
+                        sample_prs.num_snp * m_not_first + ploidy;
+                    sample_prs.prs = sample_prs.prs * m_not_first
+                                     + dosage[i] * m_stat - m_adj_score;
+                    rs.push(dosage[i]);
+                }
+            }
+            finalise();
+        }
+
+    private:
+        std::vector<PRS>* m_sample_prs;
+        std::vector<size_t> m_missing;
+        misc::RunningStat rs;
+        double m_stat = 0.0;
+        double m_miss_score = 0.0;
+        double m_adj_score = 0.0;
+        int m_miss_count = 0;
+        bool m_not_first = false;
+        bool m_setzero = false;
+        bool m_centre = false;
+        /*!
+         * \brief once we finish reading the whole SNP, we can then start
+         * processing samples with missing data. This requires us to calculate
+         * the expected value and use that as the PRS of the samples
+         */
+        void finalise()
+        {
+            if (m_centre) { m_adj_score = m_stat * rs.mean(); }
+            if (!m_setzero)
+            {
+                m_miss_count = 2;
+                m_miss_score = m_stat * rs.mean();
+            }
+
+            // only need to do this if we don't have the expected information
+            size_t cur_idx = 0;
+            for (size_t i = 0; i < m_sample_prs->size(); ++i)
+            {
+                if (cur_idx < m_missing.size() && i == m_missing[cur_idx])
+                {
+                    (*m_sample_prs)[i].prs =
+                        (*m_sample_prs)[i].prs * m_not_first + m_miss_score;
+                    ++cur_idx;
+                }
+                else if (m_centre)
+                {
+                    // if it is not missing and we want the centre the score
+                    // we will need to minus the adjusted score which was 0
+                    // before this run
+                    (*m_sample_prs)[i].prs -= m_adj_score;
+                }
+            }
+        }
+    };
     /*!
      * \brief Function to read in the genotype in PLINK binary format. Any
      * subclass must implement this function to assist the processing of
@@ -1136,6 +1729,20 @@ protected:
                                       const size_t& /*file_index*/)
     {
     }
+    /*!
+     * \brief Same as read_genotype, but only use the provided scratch and
+     * FileRead::pread such that it is safe to call from multiple threads
+     */
+    virtual void read_genotype_scratch(uintptr_t* /*genotype*/,
+                                       const std::streampos /*byte_pos*/,
+                                       const size_t /*file_index*/,
+                                       GenotypeScratch& /*scratch*/) const
+    {
+    }
+    /*!
+     * \brief Open all genotype files in m_genotype_file
+     */
+    virtual void open_genotype_files() {}
     virtual void
     read_score(std::vector<PRS>& /*prs_list*/,
                const std::vector<size_t>::const_iterator& /*start*/,
@@ -1160,7 +1767,55 @@ protected:
      */
     std::unordered_set<std::string>
     load_ref(std::unique_ptr<std::istream> input, bool ignore_fid);
+    unsigned long long sample_hash() const
+    {
+        misc::Hasher hasher;
+        for (auto&& sample : m_sample_id)
+        { hasher.add(sample.FID).add(sample.IID); }
+        return hasher.value();
+    }
+    static unsigned long long partial_record_size(const size_t num_prs)
+    {
+        return 2 * sizeof(unsigned long long)
+               + num_prs * (sizeof(double) + sizeof(unsigned long long));
+    }
+    /*!
+     * \brief Read the \p idx th record of the region into the current partial
+     * score of the shard
+     */
+    void read_partial_record(PartialShard& shard, const size_t region_idx,
+                             const size_t idx);
 
+    /*!
+     * \brief Extract an integer sort key from each SNP
+     * \param get is the function returning the key of a SNP
+     * \return the key of each SNP in m_existed_snps
+     */
+    template <typename Key>
+    std::vector<uint64_t> snp_key(Key get) const
+    {
+        std::vector<uint64_t> key(m_existed_snps.size());
+        for (size_t i = 0; i < m_existed_snps.size(); ++i)
+        { key[i] = static_cast<uint64_t>(get(m_existed_snps[i])); }
+        return key;
+    }
+    /*!
+     * \brief Stably reorder m_existed_snps by the key columns. The order is
+     * obtained by a radix sort on an index permutation so that each SNP
+     * object is only moved once
+     * \param keys are the sort keys, from the most to the least significant
+     */
+    void sort_snps(const std::vector<std::vector<uint64_t>>& keys);
+    /*!
+     * \brief Sort m_existed_snps by their order in the genotype files
+     * \param is_ref indicate if we want the order of the reference files
+     */
+    void sort_snps_by_file(const bool is_ref);
+    /*!
+     * \brief Reorder m_existed_snps such that the i th SNP is the order[i] th
+     * SNP of the original vector
+     */
+    void reorder_snps(const std::vector<size_t>& order);
     void shrink_snp_vector(const std::vector<bool>& retain)
     {
         m_existed_snps.erase(
@@ -1170,6 +1825,7 @@ protected:
                            }),
             m_existed_snps.end());
         m_existed_snps.shrink_to_fit();
+        m_variants.clear();
     }
     /*!
      * \brief Function to load in SNP extraction exclusion list
@@ -17,6 +17,7 @@
 #ifndef SRC_GENOTYPEFACTORY_HPP_
 #define SRC_GENOTYPEFACTORY_HPP_
 #include "binarygen.hpp"
+#include "binarypgen.hpp"
 #include "binaryplink.hpp"
 #include "commander.hpp"
 #include "genotype.hpp"
@@ -30,9 +31,8 @@
 class GenomeFactory
 {
 private:
-    const std::unordered_map<std::string, int> file_type {{"bed", 0},
-                                                          {"ped", 1},
-                                                          {"bgen", 2}};
+    const std::unordered_map<std::string, int> file_type {
+        {"bed", 0}, {"ped", 1}, {"bgen", 2}, {"pgen", 3}};
 
 public:
     Genotype* createGenotype(const GenoFile& geno, const Phenotype& pheno,
@@ -43,7 +43,8 @@ public:
         { code = file_type.at(geno.type); }
         else
         {
-            throw std::invalid_argument("Error: Only support bgen and bed");
+            throw std::invalid_argument(
+                "Error: Only support bgen, pgen and bed");
         }
         switch (code)
         {
@@ -55,8 +56,13 @@ public:
         {
             return new BinaryGen(geno, pheno, delim, &reporter);
         }
+        case 3:
+        {
+            return new BinaryPgen(geno, pheno, delim, &reporter);
+        }
         default:
-            throw std::invalid_argument("ERROR: Only support bgen and bed");
+            throw std::invalid_argument(
+                "ERROR: Only support bgen, pgen and bed");
         }
     }
 };
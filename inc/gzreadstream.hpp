@@ -0,0 +1,100 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GZREADSTREAM_HPP
+#define GZREADSTREAM_HPP
+
+#include <future>
+#include <istream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/*!
+ * \brief Read only stream buffer for gzip compressed files. Unlike the
+ * igzstream, which only buffer ~300 bytes, we inflate multi-megabyte chunks
+ * on a background thread into a double buffer such that decompression of the
+ * next chunk overlap with the parsing of the current chunk. Concatenated gzip
+ * members are inflated one after another
+ */
+class GZReader : public std::streambuf
+{
+public:
+    /*!
+     * \brief Constructor of GZReader
+     * \param source is the gzip compressed input, opened in binary mode
+     * \param file_name is the name of the input, used for error messages
+     */
+    GZReader(std::unique_ptr<std::istream> source,
+             const std::string& file_name);
+    virtual ~GZReader();
+    GZReader(const GZReader&) = delete;
+    GZReader& operator=(const GZReader&) = delete;
+    bool is_open() const { return m_initialized; }
+
+protected:
+    /*!
+     * \brief Return the next inflated chunk. Throw std::runtime_error if zlib
+     * failed to inflate the file, e.g. when it is corrupted or truncated
+     */
+    int_type underflow() override;
+
+private:
+    struct Chunk
+    {
+        std::vector<char> data;
+        bool error = false;
+    };
+    // size of each of the inflated buffer
+    static const size_t m_buffer_size = 4 * 1024 * 1024;
+    // size of the buffer for the compressed data
+    static const size_t m_zlib_buffer_size = 1024 * 1024;
+    std::unique_ptr<std::istream> m_file;
+    z_stream m_stream;
+    std::vector<char> m_in;
+    std::future<Chunk> m_next;
+    std::vector<char> m_current;
+    std::string m_file_name;
+    bool m_initialized = false;
+    // true if we are at the end of a gzip member
+    bool m_member_end = false;
+    bool m_input_end = false;
+    bool fill_input();
+    Chunk read_chunk(std::vector<char> buffer);
+};
+
+/*!
+ * \brief Input stream wrapper of the GZReader. Errors from the reader are
+ * rethrown instead of only setting the badbit
+ */
+class GZStream : public std::istream
+{
+public:
+    GZStream(std::unique_ptr<std::istream> source, const std::string& file_name)
+        : std::istream(nullptr), m_buffer(std::move(source), file_name)
+    {
+        rdbuf(&m_buffer);
+        exceptions(std::ios::badbit);
+        if (!m_buffer.is_open()) setstate(std::ios::failbit);
+    }
+
+private:
+    GZReader m_buffer;
+};
+
+#endif // GZREADSTREAM_HPP
@@ -0,0 +1,312 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HARDCALL_CACHE_HPP
+#define HARDCALL_CACHE_HPP
+
+#include "misc.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <ios>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*!
+ * \brief Cache of the hard calls of a bgen file. The hard calls are stored in
+ * a file with the layout of a PLINK .bed file, with a sidecar storing the
+ * location and the counts of each variant. The name of the cache is keyed on
+ * the sample inclusion and the hard coding thresholds, and its content is
+ * keyed on the path, size and modification time of the bgen file, such that
+ * it can be reused by later runs. Variants not found in the cache are
+ * appended to it. Each cache is locked from open to close, such that
+ * concurrent runs do not write the same cache
+ */
+namespace hardcall_cache
+{
+constexpr std::string_view magic = "PRSICE_HARDCALL_CACHE";
+constexpr unsigned long long version = 1;
+// magic number of a variant major PLINK .bed file
+constexpr char bed_magic[3] = {0x6c, 0x1b, 0x01};
+// magic, version, key, number of variants, bytes per variant and length of
+// the sidecar
+constexpr size_t header_size = magic.size() + 5 * sizeof(unsigned long long);
+/*!
+ * \brief Generate the key of the hard coding settings
+ * \param hard_threshold is the --hard-thres
+ * \param dose_threshold is the --dose-thres
+ * \param num_sample is the number of sample in the bgen file
+ * \param include is the bit array of included samples
+ * \return the key
+ */
+inline unsigned long long setting_key(const double hard_threshold,
+                                      const double dose_threshold,
+                                      const size_t num_sample,
+                                      const std::vector<uintptr_t>& include)
+{
+    misc::Hasher hasher;
+    hasher.add(version)
+        .add(hard_threshold)
+        .add(dose_threshold)
+        .add(num_sample)
+        .add(include);
+    return hasher.value();
+}
+inline unsigned long long file_key(const std::string& bgen_name)
+{
+    // use the canonical path, such that the same file reached with a
+    // different relative path has the same key. Both ends of the file are
+    // hashed to detect a rewrite within the same modification time
+    misc::Hasher hasher;
+    hasher.add(version)
+        .add(misc::canonical_path(bgen_name))
+        .add_file_stat(bgen_name)
+        .add_file_ends(bgen_name);
+    return hasher.value();
+}
+inline std::string cache_name(const std::string& cache_dir,
+                              const std::string& bgen_name,
+                              const unsigned long long setting_key)
+{
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", setting_key);
+    return misc::cache_file(cache_dir, bgen_name,
+                            std::string(".prsice.") + key + ".bed");
+}
+
+/*!
+ * \brief Hard calls of a variant stored in the cache, and the counts required
+ * for the QC filtering
+ */
+struct Entry
+{
+    // location of the genotype block in the bgen file
+    unsigned long long bgen_pos = 0;
+    // index of the variant in the cache
+    unsigned long long row = 0;
+    unsigned long long homcom_ct = 0;
+    unsigned long long het_ct = 0;
+    unsigned long long homrar_ct = 0;
+    unsigned long long missing_ct = 0;
+    double info_score = 0;
+    double expected = 0;
+};
+
+class Cache
+{
+public:
+    Cache() {}
+    Cache(Cache&&) = default;
+    Cache& operator=(Cache&&) = default;
+    ~Cache()
+    {
+        // cache not completed, remove the partial files
+        if (m_bed.is_open())
+        {
+            m_bed.close();
+            if (m_rebuild) std::remove(tmp_name().c_str());
+        }
+    }
+    /*!
+     * \brief Open the cache. Wait for other runs using the cache to finish,
+     * then reuse the existing cache if it matches the bgen file. Otherwise a
+     * new cache is written to a temporary file, which is only renamed once
+     * completed
+     * \param name is the name of the cache
+     * \param key is the key of the bgen file
+     * \param row_bytes is the number of bytes used by each variant
+     * \param reuse indicate if an existing cache can be used. A new cache is
+     * always written otherwise
+     * \return false if the cache cannot be written
+     */
+    bool open(const std::string& name, const unsigned long long key,
+              const size_t row_bytes, const bool reuse = true)
+    {
+        m_name = name;
+        m_key = key;
+        m_row_bytes = row_bytes;
+        m_modified = false;
+        if (!m_lock.lock(m_name + ".lock")) return false;
+        m_rebuild = !reuse || !load();
+        if (m_rebuild)
+        {
+            m_entries.clear();
+            m_lookup.clear();
+            m_bed.open(tmp_name().c_str(), std::ios::binary | std::ios::trunc);
+            m_bed.write(bed_magic, sizeof(bed_magic));
+        }
+        else
+        {
+            m_bed.open(m_name.c_str(), std::ios::binary | std::ios::app);
+        }
+        return m_bed.is_open() && static_cast<bool>(m_bed);
+    }
+    const std::string& name() const { return m_name; }
+    /*!
+     * \brief Find a variant in the cache
+     * \param bgen_pos is the location of the variant in the bgen file
+     * \return the entry of the variant, nullptr if it isn't cached
+     */
+    const Entry* find(const std::streampos& bgen_pos) const
+    {
+        auto&& found = m_lookup.find(to_pos(bgen_pos));
+        return found == m_lookup.end() ? nullptr : &m_entries[found->second];
+    }
+    /*!
+     * \brief Add a variant to the cache
+     * \param entry is the counts of the variant. Location of the variant in
+     * the cache is set here
+     * \param genotype is the PLINK binary genotype of the variant
+     * \return the entry of the variant
+     */
+    const Entry& append(Entry entry, const uintptr_t* genotype)
+    {
+        entry.row = m_entries.size();
+        m_bed.write(reinterpret_cast<const char*>(genotype),
+                    static_cast<std::streamsize>(m_row_bytes));
+        m_lookup[entry.bgen_pos] = m_entries.size();
+        m_entries.push_back(entry);
+        m_modified = true;
+        return m_entries.back();
+    }
+    /*!
+     * \brief Location of a variant in the cache
+     */
+    std::streampos byte_pos(const Entry& entry) const
+    {
+        return static_cast<std::streamoff>(sizeof(bed_magic)
+                                           + entry.row * m_row_bytes);
+    }
+    /*!
+     * \brief Location of a variant in the bgen file
+     * \param cache_pos is the location of the variant in the cache
+     */
+    std::streampos bgen_pos(const std::streampos& cache_pos) const
+    {
+        const size_t row = static_cast<size_t>(
+            (to_pos(cache_pos) - sizeof(bed_magic)) / m_row_bytes);
+        return static_cast<std::streamoff>(m_entries[row].bgen_pos);
+    }
+    /*!
+     * \brief Complete the cache, writing the sidecar if the cache was
+     * changed, then remove the lock
+     * \return false if we failed to write the cache
+     */
+    bool close()
+    {
+        const bool success = complete();
+        m_lock.remove();
+        return success;
+    }
+
+private:
+    std::vector<Entry> m_entries;
+    std::unordered_map<unsigned long long, size_t> m_lookup;
+    std::ofstream m_bed;
+    misc::FileLock m_lock;
+    std::string m_name;
+    unsigned long long m_key = 0;
+    size_t m_row_bytes = 0;
+    bool m_rebuild = false;
+    bool m_modified = false;
+    bool complete()
+    {
+        m_bed.close();
+        if (!m_bed) return false;
+        if (m_rebuild
+            && std::rename(tmp_name().c_str(), m_name.c_str()) != 0)
+        {
+            std::remove(tmp_name().c_str());
+            return false;
+        }
+        if (!m_modified && !m_rebuild) return true;
+        return save();
+    }
+    std::string tmp_name() const { return misc::tmp_file(m_name); }
+    std::string sidecar_name() const { return m_name + ".idx"; }
+    static unsigned long long to_pos(const std::streampos& pos)
+    {
+        return static_cast<unsigned long long>(
+            static_cast<std::streamoff>(pos));
+    }
+    /*!
+     * \brief Read the sidecar of an existing cache
+     * \return true if the cache exists and matches the bgen file
+     */
+    bool load()
+    {
+        std::ifstream sidecar(sidecar_name().c_str(), std::ios::binary);
+        if (!sidecar.is_open()) return false;
+        sidecar.seekg(0, sidecar.end);
+        const unsigned long long file_length =
+            static_cast<unsigned long long>(sidecar.tellg());
+        sidecar.seekg(0, sidecar.beg);
+        std::string file_magic(magic.size(), '\0');
+        unsigned long long header[5];
+        sidecar.read(&file_magic[0],
+                     static_cast<std::streamsize>(file_magic.size()));
+        sidecar.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!sidecar || file_magic != magic || header[0] != version
+            || header[1] != m_key || header[3] != m_row_bytes
+            || header[4] != file_length
+            || file_length != header_size + header[2] * sizeof(Entry))
+        { return false; }
+        // the cache is invalid if it was modified without the sidecar
+        std::ifstream bed(m_name.c_str(), std::ios::binary | std::ios::ate);
+        if (!bed.is_open()
+            || static_cast<unsigned long long>(bed.tellg())
+                   != sizeof(bed_magic) + header[2] * m_row_bytes)
+        { return false; }
+        m_entries.resize(header[2]);
+        sidecar.read(reinterpret_cast<char*>(m_entries.data()),
+                     static_cast<std::streamsize>(m_entries.size()
+                                                  * sizeof(Entry)));
+        if (!sidecar) return false;
+        m_lookup.clear();
+        for (size_t i = 0; i < m_entries.size(); ++i)
+        {
+            if (m_entries[i].row != i) return false;
+            m_lookup[m_entries[i].bgen_pos] = i;
+        }
+        return true;
+    }
+    bool save() const
+    {
+        const std::string name = sidecar_name(), tmp = misc::tmp_file(name);
+        std::ofstream sidecar(tmp.c_str(), std::ios::binary);
+        if (!sidecar.is_open()) return false;
+        const unsigned long long header[5] = {
+            version, m_key, m_entries.size(), m_row_bytes,
+            header_size + m_entries.size() * sizeof(Entry)};
+        sidecar.write(magic.data(), static_cast<std::streamsize>(magic.size()));
+        sidecar.write(reinterpret_cast<const char*>(header), sizeof(header));
+        sidecar.write(
+            reinterpret_cast<const char*>(m_entries.data()),
+            static_cast<std::streamsize>(m_entries.size() * sizeof(Entry)));
+        sidecar.close();
+        if (!sidecar || std::rename(tmp.c_str(), name.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+}
+
+#endif // HARDCALL_CACHE_HPP
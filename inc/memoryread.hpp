@@ -2,53 +2,355 @@
 #define MEMORYREAD_HPP
 
 #include "misc.hpp"
+#include <cerrno>
+#include <cstring>
 #include <fstream>
 #include <stdexcept>
 #include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-
+/*!
+ * \brief Random access to the genotype files. Each file is memory mapped once
+ * and kept open for the life time of the object, such that reading a variant
+ * is a copy from the page cache instead of a seek and read on a stream. Files
+ * that cannot be mapped (or on Windows) fall back to std::ifstream. read share
+ * a single stream and is not thread safe, use pread when multiple threads are
+ * reading from the same object
+ */
 class FileRead
 {
 public:
+    static constexpr size_t npos = ~size_t(0);
+    static constexpr size_t default_span = 1 << 20;
+    static constexpr size_t default_gap = 1 << 16;
+    enum class Access
+    {
+        NORMAL,
+        SEQUENTIAL,
+        RANDOM
+    };
     FileRead() {}
+    /*!
+     * \brief Constructor of FileRead
+     * \param map_file indicate if we should memory map the files. If false,
+     * all reads go through the stream
+     */
+    explicit FileRead(const bool map_file) : m_map_file(map_file) {}
+    FileRead(const FileRead&) = delete;
+    FileRead& operator=(const FileRead&) = delete;
+    ~FileRead() { close(); }
+    /*!
+     * \brief Open the file, or return the handle of the file if it is
+     * already opened
+     * \param file is the name of the file
+     * \return handle of the file, for use with data and read
+     */
+    size_t open(const std::string& file)
+    {
+        if (m_last < m_files.size() && m_files[m_last].name == file)
+        { return m_last; }
+        for (size_t i = 0; i < m_files.size(); ++i)
+        {
+            if (m_files[i].name == file)
+            {
+                m_last = i;
+                return i;
+            }
+        }
+        m_files.emplace_back();
+        m_files.back().name = file;
+#ifndef _WIN32
+        m_files.back().fd = ::open(file.c_str(), O_RDONLY);
+#endif
+        map(m_files.back());
+        m_last = m_files.size() - 1;
+        return m_last;
+    }
+    /*!
+     * \brief Return pointer to the content of the file without copying
+     * \param handle is the handle returned by open
+     * \param byte_pos is the start of the data
+     * \param read_size is the number of bytes required
+     * \return pointer to the mapped data, nullptr if the file is not mapped
+     */
+    const char* data(const size_t handle, const std::streampos& byte_pos,
+                     const size_t read_size)
+    {
+        MappedFile& file = m_files[handle];
+        if (file.data == nullptr) return nullptr;
+        const size_t end = static_cast<size_t>(byte_pos) + read_size;
+        if (end > file.size)
+        {
+            // the file might have grown since we mapped it (e.g. the
+            // intermediate file of bgen), so map it again
+            unmap(file);
+            map(file);
+            if (file.data == nullptr) return nullptr;
+            if (end > file.size)
+            {
+                throw std::runtime_error("Error: Cannot read file: "
+                                         + file.name);
+            }
+        }
+        return file.data + static_cast<size_t>(byte_pos);
+    }
+    void read(const size_t handle, const std::streampos& byte_pos,
+              const std::streampos read_size, char* result)
+    {
+        const size_t size = static_cast<size_t>(read_size);
+        const char* mapped = data(handle, byte_pos, size);
+        if (mapped != nullptr)
+        {
+            std::memcpy(result, mapped, size);
+            return;
+        }
+        stream_read(handle, byte_pos, read_size, result);
+    }
     void read(const std::string& file, const std::streampos& byte_pos,
               const std::streampos read_size, char* result)
     {
-        if (file != m_file_name) { new_file(file, byte_pos); }
-
-        assert(m_input.is_open());
-        if (byte_pos != m_offset)
+        read(open(file), byte_pos, read_size, result);
+    }
+    /*!
+     * \brief Thread safe read using positional read on the file descriptor,
+     * which doesn't touch the shared stream, buffer or mapping. Multiple
+     * threads can call this at the same time, as long as no file is opened or
+     * closed meanwhile. All required files must therefore be opened before
+     * the threads are started
+     * \param handle is the handle returned by open
+     * \param byte_pos is the start of the data
+     * \param read_size is the number of bytes required
+     * \param result is the output buffer
+     */
+    void pread(const size_t handle, const std::streampos& byte_pos,
+               const size_t read_size, char* result) const
+    {
+        const MappedFile& file = m_files[handle];
+        const size_t start = static_cast<size_t>(byte_pos);
+        // we can't remap here as other threads might still be using the
+        // mapping, so anything beyond it is read from the file instead
+        if (file.data != nullptr && start + read_size <= file.size)
         {
-            if (!m_input.seekg(byte_pos, std::ios_base::beg))
+            std::memcpy(result, file.data + start, read_size);
+            return;
+        }
+#ifndef _WIN32
+        size_t num_read = 0;
+        while (num_read < read_size)
+        {
+            const ssize_t cur =
+                ::pread(file.fd, result + num_read, read_size - num_read,
+                        static_cast<off_t>(start + num_read));
+            if (cur < 0 && errno == EINTR) continue;
+            if (cur <= 0)
             {
-                throw std::runtime_error("Error: Cannot seek within file: "
-                                         + m_file_name);
+                throw std::runtime_error("Error: Cannot read file: "
+                                         + file.name);
             }
+            num_read += static_cast<size_t>(cur);
         }
-        if (!m_input.read(result, read_size))
+#else
+        // no positional read, use a stream local to this call instead
+        std::ifstream input(file.name.c_str(), std::ios::binary);
+        if (!input.seekg(byte_pos, std::ios_base::beg)
+            || !input.read(result, static_cast<std::streamsize>(read_size)))
+        { throw std::runtime_error("Error: Cannot read file: " + file.name); }
+#endif
+    }
+    /*!
+     * \brief Return the handle of a file without opening it, such that it can
+     * be used when multiple threads are reading
+     * \param file is the name of the file
+     * \return handle of the file, npos if the file is not opened
+     */
+    size_t find(const std::string& file) const
+    {
+        for (size_t i = 0; i < m_files.size(); ++i)
         {
-            throw std::runtime_error("Error: Cannot read file: " + m_file_name);
+            if (m_files[i].name == file) return i;
         }
-        m_offset = read_size + byte_pos;
+        return npos;
+    }
+    /*!
+     * \brief Inform the kernel of the expected access pattern, which control
+     * how aggressive the read ahead is. Applies to all mapped files, including
+     * those opened afterward
+     */
+    void advise(const Access access)
+    {
+        m_access = access;
+        for (auto&& file : m_files) advise(file);
+    }
+    /*!
+     * \brief Control how reads on the stream are coalesced. When a read
+     * starts at most max_gap bytes after the end of the previous read, we
+     * read max_span bytes in one go and serve the following reads from the
+     * buffer. Use max_span of 0 to disable. Has no effect on mapped files
+     * \param max_span is the size of the buffer
+     * \param max_gap is the largest gap between reads considered contiguous
+     */
+    void coalesce(const size_t max_span, const size_t max_gap)
+    {
+        m_max_span = max_span;
+        m_max_gap = max_gap;
+        m_buffer.clear();
+        m_buffer_handle = npos;
+    }
+    void close()
+    {
+        for (auto&& file : m_files)
+        {
+            unmap(file);
+#ifndef _WIN32
+            if (file.fd != -1) ::close(file.fd);
+#endif
+        }
+        m_files.clear();
+        m_last = npos;
+        if (m_input.is_open()) { m_input.close(); }
+        m_stream_handle = npos;
+        m_buffer.clear();
+        m_buffer_handle = npos;
     }
 
 private:
+    struct MappedFile
+    {
+        std::string name;
+        const char* data = nullptr;
+        size_t size = 0;
+        // kept open for pread
+        int fd = -1;
+    };
+    std::vector<MappedFile> m_files;
+    std::vector<char> m_buffer;
     std::ifstream m_input;
-    std::string m_file_name;
     std::streampos m_offset;
-    void new_file(const std::string& file, const std::streampos byte_pos)
+    size_t m_last = npos;
+    size_t m_stream_handle = npos;
+    // the file and start of the content in m_buffer
+    size_t m_buffer_handle = npos;
+    size_t m_buffer_start = 0;
+    // end of the previous read on the stream
+    size_t m_prev_end = 0;
+    size_t m_max_span = default_span;
+    size_t m_max_gap = default_gap;
+    Access m_access = Access::NORMAL;
+    bool m_map_file = true;
+    void map(MappedFile& file)
     {
-        m_file_name = file;
-        m_offset = byte_pos;
-        if (m_input.is_open()) { m_input.close(); }
+#ifndef _WIN32
+        if (!m_map_file || file.fd == -1) return;
+        struct stat file_stat;
+        // cannot map an empty file
+        if (fstat(file.fd, &file_stat) == 0 && file_stat.st_size > 0)
+        {
+            void* addr = mmap(nullptr, static_cast<size_t>(file_stat.st_size),
+                              PROT_READ, MAP_PRIVATE, file.fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                file.data = static_cast<const char*>(addr);
+                file.size = static_cast<size_t>(file_stat.st_size);
+                advise(file);
+            }
+        }
+#else
+        (void) file;
+#endif
+    }
+    void unmap(MappedFile& file)
+    {
+#ifndef _WIN32
+        if (file.data != nullptr)
+        { munmap(const_cast<char*>(file.data), file.size); }
+#endif
+        file.data = nullptr;
+        file.size = 0;
+    }
+    void advise(MappedFile& file)
+    {
+#ifndef _WIN32
+        if (file.data == nullptr) return;
+        int advice = MADV_NORMAL;
+        if (m_access == Access::SEQUENTIAL) { advice = MADV_SEQUENTIAL; }
+        else if (m_access == Access::RANDOM) { advice = MADV_RANDOM; }
+        madvise(const_cast<char*>(file.data), file.size, advice);
+#else
+        (void) file;
+#endif
+    }
+    void stream_read(const size_t handle, const std::streampos& byte_pos,
+                     const std::streampos read_size, char* result)
+    {
+        const size_t start = static_cast<size_t>(byte_pos);
+        const size_t size = static_cast<size_t>(read_size);
+        if (handle == m_buffer_handle && start >= m_buffer_start
+            && start + size <= m_buffer_start + m_buffer.size())
+        {
+            std::memcpy(result, m_buffer.data() + (start - m_buffer_start),
+                        size);
+            m_prev_end = start + size;
+            return;
+        }
+        // only read ahead when the reads are (nearly) contiguous, otherwise
+        // most of the span will be wasted
+        const bool contiguous = handle == m_stream_handle && start >= m_prev_end
+                                && start - m_prev_end <= m_max_gap;
+        seek(handle, byte_pos);
+        const std::string& file_name = m_files[handle].name;
+        if (!contiguous || size >= m_max_span)
+        {
+            if (!m_input.read(result, read_size))
+            {
+                throw std::runtime_error("Error: Cannot read file: "
+                                         + file_name);
+            }
+            m_offset = read_size + byte_pos;
+            m_prev_end = start + size;
+            return;
+        }
+        m_buffer.resize(m_max_span);
+        m_input.read(m_buffer.data(),
+                     static_cast<std::streamsize>(m_buffer.size()));
+        const size_t num_read = static_cast<size_t>(m_input.gcount());
+        if (num_read < size)
+        {
+            m_buffer_handle = npos;
+            throw std::runtime_error("Error: Cannot read file: " + file_name);
+        }
+        // we might have reached the end of file
         m_input.clear();
-        m_input.open(m_file_name.c_str(), std::ios::binary);
-        if (byte_pos != 0)
+        m_buffer.resize(num_read);
+        m_buffer_handle = handle;
+        m_buffer_start = start;
+        m_offset = static_cast<std::streamoff>(start + num_read);
+        std::memcpy(result, m_buffer.data(), size);
+        m_prev_end = start + size;
+    }
+    void seek(const size_t handle, const std::streampos& byte_pos)
+    {
+        const std::string& file_name = m_files[handle].name;
+        if (handle != m_stream_handle)
+        {
+            m_stream_handle = handle;
+            if (m_input.is_open()) { m_input.close(); }
+            m_input.clear();
+            m_input.open(file_name.c_str(), std::ios::binary);
+            m_offset = -1;
+            m_prev_end = 0;
+        }
+        if (byte_pos != m_offset)
         {
             if (!m_input.seekg(byte_pos, std::ios_base::beg))
             {
                 throw std::runtime_error("Error: Cannot seek within file: "
-                                         + m_file_name);
+                                         + file_name);
             }
         }
     }
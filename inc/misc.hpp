@@ -21,7 +21,16 @@
 #include <stdio.h>
 #define _USE_MATH_DEFINES
 #include <algorithm>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include "bgzfstream.hpp"
+#include "gzreadstream.hpp"
+#include "peekstream.hpp"
+#include "zstdstream.hpp"
 #include <gzstream.h>
 #include <iostream>
 #include <limits>
@@ -31,6 +40,7 @@
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <sys/stat.h>
 #include <vector>
 #if defined __APPLE__
 #include <mach/mach.h>
@@ -81,8 +91,12 @@
 #error "Cannot define getPeakRSS( ) or getCurrentRSS( ) for an unknown OS."
 #endif
 #if defined(_WIN32)
+#include <process.h>
 #elif defined(__unix__) || defined(__unix) || defined(unix) \
     || (defined(__APPLE__) && defined(__MACH__))
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/param.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -408,6 +422,44 @@ inline T convert(const std::string& str)
 {
     return Convertor::convert<T>(str);
 }
+/*!
+ * \brief Exception free version of Convertor::convert. Accept the same input
+ * as Convertor but work directly on the string_view without allocating a
+ * temporary string. Use this when the input is expected to contain invalid
+ * entries (e.g. NA) so that they are not treated as exceptional
+ * \param str is the input string
+ * \param obj is the converted value, untouched when conversion failed
+ * \return true if the whole string is a valid number of type T
+ */
+template <typename T>
+inline bool parse_value(std::string_view str, T& obj)
+{
+    static_assert(std::is_arithmetic_v<T>, "Can only parse numeric value");
+    // istream skip leading white space and accept a leading + sign
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str[0])))
+    { str.remove_prefix(1); }
+    if (str.size() > 1 && str[0] == '+' && str[1] != '-' && str[1] != '+')
+    { str.remove_prefix(1); }
+    if (str.empty()) return false;
+    const char* last = str.data() + str.size();
+    T value;
+    auto [ptr, ec] = std::from_chars(str.data(), last, value);
+    if (ec != std::errc() || ptr != last) return false;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        if (std::fpclassify(value) != FP_NORMAL
+            && std::fpclassify(value) != FP_ZERO)
+        { return false; }
+    }
+    else if constexpr (std::is_unsigned_v<T>)
+    {
+        // same restriction as Convertor
+        if (value > static_cast<T>(std::numeric_limits<int>::max()))
+        { return false; }
+    }
+    obj = value;
+    return true;
+}
 template <typename T>
 inline std::string to_string(T value)
 {
@@ -1157,6 +1209,298 @@ inline bool logically_equal(double a, double b, double error_factor = 1.0)
                                       * error_factor));
 }
 
+/*!
+ * \brief Simple 64 bit FNV-1a style hash. Use for detecting changes in the
+ * input of the on-disk caches, not meant to be cryptographic. Input is
+ * consumed 8 bytes at a time, each word is mixed before it is combined, such
+ * that a change in any bit of the input affects all bits of the hash
+ */
+class Hasher
+{
+public:
+    Hasher& add(const void* data, size_t len)
+    {
+        const unsigned char* ptr = static_cast<const unsigned char*>(data);
+        uint64_t word;
+        // process 8 bytes at a time, much faster than per byte for large
+        // input
+        for (; len >= sizeof(word); len -= sizeof(word), ptr += sizeof(word))
+        {
+            std::memcpy(&word, ptr, sizeof(word));
+            // the multiplication only carries low bits into high bits, the
+            // rotation feeds the high bits back
+            m_hash = rotate((m_hash ^ mix(word)) * m_prime);
+        }
+        for (; len > 0; --len, ++ptr) { m_hash = (m_hash ^ *ptr) * m_prime; }
+        return *this;
+    }
+    Hasher& add(const std::string& str)
+    {
+        add(str.size());
+        return add(str.data(), str.size());
+    }
+    template <typename T>
+    Hasher& add(const T& value)
+    {
+        static_assert(std::is_arithmetic_v<T>, "Can only hash numeric value");
+        return add(&value, sizeof(T));
+    }
+    template <typename T>
+    Hasher& add(const std::vector<T>& value)
+    {
+        add(value.size());
+        for (auto&& v : value) { add(v); }
+        return *this;
+    }
+    /*!
+     * \brief Add the size and modification time of a file to the hash. Only
+     * detect changes that update the modification time. The nanoseconds are
+     * included where the platform reports them
+     * \param name is the name of the file
+     */
+    Hasher& add_file_stat(const std::string& name)
+    {
+        struct stat file_stat;
+        if (stat(name.c_str(), &file_stat) != 0)
+        { throw std::runtime_error("Error: Cannot open file - " + name); }
+        add(static_cast<long long>(file_stat.st_size));
+        add(static_cast<long long>(file_stat.st_mtime));
+#if defined(__APPLE__)
+        add(static_cast<long long>(file_stat.st_mtimespec.tv_nsec));
+#elif !defined(_WIN32)
+        add(static_cast<long long>(file_stat.st_mtim.tv_nsec));
+#endif
+        return *this;
+    }
+    /*!
+     * \brief Add the first and last block of a file to the hash. Together
+     * with add_file_stat, this detects changes made within the resolution of
+     * the modification time without reading the whole file
+     * \param name is the name of the file
+     * \param block_size is the number of bytes read from each end
+     */
+    Hasher& add_file_ends(const std::string& name,
+                          const size_t block_size = 1 << 16)
+    {
+        std::ifstream file(name.c_str(), std::ios::binary);
+        if (!file.is_open())
+        { throw std::runtime_error("Error: Cannot open file - " + name); }
+        file.seekg(0, file.end);
+        const size_t file_size = static_cast<size_t>(file.tellg());
+        std::vector<char> buffer(std::min(block_size, file_size));
+        file.seekg(0, file.beg);
+        file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        add(buffer.data(), static_cast<size_t>(file.gcount()));
+        if (file_size > buffer.size())
+        {
+            file.seekg(static_cast<std::streamoff>(file_size - buffer.size()));
+            file.read(buffer.data(),
+                      static_cast<std::streamsize>(buffer.size()));
+            add(buffer.data(), static_cast<size_t>(file.gcount()));
+        }
+        return *this;
+    }
+    unsigned long long value() const { return mix(m_hash); }
+
+private:
+    static constexpr uint64_t m_prime = 1099511628211ULL;
+    /*!
+     * \brief The splitmix64 finalizer
+     */
+    static uint64_t mix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+    static uint64_t rotate(const uint64_t x) { return (x << 27) | (x >> 37); }
+    uint64_t m_hash = 14695981039346656037ULL;
+};
+/*!
+ * \brief Return the absolute path of a file, with symbolic links and relative
+ * components resolved
+ * \param name is the name of the file
+ * \return the canonical path, or name if it cannot be resolved
+ */
+inline std::string canonical_path(const std::string& name)
+{
+#ifdef _WIN32
+    char* path = _fullpath(nullptr, name.c_str(), 0);
+#else
+    char* path = realpath(name.c_str(), nullptr);
+#endif
+    if (path == nullptr) return name;
+    std::string result(path);
+    free(path);
+    return result;
+}
+/*!
+ * \brief Return the directory part of a path
+ * \param path is the path
+ * \return the directory, "." if path doesn't contain a directory
+ */
+inline std::string dir_name(const std::string& path)
+{
+    const size_t pos = path.find_last_of("/\\");
+    if (pos == std::string::npos) return ".";
+    if (pos == 0) return path.substr(0, 1);
+    return path.substr(0, pos);
+}
+/*!
+ * \brief Name of the temporary file used when writing a file. The name is
+ * unique to the process, such that concurrent runs writing the same file
+ * don't overwrite each other before the file is renamed into place
+ * \param name is the name of the file
+ * \return the name of the temporary file
+ */
+inline std::string tmp_file(const std::string& name)
+{
+#ifdef _WIN32
+    const long long pid = _getpid();
+#else
+    const long long pid = getpid();
+#endif
+    return name + "." + std::to_string(pid) + ".tmp";
+}
+/*!
+ * \brief Name of the cache file of an input file. The name contains the hash
+ * of the canonical path of the input, such that inputs with the same name in
+ * different directories have their own cache
+ * \param cache_dir is the directory of the cache
+ * \param input is the name of the input file
+ * \param suffix is appended to the name
+ * \return the name of the cache file
+ */
+inline std::string cache_file(const std::string& cache_dir,
+                              const std::string& input,
+                              const std::string& suffix)
+{
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx",
+                  Hasher().add(canonical_path(input)).value());
+    return cache_dir + "/" + base_name<std::string>(input) + "." + key
+           + suffix;
+}
+/*!
+ * \brief Exclusive lock on a file, released when the object is destroyed.
+ * Used to stop concurrent runs from writing the same cache. The lock file is
+ * removed by remove. A run that was waiting on a removed file notices it
+ * once it gets the lock and locks the new file instead, such that two runs
+ * never hold a lock on different files of the same name
+ */
+class FileLock
+{
+public:
+    FileLock() {}
+    FileLock(FileLock&& other) noexcept
+        : m_name(std::move(other.m_name)), m_handle(other.m_handle)
+    {
+        other.m_handle = m_invalid;
+    }
+    FileLock& operator=(FileLock&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unlock();
+            m_name = std::move(other.m_name);
+            m_handle = other.m_handle;
+            other.m_handle = m_invalid;
+        }
+        return *this;
+    }
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+    ~FileLock() { unlock(); }
+    /*!
+     * \brief Wait until we hold the lock
+     * \param name is the name of the lock file, created if needed
+     * \return false if the lock file cannot be opened or locked
+     */
+    bool lock(const std::string& name)
+    {
+        unlock();
+        m_name = name;
+#ifdef _WIN32
+        m_handle = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                               OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_handle == m_invalid) return false;
+        OVERLAPPED overlapped = {};
+        if (!LockFileEx(m_handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0,
+                        &overlapped))
+        {
+            CloseHandle(m_handle);
+            m_handle = m_invalid;
+            return false;
+        }
+#else
+        while (true)
+        {
+            m_handle = ::open(name.c_str(), O_RDWR | O_CREAT, 0666);
+            if (m_handle == m_invalid) return false;
+            int res;
+            do
+            {
+                res = flock(m_handle, LOCK_EX);
+            } while (res != 0 && errno == EINTR);
+            struct stat locked, current;
+            if (res != 0 || fstat(m_handle, &locked) != 0)
+            {
+                ::close(m_handle);
+                m_handle = m_invalid;
+                return false;
+            }
+            // the previous holder might have removed the file while we were
+            // waiting, in which case we have to lock the new file
+            if (stat(name.c_str(), &current) == 0
+                && current.st_dev == locked.st_dev
+                && current.st_ino == locked.st_ino)
+            { break; }
+            ::close(m_handle);
+        }
+#endif
+        return true;
+    }
+    void unlock()
+    {
+        if (m_handle == m_invalid) return;
+#ifdef _WIN32
+        // closing the handle also release the lock
+        CloseHandle(m_handle);
+#else
+        ::close(m_handle);
+#endif
+        m_handle = m_invalid;
+    }
+    /*!
+     * \brief Remove the lock file and release the lock
+     */
+    void remove()
+    {
+        if (m_handle == m_invalid) return;
+#ifdef _WIN32
+        unlock();
+        // fails if another run has the file open, that run will then remove
+        // the file once it is done
+        DeleteFileA(m_name.c_str());
+#else
+        // remove while we still hold the lock, such that no other run can
+        // lock the file between the removal and the release
+        ::unlink(m_name.c_str());
+        unlock();
+#endif
+    }
+
+private:
+    std::string m_name;
+#ifdef _WIN32
+    static inline const HANDLE m_invalid = INVALID_HANDLE_VALUE;
+    HANDLE m_handle = INVALID_HANDLE_VALUE;
+#else
+    static constexpr int m_invalid = -1;
+    int m_handle = -1;
+#endif
+};
 inline bool is_gz_file(const std::string& name)
 {
     const unsigned char gz_magic[2] = {0x1f, 0x8b};
@@ -1164,16 +1508,31 @@ inline bool is_gz_file(const std::string& name)
     if ((fp = fopen(name.c_str(), "rb")) == nullptr)
     { throw std::runtime_error("Error: Cannot open file - " + name); }
     unsigned char buf[2];
-    if (fread(buf, 1, 2, fp) == 2)
-    {
-        if (buf[0] == gz_magic[0] && buf[1] == gz_magic[1]) { return true; }
-        return false;
-    }
-    else
-    {
-        // can open the file, but can't read the magic number.
-        return false;
-    }
+    // can open the file, but can't read the magic number.
+    const bool is_gz = fread(buf, 1, 2, fp) == 2 && buf[0] == gz_magic[0]
+                       && buf[1] == gz_magic[1];
+    fclose(fp);
+    return is_gz;
+}
+enum class Compression
+{
+    NONE = 0,
+    GZ,
+    BGZF,
+    ZSTD
+};
+/*!
+ * \brief Detect the compression of an input from its leading bytes
+ * \param head is the start of the input
+ * \return the compression of the input
+ */
+inline Compression detect_compression(const std::string& head)
+{
+    if (BGZFReader::is_bgzf(head)) return Compression::BGZF;
+    if (head.compare(0, 2, "\x1f\x8b") == 0) return Compression::GZ;
+    if (head.compare(0, 4, "\x28\xb5\x2f\xfd") == 0)
+        return Compression::ZSTD;
+    return Compression::NONE;
 }
 inline std::unique_ptr<std::istream> load_stream(const std::string& filepath)
 {
@@ -1182,33 +1541,74 @@ inline std::unique_ptr<std::istream> load_stream(const std::string& filepath)
     { throw std::runtime_error("Error: Cannot open file: " + filepath); }
     return std::unique_ptr<std::istream>(*file ? std::move(file) : nullptr);
 }
+/*!
+ * \brief Open a file that might be compressed. BGZF files are inflated in
+ * parallel using \p thread threads, all other gzip files are inflated on a
+ * background thread with GZStream and zstd files are decoded with ZSTDStream
+ * if PRSice was compiled with zstd support. The format is detected from the
+ * leading bytes of the opened file, such that pipes (e.g. process
+ * substitution) are only read once
+ * \param filepath is the name of the file
+ * \param compressed return true if the file is compressed, in which case the
+ * stream is not seekable
+ * \param thread is the number of thread allowed for decompression
+ * \return the input stream
+ */
 inline std::unique_ptr<std::istream> load_stream(const std::string& filepath,
-                                                 bool& gz_input)
+                                                 bool& compressed,
+                                                 const size_t thread = 1)
 {
-    gz_input = false;
-    try
+    auto file =
+        std::make_unique<std::ifstream>(filepath.c_str(), std::ios::binary);
+    if (!file->is_open())
+    { throw std::runtime_error("Error: Cannot open file: " + filepath); }
+    std::string head(BGZFReader::header_size(), '\0');
+    file->read(&head[0], static_cast<std::streamsize>(head.size()));
+    head.resize(static_cast<size_t>(file->gcount()));
+    const Compression compression = detect_compression(head);
+    compressed = (compression != Compression::NONE);
+    file->clear();
+    file->seekg(0, file->beg);
+    std::unique_ptr<std::istream> source;
+    if (!file->fail())
     {
-        gz_input = misc::is_gz_file(filepath);
+        // plain text are read in text mode
+        if (!compressed) return load_stream(filepath);
+        source = std::move(file);
     }
-    catch (const std::runtime_error& e)
+    else
     {
-        throw std::runtime_error(e.what());
+        // input can't be rewound, replay the bytes we have already read
+        file->clear();
+        source = std::make_unique<PeekStream>(std::move(file), std::move(head));
     }
-    if (gz_input)
+    std::unique_ptr<std::istream> stream;
+    switch (compression)
     {
-        auto gz =
-            std::make_unique<GZSTREAM_NAMESPACE::igzstream>(filepath.c_str());
-        if (!gz->good())
-        {
-            throw std::runtime_error("Error: Cannot open file: " + filepath
-                                     + " (gz) to read!\n");
-        }
-        return std::unique_ptr<std::istream>(*gz ? std::move(gz) : nullptr);
+    case Compression::NONE: return source;
+    case Compression::BGZF:
+        stream =
+            std::make_unique<BGZFStream>(std::move(source), filepath, thread);
+        break;
+    case Compression::GZ:
+        stream = std::make_unique<GZStream>(std::move(source), filepath);
+        break;
+    case Compression::ZSTD:
+#ifdef USE_ZSTD
+        stream = std::make_unique<ZSTDStream>(std::move(source), filepath);
+        break;
+#else
+        throw std::runtime_error("Error: " + filepath
+                                 + " is zstd compressed but PRSice was "
+                                   "compiled without zstd support!\n");
+#endif
     }
-    else
+    if (!stream->good())
     {
-        return load_stream(filepath);
+        throw std::runtime_error("Error: Cannot open file: " + filepath
+                                 + " (compressed) to read!\n");
     }
+    return stream;
 }
 
 inline bool isNumeric(const std::string& s)
@@ -0,0 +1,83 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PEEKSTREAM_HPP
+#define PEEKSTREAM_HPP
+
+#include <istream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Stream buffer that returns the bytes we have already read from the
+ * start of an input before reading the rest of the input. Used for input
+ * that can't be rewound once we have checked its format, such as pipes
+ */
+class PeekReader : public std::streambuf
+{
+public:
+    /*!
+     * \brief Constructor of PeekReader
+     * \param source is the input, positioned right after \p head
+     * \param head contain the bytes already read from \p source
+     */
+    PeekReader(std::unique_ptr<std::istream> source, std::string head)
+        : m_source(std::move(source)), m_head(std::move(head))
+    {
+        setg(m_head.data(), m_head.data(), m_head.data() + m_head.size());
+    }
+    PeekReader(const PeekReader&) = delete;
+    PeekReader& operator=(const PeekReader&) = delete;
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        m_buffer.resize(m_buffer_size);
+        m_source->read(m_buffer.data(),
+                       static_cast<std::streamsize>(m_buffer.size()));
+        const std::streamsize num_read = m_source->gcount();
+        if (num_read <= 0) return traits_type::eof();
+        setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + num_read);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    static const size_t m_buffer_size = 1 << 16;
+    std::unique_ptr<std::istream> m_source;
+    std::string m_head;
+    std::vector<char> m_buffer;
+};
+
+/*!
+ * \brief Input stream wrapper of the PeekReader
+ */
+class PeekStream : public std::istream
+{
+public:
+    PeekStream(std::unique_ptr<std::istream> source, std::string head)
+        : std::istream(nullptr), m_buffer(std::move(source), std::move(head))
+    {
+        rdbuf(&m_buffer);
+    }
+
+private:
+    PeekReader m_buffer;
+};
+
+#endif // PEEKSTREAM_HPP
@@ -0,0 +1,631 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PGEN_HPP
+#define PGEN_HPP
+
+#include "plink_common.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Reader of the PLINK 2 .pgen format. The hard calls are decoded into
+ * an 2-bit array where 0 = homozygous REF, 1 = heterozygous, 2 = homozygous
+ * ALT and 3 = missing, and the dosages into the number of ALT allele times
+ * 16384, with 65535 as missing
+ */
+namespace pgen
+{
+constexpr uint16_t dosage_missing = 65535;
+constexpr uint32_t dosage_unit = 16384;
+// storage modes of the pgen file
+constexpr uint8_t plink1_mode = 0x01;
+constexpr uint8_t fixed_hardcall_mode = 0x02;
+constexpr uint8_t fixed_dosage_mode = 0x03;
+constexpr uint8_t variable_mode = 0x10;
+// number of variants in each block of the variable width index
+constexpr uint32_t vblock_size = 1 << 16;
+
+inline void malformed()
+{
+    throw std::runtime_error("Error: Malformed pgen record");
+}
+/*!
+ * \brief Read a little endian unsigned integer of \p num_byte bytes
+ */
+inline uint32_t read_uint(const uint8_t*& ptr, const uint8_t* end,
+                          const uint32_t num_byte)
+{
+    if (end - ptr < static_cast<std::ptrdiff_t>(num_byte)) malformed();
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < num_byte; ++i)
+    { value |= static_cast<uint32_t>(ptr[i]) << (8 * i); }
+    ptr += num_byte;
+    return value;
+}
+/*!
+ * \brief Read an integer stored with 7 bits per byte, where the highest bit
+ * indicates if there are more bytes to follow
+ */
+inline uint32_t read_varint(const uint8_t*& ptr, const uint8_t* end)
+{
+    uint32_t value = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 7)
+    {
+        if (ptr == end) malformed();
+        const uint8_t cur = *ptr++;
+        value |= static_cast<uint32_t>(cur & 0x7f) << shift;
+        if (!(cur & 0x80)) return value;
+    }
+    malformed();
+    return value;
+}
+// records that are stored as the difference to the previous record that
+// isn't LD compressed
+inline bool ld_compressed(const uint8_t vrtype) { return (vrtype & 6) == 2; }
+inline uint32_t get_geno(const uintptr_t* genotype, const uint32_t idx)
+{
+    return static_cast<uint32_t>(
+        (genotype[idx / BITCT2] >> (2 * (idx % BITCT2))) & 3);
+}
+inline void set_geno(uintptr_t* genotype, const uint32_t idx,
+                     const uint32_t geno)
+{
+    const uint32_t shift = 2 * (idx % BITCT2);
+    uintptr_t& word = genotype[idx / BITCT2];
+    word = (word & ~(uintptr_t(3) << shift))
+           | (static_cast<uintptr_t>(geno) << shift);
+}
+/*!
+ * \brief Parse a list of sample indices (and optionally their genotypes)
+ * \param has_geno indicates if the genotypes are stored in the list
+ * \param entry is called with the sample index and the genotype (0 if the
+ * genotypes are not stored) of each entry
+ * \return the end of the list
+ */
+template <typename Entry>
+const uint8_t* parse_difflist(const uint8_t* ptr, const uint8_t* end,
+                              const uint32_t num_sample, const bool has_geno,
+                              Entry&& entry)
+{
+    const uint32_t length = read_varint(ptr, end);
+    if (!length) return ptr;
+    if (length > num_sample) malformed();
+    // the list is stored in groups of 64, each starting with the full sample
+    // index, followed by the deltas to the previous sample
+    uint32_t id_bytes = 1;
+    while (id_bytes < 4 && (num_sample >> (8 * id_bytes))) ++id_bytes;
+    const uint32_t num_group = (length + 63) / 64;
+    const uint32_t group_info_size = num_group * id_bytes + (num_group - 1);
+    const uint32_t geno_size = has_geno ? (length + 3) / 4 : 0;
+    if (static_cast<uint32_t>(end - ptr) < group_info_size + geno_size)
+        malformed();
+    const uint8_t* group_id = ptr;
+    const uint8_t* geno = ptr + group_info_size;
+    ptr = geno + geno_size;
+    uint32_t sample = 0;
+    for (uint32_t i = 0; i < length; ++i)
+    {
+        const uint32_t prev = sample;
+        if (i % 64 == 0) { sample = read_uint(group_id, geno, id_bytes); }
+        else
+        {
+            sample += read_varint(ptr, end);
+        }
+        if (sample >= num_sample || (i != 0 && sample <= prev)) malformed();
+        entry(sample, has_geno ? (geno[i / 4] >> (2 * (i % 4))) & 3u : 0u);
+    }
+    return ptr;
+}
+/*!
+ * \brief Convert the bit array of the one bit records to 2-bit genotypes
+ * \param bits is the bit array, one bit per sample
+ * \param low is the genotype of samples with the bit unset
+ * \param delta is the difference to the genotype of samples with the bit set
+ */
+inline void expand_one_bit(const uint8_t* bits, const uint32_t num_sample,
+                           const uint32_t low, const uint32_t delta,
+                           uintptr_t* genotype)
+{
+    static const std::array<uint16_t, 256> spread = [] {
+        std::array<uint16_t, 256> table {};
+        for (uint32_t byte = 0; byte < 256; ++byte)
+        {
+            for (uint32_t bit = 0; bit < 8; ++bit)
+            {
+                if (byte & (1u << bit))
+                { table[byte] |= static_cast<uint16_t>(1u << (2 * bit)); }
+            }
+        }
+        return table;
+    }();
+    const uint32_t base = low * 0x5555;
+    const uint32_t num_byte = (num_sample + 3) / 4;
+    uint8_t* out = reinterpret_cast<uint8_t*>(genotype);
+    for (uint32_t i = 0; i < num_byte; i += 2)
+    {
+        const uint32_t quarter = base + spread[bits[i / 2]] * delta;
+        out[i] = static_cast<uint8_t>(quarter);
+        if (i + 1 < num_byte) out[i + 1] = static_cast<uint8_t>(quarter >> 8);
+    }
+}
+/*!
+ * \brief Decode the hard calls of a variable width record
+ * \param ptr is the start of the record
+ * \param end is the end of the record
+ * \param vrtype is the type of the record
+ * \param num_sample is the number of sample in the file
+ * \param genotype is the output, must have QUATERCT_TO_WORDCT(num_sample)
+ * words. For LD compressed records, it must contain the hard calls of the
+ * LD base
+ * \return the end of the hard calls
+ */
+inline const uint8_t* decode_hardcall(const uint8_t* ptr, const uint8_t* end,
+                                      const uint8_t vrtype,
+                                      const uint32_t num_sample,
+                                      uintptr_t* genotype)
+{
+    const uint32_t num_word = QUATERCT_TO_WORDCT(num_sample);
+    const uint32_t num_byte = (num_sample + 3) / 4;
+    auto patch = [genotype](const uint32_t sample, const uint32_t geno) {
+        set_geno(genotype, sample, geno);
+    };
+    switch (vrtype & 7)
+    {
+    case 0:
+        if (static_cast<uint32_t>(end - ptr) < num_byte) malformed();
+        genotype[num_word - 1] = 0;
+        std::memcpy(genotype, ptr, num_byte);
+        ptr += num_byte;
+        break;
+    case 1:
+    {
+        const uint32_t bit_byte = (num_sample + 7) / 8;
+        if (static_cast<uint32_t>(end - ptr) < 1 + bit_byte) malformed();
+        const uint32_t code = *ptr++;
+        genotype[num_word - 1] = 0;
+        expand_one_bit(ptr, num_sample, code >> 2, code & 3, genotype);
+        ptr = parse_difflist(ptr + bit_byte, end, num_sample, true, patch);
+        break;
+    }
+    case 2:
+    case 3:
+        ptr = parse_difflist(ptr, end, num_sample, true, patch);
+        if (vrtype & 1)
+        {
+            // swap homozygous REF and homozygous ALT
+            for (uint32_t i = 0; i < num_word; ++i)
+            {
+                const uintptr_t word = genotype[i];
+                genotype[i] = word ^ ((~(word << 1)) & (FIVEMASK << 1));
+            }
+        }
+        break;
+    case 5: malformed(); break;
+    default:
+    {
+        // all samples have the same genotype, except those in the list
+        const uintptr_t fill = (vrtype & 3) * FIVEMASK;
+        std::fill(genotype, genotype + num_word, fill);
+        ptr = parse_difflist(ptr, end, num_sample, true, patch);
+        break;
+    }
+    }
+    // the trailing bits are zero, such that they don't affect the counts
+    if (num_sample % BITCT2)
+    {
+        genotype[num_word - 1] &=
+            (ONELU << (2 * (num_sample % BITCT2))) - ONELU;
+    }
+    return ptr;
+}
+/*!
+ * \brief Count the number of heterozygous samples
+ */
+inline uint32_t count_het(const uintptr_t* genotype, const uint32_t num_sample)
+{
+    uint32_t het = 0;
+    for (uint32_t i = 0; i < QUATERCT_TO_WORDCT(num_sample); ++i)
+    {
+        const uintptr_t word = genotype[i];
+        het += popcount_long(word & (~(word >> 1)) & FIVEMASK);
+    }
+    return het;
+}
+/*!
+ * \brief Set the dosage of each sample to its hard call
+ */
+inline void hardcall_dosage(const uintptr_t* genotype,
+                            const uint32_t num_sample,
+                            std::vector<uint16_t>& dosage)
+{
+    static const uint16_t hardcall_dose[4] = {0, dosage_unit, 2 * dosage_unit,
+                                              dosage_missing};
+    dosage.resize(num_sample);
+    for (uint32_t i = 0; i < num_sample; ++i)
+    { dosage[i] = hardcall_dose[get_geno(genotype, i)]; }
+}
+/*!
+ * \brief Decode a variable width record
+ * \param dosage is the dosage of each sample, or nullptr if only the hard
+ * calls are required
+ * \return the end of the hard calls, or the end of the dosage if \p dosage is
+ * provided
+ */
+inline const uint8_t* decode_record(const uint8_t* ptr, const uint8_t* end,
+                                    const uint8_t vrtype,
+                                    const uint32_t num_sample,
+                                    uintptr_t* genotype,
+                                    std::vector<uint16_t>* dosage)
+{
+    ptr = decode_hardcall(ptr, end, vrtype, num_sample, genotype);
+    if (dosage == nullptr) return ptr;
+    hardcall_dosage(genotype, num_sample, *dosage);
+    if (!(vrtype & 0x60)) return ptr;
+    uint16_t* dose = dosage->data();
+    // we only read variants with one ALT allele
+    if (vrtype & 0x08)
+    {
+        throw std::runtime_error(
+            "Error: Multi-allelic pgen records are not supported");
+    }
+    if (vrtype & 0x10)
+    {
+        // skip the phase of the heterozygous samples
+        const uint32_t het = count_het(genotype, num_sample);
+        const uint32_t phase_byte = (het + 8) / 8;
+        if (static_cast<uint32_t>(end - ptr) < phase_byte) malformed();
+        uint32_t skip = phase_byte;
+        if (ptr[0] & 1)
+        {
+            // only some heterozygous samples are phased
+            uint32_t phased = 0;
+            for (uint32_t i = 1; i <= het; ++i)
+            { phased += (ptr[i / 8] >> (i % 8)) & 1; }
+            skip += (phased + 7) / 8;
+            if (static_cast<uint32_t>(end - ptr) < skip) malformed();
+        }
+        ptr += skip;
+    }
+    auto read_dose = [&ptr, end]() {
+        if (end - ptr < 2) malformed();
+        const uint16_t value = static_cast<uint16_t>(ptr[0] | (ptr[1] << 8));
+        ptr += 2;
+        if (value > 2 * dosage_unit && value != dosage_missing) malformed();
+        return value;
+    };
+    switch (vrtype & 0x60)
+    {
+    case 0x20:
+    {
+        // list of samples with dosage, then their dosages
+        std::vector<uint32_t> present;
+        ptr = parse_difflist(ptr, end, num_sample, false,
+                             [&present](const uint32_t sample, uint32_t) {
+                                 present.push_back(sample);
+                             });
+        for (auto&& sample : present) dose[sample] = read_dose();
+        break;
+    }
+    case 0x40:
+        for (uint32_t i = 0; i < num_sample; ++i) dose[i] = read_dose();
+        break;
+    default:
+    {
+        // bit array of samples with dosage, then their dosages
+        const uint32_t bit_byte = (num_sample + 7) / 8;
+        if (static_cast<uint32_t>(end - ptr) < bit_byte) malformed();
+        const uint8_t* bits = ptr;
+        ptr += bit_byte;
+        for (uint32_t i = 0; i < num_sample; ++i)
+        {
+            if ((bits[i / 8] >> (i % 8)) & 1) dose[i] = read_dose();
+        }
+        break;
+    }
+    }
+    return ptr;
+}
+/*!
+ * \brief Convert PLINK 1 binary genotypes to pgen hard calls (in place)
+ */
+inline void from_plink1(uintptr_t* genotype, const uint32_t num_sample)
+{
+    for (uint32_t i = 0; i < QUATERCT_TO_WORDCT(num_sample); ++i)
+    {
+        const uintptr_t word = genotype[i];
+        genotype[i] = ((~word) & (FIVEMASK << 1))
+                      | (((word >> 1) ^ word) & FIVEMASK);
+    }
+    if (num_sample % BITCT2)
+    {
+        genotype[QUATERCT_TO_WORDCT(num_sample) - 1] &=
+            (ONELU << (2 * (num_sample % BITCT2))) - ONELU;
+    }
+}
+/*!
+ * \brief Convert pgen hard calls to PLINK 1 binary genotypes (in place),
+ * where the ALT allele is A1
+ */
+inline void to_plink1(uintptr_t* genotype, const uint32_t num_sample)
+{
+    for (uint32_t i = 0; i < QUATERCT_TO_WORDCT(num_sample); ++i)
+    {
+        const uintptr_t word = genotype[i];
+        genotype[i] = ((~word) & (FIVEMASK << 1))
+                      | ((~((word >> 1) ^ word)) & FIVEMASK);
+    }
+    if (num_sample % BITCT2)
+    {
+        genotype[QUATERCT_TO_WORDCT(num_sample) - 1] &=
+            (ONELU << (2 * (num_sample % BITCT2))) - ONELU;
+    }
+}
+
+/*!
+ * \brief Location and type of a pgen record
+ */
+struct Record
+{
+    unsigned long long fpos = 0;
+    uint32_t variant = 0;
+    uint32_t length = 0;
+    // the record that this record is LD compressed against
+    uint32_t ldbase = 0;
+    uint8_t vrtype = 0;
+};
+
+/*!
+ * \brief Header of a pgen file, containing the location and type of each
+ * record
+ */
+class Index
+{
+public:
+    /*!
+     * \brief Read the header of the pgen file
+     * \param name is the name of the pgen file
+     * \param num_sample is the number of sample in the .psam file
+     * \param num_variant is the number of variant in the .pvar file
+     */
+    void open(const std::string& name, const uint32_t num_sample,
+              const uint32_t num_variant)
+    {
+        std::ifstream pgen(name.c_str(), std::ios::binary);
+        if (!pgen.is_open())
+        { throw std::runtime_error("Error: Cannot open pgen file: " + name); }
+        pgen.seekg(0, pgen.end);
+        const unsigned long long file_size =
+            static_cast<unsigned long long>(pgen.tellg());
+        pgen.seekg(0, pgen.beg);
+        uint8_t header[12] = {0};
+        pgen.read(reinterpret_cast<char*>(header), sizeof(header));
+        const size_t header_read = static_cast<size_t>(pgen.gcount());
+        if (header_read < 3 || header[0] != 0x6c || header[1] != 0x1b)
+        { throw std::runtime_error("Error: Invalid pgen file: " + name); }
+        m_num_sample = num_sample;
+        m_num_variant = num_variant;
+        m_mode = header[2];
+        const unsigned long long geno_size = (num_sample + 3) / 4;
+        if (m_mode != plink1_mode)
+        {
+            const uint8_t* ptr = header + 3;
+            if (header_read < 11
+                || read_uint(ptr, header + 11, 4) != num_variant
+                || read_uint(ptr, header + 11, 4) != num_sample)
+            {
+                throw std::runtime_error(
+                    "Error: Number of variants or samples in " + name
+                    + " does not match the .pvar and .psam file");
+            }
+        }
+        switch (m_mode)
+        {
+        case plink1_mode:
+            m_first = 3;
+            m_record_size = geno_size;
+            break;
+        case fixed_hardcall_mode:
+            m_first = 11;
+            m_record_size = geno_size;
+            break;
+        case fixed_dosage_mode:
+            m_first = 11;
+            m_record_size = geno_size + 2ULL * num_sample;
+            break;
+        case variable_mode:
+            if (header_read < 12)
+            { throw std::runtime_error("Error: Invalid pgen file: " + name); }
+            read_variable_index(pgen, name, header[11], file_size);
+            return;
+        default:
+            throw std::runtime_error("Error: Unsupported pgen storage mode in "
+                                     + name);
+        }
+        if (file_size != m_first + m_record_size * num_variant)
+        {
+            throw std::runtime_error("Error: Invalid pgen file size for "
+                                     + name);
+        }
+    }
+    /*!
+     * \brief Only keep the location of the required variants (and the records
+     * they are LD compressed against) to save memory
+     * \param variants is the sorted list of required variants
+     */
+    void retain(const std::vector<uint32_t>& variants)
+    {
+        if (m_mode != variable_mode || m_fpos.empty()) return;
+        std::vector<uint32_t> required;
+        required.reserve(2 * variants.size());
+        for (auto&& variant : variants)
+        {
+            const uint32_t base = ldbase(variant);
+            if (base != variant) required.push_back(base);
+            required.push_back(variant);
+        }
+        std::sort(required.begin(), required.end());
+        required.erase(std::unique(required.begin(), required.end()),
+                       required.end());
+        m_records.clear();
+        m_records.reserve(required.size());
+        for (auto&& variant : required)
+        { m_records.push_back(full_record(variant)); }
+        std::vector<unsigned long long>().swap(m_fpos);
+        std::vector<uint8_t>().swap(m_vrtype);
+    }
+    /*!
+     * \brief Return the location and type of the record of the variant
+     */
+    Record record(const uint32_t variant) const
+    {
+        if (m_mode != variable_mode)
+        {
+            Record res;
+            res.fpos = m_first + m_record_size * variant;
+            res.variant = variant;
+            res.length = static_cast<uint32_t>(m_record_size);
+            res.ldbase = variant;
+            res.vrtype = (m_mode == fixed_dosage_mode) ? 0x40 : 0;
+            return res;
+        }
+        if (!m_fpos.empty()) return full_record(variant);
+        auto found = std::lower_bound(
+            m_records.begin(), m_records.end(), variant,
+            [](const Record& rec, uint32_t v) { return rec.variant < v; });
+        if (found == m_records.end() || found->variant != variant)
+        {
+            throw std::logic_error("Error: pgen record "
+                                   + std::to_string(variant)
+                                   + " is not indexed");
+        }
+        return *found;
+    }
+    bool plink1() const { return m_mode == plink1_mode; }
+    uint32_t num_sample() const { return m_num_sample; }
+    uint32_t num_variant() const { return m_num_variant; }
+
+private:
+    // location of each record and the end of the file, and type of each
+    // record. Only used until retain is called
+    std::vector<unsigned long long> m_fpos;
+    std::vector<uint8_t> m_vrtype;
+    std::vector<Record> m_records;
+    unsigned long long m_first = 0;
+    unsigned long long m_record_size = 0;
+    uint32_t m_num_sample = 0;
+    uint32_t m_num_variant = 0;
+    uint8_t m_mode = 0;
+    uint32_t ldbase(const uint32_t variant) const
+    {
+        uint32_t base = variant;
+        while (ld_compressed(m_vrtype[base]))
+        {
+            if (base == 0)
+            {
+                throw std::runtime_error(
+                    "Error: First pgen record cannot be LD compressed");
+            }
+            --base;
+        }
+        return base;
+    }
+    Record full_record(const uint32_t variant) const
+    {
+        Record res;
+        res.fpos = m_fpos[variant];
+        res.variant = variant;
+        res.length =
+            static_cast<uint32_t>(m_fpos[variant + 1] - m_fpos[variant]);
+        res.ldbase = ldbase(variant);
+        res.vrtype = m_vrtype[variant];
+        return res;
+    }
+    void read_variable_index(std::ifstream& pgen, const std::string& name,
+                             const uint8_t control,
+                             const unsigned long long file_size)
+    {
+        auto invalid = [&name]() {
+            throw std::runtime_error("Error: Invalid pgen file: " + name);
+        };
+        const uint32_t storage = control & 15;
+        if (storage >= 8)
+        {
+            throw std::runtime_error("Error: Unsupported pgen record index in "
+                                     + name);
+        }
+        const bool four_bit = storage < 4;
+        const uint32_t length_byte = (storage & 3) + 1;
+        const uint32_t allele_byte = (control >> 4) & 3;
+        const bool has_nonref = (control >> 6) == 3;
+        const uint32_t num_block =
+            (m_num_variant + vblock_size - 1) / vblock_size;
+        std::vector<unsigned long long> block_fpos(num_block);
+        pgen.read(reinterpret_cast<char*>(block_fpos.data()),
+                  static_cast<std::streamsize>(num_block * sizeof(uint64_t)));
+        if (!pgen) invalid();
+        m_fpos.resize(m_num_variant + 1ULL);
+        m_vrtype.resize(m_num_variant);
+        std::vector<uint8_t> buffer;
+        for (uint32_t block = 0; block < num_block; ++block)
+        {
+            const uint32_t start = block * vblock_size;
+            const uint32_t count =
+                std::min(vblock_size, m_num_variant - start);
+            const uint32_t vrtype_size = four_bit ? (count + 1) / 2 : count;
+            buffer.resize(vrtype_size + count * (length_byte + allele_byte)
+                          + (has_nonref ? (count + 7) / 8 : 0));
+            pgen.read(reinterpret_cast<char*>(buffer.data()),
+                      static_cast<std::streamsize>(buffer.size()));
+            if (!pgen) invalid();
+            const uint8_t* ptr = buffer.data();
+            const uint8_t* end = ptr + buffer.size();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                m_vrtype[start + i] =
+                    four_bit ? (ptr[i / 2] >> (4 * (i % 2))) & 15 : ptr[i];
+            }
+            ptr += vrtype_size;
+            unsigned long long fpos = block_fpos[block];
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                m_fpos[start + i] = fpos;
+                fpos += read_uint(ptr, end, length_byte);
+            }
+            if (block + 1 < num_block && fpos != block_fpos[block + 1])
+                invalid();
+            m_fpos[start + count] = fpos;
+        }
+        // the records start right after the index and end at the end of the
+        // file
+        const unsigned long long index_end =
+            static_cast<unsigned long long>(pgen.tellg());
+        if (!num_block) m_fpos.back() = index_end;
+        if ((num_block && block_fpos[0] != index_end)
+            || m_fpos.back() != file_size)
+        { invalid(); }
+    }
+};
+}
+
+#endif // PGEN_HPP
@@ -0,0 +1,160 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PREFETCHER_HPP
+#define PREFETCHER_HPP
+
+#include "memoryread.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <ios>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*!
+ * \brief Read ahead of fixed size genotype blocks on a separate I/O thread.
+ * The list of blocks must be known in advance, blocks are then read in order
+ * into a ring of word aligned buffers while the caller process the previous
+ * blocks
+ */
+class Prefetcher
+{
+public:
+    struct Request
+    {
+        size_t file_idx;
+        std::streampos byte_pos;
+    };
+    /*!
+     * \brief Start reading the requested blocks
+     * \param file_names is the name of the genotype files, indexed by the
+     * file_idx of the requests
+     * \param requests is the list of blocks, in the order they will be used
+     * \param block_size is the size of each block in bytes
+     * \param depth is the maximum number of blocks read ahead
+     */
+    Prefetcher(std::vector<std::string> file_names,
+               std::vector<Request> requests, const size_t block_size,
+               const size_t depth)
+        : m_file_names(std::move(file_names))
+        , m_requests(std::move(requests))
+        , m_block_size(block_size)
+        , m_depth(std::max(depth, size_t(2)))
+    {
+        const size_t block_words =
+            (block_size + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+        m_ring.resize(std::min(m_depth, std::max(m_requests.size(), size_t(1))),
+                      std::vector<uintptr_t>(block_words, 0));
+        m_depth = m_ring.size();
+        m_worker = std::thread(&Prefetcher::prefetch, this);
+    }
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+    ~Prefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond_space.notify_one();
+        if (m_worker.joinable()) m_worker.join();
+    }
+    /*!
+     * \brief Return the next block. The previous block returned will be
+     * reused for read ahead, so it must not be used afterward
+     * \return pointer to the block, with at least block_size bytes
+     */
+    const uintptr_t* next()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_returned >= m_requests.size())
+        { throw std::runtime_error("Error: Read beyond the prefetch list"); }
+        m_released = m_returned;
+        m_cond_space.notify_one();
+        m_cond_ready.wait(
+            lock, [this] { return m_produced > m_returned || m_error; });
+        if (m_produced <= m_returned) std::rethrow_exception(m_error);
+        return m_ring[m_returned++ % m_depth].data();
+    }
+    size_t size() const { return m_requests.size(); }
+
+private:
+    std::vector<std::string> m_file_names;
+    std::vector<Request> m_requests;
+    std::vector<std::vector<uintptr_t>> m_ring;
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_cond_ready;
+    std::condition_variable m_cond_space;
+    std::exception_ptr m_error;
+    size_t m_block_size;
+    size_t m_depth;
+    // number of block read by the I/O thread
+    size_t m_produced = 0;
+    // number of block returned to the caller
+    size_t m_returned = 0;
+    // number of block that can be overwritten
+    size_t m_released = 0;
+    bool m_stop = false;
+    void prefetch()
+    {
+        // use our own reader, as FileRead is not thread safe
+        FileRead reader;
+        std::vector<size_t> handles(m_file_names.size(), FileRead::npos);
+        try
+        {
+            for (size_t i = 0; i < m_requests.size(); ++i)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cond_space.wait(lock, [this, i] {
+                        return m_stop || i - m_released < m_depth;
+                    });
+                    if (m_stop) return;
+                }
+                // the slot is not used by the caller, no lock required
+                const Request& request = m_requests[i];
+                size_t& handle = handles[request.file_idx];
+                if (handle == FileRead::npos)
+                { handle = reader.open(m_file_names[request.file_idx]); }
+                reader.read(
+                    handle, request.byte_pos,
+                    static_cast<std::streampos>(m_block_size),
+                    reinterpret_cast<char*>(m_ring[i % m_depth].data()));
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    ++m_produced;
+                }
+                m_cond_ready.notify_one();
+            }
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_error = std::current_exception();
+            }
+            m_cond_ready.notify_one();
+        }
+    }
+};
+
+#endif // PREFETCHER_HPP
@@ -530,7 +530,11 @@ private:
             Pmat,
         const Eigen::MatrixXd& R, const bool run_glm);
 
-    void parse_pheno(const bool binary, const std::string& pheno,
+    /*!
+     * \brief Parse the phenotype of a sample and update the phenotype summary
+     * \return false if the phenotype is invalid
+     */
+    bool parse_pheno(const bool binary, const std::string& pheno,
                      std::vector<double>& pheno_store, double& first_pheno,
                      bool& more_than_one_pheno, size_t& num_case,
                      size_t& num_control, int& max_pheno_code);
@@ -0,0 +1,170 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RADIX_SORT_HPP
+#define RADIX_SORT_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+namespace radix
+{
+/*!
+ * \brief Pack multiple integer columns into as few 64 bit words as possible,
+ * using only the number of bits required by the largest value of each column
+ * \param columns are the sort keys, from the most to the least significant
+ * \return the packed keys, from the most to the least significant word
+ */
+inline std::vector<std::vector<uint64_t>>
+pack_keys(const std::vector<std::vector<uint64_t>>& columns)
+{
+    std::vector<std::vector<uint64_t>> words;
+    if (columns.empty()) return words;
+    const size_t num_item = columns.front().size();
+    size_t used_bits = 64;
+    // fill from the least significant column such that the most significant
+    // column ends up in the upper bits
+    for (auto column = columns.rbegin(); column != columns.rend(); ++column)
+    {
+        const uint64_t max_value =
+            column->empty() ? 0
+                            : *std::max_element(column->begin(), column->end());
+        size_t bits = 0;
+        while (bits < 64 && (max_value >> bits) != 0) ++bits;
+        if (bits == 0) continue;
+        if (used_bits + bits > 64)
+        {
+            words.emplace_back(num_item, 0);
+            used_bits = 0;
+        }
+        auto& word = words.back();
+        for (size_t i = 0; i < num_item; ++i)
+        { word[i] |= (*column)[i] << used_bits; }
+        used_bits += bits;
+    }
+    std::reverse(words.begin(), words.end());
+    return words;
+}
+
+/*!
+ * \brief Stable LSD radix sort of the index permutation by one 64 bit key.
+ * Digits where all keys are identical are skipped, so small keys only need
+ * one or two passes
+ * \param order is the permutation to sort, sorted in place
+ * \param key is the key of each item, indexed by the item (not the position
+ * in order)
+ * \param thread is the number of thread to use
+ */
+inline void sort_by_key(std::vector<size_t>& order,
+                        const std::vector<uint64_t>& key, size_t thread)
+{
+    constexpr size_t radix_bits = 8;
+    constexpr size_t num_bucket = 1 << radix_bits;
+    const size_t num_item = order.size();
+    if (num_item < 2) return;
+    // too much overhead to start threads for small input
+    if (num_item < (1 << 16)) thread = 1;
+    thread = std::max(size_t(1), std::min(thread, num_item));
+    // carry the keys along with the index to avoid random access
+    std::vector<uint64_t> cur_key(num_item), next_key(num_item);
+    std::vector<size_t> next_order(num_item);
+    uint64_t all_or = 0, all_and = ~uint64_t(0);
+    for (size_t i = 0; i < num_item; ++i)
+    {
+        cur_key[i] = key[order[i]];
+        all_or |= cur_key[i];
+        all_and &= cur_key[i];
+    }
+    // bits that differ between the keys
+    const uint64_t varying = all_or ^ all_and;
+    std::vector<std::array<size_t, num_bucket>> count(thread);
+    std::vector<std::thread> workers;
+    const size_t job_size = num_item / thread;
+    auto chunk_start = [job_size](size_t i) { return i * job_size; };
+    auto chunk_end = [job_size, thread, num_item](size_t i) {
+        return i + 1 == thread ? num_item : (i + 1) * job_size;
+    };
+    for (size_t shift = 0; shift < 64; shift += radix_bits)
+    {
+        if (((varying >> shift) & (num_bucket - 1)) == 0) continue;
+        auto histogram = [&](size_t i_thread) {
+            auto& cur_count = count[i_thread];
+            cur_count.fill(0);
+            for (size_t i = chunk_start(i_thread); i < chunk_end(i_thread); ++i)
+            { ++cur_count[(cur_key[i] >> shift) & (num_bucket - 1)]; }
+        };
+        auto scatter = [&](size_t i_thread) {
+            auto& offset = count[i_thread];
+            for (size_t i = chunk_start(i_thread); i < chunk_end(i_thread); ++i)
+            {
+                const size_t dest =
+                    offset[(cur_key[i] >> shift) & (num_bucket - 1)]++;
+                next_key[dest] = cur_key[i];
+                next_order[dest] = order[i];
+            }
+        };
+        auto run = [&](auto& job) {
+            workers.clear();
+            for (size_t i_thread = 1; i_thread < thread; ++i_thread)
+            { workers.emplace_back(job, i_thread); }
+            job(0);
+            for (auto&& w : workers) w.join();
+        };
+        run(histogram);
+        // convert the counts into the starting offset of each thread within
+        // each bucket. Earlier chunks come first, which keeps the sort stable
+        size_t total = 0;
+        for (size_t bucket = 0; bucket < num_bucket; ++bucket)
+        {
+            for (size_t i_thread = 0; i_thread < thread; ++i_thread)
+            {
+                const size_t cur = count[i_thread][bucket];
+                count[i_thread][bucket] = total;
+                total += cur;
+            }
+        }
+        run(scatter);
+        cur_key.swap(next_key);
+        order.swap(next_order);
+    }
+}
+
+/*!
+ * \brief Return the permutation that stably sort the items by the key
+ * columns
+ * \param columns are the sort keys, from the most to the least significant
+ * \param thread is the number of thread to use
+ * \return the sorted permutation
+ */
+inline std::vector<size_t>
+sort_index(const std::vector<std::vector<uint64_t>>& columns,
+           const size_t thread)
+{
+    std::vector<size_t> order(columns.empty() ? 0 : columns.front().size());
+    std::iota(order.begin(), order.end(), 0);
+    auto words = pack_keys(columns);
+    // LSD, sort by the least significant word first
+    for (auto word = words.rbegin(); word != words.rend(); ++word)
+    { sort_by_key(order, *word, thread); }
+    return order;
+}
+} // namespace radix
+
+#endif // RADIX_SORT_HPP
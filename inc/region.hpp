@@ -52,7 +52,14 @@ public:
      * \brief Default constructor that do nothing
      */
     Region() {}
-    Region(const GeneSets& set, Reporter* reporter)
+    /*!
+     * \brief Constructor of Region
+     * \param set contains all the set information
+     * \param reporter is the logger
+     * \param thread is the number of thread allowed for reading compressed
+     * GTF file
+     */
+    Region(const GeneSets& set, Reporter* reporter, const size_t thread = 1)
         : m_bed(set.bed)
         , m_feature(set.feature)
         , m_msigdb(set.msigdb)
@@ -61,6 +68,7 @@ public:
         , m_gtf(set.gtf)
         , m_window_5(set.wind_5)
         , m_window_3(set.wind_3)
+        , m_thread(thread)
         , m_genome_wide_background(set.full_as_background)
         , m_reporter(reporter)
     {
@@ -68,6 +76,14 @@ public:
     virtual ~Region();
     static void generate_exclusion(std::vector<IITree<size_t, size_t>>& cr,
                                    const std::string& exclusion_range);
+    /*!
+     * \brief Exclude every chromosome except \p chr such that only SNPs on
+     * \p chr are processed
+     * \param cr is the exclusion region
+     * \param chr is the chromosome to keep
+     */
+    static void restrict_to_chromosome(std::vector<IITree<size_t, size_t>>& cr,
+                                       const std::string& chr);
     size_t generate_regions(const size_t max_chr);
     std::vector<std::string> get_names() const { return m_region_name; }
 
@@ -112,35 +128,24 @@ protected:
                                      + std::string(strand));
         }
     }
-    static void start_end(std::string_view start_str, std::string_view end_str,
-                          const size_t pad, size_t& start, size_t& end)
-    {
-        start_end(std::string(start_str), std::string(end_str), pad, start,
-                  end);
-    }
-
     static void start_end(const std::string& start_str,
                           const std::string& end_str, const size_t pad,
                           size_t& start, size_t& end)
     {
-        try
-        {
-            // That's because bed is 0 based and range format is 1
-            // based. and type for bed is 1 and type for range is 0
-            start = misc::Convertor::convert<size_t>(start_str) + pad;
-        }
-        catch (...)
-        {
-            throw std::runtime_error("start");
-        }
-        try
-        {
-            end = misc::Convertor::convert<size_t>(end_str);
-        }
-        catch (...)
-        {
-            throw std::runtime_error("end ");
-        }
+        start_end(std::string_view(start_str), std::string_view(end_str), pad,
+                  start, end);
+    }
+
+    static void start_end(std::string_view start_str, std::string_view end_str,
+                          const size_t pad, size_t& start, size_t& end)
+    {
+        // That's because bed is 0 based and range format is 1
+        // based. and type for bed is 1 and type for range is 0
+        if (!misc::parse_value(start_str, start))
+        { throw std::runtime_error("start"); }
+        start += pad;
+        if (!misc::parse_value(end_str, end))
+        { throw std::runtime_error("end "); }
         if (start > end)
         {
             // don't check if it's already error out
@@ -331,6 +336,7 @@ protected:
     std::string m_gtf;
     size_t m_window_5 = 0;
     size_t m_window_3 = 0;
+    size_t m_thread = 1;
     bool m_genome_wide_background;
     bool m_printed_bed_strand_warning = false;
     Reporter* m_reporter;
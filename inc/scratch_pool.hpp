@@ -0,0 +1,107 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SCRATCH_POOL_HPP
+#define SCRATCH_POOL_HPP
+
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/*!
+ * \brief Thread safe pool of scratch objects. Each thread acquire its own
+ * object for the duration of a call and return it to the pool afterward,
+ * such that the buffers inside are reused instead of reallocated
+ */
+template <typename T>
+class ScratchPool
+{
+public:
+    /*!
+     * \brief Handle to an object taken from the pool. The object is returned
+     * to the pool when the lease is destroyed
+     */
+    class Lease
+    {
+    public:
+        Lease(ScratchPool* pool, std::unique_ptr<T> item)
+            : m_pool(pool), m_item(std::move(item))
+        {
+        }
+        Lease(Lease&& other) noexcept = default;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease()
+        {
+            if (m_item) m_pool->release(std::move(m_item));
+        }
+        T& operator*() const { return *m_item; }
+        T* operator->() const { return m_item.get(); }
+
+    private:
+        ScratchPool* m_pool;
+        std::unique_ptr<T> m_item;
+    };
+    ScratchPool() {}
+    ScratchPool(const ScratchPool&) = delete;
+    ScratchPool& operator=(const ScratchPool&) = delete;
+    /*!
+     * \brief Take an idle object from the pool, or create a new one if all
+     * of them are in use
+     */
+    Lease acquire()
+    {
+        std::unique_ptr<T> item;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_idle.empty())
+            {
+                item = std::move(m_idle.back());
+                m_idle.pop_back();
+            }
+        }
+        if (!item) item.reset(new T());
+        return Lease(this, std::move(item));
+    }
+    /*!
+     * \brief Return the number of idle objects in the pool
+     */
+    size_t idle() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_idle.size();
+    }
+    /*!
+     * \brief Free all idle objects
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_idle.clear();
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<T>> m_idle;
+    void release(std::unique_ptr<T> item)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_idle.push_back(std::move(item));
+    }
+};
+
+#endif // SCRATCH_POOL_HPP
@@ -22,11 +22,14 @@
 #include "misc.hpp"
 #include "plink_common.hpp"
 #include "storage.hpp"
+#include "string_index.hpp"
 #include <algorithm>
+#include <cstdint>
 #include <limits.h>
 #include <numeric>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 static_assert(sizeof(std::streamsize) <= sizeof(unsigned long long),
               "streampos larger than long long, don't know how to proceed. "
               "Please use PRSice on another machine");
@@ -34,14 +37,24 @@ class Genotype;
 class SNP
 {
 public:
+    // codes of alleles that are not SNVs
+    static constexpr uint8_t ALLELE_EMPTY = 4;
+    static constexpr uint8_t ALLELE_OTHER = 5;
     SNP() {}
-    SNP(const std::string& rs_id, const size_t chr, const size_t loc,
-        const std::string& ref_allele, const std::string& alt_allele,
-        const double& stat, const double& p_value,
+    /*!
+     * \brief Constructor of SNP. The ID and alleles are copied into arena,
+     * which must outlive the SNP (usually the arena of the Genotype holding
+     * the SNP)
+     */
+    SNP(StringArena& arena, std::string_view rs_id, const size_t chr,
+        const size_t loc, std::string_view ref_allele,
+        std::string_view alt_allele, const double& stat, const double& p_value,
         const unsigned long long category, const double p_threshold)
-        : m_alt(alt_allele)
-        , m_ref(ref_allele)
-        , m_rs(rs_id)
+        : m_alt(arena.intern(alt_allele))
+        , m_ref(arena.intern(ref_allele))
+        , m_rs(arena.store(rs_id))
+        , m_ref_code(encode_allele(ref_allele))
+        , m_alt_code(encode_allele(alt_allele))
         , m_stat(stat)
         , m_p_value(p_value)
         , m_p_threshold(p_threshold)
@@ -72,10 +85,11 @@ public:
             m_flipped = flip;
         }
     }
-    void add_snp_info(const size_t& idx, const std::streampos byte_pos,
-                      const size_t chr, const size_t loc,
-                      const std::string& ref, const std::string& alt,
-                      const bool flipping, const bool is_ref)
+    void add_snp_info(StringArena& arena, const size_t& idx,
+                      const std::streampos byte_pos, const size_t chr,
+                      const size_t loc, const std::string& ref,
+                      const std::string& alt, const bool flipping,
+                      const bool is_ref)
     {
         if (!is_ref)
         {
@@ -84,8 +98,10 @@ public:
             m_chr = chr;
             m_loc = loc;
             m_flipped = flipping;
-            m_ref = ref;
-            m_alt = alt;
+            m_ref = arena.intern(ref);
+            m_alt = arena.intern(alt);
+            m_ref_code = encode_allele(ref);
+            m_alt_code = encode_allele(alt);
         }
         else
         {
@@ -104,6 +120,50 @@ public:
      */
     static std::vector<size_t> sort_by_p_chr(const std::vector<SNP>& input);
 
+    /*!
+     * \brief Encode an allele into a small integer. SNVs are encoded such
+     * that the complement of code c is c ^ 3
+     * \param allele is the allele, should be in upper case
+     * \return the code of the allele
+     */
+    static uint8_t encode_allele(std::string_view allele)
+    {
+        if (allele.empty()) return ALLELE_EMPTY;
+        if (allele.size() != 1) return ALLELE_OTHER;
+        switch (allele.front())
+        {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return ALLELE_OTHER;
+        }
+    }
+    /*!
+     * \brief Generate the 64 bit key of a variant for position based
+     * matching. Upper 16 bits are the chromosome, followed by 40 bits of
+     * coordinate and 8 bits of allele code which is identical for the same
+     * SNV regardless of strand and allele order (0xFF for all other
+     * variants)
+     * \return the key, ~0 if the variant cannot be represented
+     */
+    static uint64_t position_key(const size_t chr, const size_t loc,
+                                 std::string_view ref, std::string_view alt)
+    {
+        if (chr >= (size_t(1) << 16) || loc >= (uint64_t(1) << 40))
+            return ~uint64_t(0);
+        const uint8_t a = encode_allele(ref), b = encode_allele(alt);
+        uint64_t allele_key = 0xFF;
+        if (a < ALLELE_EMPTY && b < ALLELE_EMPTY)
+        {
+            const uint8_t ca = a ^ 3, cb = b ^ 3;
+            allele_key = std::min({(a << 2) | b, (b << 2) | a,
+                                   (ca << 2) | cb, (cb << 2) | ca});
+        }
+        return (static_cast<uint64_t>(chr) << 48)
+               | (static_cast<uint64_t>(loc) << 8) | allele_key;
+    }
+
     /*!
      * \brief Compare the current SNP with another SNP
      * \param chr is the chromosome encoding of the other SNP
@@ -114,8 +174,8 @@ public:
      * flipped = true
      * \return true if it is a match
      */
-    inline bool matching(size_t chr, size_t loc, std::string& ref,
-                         std::string& alt, bool& flipped)
+    inline bool matching(size_t chr, size_t loc, std::string_view ref,
+                         std::string_view alt, bool& flipped) const
     {
         // should be trimmed
         if (chr != ~size_t(0) && m_chr != ~size_t(0) && chr != m_chr)
@@ -123,6 +183,13 @@ public:
         if (loc != ~size_t(0) && m_loc != ~size_t(0) && loc != m_loc)
         { return false; }
         flipped = false;
+        const uint8_t ref_code = encode_allele(ref);
+        const uint8_t alt_code = encode_allele(alt);
+        // SNVs can be matched with integer operations, only indels and other
+        // long alleles need the string comparison
+        if (m_ref_code < ALLELE_EMPTY && ref_code < ALLELE_EMPTY
+            && m_alt_code != ALLELE_OTHER && alt_code != ALLELE_OTHER)
+        { return matching_code(ref_code, alt_code, flipped); }
         if (m_ref == ref)
         {
             if (!m_alt.empty() && !alt.empty()) { return (m_alt == alt); }
@@ -223,9 +290,9 @@ public:
         return is_ref ? m_reference.byte_pos : m_target.byte_pos;
     }
 
-    std::string rs() const { return m_rs; }
-    std::string ref() const { return m_ref; }
-    std::string alt() const { return m_alt; }
+    std::string_view rs() const { return m_rs; }
+    std::string_view ref() const { return m_ref; }
+    std::string_view alt() const { return m_alt; }
     bool is_flipped() const { return m_flipped; }
     bool is_ref_flipped() const { return m_ref_flipped; }
 
@@ -266,9 +333,25 @@ public:
     {
         // if the target is already clumped, we will do nothing
         if (target.clumped()) return;
-        // we need to check if the target SNP is completely clumped (e.g. no
-        // longer representing any set)
-        bool target_clumped = true;
+        // if the target SNP no longer represent any gene set, it is
+        // considered as clumped and can be removed
+        if (clump_flags(target, r2, use_proxy, proxy)) target.set_clumped();
+        m_clump_info.clumped = true;
+        // protect from other SNPs tempering its flags
+    }
+
+    /*!
+     * \brief Update the set membership of the current and target SNP as in
+     * clump, without touching the clump status of either SNP, such that the
+     * caller can keep track of the clump status by itself
+     * \param target is the target SNP
+     * \param r2 is the observed R2
+     * \param use_proxy indicate if we want to perform proxy clump
+     * \param proxy is the threshold for proxy clumping
+     * \return true if the target SNP is completely clumped
+     */
+    bool clump_flags(SNP& target, double r2, bool use_proxy, double proxy = 2)
+    {
         // if we want to use proxy, and that our r2 is higher than
         // the proxy threshold, we will do the proxy clumping
         // and the index SNP will get all membership (or) from the clumped
@@ -279,38 +362,29 @@ public:
             {
                 m_clump_info.flags[i_flag] |= target.m_clump_info.flags[i_flag];
             }
-            target_clumped = true;
-        }
-        else
-        {
-            for (size_t i_flag = 0; i_flag < m_clump_info.max_flag_idx;
-                 ++i_flag)
-            {
-                // For normal clumping, we will remove set identity from the
-                // target SNP whenever both SNPs are within the same set.
-                // i.e. if flag of SNP A (current) is 11011 and SNP B (target)
-                // is 11110, by the end of clumping, it will become SNP A
-                // =11011, SNP B = 00100
-                // bit operation meaning:
-                // ~m_clump_info = not in index
-                // target.m_clump_info & ~m_clump_info = retain bit that are not
-                // found in index
-                target.m_clump_info.flags[i_flag] =
-                    target.m_clump_info.flags[i_flag]
-                    & ~m_clump_info.flags[i_flag];
-                // if all flags of the target SNP == 0, it means that it no
-                // longer represent any gene set and is consided as "clumped"
-                target_clumped &= (target.m_clump_info.flags[i_flag] == 0);
-            }
+            return true;
         }
-        if (target_clumped)
+        // we need to check if the target SNP is completely clumped (e.g. no
+        // longer representing any set)
+        bool target_clumped = true;
+        for (size_t i_flag = 0; i_flag < m_clump_info.max_flag_idx; ++i_flag)
         {
-            // if the target SNP no longer represent any gene set, it is
-            // considered as clumped and can be removed
-            target.set_clumped();
+            // For normal clumping, we will remove set identity from the
+            // target SNP whenever both SNPs are within the same set.
+            // i.e. if flag of SNP A (current) is 11011 and SNP B (target)
+            // is 11110, by the end of clumping, it will become SNP A
+            // =11011, SNP B = 00100
+            // bit operation meaning:
+            // ~m_clump_info = not in index
+            // target.m_clump_info & ~m_clump_info = retain bit that are not
+            // found in index
+            target.m_clump_info.flags[i_flag] =
+                target.m_clump_info.flags[i_flag] & ~m_clump_info.flags[i_flag];
+            // if all flags of the target SNP == 0, it means that it no
+            // longer represent any gene set and is consided as "clumped"
+            target_clumped &= (target.m_clump_info.flags[i_flag] == 0);
         }
-        m_clump_info.clumped = true;
-        // protect from other SNPs tempering its flags
+        return target_clumped;
     }
 
     /*!
@@ -430,9 +504,12 @@ private:
     FileInfo m_reference;
     SNPClump m_clump_info;
     std::vector<uintptr_t> m_genotype;
-    std::string m_alt;
-    std::string m_ref;
-    std::string m_rs;
+    // IDs and alleles are stored in the string arena to avoid millions of
+    // small heap allocations. Alleles are interned as they are mostly
+    // identical
+    std::string_view m_alt;
+    std::string_view m_ref;
+    std::string_view m_rs;
     double m_stat = 0.0;
     double m_p_value = 2.0;
     double m_p_threshold = 0;
@@ -441,13 +518,32 @@ private:
     size_t m_chr = ~size_t(0);
     size_t m_loc = ~size_t(0);
     unsigned long long m_category = 0;
+    uint8_t m_ref_code = ALLELE_EMPTY;
+    uint8_t m_alt_code = ALLELE_EMPTY;
     bool m_has_expected = false;
     bool m_has_ref_expected = false;
     bool m_flipped = false;
     bool m_ref_flipped = false;
     bool m_is_valid = true;
 
-    inline std::string complement(const std::string& allele) const
+    /*!
+     * \brief SNV version of matching, where the reference alleles are SNVs
+     * and the alternative alleles are either SNVs or empty
+     */
+    inline bool matching_code(const uint8_t ref, const uint8_t alt,
+                              bool& flipped) const
+    {
+        const bool has_alt =
+            (m_alt_code != ALLELE_EMPTY && alt != ALLELE_EMPTY);
+        if (m_ref_code == ref) { return !has_alt || m_alt_code == alt; }
+        if ((m_ref_code ^ 3) == ref)
+        { return !has_alt || (m_alt_code ^ 3) == alt; }
+        if (!has_alt) return false;
+        flipped = (m_ref_code == alt && m_alt_code == ref)
+                  || ((m_ref_code ^ 3) == alt && (m_alt_code ^ 3) == ref);
+        return flipped;
+    }
+    inline std::string_view complement(std::string_view allele) const
     {
         // assume capitalized
         if (allele == "A") return "T";
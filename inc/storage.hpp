@@ -72,6 +72,8 @@ struct BaseFile
     // use int as vector<bool> is abnormal
     std::vector<int> has_column = std::vector<int>(+BASE_INDEX::MAX + 1, false);
     std::string file_name;
+    // binary cache of the filtered base SNPs, empty if not used
+    std::string cache_file;
     int is_index = false;
     int is_beta = false;
     int is_or = false;
@@ -83,6 +85,7 @@ struct GenoFile
     std::string file_list;
     std::string keep;
     std::string remove;
+    std::string freq_count;
     std::string type = "bed";
     int num_autosome = 22;
     int hard_coded = false;
@@ -131,6 +134,43 @@ struct SNPClump
     bool clumped = false;
 };
 
+/*!
+ * \brief Columnar copy of the SNP fields used by the hot loops (clumping
+ * window, clumping and scoring). Row i correspond to m_existed_snps[i], so
+ * these loops only stream through a few bytes per SNP instead of the whole
+ * SNP object
+ */
+struct VariantTable
+{
+    std::vector<double> p_value;
+    std::vector<double> threshold;
+    std::vector<unsigned long long> category;
+    std::vector<size_t> chr;
+    std::vector<size_t> loc;
+    std::vector<size_t> low_bound;
+    std::vector<size_t> up_bound;
+    std::vector<FileInfo> target;
+    std::vector<FileInfo> reference;
+    size_t size() const { return p_value.size(); }
+    void resize(const size_t num_snp)
+    {
+        p_value.resize(num_snp);
+        threshold.resize(num_snp);
+        category.resize(num_snp);
+        chr.resize(num_snp);
+        loc.resize(num_snp);
+        low_bound.resize(num_snp);
+        up_bound.resize(num_snp);
+        target.resize(num_snp);
+        reference.resize(num_snp);
+    }
+    void clear()
+    {
+        // swap to release the memory
+        *this = VariantTable();
+    }
+};
+
 struct AlleleCounts
 {
     size_t homcom = 0;
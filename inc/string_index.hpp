@@ -0,0 +1,212 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef STRING_INDEX_HPP
+#define STRING_INDEX_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/*!
+ * \brief Open addressing hash table mapping a string to an index. Only the
+ * view of the key is stored, so the key must outlive the index (e.g. stored
+ * in a StringArena or in the SNP vector)
+ */
+class StringIndex
+{
+public:
+    static constexpr size_t npos = ~size_t(0);
+    StringIndex() {}
+    /*!
+     * \brief Make sure we can store num_key keys without rehashing
+     */
+    void reserve(const size_t num_key)
+    {
+        size_t capacity = 16;
+        while (capacity < num_key * 2) capacity <<= 1;
+        if (capacity > m_slots.size()) rehash(capacity);
+    }
+    /*!
+     * \brief Insert key into the index, existing key will not be updated
+     * \param key is the key to insert. Must outlive the index
+     * \param value is the value of the key
+     * \return true if the key was inserted, false if it already exists
+     */
+    bool insert(std::string_view key, const size_t value)
+    {
+        if ((m_size + 1) * 2 > m_slots.size())
+        { rehash(m_slots.empty() ? 16 : m_slots.size() * 2); }
+        const size_t hash = std::hash<std::string_view>()(key);
+        Slot& slot = m_slots[probe(key, hash)];
+        if (slot.data != nullptr) return false;
+        // null data is used to mark empty slots
+        slot.data = key.data() == nullptr ? "" : key.data();
+        slot.length = static_cast<uint32_t>(key.size());
+        slot.hash = upper_hash(hash);
+        slot.value = value;
+        ++m_size;
+        return true;
+    }
+    /*!
+     * \brief Return the value of the key
+     * \return value of the key. npos if key is not found
+     */
+    size_t find(std::string_view key) const
+    {
+        if (m_size == 0) return npos;
+        const Slot& slot =
+            m_slots[probe(key, std::hash<std::string_view>()(key))];
+        return slot.data == nullptr ? npos : slot.value;
+    }
+    bool contains(std::string_view key) const
+    {
+        if (m_size == 0) return false;
+        return m_slots[probe(key, std::hash<std::string_view>()(key))].data
+               != nullptr;
+    }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    void clear()
+    {
+        m_slots.clear();
+        m_slots.shrink_to_fit();
+        m_size = 0;
+    }
+
+private:
+    // keep the slot small so that probing stays within the cache line. Upper
+    // bits of the hash are stored to avoid comparing most of the strings
+    struct Slot
+    {
+        const char* data = nullptr;
+        uint32_t length = 0;
+        uint32_t hash = 0;
+        size_t value = npos;
+    };
+    std::vector<Slot> m_slots;
+    size_t m_size = 0;
+    static uint32_t upper_hash(const size_t hash)
+    {
+        return static_cast<uint32_t>(hash >> (sizeof(size_t) * 4));
+    }
+    /*!
+     * \brief Linear probing for the slot of the key
+     * \return index of the slot containing the key, or the empty slot where
+     * the key should be inserted
+     */
+    size_t probe(std::string_view key, const size_t hash) const
+    {
+        const size_t mask = m_slots.size() - 1;
+        const uint32_t upper = upper_hash(hash);
+        size_t idx = hash & mask;
+        while (true)
+        {
+            const Slot& slot = m_slots[idx];
+            if (slot.data == nullptr
+                || (slot.hash == upper && slot.length == key.size()
+                    && std::memcmp(slot.data, key.data(), key.size()) == 0))
+            { return idx; }
+            idx = (idx + 1) & mask;
+        }
+    }
+    void rehash(const size_t capacity)
+    {
+        std::vector<Slot> old(capacity);
+        old.swap(m_slots);
+        const size_t mask = capacity - 1;
+        for (auto&& slot : old)
+        {
+            if (slot.data == nullptr) continue;
+            const size_t hash = std::hash<std::string_view>()(
+                std::string_view(slot.data, slot.length));
+            size_t idx = hash & mask;
+            while (m_slots[idx].data != nullptr) idx = (idx + 1) & mask;
+            m_slots[idx] = slot;
+        }
+    }
+};
+
+/*!
+ * \brief Append only storage for strings. Strings are stored back to back in
+ * large blocks, which avoid the per string heap allocation of std::string and
+ * views to the stored strings remain valid for the life time of the arena.
+ * Not thread safe, only one thread can store strings at a time
+ */
+class StringArena
+{
+public:
+    StringArena() {}
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+    /*!
+     * \brief Copy the string into the arena
+     * \return view of the stored string
+     */
+    std::string_view store(std::string_view str)
+    {
+        return append(str);
+    }
+    /*!
+     * \brief Same as store, but identical strings are only stored once. Use
+     * for strings with few distinct values (e.g. alleles)
+     * \return view of the stored string
+     */
+    std::string_view intern(std::string_view str)
+    {
+        if (str.empty()) return std::string_view();
+        const size_t idx = m_interned_index.find(str);
+        if (idx != StringIndex::npos) return m_interned[idx];
+        std::string_view stored = append(str);
+        m_interned_index.insert(stored, m_interned.size());
+        m_interned.push_back(stored);
+        return stored;
+    }
+
+private:
+    static constexpr size_t m_block_size = 1 << 20;
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    std::vector<std::unique_ptr<char[]>> m_large;
+    std::vector<std::string_view> m_interned;
+    StringIndex m_interned_index;
+    size_t m_used = m_block_size;
+    std::string_view append(std::string_view str)
+    {
+        if (str.empty()) return std::string_view();
+        if (str.size() > m_block_size / 4)
+        {
+            // long strings get their own block such that we don't waste the
+            // remaining space of the current block
+            m_large.emplace_back(new char[str.size()]);
+            std::memcpy(m_large.back().get(), str.data(), str.size());
+            return std::string_view(m_large.back().get(), str.size());
+        }
+        if (m_used + str.size() > m_block_size)
+        {
+            m_blocks.emplace_back(new char[m_block_size]);
+            m_used = 0;
+        }
+        char* dest = m_blocks.back().get() + m_used;
+        std::memcpy(dest, str.data(), str.size());
+        m_used += str.size();
+        return std::string_view(dest, str.size());
+    }
+};
+
+#endif // STRING_INDEX_HPP
@@ -0,0 +1,162 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * \brief Persistent pool of worker threads, such that we don't need to start
+ * new threads for every batch of work. A batch is started with start and the
+ * caller is free to do other work until it calls wait, which also help the
+ * workers with the remaining tasks. Only one batch can run at a time
+ */
+class WorkerPool
+{
+public:
+    /*!
+     * \brief Constructor of WorkerPool
+     * \param num_thread is the total number of thread, including the calling
+     * thread
+     */
+    explicit WorkerPool(const size_t num_thread)
+    {
+        for (size_t i = 1; i < num_thread; ++i)
+        { m_workers.emplace_back(&WorkerPool::work, this); }
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond_task.notify_all();
+        for (auto&& worker : m_workers) worker.join();
+    }
+    size_t num_thread() const { return m_workers.size() + 1; }
+    /*!
+     * \brief Start running task(i) for i from 0 to num_task (exclusive) on
+     * the workers. Return without waiting for the tasks to finish
+     */
+    void start(const size_t num_task, std::function<void(size_t)> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = std::move(task);
+            m_num_task = num_task;
+            m_next_task = 0;
+            m_finished = 0;
+            m_error = nullptr;
+            m_error_idx = num_task;
+        }
+        m_cond_task.notify_all();
+    }
+    /*!
+     * \brief Wait for the current batch to finish. If any of the task failed,
+     * the error of the task with the smallest index is thrown, such that the
+     * error doesn't depend on the number of thread
+     */
+    void wait()
+    {
+        std::exception_ptr error = finish();
+        if (error) std::rethrow_exception(error);
+    }
+    /*!
+     * \brief Wait for the current batch to finish and ignore any error. Used
+     * when the caller is already handling another error
+     */
+    void drain() { finish(); }
+
+private:
+    std::vector<std::thread> m_workers;
+    std::function<void(size_t)> m_task;
+    std::exception_ptr m_error;
+    std::mutex m_mutex;
+    std::condition_variable m_cond_task;
+    std::condition_variable m_cond_done;
+    size_t m_num_task = 0;
+    size_t m_next_task = 0;
+    size_t m_finished = 0;
+    size_t m_error_idx = 0;
+    bool m_stop = false;
+    std::exception_ptr finish()
+    {
+        // help the workers instead of idling
+        while (run_next()) {}
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond_done.wait(lock, [this] { return m_finished == m_num_task; });
+        m_task = nullptr;
+        std::exception_ptr error = m_error;
+        m_error = nullptr;
+        return error;
+    }
+    /*!
+     * \brief Run the next task of the current batch
+     * \return false if all tasks were already taken
+     */
+    bool run_next()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_next_task == m_num_task) return false;
+        const size_t idx = m_next_task++;
+        lock.unlock();
+        std::exception_ptr error;
+        try
+        {
+            m_task(idx);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && idx < m_error_idx)
+        {
+            m_error = error;
+            m_error_idx = idx;
+        }
+        if (++m_finished == m_num_task)
+        {
+            lock.unlock();
+            m_cond_done.notify_all();
+        }
+        return true;
+    }
+    void work()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond_task.wait(lock, [this] {
+                    return m_stop || m_next_task < m_num_task;
+                });
+                if (m_stop) return;
+            }
+            run_next();
+        }
+    }
+};
+
+#endif // WORKER_POOL_HPP
@@ -0,0 +1,92 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ZSTDSTREAM_HPP
+#define ZSTDSTREAM_HPP
+
+// zstd is optional, only available if the library is found during
+// configuration
+#ifdef USE_ZSTD
+#include <istream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <zstd.h>
+
+/*!
+ * \brief Read only stream buffer for zstd compressed files. The input is
+ * decoded in a streaming fashion, so it works for files of any size and
+ * files with multiple concatenated frames
+ */
+class ZSTDReader : public std::streambuf
+{
+public:
+    /*!
+     * \brief Constructor of ZSTDReader
+     * \param source is the zstd compressed input, opened in binary mode
+     * \param file_name is the name of the input, used for error messages
+     */
+    ZSTDReader(std::unique_ptr<std::istream> source,
+               const std::string& file_name);
+    virtual ~ZSTDReader();
+    ZSTDReader(const ZSTDReader&) = delete;
+    ZSTDReader& operator=(const ZSTDReader&) = delete;
+    bool is_open() const { return m_file != nullptr && m_stream != nullptr; }
+
+protected:
+    /*!
+     * \brief Decode the next chunk. Throw std::runtime_error if the file is
+     * corrupted or truncated
+     */
+    int_type underflow() override;
+
+private:
+    // size of the decompressed buffer
+    static const size_t m_buffer_size = 4 * 1024 * 1024;
+    std::unique_ptr<std::istream> m_file;
+    std::vector<char> m_in;
+    std::string m_file_name;
+    std::vector<char> m_out;
+    ZSTD_DStream* m_stream = nullptr;
+    ZSTD_inBuffer m_in_buffer = {nullptr, 0, 0};
+    size_t m_last_ret = 0;
+    bool m_file_end = false;
+    [[noreturn]] void throw_error() const;
+};
+
+/*!
+ * \brief Input stream wrapper of the ZSTDReader. Errors from the reader are
+ * rethrown instead of only setting the badbit
+ */
+class ZSTDStream : public std::istream
+{
+public:
+    ZSTDStream(std::unique_ptr<std::istream> source,
+               const std::string& file_name)
+        : std::istream(nullptr), m_buffer(std::move(source), file_name)
+    {
+        rdbuf(&m_buffer);
+        exceptions(std::ios::badbit);
+        if (!m_buffer.is_open()) setstate(std::ios::failbit);
+    }
+
+private:
+    ZSTDReader m_buffer;
+};
+#endif // USE_ZSTD
+
+#endif // ZSTDSTREAM_HPP
@@ -13,9 +13,15 @@
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <stdexcept>
 #include <stdint.h>
+#include <string>
 #include <vector>
 #include <zlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 //#include "genfile/snp_data_utils.hpp"
 //#include "genfile/get_set.hpp"
 
@@ -135,19 +141,32 @@ void zlib_uncompress(byte_t const* begin, byte_t const* const end,
     assert(dest_size % sizeof(T) == 0);
     dest->resize(dest_size / sizeof(T));
 }
-/*
-    template< typename T >
-    void zstd_uncompress( byte_t const* begin, byte_t const* const end,
-   std::vector< T >* dest ) { std::size_t const source_size = ( end - begin ) ;
-        std::size_t const dest_size = dest->size() * sizeof( T ) ;
-        std::size_t const uncompressed_size = ZSTD_getDecompressedSize(
-   reinterpret_cast< void const* >( begin ), source_size ) ; std::size_t const
-   result = ZSTD_decompress( reinterpret_cast< void* >( &dest->operator[]( 0 )
-   ), dest_size, reinterpret_cast< void const* >( begin ), source_size ) ;
-        assert( result == uncompressed_size ) ;
-        dest->resize( dest_size / sizeof( T )) ;
+#ifdef USE_ZSTD
+// Uncompress zstd compressed data (bgen compression flag 2). The destination
+// must be large enough to fit the uncompressed data and will be resized to
+// exactly fit the uncompressed data. The decompression context is kept per
+// thread so it is not reallocated for every genotype block
+template <typename T>
+void zstd_uncompress(byte_t const* begin, byte_t const* const end,
+                     std::vector<T>* dest)
+{
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> context(
+        ZSTD_createDCtx(), ZSTD_freeDCtx);
+    if (!context)
+    { throw std::runtime_error("Error: Cannot allocate zstd context"); }
+    std::size_t const source_size = static_cast<std::size_t>(end - begin);
+    std::size_t const dest_size = dest->size() * sizeof(T);
+    std::size_t const result = ZSTD_decompressDCtx(
+        context.get(), dest->data(), dest_size, begin, source_size);
+    if (ZSTD_isError(result) || result % sizeof(T) != 0)
+    {
+        throw std::runtime_error(
+            "Error: Failed to uncompress zstd genotype block: "
+            + std::string(ZSTD_getErrorName(result)));
     }
-*/
+    dest->resize(result / sizeof(T));
+}
+#endif
 // Uncompress the given data, symmetric with zlib_compress.
 // The destination must be large enough to fit the uncompressed data,
 // and it will be resized to exactly fit the uncompressed data.
@@ -340,6 +359,11 @@ namespace bgen
                                   Context const& context,
                                   std::vector<byte_t>* buffer1,
                                   const std::streampos idx);
+    // Thread safe version, reading with FileRead::pread
+    void read_genotype_data_block(const FileRead& aStream, const size_t handle,
+                                  Context const& context,
+                                  std::vector<byte_t>* buffer1,
+                                  const std::streampos idx);
 
     // Low-level function which uncompresses probability data stored in the
     // genotype data block contained in the first buffer into a second buffer
@@ -527,6 +551,18 @@ namespace bgen
                                    integer_ptr);
     }
     template <typename IntegerType>
+    void read_little_endian_integer(const FileRead& in_stream,
+                                    const size_t handle,
+                                    IntegerType* integer_ptr,
+                                    const std::streampos idx)
+    {
+        byte_t buffer[sizeof(IntegerType)];
+        in_stream.pread(handle, idx, sizeof(IntegerType),
+                        reinterpret_cast<char*>(buffer));
+        read_little_endian_integer(buffer, buffer + sizeof(IntegerType),
+                                   integer_ptr);
+    }
+    template <typename IntegerType>
     void read_length_followed_by_data(std::istream& in_stream,
                                       IntegerType* length_ptr,
                                       std::string* string_ptr)
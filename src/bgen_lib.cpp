@@ -53,6 +53,7 @@ namespace bgen
         , magic(other.magic)
         , free_data(other.free_data)
         , flags(other.flags)
+        , offset(other.offset)
     {
     }
 
@@ -63,6 +64,7 @@ namespace bgen
         magic = other.magic;
         free_data = other.free_data;
         flags = other.flags;
+        offset = other.offset;
         return *this;
     }
 
@@ -342,26 +344,18 @@ namespace bgen
     void ignore_genotype_data_block(std::istream& aStream,
                                     Context const& context)
     {
-        if ((context.flags & bgen::e_CompressedSNPBlocks) != e_NoCompression)
-        {
-            uint32_t compressed_data_size = 0;
-            read_little_endian_integer(aStream, &compressed_data_size);
-            if (compressed_data_size > 0)
-            {
-                // gcc std::istream::ignore() has a bug / feature in which
-                // it peeks at the next char and sets eof() if you ignore all
-                // the bytes in the file. This breaks our expected invariant and
-                // means subsequent calls to peekg() fail with -1, which stops
-                // us getting file size. We deal with this by simply ignoring
-                // one less character here.
-                aStream.ignore(compressed_data_size - 1);
-                aStream.get();
-            }
-        }
+        // same rule as read_genotype_data_block, but seek past the payload
+        // instead of reading it, such that the probability data is never
+        // pulled off the disk
+        uint32_t payload_size = 0;
+        if ((context.flags & e_Layout) == e_Layout2
+            || ((context.flags & e_CompressedSNPBlocks) != e_NoCompression))
+        { read_little_endian_integer(aStream, &payload_size); }
         else
         {
-            aStream.ignore(6 * context.number_of_samples);
+            payload_size = 6 * context.number_of_samples;
         }
+        aStream.seekg(payload_size, std::ios_base::cur);
     }
 
     void read_genotype_data_block(std::istream& aStream, Context const& context,
@@ -400,6 +394,27 @@ namespace bgen
         aStream.read(file_name, cur_idx, payload_size,
                      reinterpret_cast<char*>(buffer->data()));
     }
+    void read_genotype_data_block(const FileRead& aStream, const size_t handle,
+                                  Context const& context,
+                                  std::vector<byte_t>* buffer,
+                                  const std::streampos idx)
+    {
+        uint32_t payload_size = 0;
+        std::streampos cur_idx = idx;
+        if ((context.flags & e_Layout) == e_Layout2
+            || ((context.flags & e_CompressedSNPBlocks) != e_NoCompression))
+        {
+            read_little_endian_integer(aStream, handle, &payload_size, idx);
+            cur_idx += sizeof(payload_size);
+        }
+        else
+        {
+            payload_size = 6 * context.number_of_samples;
+        }
+        buffer->resize(payload_size);
+        aStream.pread(handle, cur_idx, payload_size,
+                      reinterpret_cast<char*>(buffer->data()));
+    }
     void uncompress_probability_data(Context const& context,
                                      std::vector<byte_t> const& compressed_data,
                                      std::vector<byte_t>* buffer)
@@ -426,10 +441,19 @@ namespace bgen
             { zlib_uncompress(begin, end, buffer); }
             else if (compressionType == e_ZstdCompression)
             {
+#ifdef USE_ZSTD
+                zstd_uncompress(begin, end, buffer);
+                if (buffer->size() != uncompressed_data_size)
+                {
+                    throw std::runtime_error(
+                        "Error: Size of zstd genotype block does not match "
+                        "the bgen file");
+                }
+#else
                 throw std::runtime_error(
-                    "Error: ZSTD compression currently unsupported");
-                // ZSTD
-                // zstd_uncompress(begin, end, buffer);
+                    "Error: Bgen file is zstd compressed but PRSice was "
+                    "compiled without zstd support!");
+#endif
             }
             assert(buffer->size() == uncompressed_data_size);
         }
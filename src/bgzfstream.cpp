@@ -0,0 +1,214 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "bgzfstream.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <zlib.h>
+
+namespace
+{
+uint32_t read_le(const unsigned char* ptr, const size_t num_byte)
+{
+    uint32_t res = 0;
+    for (size_t i = num_byte; i > 0; --i) { res = (res << 8) | ptr[i - 1]; }
+    return res;
+}
+}
+
+BGZFReader::BGZFReader(std::unique_ptr<std::istream> source,
+                       const std::string& file_name, const size_t thread)
+    : m_file(std::move(source))
+    , m_file_name(file_name)
+    , m_thread(std::max(thread, size_t(1)))
+{
+    setg(nullptr, nullptr, nullptr);
+    if (m_file != nullptr)
+    { m_next = std::async(std::launch::async, &BGZFReader::read_batch, this); }
+}
+
+BGZFReader::~BGZFReader()
+{
+    // make sure the background thread is no longer using the file
+    if (m_next.valid()) m_next.wait();
+}
+
+bool BGZFReader::valid_header(const unsigned char* header)
+{
+    // gzip magic, deflate, FEXTRA flag, XLEN = 6 and the BC subfield
+    return header[0] == 0x1f && header[1] == 0x8b && header[2] == 8
+           && (header[3] & 4) && read_le(header + 10, 2) == 6
+           && header[12] == 'B' && header[13] == 'C'
+           && read_le(header + 14, 2) == 2;
+}
+
+bool BGZFReader::is_bgzf(const std::string& head)
+{
+    return head.size() >= m_header_size
+           && valid_header(reinterpret_cast<const unsigned char*>(head.data()));
+}
+
+bool BGZFReader::inflate_block(const char* block, const size_t block_size,
+                               char* dest, const size_t dest_size)
+{
+    const unsigned char* footer = reinterpret_cast<const unsigned char*>(
+        block + block_size - m_footer_size);
+    const uint32_t expected_crc = read_le(footer, 4);
+    // the EOF marker block has nothing to inflate
+    if (dest_size == 0) return true;
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(block + m_header_size));
+    strm.avail_in =
+        static_cast<uInt>(block_size - m_header_size - m_footer_size);
+    // negative window bits for raw deflate stream as we have already parsed
+    // the gzip header
+    if (inflateInit2(&strm, -15) != Z_OK) return false;
+    strm.next_out = reinterpret_cast<Bytef*>(dest);
+    strm.avail_out = static_cast<uInt>(dest_size);
+    const int ret = inflate(&strm, Z_FINISH);
+    const bool success = (ret == Z_STREAM_END && strm.total_out == dest_size);
+    inflateEnd(&strm);
+    return success
+           && crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<Bytef*>(dest),
+                    static_cast<uInt>(dest_size))
+                  == expected_crc;
+}
+
+BGZFReader::Batch BGZFReader::read_batch()
+{
+    Batch batch;
+    std::vector<std::vector<char>> blocks;
+    std::vector<size_t> offset = {0};
+    const size_t max_block = m_block_per_thread * m_thread;
+    unsigned char header[m_header_size];
+    while (blocks.size() < max_block)
+    {
+        m_file->read(reinterpret_cast<char*>(header), m_header_size);
+        if (m_file->gcount() == 0)
+        {
+            // a complete file ends with the empty EOF marker block, otherwise
+            // it was truncated at a block boundary
+            batch.last = true;
+            batch.error = !m_eof_marker;
+            break;
+        }
+        if (m_file->gcount() != static_cast<std::streamsize>(m_header_size)
+            || !valid_header(header))
+        {
+            batch.error = true;
+            break;
+        }
+        // BSIZE is the total block size minus 1
+        const size_t block_size = read_le(header + 16, 2) + 1;
+        if (block_size < m_header_size + m_footer_size)
+        {
+            batch.error = true;
+            break;
+        }
+        std::vector<char> block(block_size);
+        std::copy(header, header + m_header_size, block.begin());
+        const std::streamsize remain =
+            static_cast<std::streamsize>(block_size - m_header_size);
+        m_file->read(block.data() + m_header_size, remain);
+        if (m_file->gcount() != remain)
+        {
+            batch.error = true;
+            break;
+        }
+        const size_t inflated_size = read_le(
+            reinterpret_cast<const unsigned char*>(block.data() + block_size
+                                                   - 4),
+            4);
+        if (inflated_size > m_max_block_size)
+        {
+            batch.error = true;
+            break;
+        }
+        m_eof_marker = (inflated_size == 0);
+        offset.push_back(offset.back() + inflated_size);
+        blocks.push_back(std::move(block));
+    }
+    if (blocks.empty()) return batch;
+    batch.data.resize(offset.back());
+    // now inflate the blocks, each worker handle a consecutive run of blocks
+    // and write directly to their final location in the output
+    const size_t num_worker = std::min(m_thread, blocks.size());
+    const size_t job_size = blocks.size() / num_worker;
+    const size_t remain = blocks.size() % num_worker;
+    std::vector<char> success(num_worker, true);
+    auto inflate_range = [&blocks, &offset, &batch, &success](
+                             size_t i_worker, size_t start, size_t end) {
+        for (size_t i = start; i < end && success[i_worker]; ++i)
+        {
+            success[i_worker] = inflate_block(
+                blocks[i].data(), blocks[i].size(),
+                batch.data.data() + offset[i], offset[i + 1] - offset[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    size_t start = 0;
+    for (size_t i_worker = 0; i_worker < num_worker; ++i_worker)
+    {
+        const size_t end = start + job_size + (i_worker < remain);
+        if (i_worker + 1 == num_worker) { inflate_range(i_worker, start, end); }
+        else
+        {
+            workers.push_back(std::thread(inflate_range, i_worker, start, end));
+        }
+        start = end;
+    }
+    for (auto&& worker : workers) worker.join();
+    if (std::find(success.begin(), success.end(), false) != success.end())
+    {
+        batch.error = true;
+        batch.data.clear();
+    }
+    return batch;
+}
+
+BGZFReader::int_type BGZFReader::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    while (m_next.valid())
+    {
+        Batch batch = m_next.get();
+        if (batch.error)
+        {
+            throw std::runtime_error("Error: " + m_file_name
+                                     + " is corrupted or truncated!\n");
+        }
+        // start inflating the next batch while the current batch is being
+        // consumed
+        if (!batch.last)
+        {
+            m_next =
+                std::async(std::launch::async, &BGZFReader::read_batch, this);
+        }
+        m_current = std::move(batch.data);
+        if (!m_current.empty())
+        {
+            setg(m_current.data(), m_current.data(),
+                 m_current.data() + m_current.size());
+            return traits_type::to_int_type(*gptr());
+        }
+    }
+    return traits_type::eof();
+}
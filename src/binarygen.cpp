@@ -256,7 +256,12 @@ genfile::bgen::Context BinaryGen::get_context(const size_t& idx)
     if (!bgen_file.is_open())
     { throw std::runtime_error("Error: Cannot open bgen file " + bgen_name); }
     genfile::bgen::Context context;
+    // the header block starts after the offset of the first variant, which
+    // is needed to locate the variants
+    uint32_t offset = 0;
+    genfile::bgen::read_offset(bgen_file, &offset);
     genfile::bgen::read_header_block(bgen_file, &context);
+    context.offset = offset;
     return context;
 }
 
@@ -360,8 +365,9 @@ void BinaryGen::gen_snp_vector(
     const std::string mismatch_snp_record_name = out_prefix + ".mismatch";
     const std::string mismatch_source = m_is_ref ? "Reference" : "Base";
     std::unordered_set<std::string> duplicated_snps;
-    std::unordered_set<std::string> processed_snps;
     auto&& genotype = (m_is_ref) ? target : this;
+    const bool match_by_pos = genotype->m_match_by_pos;
+    if (match_by_pos) genotype->build_position_index();
     std::vector<bool> retain_snp(genotype->m_existed_snps.size(), false);
     std::ifstream bgen_file;
     std::string bgen_name;
@@ -374,7 +380,7 @@ void BinaryGen::gen_snp_vector(
     std::string file_name;
     std::string error_message = "";
     std::string A1, A2, prefix;
-    std::streampos byte_pos, start;
+    std::streampos byte_pos;
     size_t total_unfiltered_snps = 0;
     size_t ref_target_match = 0;
     size_t num_snp;
@@ -408,21 +414,43 @@ void BinaryGen::gen_snp_vector(
         // now start reading each bgen file
         prefix = m_genotype_file_names[file_idx];
         bgen_name = prefix + ".bgen";
-        if (bgen_file.is_open()) bgen_file.close();
-        bgen_file.clear();
-        bgen_file.open(bgen_name.c_str(), std::ifstream::binary);
-        if (!bgen_file.is_open())
-        {
-            std::string error_message =
-                "Error: Cannot open bgen file " + bgen_name;
-            throw std::runtime_error(error_message);
-        }
         // read in the offset
         auto&& context = m_context_map[file_idx];
         offset = context.offset;
-        // skip the offest
-        bgen_file.seekg(offset + 4);
         num_snp = context.number_of_variants;
+        // use the sidecar index if available, such that we don't need to
+        // scan through the bgen file
+        const bool use_cache = !m_cache_dir.empty();
+        const std::string index_name =
+            use_cache ? bgen_index::index_name(m_cache_dir, bgen_name) : "";
+        const unsigned long long index_key =
+            use_cache ? bgen_index::key(bgen_name, offset + 4) : 0;
+        bgen_index::Reader index_reader;
+        bgen_index::Writer index_writer;
+        const bool use_index =
+            use_cache && index_reader.open(index_name, index_key, num_snp);
+        if (!use_index)
+        {
+            if (bgen_file.is_open()) bgen_file.close();
+            bgen_file.clear();
+            bgen_file.open(bgen_name.c_str(), std::ifstream::binary);
+            if (!bgen_file.is_open())
+            {
+                std::string error_message =
+                    "Error: Cannot open bgen file " + bgen_name;
+                throw std::runtime_error(error_message);
+            }
+            // skip the offest
+            bgen_file.seekg(offset + 4);
+            if (use_cache
+                && !index_writer.open(index_name, index_key, num_snp))
+            {
+                cache_warning("Warning: Cannot open bgen index file "
+                              + index_name
+                              + " for write. Bgen index will not be "
+                                "generated");
+            }
+        }
         // obtain the context information. We don't check out of bound as that
         // is unlikely to happen
         for (size_t i_snp = 0; i_snp < num_snp; ++i_snp)
@@ -439,10 +467,29 @@ void BinaryGen::gen_snp_vector(
                         bgen_name.c_str());
             }
             m_unfiltered_marker_ct++;
-            start = bgen_file.tellg();
-            // directly use the library without decompressing the genotype
-            read_snp_identifying_data(bgen_file, context, &SNPID, &RSID,
-                                      &chromosome, &SNP_position, &A1, &A2);
+            if (use_index)
+            {
+                index_reader.read(SNPID, RSID, chromosome, SNP_position, A1,
+                                  A2, byte_pos);
+            }
+            else
+            {
+                // directly use the library without decompressing the genotype
+                read_snp_identifying_data(bgen_file, context, &SNPID, &RSID,
+                                          &chromosome, &SNP_position, &A1,
+                                          &A2);
+                // get the current location of bgen file, this will be used to
+                // skip to current location later on
+                byte_pos = bgen_file.tellg();
+                // seek past the genotype data block using its length, such
+                // that we never read the probability data here
+                ignore_genotype_data_block(bgen_file, context);
+                if (index_writer.is_open())
+                {
+                    index_writer.write(SNPID, RSID, chromosome, SNP_position,
+                                       A1, A2, byte_pos);
+                }
+            }
             exclude_snp = false;
             if (chromosome != prev_chr)
             {
@@ -481,29 +528,44 @@ void BinaryGen::gen_snp_vector(
             // by this time point, we should always have the
             // m_existed_snps_index propagated with SNPs from the base. So we
             // can first check if the SNP are presented in base
-            auto&& find_rs = genotype->m_existed_snps_index.find(RSID);
-            auto&& find_snp = genotype->m_existed_snps_index.find(SNPID);
-            if (find_rs == genotype->m_existed_snps_index.end()
-                && find_snp == genotype->m_existed_snps_index.end())
+            size_t find_rs = StringIndex::npos, find_snp = StringIndex::npos;
+            if (match_by_pos)
+            {
+                // use the ID of the base SNP
+                find_snp = genotype->find_by_position(chr_num, SNP_position,
+                                                      A1, A2);
+                if (find_snp != StringIndex::npos)
+                { SNPID = genotype->m_existed_snps[find_snp].rs(); }
+            }
+            else
+            {
+                find_rs = genotype->m_existed_snps_index.find(RSID);
+                find_snp = genotype->m_existed_snps_index.find(SNPID);
+            }
+            size_t target_index = StringIndex::npos;
+            if (find_rs == StringIndex::npos && find_snp == StringIndex::npos)
             {
                 // this is the reference panel, and the SNP wasn't found in the
                 // target doens't matter if we use RSID or SNPID
                 ++m_base_missed;
                 exclude_snp = true;
             }
-            else if (find_snp != genotype->m_existed_snps_index.end())
+            else if (find_snp != StringIndex::npos)
             {
                 // we found the SNPID
                 cur_id = SNPID;
+                target_index = find_snp;
             }
-            else if (find_rs != genotype->m_existed_snps_index.end())
+            else
             {
                 // we found the RSID
                 cur_id = RSID;
+                target_index = find_rs;
             }
 
             bool ambig = ambiguous(A1, A2);
-            if (processed_snps.find(cur_id) != processed_snps.end())
+            // a SNP is only retained once it is processed
+            if (target_index != StringIndex::npos && retain_snp[target_index])
             {
                 duplicated_snps.insert(cur_id);
                 exclude_snp = true;
@@ -522,36 +584,28 @@ void BinaryGen::gen_snp_vector(
                 ++m_num_xrange;
                 exclude_snp = true;
             }
-            // get the current location of bgen file, this will be used to skip
-            // to current location later on
-            byte_pos = bgen_file.tellg();
-            // read in the genotype data block so that we advance the ifstream
-            // pointer to the next SNP entry
-            read_genotype_data_block(bgen_file, context, &m_buffer1);
             // if we want to exclude this SNP, we will not perform
             // decompression
             if (!exclude_snp)
             {
                 // A1 = alleles.front();
                 // A2 = alleles.back();
-                auto&& target_index = genotype->m_existed_snps_index[cur_id];
-                if (!genotype->m_existed_snps[target_index].matching(
-                        chr_num, SNP_position, A1, A2, flipping))
+                auto&& target_snp = genotype->m_existed_snps[target_index];
+                if (!target_snp.matching(chr_num, SNP_position, A1, A2,
+                                         flipping))
                 {
-                    genotype->print_mismatch(
-                        mismatch_snp_record_name, mismatch_source,
-                        genotype->m_existed_snps[target_index], cur_id, A1, A2,
-                        chr_num, SNP_position);
+                    genotype->print_mismatch(mismatch_snp_record_name,
+                                             mismatch_source, target_snp,
+                                             cur_id, A1, A2, chr_num,
+                                             SNP_position);
                     ++m_num_ref_target_mismatch;
                 }
                 else
                 {
-                    processed_snps.insert(cur_id);
-                    if (ambig)
-                    { flipping = (A1 != m_existed_snps[target_index].ref()); }
-                    genotype->m_existed_snps[target_index].add_snp_info(
-                        file_idx, byte_pos, chr_num, SNP_position, A1, A2,
-                        flipping, m_is_ref);
+                    if (ambig) { flipping = (A1 != target_snp.ref()); }
+                    target_snp.add_snp_info(genotype->m_string_arena, file_idx,
+                                            byte_pos, chr_num, SNP_position,
+                                            A1, A2, flipping, m_is_ref);
                     retain_snp[target_index] = true;
                     ++ref_target_match;
                 }
@@ -567,9 +621,16 @@ void BinaryGen::gen_snp_vector(
             fprintf(stderr, "\r%zu SNPs processed in %s\r", num_snp,
                     bgen_name.c_str());
         }
-        bgen_file.close();
+        if (bgen_file.is_open()) bgen_file.close();
         fprintf(stderr, "\n");
+        if (index_writer.is_open() && !index_writer.close())
+        {
+            cache_warning("Warning: Failed to write bgen index file "
+                          + index_name);
+        }
     }
+    genotype->m_position_index.clear();
+    genotype->m_position_index.shrink_to_fit();
     if (ref_target_match != genotype->m_existed_snps.size())
     {
         // there are mismatch, so we need to update the snp vector
@@ -584,7 +645,6 @@ void BinaryGen::gen_snp_vector(
     }
 }
 
-
 bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
                                     const std::string& prefix, Genotype* target,
                                     bool force_cal)
@@ -603,33 +663,19 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
                        + " SNPs\n"
                          "==================================================");
     auto&& genotype = (m_is_ref) ? target : this;
-    std::sort(
-        begin(genotype->m_existed_snps), end(genotype->m_existed_snps),
-        [this](SNP const& t1, SNP const& t2) {
-            if (t1.get_file_idx(m_is_ref) == t2.get_file_idx(m_is_ref))
-            { return t1.get_byte_pos(m_is_ref) < t2.get_byte_pos(m_is_ref); }
-            else
-                return t1.get_file_idx(m_is_ref) == t2.get_file_idx(m_is_ref);
-        });
+    // sort SNPs by the read order to minimize skipping
+    genotype->sort_snps_by_file(m_is_ref);
     const double sample_ct_recip = 1.0 / (static_cast<double>(m_sample_ct));
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
     const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
     std::vector<bool> retain_snps(genotype->m_existed_snps.size(), false);
 
-    std::string bgen_name = "";
-    const std::string intermediate_name = prefix + ".inter";
-    std::ifstream bgen_file;
     double cur_maf, cur_geno;
-    std::streampos byte_pos, tmp_byte_pos;
-    size_t processed_count = 0;
+    std::streampos byte_pos, cache_pos;
     size_t cur_file_idx = 0;
     size_t retained = 0;
-    size_t ll_ct = 0;
-    size_t lh_ct = 0;
-    size_t hh_ct = 0;
     size_t uii = 0;
-    size_t missing = 0;
     // initialize the sample inclusion mask
     std::vector<uintptr_t> sample_include2(unfiltered_sample_ctv2);
     std::vector<uintptr_t> founder_include2(unfiltered_sample_ctv2);
@@ -638,36 +684,76 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
                                sample_include2.data());
     init_quaterarr_from_bitarr(m_sample_for_ld.data(), m_unfiltered_sample_ct,
                                founder_include2.data());
-    m_tmp_genotype.resize(unfiltered_sample_ctv2, 0);
-    // we initialize the plink converter with the sample inclusion vector and
-    // also the tempory genotype vector list. We also provide the hard coding
-    // threshold
-    PLINK_generator setter(&m_calculate_prs, m_tmp_genotype.data(),
-                           m_hard_threshold, m_dose_threshold);
-    // now consider if we are generating the intermediate file
-    std::ofstream inter_out;
-    if (m_intermediate)
+    // we will only use the hard call cache if the following happen:
+    // 1. User want to generate the intermediate file
+    // 2. We are dealing with reference file format
+    // 3. We are dealing with target file and there is
+    // no reference file
+    // 4. We are dealing with target file and we are
+    // expected to use hard_coding
+    const bool use_cache =
+        m_intermediate
+        && (m_is_ref || !m_expect_reference || (!m_is_ref && m_hard_coded));
+    std::vector<hardcall_cache::Cache> caches(
+        use_cache ? m_genotype_file_names.size() : 0);
+    const unsigned long long setting_key = hardcall_cache::setting_key(
+        m_hard_threshold, m_dose_threshold, m_unfiltered_sample_ct,
+        m_calculate_prs);
+    // the hard calls are still required when caches are disabled, they are
+    // then written next to the output and removed once we are done
+    const bool reuse = !m_cache_dir.empty();
+    for (size_t i = 0; i < caches.size(); ++i)
     {
-        // allow generation of intermediate file
-        if (m_target_plink && m_is_ref)
-        {
-            // target already generated some intermediate, now append for
-            // reference
-            inter_out.open(intermediate_name.c_str(),
-                           std::ios::binary | std::ios::app);
-        }
-        else
+        const std::string bgen_name = m_genotype_file_names[i] + ".bgen";
+        const std::string cache_name =
+            reuse ? hardcall_cache::cache_name(m_cache_dir, bgen_name,
+                                               setting_key)
+                  : prefix + (m_is_ref ? ".ref." : ".") + std::to_string(i)
+                        + ".inter";
+        if (!reuse) m_inter_names.push_back(cache_name);
+        if (!caches[i].open(cache_name, hardcall_cache::file_key(bgen_name),
+                            (m_unfiltered_sample_ct + 3) / 4, reuse))
         {
-            // a new intermediate file
-            inter_out.open(intermediate_name.c_str(), std::ios::binary);
+            cache_warning("Warning: Cannot write the hard call cache - "
+                          + cache_name + ". Will not generate intermediate "
+                                         "file");
+            caches.clear();
+            m_intermediate = false;
         }
     }
-    // now start processing the bgen file
+    // now start processing the bgen file. The blocks are read in order and
+    // decoded on m_thread threads, the filtering and the writing of the cache
+    // are then done in SNP order
     double progress = 0, prev_progress = -1.0;
     const size_t total_snp = genotype->m_existed_snps.size();
-    genfile::bgen::Context context;
-    for (auto&& snp : genotype->m_existed_snps)
-    {
+    std::vector<size_t> snp_order(total_snp);
+    std::iota(snp_order.begin(), snp_order.end(), 0);
+    size_t processed_count = 0;
+    hardcall_cache::Entry entry;
+    auto read = [&](const SNP& snp, DecodedSNP& decoded) {
+        decoded.block.clear();
+        snp.get_file_info(decoded.file_idx, byte_pos, m_is_ref);
+        // cached SNPs don't need to be decoded
+        if (!caches.empty() && caches[decoded.file_idx].find(byte_pos))
+        { return; }
+        decoded.genotype.resize(unfiltered_sample_ctv2);
+        read_block(snp, decoded);
+    };
+    auto decode = [this](const SNP&, DecodedSNP& decoded,
+                         GenotypeScratch& scratch) {
+        // we initialize the plink converter with the sample inclusion vector
+        // and the genotype vector. We also provide the hard coding threshold
+        PLINK_generator setter(&m_calculate_prs, decoded.genotype.data(),
+                               m_hard_threshold, m_dose_threshold);
+        parse_genotype_block(m_context_map[decoded.file_idx], decoded.block,
+                             &scratch.buffer2, setter);
+        // no founder, much easier
+        setter.get_count(decoded.homcom_ct, decoded.het_ct, decoded.homrar_ct,
+                         decoded.missing_ct);
+        decoded.info_score = setter.info_score();
+        decoded.expected = setter.expected();
+    };
+    auto fold = [&](SNP& snp, DecodedSNP& decoded) {
         progress = static_cast<double>(processed_count)
                    / static_cast<double>(total_snp) * 100;
         if (progress - prev_progress > 0.01)
@@ -676,15 +762,38 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
                     progress);
             prev_progress = progress;
         }
-        snp.get_file_info(cur_file_idx, byte_pos, m_is_ref);
-        context = m_context_map[cur_file_idx];
         ++processed_count;
-        // now read in the genotype information
-        genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
-            m_genotype_file, m_genotype_file_names[cur_file_idx] + ".bgen",
-            context, setter, &m_buffer1, &m_buffer2, byte_pos);
-        // no founder, much easier
-        setter.get_count(ll_ct, lh_ct, hh_ct, missing);
+        snp.get_file_info(cur_file_idx, byte_pos, m_is_ref);
+        const hardcall_cache::Entry* cached =
+            caches.empty() ? nullptr : caches[cur_file_idx].find(byte_pos);
+        if (cached != nullptr)
+        {
+            decoded.homcom_ct = cached->homcom_ct;
+            decoded.het_ct = cached->het_ct;
+            decoded.homrar_ct = cached->homrar_ct;
+            decoded.missing_ct = cached->missing_ct;
+            decoded.info_score = cached->info_score;
+            decoded.expected = cached->expected;
+        }
+        else if (!caches.empty())
+        {
+            // cache all variants, such that runs with different QC
+            // filtering can still use the cache
+            entry.bgen_pos = static_cast<unsigned long long>(
+                static_cast<std::streamoff>(byte_pos));
+            entry.homcom_ct = decoded.homcom_ct;
+            entry.het_ct = decoded.het_ct;
+            entry.homrar_ct = decoded.homrar_ct;
+            entry.missing_ct = decoded.missing_ct;
+            entry.info_score = decoded.info_score;
+            entry.expected = decoded.expected;
+            cached =
+                &caches[cur_file_idx].append(entry, decoded.genotype.data());
+        }
+        if (cached != nullptr)
+        { cache_pos = caches[cur_file_idx].byte_pos(*cached); }
+        const size_t ll_ct = decoded.homcom_ct, lh_ct = decoded.het_ct,
+                     hh_ct = decoded.homrar_ct;
         uii = ll_ct + lh_ct + hh_ct;
         cur_geno = 1.0 - ((static_cast<int32_t>(uii)) * sample_ct_recip);
         uii = 2 * (ll_ct + lh_ct + hh_ct);
@@ -702,7 +811,7 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
         if (filter_info.geno < cur_geno)
         {
             ++m_num_geno_filter;
-            continue;
+            return;
         }
         // filter by MAF
         // do not flip the MAF for now, so that we
@@ -711,96 +820,153 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
         if (cur_maf < filter_info.maf)
         {
             ++m_num_maf_filter;
-            continue;
+            return;
         }
         else if (ll_ct == m_sample_ct || hh_ct == m_sample_ct)
         {
             // none of the sample contain this SNP
             // still count as MAF filtering (for now)
             ++m_num_maf_filter;
-            continue;
+            return;
         }
 
-        if (setter.info_score() < filter_info.info_score)
+        if (decoded.info_score < filter_info.info_score)
         {
             ++m_num_info_filter;
-            continue;
+            return;
         }
         // if we can reach here, it is not removed
-        snp.set_counts(ll_ct, lh_ct, hh_ct, missing, m_is_ref);
-        if (m_is_ref) { snp.set_ref_expected(setter.expected()); }
+        snp.set_counts(ll_ct, lh_ct, hh_ct, decoded.missing_ct, m_is_ref);
+        if (m_is_ref) { snp.set_ref_expected(decoded.expected); }
         else
         {
-            snp.set_expected(setter.expected());
+            snp.set_expected(decoded.expected);
         }
         ++retained;
         // we need to -1 because we put processed_count ++ forward
         // to avoid continue skipping out the addition
         retain_snps[processed_count - 1] = true;
-        if (m_intermediate
-            && (m_is_ref || !m_expect_reference || (!m_is_ref && m_hard_coded)))
-        {
-            // we will only generate the intermediate file if
-            // the following happen:
-            // 1. User want to generate the intermediate file
-            // 2. We are dealing with reference file format
-            // 3. We are dealing with target file and there is
-            // no reference file
-            // 4. We are dealing with target file and we are
-            // expected to use hard_coding
-            tmp_byte_pos = inter_out.tellp();
-            inter_out.write(reinterpret_cast<char*>(&m_tmp_genotype[0]),
-                            m_tmp_genotype.size() * sizeof(m_tmp_genotype[0]));
+        if (!caches.empty())
+        {
             if (!m_is_ref)
             {
                 // target file
                 if (m_hard_coded)
                 {
                     m_target_plink = true;
-                    snp.update_file(m_genotype_file_names.size(), tmp_byte_pos,
-                                    false);
+                    snp.update_file(cur_file_idx, cache_pos, false);
                 }
                 if (!m_expect_reference)
                 {
                     // we don't have reference
                     m_ref_plink = true;
-                    snp.update_file(m_genotype_file_names.size(), tmp_byte_pos,
-                                    true);
+                    snp.update_file(cur_file_idx, cache_pos, true);
                 }
             }
             else
             {
                 // this is the reference file
                 m_ref_plink = true;
-                snp.update_file(m_genotype_file_names.size(), tmp_byte_pos,
-                                true);
+                snp.update_file(cur_file_idx, cache_pos, true);
             }
         }
-    }
-    if (m_intermediate
-        && (m_is_ref || (!m_is_ref && m_hard_coded) || !m_expect_reference))
-    { // update our genotype file
-        inter_out.close();
-        m_genotype_file_names.push_back(intermediate_name);
+    };
+    const size_t slot_size = 2 * unfiltered_sample_ctv2 * sizeof(uintptr_t);
+    decode_in_order(genotype->m_existed_snps, snp_order.begin(),
+                    snp_order.end(), slot_size, read, decode, fold);
+    m_cache_names.clear();
+    bool cache_failed = false;
+    for (auto&& cache : caches)
+    {
+        if (!cache.close())
+        {
+            cache_warning("Warning: Cannot write the hard call cache - "
+                          + cache.name()
+                          + ". Will read the genotypes from the bgen file");
+            cache_failed = true;
+        }
+        m_cache_names.push_back(cache.name());
     }
     fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%\n", 100.0);
     // now update the vector
     if (retained != genotype->m_existed_snps.size())
     { genotype->shrink_snp_vector(retain_snps); }
+    if (cache_failed)
+    {
+        // the SNPs now point to the caches, point them back to the bgen files
+        for (auto&& snp : genotype->m_existed_snps)
+        {
+            for (const bool is_ref : {false, true})
+            {
+                if (is_ref ? !m_ref_plink : !m_target_plink) continue;
+                snp.get_file_info(cur_file_idx, cache_pos, is_ref);
+                snp.update_file(cur_file_idx,
+                                caches[cur_file_idx].bgen_pos(cache_pos),
+                                is_ref);
+            }
+        }
+        m_cache_names.clear();
+        m_intermediate = false;
+        m_target_plink = false;
+        m_ref_plink = false;
+    }
     return true;
 }
 
 BinaryGen::~BinaryGen()
 {
-    if (m_target_plink || m_ref_plink)
+    if (m_inter_names.empty()) return;
+    // these can't be reused by other runs, remove them to save space. Close
+    // the genotype file first, as mapped files can't be removed on Windows
+    m_genotype_file.close();
+    for (auto&& name : m_inter_names)
     {
-        // if we have constructed the intermediate file, we should remove it
-        // to save space (plus that file isn't of any useful format and
-        // can't be used by any other problem nor can it be reused)
-        std::remove(m_genotype_file_names.back().c_str());
+        std::remove(name.c_str());
+        std::remove((name + ".idx").c_str());
     }
 }
 
+template <typename Read, typename Decode, typename Fold>
+void BinaryGen::decode_in_order(
+    std::vector<SNP>& snps,
+    const std::vector<size_t>::const_iterator& start_idx,
+    const std::vector<size_t>::const_iterator& end_idx, const size_t slot_size,
+    Read&& read, Decode&& decode, Fold&& fold)
+{
+    const size_t num_snp =
+        static_cast<size_t>(std::distance(start_idx, end_idx));
+    auto snp = [&](const size_t idx) -> SNP& {
+        return snps[*(start_idx + static_cast<std::ptrdiff_t>(idx))];
+    };
+    // the file is read in order, so reads remain sequential. Give each
+    // thread a few SNPs per window to balance the load
+    process_in_order<DecodedSNP>(
+        num_snp, slot_size, 16,
+        [&](const size_t idx, DecodedSNP& decoded) {
+            read(snp(idx), decoded);
+        },
+        [&](const size_t start, const size_t end, DecodedSNP* decoded) {
+            auto scratch = m_scratch_pool.acquire();
+            for (size_t idx = start; idx < end; ++idx, ++decoded)
+            {
+                if (decoded->block.empty()) continue;
+                decode(snp(idx), *decoded, *scratch);
+            }
+        },
+        [&](const size_t idx, DecodedSNP& decoded) {
+            fold(snp(idx), decoded);
+        });
+}
+
+void BinaryGen::read_block(const SNP& snp, DecodedSNP& decoded)
+{
+    std::streampos byte_pos;
+    snp.get_file_info(decoded.file_idx, byte_pos, m_is_ref);
+    genfile::bgen::read_genotype_data_block(
+        m_genotype_file, m_genotype_file_names[decoded.file_idx] + ".bgen",
+        m_context_map[decoded.file_idx], &decoded.block, byte_pos);
+}
+
 void BinaryGen::dosage_score(
     std::vector<PRS>& prs_list,
     const std::vector<size_t>::const_iterator& start_idx,
@@ -810,33 +976,32 @@ void BinaryGen::dosage_score(
     // main reason is we need expected value instead of
     // the MAF
     bool not_first = !reset_zero;
-    // we initialize the PRS interpretor with the required information.
-    // m_prs_info is where we store the PRS information
-    // and m_sample_include let us know if the sample is required.
-    // m_missing_score will inform us as to how to handle the missingness
-    PRS_Interpreter setter(&prs_list, &m_calculate_prs,
-                           m_prs_calculation.missing_score);
-    std::vector<size_t>::const_iterator cur_idx = start_idx;
-    size_t file_idx;
-    std::streampos byte_pos;
-    for (; cur_idx != end_idx; ++cur_idx)
-    {
-        auto&& snp = m_existed_snps[(*cur_idx)];
-        snp.get_file_info(file_idx, byte_pos, m_is_ref);
-        // if the file name differ, or the file isn't open, we will open it
-        auto&& context = m_context_map[file_idx];
-        setter.set_stat(snp.stat(), m_homcom_weight, m_het_weight,
-                        m_homrar_weight, snp.is_flipped(), not_first);
-
-        // start performing the parsing
-        genfile::bgen::read_and_parse_genotype_data_block<PRS_Interpreter>(
-            m_genotype_file, m_genotype_file_names[file_idx] + ".bgen", context,
-            setter, &m_buffer1, &m_buffer2, byte_pos);
-        // check if this SNP has some non-missing sample, if not, invalidate
-        // it
-        // after reading in this SNP, we no longer need to reset the PRS
-        not_first = true;
-    }
+    // the dosages are decoded on the worker threads, PRS_Interpreter then add
+    // them to the PRS in SNP order. m_missing_score will inform us as to how
+    // to handle the missingness
+    PRS_Interpreter interpreter(&prs_list, m_prs_calculation.missing_score);
+    const size_t slot_size = prs_list.size() * (sizeof(double) + 1);
+    decode_in_order(
+        m_existed_snps, start_idx, end_idx, slot_size,
+        [this](const SNP& snp, DecodedSNP& decoded) {
+            read_block(snp, decoded);
+        },
+        [this](const SNP& snp, DecodedSNP& decoded,
+               GenotypeScratch& scratch) {
+            Dosage_Decoder setter(&m_calculate_prs, &decoded.dosage,
+                                  &decoded.missing);
+            setter.set_weight(m_homcom_weight, m_het_weight, m_homrar_weight,
+                              snp.is_flipped());
+            parse_genotype_block(m_context_map[decoded.file_idx],
+                                 decoded.block, &scratch.buffer2, setter);
+            decoded.ploidy = setter.ploidy();
+        },
+        [&](const SNP& snp, const DecodedSNP& decoded) {
+            interpreter.set_stat(snp.stat(), not_first);
+            interpreter.add(decoded.dosage, decoded.missing, decoded.ploidy);
+            // after reading in this SNP, we no longer need to reset the PRS
+            not_first = true;
+        });
 }
 
 
@@ -850,19 +1015,12 @@ void BinaryGen::hard_code_score(
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
     const uintptr_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
-    // genotype counts
-    size_t homrar_ct = 0;
-    size_t missing_ct = 0;
-    size_t het_ct = 0;
-    size_t homcom_ct = 0;
     // weight of each genotype
     double homcom_weight = m_homcom_weight;
     double het_weight = m_het_weight;
     double homrar_weight = m_homrar_weight;
     // this is needed if we want to calculate the MAF of the sample
     const size_t ploidy = 2;
-    const size_t miss_count =
-        (m_prs_calculation.missing_score != MISSING_SCORE::SET_ZERO) * ploidy;
     const bool is_centre =
         (m_prs_calculation.missing_score == MISSING_SCORE::CENTER);
     const bool mean_impute =
@@ -870,60 +1028,56 @@ void BinaryGen::hard_code_score(
     // check if we need to reset the sample's PRS
     bool not_first = !reset_zero;
     double stat, maf, adj_score, miss_score;
-    std::streampos byte_pos;
-    // initialize the data structure for storing the genotype
-    std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
-    genfile::bgen::Context context;
-    PLINK_generator setter(&m_calculate_prs, genotype.data(), m_hard_threshold,
-                           m_dose_threshold);
-    std::vector<size_t>::const_iterator cur_idx = start_idx;
-    size_t idx;
-    for (; cur_idx != end_idx; ++cur_idx)
-    {
-        auto&& cur_snp = m_existed_snps[(*cur_idx)];
-        // read in the genotype using the modified load_and_collapse_incl
-        // function. m_target_plink will inform the function wheter there's
-        // an intermediate file
+    const size_t slot_size = unfiltered_sample_ctl * 2 * sizeof(uintptr_t);
+    auto read = [&](const SNP& snp, DecodedSNP& decoded) {
+        decoded.block.clear();
         // if it has the intermediate file, then we should have already
         // calculated the counts
-        if (!cur_snp.stored_genotype())
+        if (snp.stored_genotype())
         {
-            cur_snp.get_file_info(idx, byte_pos, m_is_ref);
-
-            auto&& file_name = m_genotype_file_names[idx];
-            if (m_intermediate
-                && cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
-                                      m_prs_calculation.use_ref_maf))
-            {
-                // Have intermediate file and have the counts
-                // read in the genotype information to the genotype vector
-                m_genotype_file.read(file_name, byte_pos, unfiltered_sample_ct4,
-                                     reinterpret_cast<char*>(genotype.data()));
-            }
-            else if (m_intermediate)
-            {
-                // Have intermediate file but not have the counts
-                throw std::logic_error("Error: Sam has a logic error in bgen");
-            }
-            else
-            {
-                // now read in the genotype information
-                context = m_context_map[idx];
-                // start performing the parsing
-                genfile::bgen::read_and_parse_genotype_data_block<
-                    PLINK_generator>(m_genotype_file, file_name + ".bgen",
-                                     context, setter, &m_buffer1, &m_buffer2,
-                                     byte_pos);
-                setter.get_count(homcom_ct, het_ct, homrar_ct, missing_ct);
-            }
-            if (read_only) cur_snp.assign_genotype(genotype);
+            decoded.genotype = snp.get_genotype();
+            snp.get_counts(decoded.homcom_ct, decoded.het_ct, decoded.homrar_ct,
+                           decoded.missing_ct, m_prs_calculation.use_ref_maf);
+            return;
+        }
+        decoded.genotype.assign(unfiltered_sample_ctl * 2, 0);
+        if (m_intermediate
+            && snp.get_counts(decoded.homcom_ct, decoded.het_ct,
+                              decoded.homrar_ct, decoded.missing_ct,
+                              m_prs_calculation.use_ref_maf))
+        {
+            // Have intermediate file and have the counts
+            // read in the genotype information to the genotype vector
+            std::streampos byte_pos;
+            snp.get_file_info(decoded.file_idx, byte_pos, m_is_ref);
+            m_genotype_file.read(
+                m_cache_names[decoded.file_idx], byte_pos,
+                unfiltered_sample_ct4,
+                reinterpret_cast<char*>(decoded.genotype.data()));
+        }
+        else if (m_intermediate)
+        {
+            // Have intermediate file but not have the counts
+            throw std::logic_error("Error: Sam has a logic error in bgen");
         }
         else
         {
-            genotype = cur_snp.get_genotype();
-            cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
-                               m_prs_calculation.use_ref_maf);
+            // the genotype will be decoded by the worker threads
+            read_block(snp, decoded);
         }
+    };
+    auto decode = [this](const SNP&, DecodedSNP& decoded,
+                         GenotypeScratch& scratch) {
+        PLINK_generator setter(&m_calculate_prs, decoded.genotype.data(),
+                               m_hard_threshold, m_dose_threshold);
+        parse_genotype_block(m_context_map[decoded.file_idx], decoded.block,
+                             &scratch.buffer2, setter);
+        setter.get_count(decoded.homcom_ct, decoded.het_ct, decoded.homrar_ct,
+                         decoded.missing_ct);
+    };
+    auto fold = [&](SNP& cur_snp, DecodedSNP& decoded) {
+        if (read_only && !cur_snp.stored_genotype())
+        { cur_snp.assign_genotype(decoded.genotype); }
         // TODO: if we haven't got the count from the genotype matrix, we will
         // need to calculate that, we might not need to do the
         // counting as that is already done when we convert the dosages into
@@ -932,10 +1086,11 @@ void BinaryGen::hard_code_score(
         het_weight = m_het_weight;
         homrar_weight = m_homrar_weight;
         maf = 1.0
-              - static_cast<double>(homcom_weight * homcom_ct
-                                    + het_ct * het_weight
-                                    + homrar_weight * homrar_ct)
-                    / (static_cast<double>(homcom_ct + het_ct + homrar_ct)
+              - static_cast<double>(homcom_weight * decoded.homcom_ct
+                                    + decoded.het_ct * het_weight
+                                    + homrar_weight * decoded.homrar_ct)
+                    / (static_cast<double>(decoded.homcom_ct + decoded.het_ct
+                                           + decoded.homrar_ct)
                        * ploidy);
         if (cur_snp.is_flipped())
         {
@@ -957,14 +1112,16 @@ void BinaryGen::hard_code_score(
         // start reading the genotype
         if (!read_only)
         {
-            read_prs(genotype, prs_list, ploidy, stat, adj_score, miss_score,
-                     miss_count, homcom_weight, het_weight, homrar_weight,
+            read_prs(decoded.genotype, prs_list, ploidy, stat, adj_score,
+                     miss_score, homcom_weight, het_weight, homrar_weight,
                      not_first);
         }
         // we've finish processing the first SNP no longer need to reset the
         // PRS
         not_first = true;
-    }
+    };
+    decode_in_order(m_existed_snps, start_idx, end_idx, slot_size, read,
+                    decode, fold);
 }
 
 
@@ -0,0 +1,684 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "binarypgen.hpp"
+
+BinaryPgen::BinaryPgen(const GenoFile& geno, const Phenotype& pheno,
+                       const std::string& delim, Reporter* reporter)
+{
+    m_hard_coded = geno.hard_coded;
+    const std::string message =
+        initialize(geno, pheno, delim, "pgen", reporter);
+    if (m_sample_file.empty())
+    { m_sample_file = m_genotype_file_names.front() + ".psam"; }
+    m_reporter->report(message);
+}
+
+BinaryPgen::~BinaryPgen() {}
+
+std::vector<Sample_ID> BinaryPgen::gen_sample_vector()
+{
+    assert(m_genotype_file_names.size() > 0);
+    std::ifstream psam(m_sample_file.c_str());
+    if (!psam.is_open())
+    {
+        throw std::runtime_error("Error: Cannot open psam file: "
+                                 + m_sample_file);
+    }
+    // column of each field, ~size_t(0) if it is absent. A file without header
+    // is read as a fam file
+    const size_t absent = ~size_t(0);
+    size_t fid_idx = +FAM::FID, iid_idx = +FAM::IID, dad_idx = +FAM::FATHER,
+           mum_idx = +FAM::MOTHER, sex_idx = +FAM::SEX,
+           pheno_idx = +FAM::PHENOTYPE;
+    size_t num_col = +FAM::MAX;
+    bool has_header = false;
+    std::vector<std::vector<std::string>> samples;
+    std::vector<std::string> token;
+    std::string line;
+    while (std::getline(psam, line))
+    {
+        misc::trim(line);
+        if (line.empty()) continue;
+        misc::split(token, line);
+        if (samples.empty() && !has_header
+            && (token.front() == "#FID" || token.front() == "#IID"))
+        {
+            has_header = true;
+            token.front().erase(0, 1);
+            fid_idx = iid_idx = dad_idx = mum_idx = sex_idx = pheno_idx =
+                absent;
+            for (size_t i = 0; i < token.size(); ++i)
+            {
+                if (token[i] == "FID") { fid_idx = i; }
+                else if (token[i] == "IID")
+                {
+                    iid_idx = i;
+                }
+                else if (token[i] == "PAT")
+                {
+                    dad_idx = i;
+                }
+                else if (token[i] == "MAT")
+                {
+                    mum_idx = i;
+                }
+                else if (token[i] == "SEX")
+                {
+                    sex_idx = i;
+                }
+                else if (token[i] != "SID" && pheno_idx == absent)
+                {
+                    pheno_idx = i;
+                }
+            }
+            num_col = token.size();
+            // without FID, all samples have a FID of 0, which we append to
+            // the end of each line
+            if (fid_idx == absent) fid_idx = num_col;
+            continue;
+        }
+        if (token.size() != num_col)
+        {
+            throw std::runtime_error(
+                "Error: Malformed psam file. Expect " + std::to_string(num_col)
+                + " columns on line: " + std::to_string(samples.size() + 1)
+                + "\n");
+        }
+        if (fid_idx == num_col) token.push_back("0");
+        samples.push_back(token);
+    }
+    psam.close();
+    m_unfiltered_sample_ct = samples.size();
+    std::unordered_set<std::string> founder_info;
+    for (auto&& sample : samples)
+    { founder_info.insert(sample[fid_idx] + m_delim + sample[iid_idx]); }
+    init_sample_vectors();
+    std::vector<Sample_ID> sample_name;
+    std::unordered_set<std::string> samples_in_file;
+    std::vector<std::string> duplicated_sample_id;
+    for (size_t sample_index = 0; sample_index < samples.size();
+         ++sample_index)
+    {
+        auto&& sample = samples[sample_index];
+        const std::string pheno =
+            (pheno_idx == absent) ? "NA" : sample[pheno_idx];
+        gen_sample(fid_idx, iid_idx, sex_idx, dad_idx, mum_idx, sample_index,
+                   founder_info, pheno, sample, sample_name, samples_in_file,
+                   duplicated_sample_id);
+    }
+    if (duplicated_sample_id.size() > 0)
+    {
+        throw std::runtime_error(
+            "Error: A total of " + misc::to_string(duplicated_sample_id.size())
+            + " duplicated samples detected!\n"
+            + "Please ensure all samples have an unique identifier");
+    }
+    post_sample_read_init();
+    return sample_name;
+}
+
+void BinaryPgen::load_pvar(const size_t idx, PvarBatch& batch) const
+{
+    const std::string& prefix = m_genotype_file_names[idx];
+    std::string pvar_name = prefix + ".pvar";
+    if (!std::ifstream(pvar_name.c_str()).is_open()
+        && std::ifstream((pvar_name + ".zst").c_str()).is_open())
+    { pvar_name += ".zst"; }
+    bool compressed;
+    auto pvar = misc::load_stream(pvar_name, compressed);
+    // files without header are read as bim files
+    size_t chr_idx = +BIM::CHR, rs_idx = +BIM::RS, bp_idx = +BIM::BP,
+           a1_idx = +BIM::A1, a2_idx = +BIM::A2;
+    size_t num_col = 0;
+    std::vector<std::string> token;
+    std::string line;
+    while (std::getline(*pvar, line))
+    {
+        misc::trim(line);
+        if (line.empty() || line.rfind("##", 0) == 0) continue;
+        misc::split(token, line);
+        if (line.front() == '#')
+        {
+            token.front().erase(0, 1);
+            auto column = [&token, &pvar_name](const std::string& name) {
+                auto found = std::find(token.begin(), token.end(), name);
+                if (found == token.end())
+                {
+                    throw std::runtime_error("Error: Column " + name
+                                             + " not found in " + pvar_name);
+                }
+                return static_cast<size_t>(found - token.begin());
+            };
+            chr_idx = column("CHROM");
+            bp_idx = column("POS");
+            rs_idx = column("ID");
+            a2_idx = column("REF");
+            a1_idx = column("ALT");
+            num_col = token.size();
+            continue;
+        }
+        if (!num_col)
+        {
+            // bim file without the centimorgan column
+            if (token.size() == 5)
+            {
+                --bp_idx;
+                --a1_idx;
+                --a2_idx;
+            }
+            num_col = token.size();
+        }
+        if (token.size() < num_col
+            || token.size() <= std::max({chr_idx, bp_idx, rs_idx, a1_idx,
+                                         a2_idx}))
+        {
+            throw std::runtime_error(
+                "Error: Malformed pvar file. Less than "
+                + std::to_string(num_col) + " column on line: "
+                + misc::to_string(batch.num_variant + 1) + "\n");
+        }
+        const uint32_t variant = batch.num_variant++;
+        // we only use bi-allelic variants
+        if (token[a1_idx] == "."
+            || token[a1_idx].find(',') != std::string::npos)
+        {
+            ++batch.num_not_biallelic;
+            continue;
+        }
+        std::transform(token[a1_idx].begin(), token[a1_idx].end(),
+                       token[a1_idx].begin(), ::toupper);
+        std::transform(token[a2_idx].begin(), token[a2_idx].end(),
+                       token[a2_idx].begin(), ::toupper);
+        size_t loc = ~size_t(0);
+        if (!misc::parse_value(token[bp_idx], loc))
+        { batch.invalid_loc[batch.rs.size()] = token[bp_idx]; }
+        batch.loc.push_back(loc);
+        batch.variant.push_back(variant);
+        batch.rs.push_back(std::move(token[rs_idx]));
+        batch.chr.push_back(std::move(token[chr_idx]));
+        batch.a1.push_back(std::move(token[a1_idx]));
+        batch.a2.push_back(std::move(token[a2_idx]));
+    }
+}
+
+void BinaryPgen::gen_snp_vector(
+    const std::vector<IITree<size_t, size_t>>& exclusion_regions,
+    const std::string& out_prefix, Genotype* target)
+{
+    const std::string mismatch_snp_record_name = out_prefix + ".mismatch";
+    const std::string mismatch_print_type = (m_is_ref) ? "Reference" : "Base";
+    std::unordered_set<std::string> duplicated_snp;
+    auto&& genotype = (m_is_ref) ? target : this;
+    const bool match_by_pos = genotype->m_match_by_pos;
+    if (match_by_pos) genotype->build_position_index();
+    std::vector<bool> retain_snp(genotype->m_existed_snps.size(), false);
+    std::string prev_chr = "", error_message = "";
+    size_t num_retained = 0;
+    size_t chr_num = 0;
+    int chr_code = 0;
+    bool chr_error = false, chr_sex_error = false, prev_chr_sex_error = false,
+         prev_chr_error = false, flipping = false;
+    m_pgen_index.resize(m_genotype_file_names.size());
+    for (size_t idx = 0; idx < m_genotype_file_names.size(); ++idx)
+    {
+        PvarBatch batch;
+        load_pvar(idx, batch);
+        if (batch.num_not_biallelic)
+        {
+            m_reporter->report(
+                "Warning: " + misc::to_string(batch.num_not_biallelic)
+                + " variant(s) without exactly one ALT allele in "
+                + m_genotype_file_names[idx] + ".pvar are ignored\n");
+        }
+        m_pgen_index[idx].open(m_genotype_file_names[idx] + ".pgen",
+                               static_cast<uint32_t>(m_unfiltered_sample_ct),
+                               batch.num_variant);
+        // variants used, such that we only keep their location in memory
+        std::vector<uint32_t> used_variant;
+        prev_chr = "";
+        for (size_t i_snp = 0; i_snp < batch.rs.size(); ++i_snp)
+        {
+            const std::string& rs = batch.rs[i_snp];
+            const std::string& a1 = batch.a1[i_snp];
+            const std::string& a2 = batch.a2[i_snp];
+            size_t base_idx = StringIndex::npos;
+            if (!match_by_pos)
+            {
+                base_idx = genotype->m_existed_snps_index.find(rs);
+                if (base_idx == StringIndex::npos)
+                {
+                    ++m_base_missed;
+                    continue;
+                }
+            }
+            const std::string& chr = batch.chr[i_snp];
+            if (chr != prev_chr)
+            {
+                chr_code = get_chrom_code_raw(chr.c_str());
+                if (chr_code_check(chr_code, chr_sex_error, chr_error,
+                                   error_message))
+                {
+                    if (chr_error && !prev_chr_error)
+                    {
+                        m_reporter->report(error_message);
+                        prev_chr_error = chr_error;
+                    }
+                    else if (chr_sex_error && !prev_chr_sex_error)
+                    {
+                        m_reporter->report(error_message);
+                        prev_chr_sex_error = chr_sex_error;
+                    }
+                    continue;
+                }
+                prev_chr = chr;
+                chr_num = static_cast<size_t>(chr_code);
+            }
+            auto invalid = batch.invalid_loc.find(i_snp);
+            if (invalid != batch.invalid_loc.end())
+            {
+                throw std::runtime_error(
+                    "Error: Invalid SNP coordinate: " + rs + ":"
+                    + invalid->second
+                    + "\nPlease check you have the correct input");
+            }
+            const size_t loc = static_cast<size_t>(batch.loc[i_snp]);
+            if (Genotype::within_region(exclusion_regions, chr_num, loc))
+            {
+                ++m_num_xrange;
+                continue;
+            }
+            if (match_by_pos)
+            {
+                base_idx = genotype->find_by_position(chr_num, loc, a1, a2);
+                if (base_idx == StringIndex::npos)
+                {
+                    ++m_base_missed;
+                    continue;
+                }
+            }
+            bool ambig = ambiguous(a1, a2);
+            if (retain_snp[base_idx])
+            {
+                duplicated_snp.insert(rs);
+                continue;
+            }
+            else if (!ambig || m_keep_ambig)
+            {
+                m_num_ambig += ambig;
+                if (!genotype->m_existed_snps[base_idx].matching(
+                        chr_num, loc, a1, a2, flipping))
+                {
+                    genotype->print_mismatch(
+                        mismatch_snp_record_name, mismatch_print_type,
+                        genotype->m_existed_snps[base_idx], rs, a1, a2,
+                        chr_num, loc);
+                    ++m_num_ref_target_mismatch;
+                }
+                else
+                {
+                    // the location of a variant is its index in the .pgen
+                    const std::streampos byte_pos =
+                        static_cast<std::streamoff>(batch.variant[i_snp]);
+                    if (ambig)
+                    {
+                        flipping =
+                            (a1 != genotype->m_existed_snps[base_idx].ref());
+                    }
+                    genotype->m_existed_snps[base_idx].add_snp_info(
+                        genotype->m_string_arena, idx, byte_pos, chr_num,
+                        loc, a1, a2, flipping, m_is_ref);
+                    used_variant.push_back(batch.variant[i_snp]);
+                    retain_snp[base_idx] = true;
+                    ++num_retained;
+                }
+            }
+            else
+            {
+                ++m_num_ambig;
+            }
+        }
+        m_pgen_index[idx].retain(used_variant);
+    }
+    genotype->m_position_index.clear();
+    genotype->m_position_index.shrink_to_fit();
+    if (num_retained != genotype->m_existed_snps.size())
+    {
+        genotype->shrink_snp_vector(retain_snp);
+        genotype->update_snp_index();
+    }
+    if (duplicated_snp.size() != 0)
+    {
+        throw std::runtime_error(
+            genotype->print_duplicated_snps(duplicated_snp, out_prefix));
+    }
+}
+
+void BinaryPgen::decode_variant(const size_t file_idx,
+                                const std::streampos byte_pos,
+                                GenotypeScratch& scratch, uintptr_t* genotype,
+                                std::vector<uint16_t>* dosage,
+                                LDBase* ldbase) const
+{
+    const pgen::Index& index = m_pgen_index[file_idx];
+    const size_t handle = m_pgen_handles.at(file_idx);
+    const uint32_t num_sample = static_cast<uint32_t>(m_unfiltered_sample_ct);
+    const uint32_t num_word = QUATERCT_TO_WORDCT(num_sample);
+    auto read = [&](const pgen::Record& record, std::vector<uint8_t>& buffer) {
+        buffer.resize(record.length);
+        m_genotype_file.pread(handle, static_cast<std::streamoff>(record.fpos),
+                              record.length,
+                              reinterpret_cast<char*>(buffer.data()));
+        return buffer.data();
+    };
+    const pgen::Record record = index.record(
+        static_cast<uint32_t>(static_cast<std::streamoff>(byte_pos)));
+    const uint8_t* ptr = read(record, scratch.buffer1);
+    if (index.plink1())
+    {
+        genotype[num_word - 1] = 0;
+        std::memcpy(genotype, ptr, record.length);
+        pgen::from_plink1(genotype, num_sample);
+        if (dosage != nullptr)
+        { pgen::hardcall_dosage(genotype, num_sample, *dosage); }
+        return;
+    }
+    const bool ld_compressed = pgen::ld_compressed(record.vrtype);
+    if (ld_compressed && ldbase != nullptr && ldbase->file_idx == file_idx
+        && ldbase->variant == record.ldbase)
+    {
+        std::copy(ldbase->genotype.begin(), ldbase->genotype.end(),
+                  genotype);
+    }
+    else if (ld_compressed)
+    {
+        const pgen::Record base = index.record(record.ldbase);
+        const uint8_t* base_ptr = read(base, scratch.buffer2);
+        pgen::decode_hardcall(base_ptr, base_ptr + base.length, base.vrtype,
+                              num_sample, genotype);
+        if (ldbase != nullptr)
+        {
+            ldbase->file_idx = file_idx;
+            ldbase->variant = base.variant;
+            ldbase->genotype.assign(genotype, genotype + num_word);
+        }
+    }
+    pgen::decode_record(ptr, ptr + record.length, record.vrtype, num_sample,
+                        genotype, dosage);
+    if (!ld_compressed && ldbase != nullptr)
+    {
+        ldbase->file_idx = file_idx;
+        ldbase->variant = record.variant;
+        ldbase->genotype.assign(genotype, genotype + num_word);
+    }
+}
+
+bool BinaryPgen::calc_freq_gen_inter(const QCFiltering& filter_info,
+                                     const std::string&, Genotype* target,
+                                     bool force_cal)
+{
+    if (misc::logically_equal(filter_info.geno, 1.0)
+        && misc::logically_equal(filter_info.maf, 0.0) && !force_cal)
+    { return false; }
+    const std::string print_target = (m_is_ref) ? "reference" : "target";
+    m_reporter->report("Calculate MAF and perform filtering on " + print_target
+                       + " SNPs\n"
+                         "==================================================");
+    auto&& genotype = (m_is_ref) ? target : this;
+    genotype->sort_snps_by_file(m_is_ref);
+    open_genotype_files();
+    const uintptr_t unfiltered_sample_ctl =
+        BITCT_TO_WORDCT(m_unfiltered_sample_ct);
+    const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
+    const size_t total_snp = genotype->m_existed_snps.size();
+    std::vector<bool> retain_snps(genotype->m_existed_snps.size(), false);
+    double progress = 0.0, prev_progress = -1.0;
+    size_t retained = 0;
+    // SNPs with counts from the cache or the --freq-count file don't need to
+    // be read
+    std::vector<count_cache::Cache> caches;
+    std::vector<MarkerCounts> known_counts;
+    const std::vector<CountSource> source =
+        load_known_counts(genotype, ".pgen", caches, known_counts);
+    auto compute = [&](const size_t start, const size_t end,
+                       MarkerCounts* counts) {
+        auto scratch = m_scratch_pool.acquire();
+        auto&& geno = scratch->tmp_genotype;
+        geno.resize(unfiltered_sample_ctv2, 0);
+        // each thread reads its range in order, so it keeps its own LD base
+        LDBase ldbase;
+        size_t file_idx;
+        std::streampos byte_pos;
+        for (size_t i = start; i < end; ++i, ++counts)
+        {
+            if (source[i] != CountSource::READ)
+            {
+                *counts = known_counts[i];
+                continue;
+            }
+            genotype->m_existed_snps[i].get_file_info(file_idx, byte_pos,
+                                                      m_is_ref);
+            decode_variant(file_idx, byte_pos, *scratch, geno.data(), nullptr,
+                           &ldbase);
+            pgen::to_plink1(geno.data(),
+                            static_cast<uint32_t>(m_unfiltered_sample_ct));
+            single_marker_freqs_and_hwe(
+                unfiltered_sample_ctv2, geno.data(), m_sample_include2.data(),
+                m_founder_include2.data(), m_sample_ct, &counts->ll_ct,
+                &counts->lh_ct, &counts->hh_ct, m_founder_ct, &counts->ll_ctf,
+                &counts->lh_ctf, &counts->hh_ctf);
+        }
+    };
+    // the filtering is done in SNP order, such that the counters do not
+    // depend on the number of thread
+    auto fold = [&](const size_t idx, const MarkerCounts& count) {
+        progress =
+            static_cast<double>(idx) / static_cast<double>(total_snp) * 100;
+        if (progress - prev_progress > 0.01)
+        {
+            fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%",
+                    progress);
+            prev_progress = progress;
+        }
+        auto&& snp = genotype->m_existed_snps[idx];
+        // only counts read from the genotype file are new to the cache
+        if (source[idx] == CountSource::READ && !caches.empty())
+        { cache_counts(count, snp, caches); }
+        if (filter_by_counts(filter_info, count, source[idx], snp))
+        {
+            ++retained;
+            retain_snps[idx] = true;
+        }
+    };
+    process_in_order<MarkerCounts>(
+        total_snp, sizeof(MarkerCounts), 4096,
+        [](const size_t, MarkerCounts&) {}, compute, fold);
+    close_count_caches(caches);
+    fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%\n", 100.0);
+    if (retained != genotype->m_existed_snps.size())
+    { genotype->shrink_snp_vector(retain_snps); }
+    return true;
+}
+
+void BinaryPgen::read_score(
+    std::vector<PRS>& prs_list,
+    const std::vector<size_t>::const_iterator& start_idx,
+    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero,
+    bool ultra)
+{
+    open_genotype_files();
+    if (m_hard_coded)
+    { hard_code_score(prs_list, start_idx, end_idx, reset_zero, ultra); }
+    else
+    {
+        dosage_score(prs_list, start_idx, end_idx, reset_zero);
+    }
+}
+
+void BinaryPgen::hard_code_score(
+    std::vector<PRS>& prs_list,
+    const std::vector<size_t>::const_iterator& start_idx,
+    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero,
+    bool read_only)
+{
+    const uintptr_t unfiltered_sample_ctl =
+        BITCT_TO_WORDCT(m_unfiltered_sample_ct);
+    const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
+    uint32_t ll_ct, lh_ct, hh_ct;
+    uint32_t ll_ctf, lh_ctf, hh_ctf;
+    size_t homrar_ct = 0, missing_ct = 0, het_ct = 0, homcom_ct = 0;
+    size_t tmp_total = 0;
+    const size_t ploidy = 2;
+    double homcom_weight = m_homcom_weight;
+    double het_weight = m_het_weight;
+    double homrar_weight = m_homrar_weight;
+    const bool is_centre =
+        (m_prs_calculation.missing_score == MISSING_SCORE::CENTER);
+    const bool mean_impute =
+        (m_prs_calculation.missing_score == MISSING_SCORE::MEAN_IMPUTE);
+    bool not_first = !reset_zero;
+    double stat, maf, adj_score, miss_score;
+    auto scratch = m_scratch_pool.acquire();
+    std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
+    std::streampos byte_pos;
+    size_t file_idx;
+    for (auto cur_idx = start_idx; cur_idx != end_idx; ++cur_idx)
+    {
+        auto&& cur_snp = m_existed_snps[(*cur_idx)];
+        if (!cur_snp.stored_genotype())
+        {
+            cur_snp.get_file_info(file_idx, byte_pos, false);
+            decode_variant(file_idx, byte_pos, *scratch,
+                           m_tmp_genotype.data(), nullptr, &m_ldbase);
+            pgen::to_plink1(m_tmp_genotype.data(),
+                            static_cast<uint32_t>(m_unfiltered_sample_ct));
+            if (!cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
+                                    m_prs_calculation.use_ref_maf))
+            {
+                single_marker_freqs_and_hwe(
+                    unfiltered_sample_ctv2, m_tmp_genotype.data(),
+                    m_sample_include2.data(), m_founder_include2.data(),
+                    m_sample_ct, &ll_ct, &lh_ct, &hh_ct, m_founder_ct, &ll_ctf,
+                    &lh_ctf, &hh_ctf);
+                homcom_ct = ll_ctf;
+                het_ct = lh_ctf;
+                homrar_ct = hh_ctf;
+                tmp_total = (homcom_ct + het_ct + homrar_ct);
+                assert(m_founder_ct >= tmp_total);
+                missing_ct = m_founder_ct - tmp_total;
+                cur_snp.set_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
+                                   false);
+            }
+            if (m_unfiltered_sample_ct != m_sample_ct)
+            {
+                copy_quaterarr_nonempty_subset(
+                    m_tmp_genotype.data(), m_calculate_prs.data(),
+                    static_cast<uint32_t>(m_unfiltered_sample_ct),
+                    static_cast<uint32_t>(m_sample_ct), genotype.data());
+            }
+            else
+            {
+                std::copy(m_tmp_genotype.begin(), m_tmp_genotype.end(),
+                          genotype.begin());
+            }
+            if (read_only) { cur_snp.assign_genotype(genotype); }
+        }
+        else
+        {
+            genotype = cur_snp.get_genotype();
+            cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
+                               m_prs_calculation.use_ref_maf);
+        }
+        if (m_founder_ct == missing_ct)
+        {
+            cur_snp.invalid();
+            continue;
+        }
+        homcom_weight = m_homcom_weight;
+        het_weight = m_het_weight;
+        homrar_weight = m_homrar_weight;
+        maf = 1.0
+              - static_cast<double>(homcom_weight * homcom_ct
+                                    + het_ct * het_weight
+                                    + homrar_weight * homrar_ct)
+                    / (static_cast<double>((homcom_ct + het_ct + homrar_ct)
+                                           * ploidy));
+        if (cur_snp.is_flipped())
+        {
+            std::swap(homcom_weight, homrar_weight);
+            maf = 1.0 - maf;
+        }
+        stat = cur_snp.stat();
+        adj_score = 0;
+        if (is_centre) { adj_score = ploidy * stat * maf; }
+        miss_score = 0;
+        if (mean_impute) { miss_score = ploidy * stat * maf; }
+        if (!read_only)
+        {
+            read_prs(genotype, prs_list, ploidy, stat, adj_score, miss_score,
+                     homcom_weight, het_weight, homrar_weight, not_first);
+        }
+        not_first = true;
+    }
+}
+
+void BinaryPgen::dosage_score(
+    std::vector<PRS>& prs_list,
+    const std::vector<size_t>::const_iterator& start_idx,
+    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero)
+{
+    bool not_first = !reset_zero;
+    PRS_Interpreter interpreter(&prs_list, m_prs_calculation.missing_score);
+    auto scratch = m_scratch_pool.acquire();
+    std::streampos byte_pos;
+    size_t file_idx;
+    for (auto cur_idx = start_idx; cur_idx != end_idx; ++cur_idx)
+    {
+        auto&& cur_snp = m_existed_snps[(*cur_idx)];
+        cur_snp.get_file_info(file_idx, byte_pos, false);
+        decode_variant(file_idx, byte_pos, *scratch, m_tmp_genotype.data(),
+                       &m_dosage, &m_ldbase);
+        // the ALT allele is the effect allele unless the SNP is flipped
+        double homcom_weight = m_homcom_weight;
+        const double het_weight = m_het_weight;
+        double homrar_weight = m_homrar_weight;
+        if (cur_snp.is_flipped()) std::swap(homcom_weight, homrar_weight);
+        m_sample_dosage.clear();
+        m_sample_missing.clear();
+        for (size_t i = 0; i < m_unfiltered_sample_ct; ++i)
+        {
+            if (!IS_SET(m_calculate_prs.data(), i)) continue;
+            const uint16_t dose = m_dosage[i];
+            if (dose == pgen::dosage_missing)
+            {
+                m_sample_dosage.push_back(0.0);
+                m_sample_missing.push_back(true);
+                continue;
+            }
+            // interpolate between the weights of the nearest genotypes
+            const double count = static_cast<double>(dose) / pgen::dosage_unit;
+            m_sample_dosage.push_back(
+                (count <= 1.0)
+                    ? homcom_weight + (het_weight - homcom_weight) * count
+                    : het_weight + (homrar_weight - het_weight) * (count - 1));
+            m_sample_missing.push_back(false);
+        }
+        interpreter.set_stat(cur_snp.stat(), not_first);
+        interpreter.add(m_sample_dosage, m_sample_missing, 2);
+        not_first = true;
+    }
+}
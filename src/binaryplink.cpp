@@ -113,103 +113,100 @@ bool BinaryPlink::calc_freq_gen_inter(const QCFiltering& filter_info,
                          "==================================================");
     auto&& genotype = (m_is_ref) ? target : this;
     // sort SNPs by the read order to minimize skipping
-    std::sort(
-        begin(genotype->m_existed_snps), end(genotype->m_existed_snps),
-        [this](SNP const& t1, SNP const& t2) {
-            if (t1.get_file_idx(m_is_ref) == t2.get_file_idx(m_is_ref))
-            { return t1.get_byte_pos(m_is_ref) < t2.get_byte_pos(m_is_ref); }
-            else
-                return t1.get_file_idx(m_is_ref) < t2.get_file_idx(m_is_ref);
-        });
+    genotype->sort_snps_by_file(m_is_ref);
     // now process the SNPs
-    const double sample_ct_recip = 1.0 / (static_cast<double>(m_sample_ct));
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
     const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
     const uintptr_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
     const size_t total_snp = genotype->m_existed_snps.size();
     std::vector<bool> retain_snps(genotype->m_existed_snps.size(), false);
-    std::ifstream bed_file;
-    std::string bed_name;
-    std::string prev_file = "";
     double progress = 0.0, prev_progress = -1.0;
-    double cur_maf, cur_geno;
-    std::streampos byte_pos;
-    size_t processed_count = 0;
     size_t retained = 0;
-    size_t cur_file_idx = 0;
-    uint32_t ll_ct = 0;
-    uint32_t lh_ct = 0;
-    uint32_t hh_ct = 0;
-    uint32_t ll_ctf = 0;
-    uint32_t lh_ctf = 0;
-    uint32_t hh_ctf = 0;
-    uint32_t uii = 0;
-    uint32_t missing = 0;
-    uint32_t tmp_total = 0;
-    // initialize the sample inclusion mask
-    for (auto&& snp : genotype->m_existed_snps)
+    // SNPs with counts from the cache or the --freq-count file don't need to
+    // be read
+    std::vector<count_cache::Cache> caches;
+    std::vector<MarkerCounts> known_counts;
+    const std::vector<CountSource> source =
+        load_known_counts(genotype, ".bed", caches, known_counts);
+    open_genotype_files();
+    // with a single thread, all SNPs are read in order, so we can read ahead.
+    // Otherwise each thread reads its own range of SNPs
+    std::unique_ptr<Prefetcher> prefetch;
+    if (m_thread <= 1)
     {
-        progress = static_cast<double>(processed_count)
-                   / static_cast<double>(total_snp) * 100;
-        if (progress - prev_progress > 0.01)
-        {
-            fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%",
-                    progress);
-            prev_progress = progress;
-        }
-        ++processed_count;
-        snp.get_file_info(cur_file_idx, byte_pos, m_is_ref);
-        bed_name = m_genotype_file_names[cur_file_idx] + ".bed";
-
-        m_genotype_file.read(bed_name, byte_pos, unfiltered_sample_ct4,
-                             reinterpret_cast<char*>(m_tmp_genotype.data()));
-        // calculate the MAF using PLINK2 function (take into account of founder
-        // status)
-        single_marker_freqs_and_hwe(
-            unfiltered_sample_ctv2, m_tmp_genotype.data(),
-            m_sample_include2.data(), m_founder_include2.data(), m_sample_ct,
-            &ll_ct, &lh_ct, &hh_ct, m_founder_ct, &ll_ctf, &lh_ctf, &hh_ctf);
-        uii = ll_ct + lh_ct + hh_ct;
-        cur_geno = 1.0 - (static_cast<int32_t>(uii)) * sample_ct_recip;
-        uii = 2 * (ll_ctf + lh_ctf + hh_ctf);
-        tmp_total = (ll_ctf + lh_ctf + hh_ctf);
-        assert(m_founder_ct >= tmp_total);
-        missing = static_cast<uint32_t>(m_founder_ct) - tmp_total;
-        if (!uii) { cur_maf = 0.5; }
-        else
+        std::vector<Prefetcher::Request> requests;
+        requests.reserve(total_snp);
+        for (size_t i = 0; i < total_snp; ++i)
         {
-            cur_maf = (static_cast<double>(2 * hh_ctf + lh_ctf))
-                      / (static_cast<double>(uii));
-
-            cur_maf = (cur_maf > 0.5) ? 1 - cur_maf : cur_maf;
+            if (source[i] != CountSource::READ) continue;
+            auto&& snp = genotype->m_existed_snps[i];
+            requests.push_back(
+                {snp.get_file_idx(m_is_ref), snp.get_byte_pos(m_is_ref)});
         }
-        if (misc::logically_equal(cur_maf, 0.0)
-            || misc::logically_equal(cur_maf, 1.0))
+        prefetch = prefetch_bed(std::move(requests));
+    }
+    auto compute = [&](const size_t start, const size_t end,
+                       MarkerCounts* counts) {
+        auto scratch = m_scratch_pool.acquire();
+        auto&& geno = scratch->tmp_genotype;
+        geno.resize(unfiltered_sample_ctv2, 0);
+        size_t file_idx;
+        std::streampos byte_pos;
+        for (size_t i = start; i < end; ++i, ++counts)
         {
-            // none of the sample contain this SNP
-            // still count as MAF filtering (for now)
-            ++m_num_maf_filter;
-            continue;
+            if (source[i] != CountSource::READ)
+            {
+                *counts = known_counts[i];
+                continue;
+            }
+            if (prefetch)
+            {
+                std::memcpy(geno.data(), prefetch->next(),
+                            unfiltered_sample_ct4);
+            }
+            else
+            {
+                genotype->m_existed_snps[i].get_file_info(file_idx, byte_pos,
+                                                          m_is_ref);
+                m_genotype_file.pread(m_bed_handles[file_idx], byte_pos,
+                                      unfiltered_sample_ct4,
+                                      reinterpret_cast<char*>(geno.data()));
+            }
+            // calculate the MAF using PLINK2 function (take into account of
+            // founder status)
+            single_marker_freqs_and_hwe(
+                unfiltered_sample_ctv2, geno.data(), m_sample_include2.data(),
+                m_founder_include2.data(), m_sample_ct, &counts->ll_ct,
+                &counts->lh_ct, &counts->hh_ct, m_founder_ct, &counts->ll_ctf,
+                &counts->lh_ctf, &counts->hh_ctf);
         }
-        // filter by genotype missingness
-        if (filter_info.geno < cur_geno)
+    };
+    // the filtering is done in SNP order, such that the counters do not
+    // depend on the number of thread
+    auto fold = [&](const size_t idx, const MarkerCounts& count) {
+        progress =
+            static_cast<double>(idx) / static_cast<double>(total_snp) * 100;
+        if (progress - prev_progress > 0.01)
         {
-            ++m_num_geno_filter;
-            continue;
+            fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%",
+                    progress);
+            prev_progress = progress;
         }
-        if (cur_maf < filter_info.maf)
+        auto&& snp = genotype->m_existed_snps[idx];
+        // only counts read from the genotype file are new to the cache
+        if (source[idx] == CountSource::READ && !caches.empty())
+        { cache_counts(count, snp, caches); }
+        if (filter_by_counts(filter_info, count, source[idx], snp))
         {
-            ++m_num_maf_filter;
-            continue;
+            ++retained;
+            retain_snps[idx] = true;
         }
-        // if we can reach here, it is not removed
-        snp.set_counts(ll_ctf, lh_ctf, hh_ctf, missing, m_is_ref);
-        ++retained;
-        // we need to -1 because we put processed_count ++ forward
-        // to avoid continue skipping out the addition
-        retain_snps[processed_count - 1] = true;
-    }
+    };
+    process_in_order<MarkerCounts>(
+        total_snp, sizeof(MarkerCounts), 4096,
+        [](const size_t, MarkerCounts&) {}, compute, fold);
+    close_count_caches(caches);
     fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%\n", 100.0);
     // now update the vector
     if (retained != genotype->m_existed_snps.size())
@@ -224,54 +221,217 @@ void BinaryPlink::gen_snp_vector(
     const uintptr_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
     const std::string mismatch_snp_record_name = out_prefix + ".mismatch";
     const std::string mismatch_print_type = (m_is_ref) ? "Reference" : "Base";
-    std::unordered_set<std::string> processed_snps;
     std::unordered_set<std::string> duplicated_snp;
-    std::vector<std::string> bim_token;
     auto&& genotype = (m_is_ref) ? target : this;
+    const bool match_by_pos = genotype->m_match_by_pos;
+    if (match_by_pos) genotype->build_position_index();
     std::vector<bool> retain_snp(genotype->m_existed_snps.size(), false);
-    std::ifstream bim;
-    std::string bim_name, bed_name, chr, line;
     std::string prev_chr = "", error_message = "";
-    std::string prefix;
-    uintptr_t bed_offset;
     size_t num_retained = 0;
     size_t chr_num = 0;
-    size_t num_snp_read = 0;
     std::streampos byte_pos;
     int chr_code = 0;
     bool chr_error = false, chr_sex_error = false, prev_chr_sex_error = false,
          prev_chr_error = false, flipping = false;
-    for (size_t idx = 0; idx < m_genotype_file_names.size(); ++idx)
+    // files are independent, so we load up to m_thread files at a time and
+    // merge them in file order, such that the result is identical to reading
+    // them one by one
+    const size_t num_file = m_genotype_file_names.size();
+    const size_t num_thread =
+        std::max(std::min(m_thread, num_file), size_t(1));
+    std::vector<BimBatch> batches(num_thread);
+    std::vector<std::thread> workers;
+    for (size_t start = 0; start < num_file; start += num_thread)
+    {
+        const size_t end = std::min(start + num_thread, num_file);
+        workers.clear();
+        for (size_t idx = start; idx < end; ++idx)
+        {
+            auto&& batch = batches[idx - start];
+            batch = BimBatch();
+            // let the main thread do the last file
+            if (idx + 1 == end) { load_bim(idx, batch); }
+            else
+            {
+                workers.push_back(std::thread(&BinaryPlink::load_bim, this,
+                                              idx, std::ref(batch)));
+            }
+        }
+        for (auto&& worker : workers) worker.join();
+        for (size_t idx = start; idx < end; ++idx)
+        {
+            auto&& batch = batches[idx - start];
+            if (batch.error) std::rethrow_exception(batch.error);
+            if (!batch.warning.empty()) cache_warning(batch.warning);
+            prev_chr = "";
+            for (size_t i_snp = 0; i_snp < batch.rs.size(); ++i_snp)
+            {
+                const std::string& rs = batch.rs[i_snp];
+                const std::string& a1 = batch.a1[i_snp];
+                const std::string& a2 = batch.a2[i_snp];
+                // when matching by position, we can only search for the SNP
+                // once the coordinate and alleles are parsed
+                size_t base_idx = StringIndex::npos;
+                if (!match_by_pos)
+                {
+                    base_idx = genotype->m_existed_snps_index.find(rs);
+                    if (base_idx == StringIndex::npos)
+                    {
+                        ++m_base_missed;
+                        continue;
+                    }
+                }
+                // check if this is a new chromosome. If this is a new
+                // chromosome, check if we want to remove it
+                const std::string& chr = batch.chr[i_snp];
+                if (chr != prev_chr)
+                {
+                    // get the chromosome code using PLINK 2 function
+                    chr_code = get_chrom_code_raw(chr.c_str());
+                    // check if we want to skip this chromosome
+                    if (chr_code_check(chr_code, chr_sex_error, chr_error,
+                                       error_message))
+                    {
+                        // only print chr error message if we haven't already
+                        if (chr_error && !prev_chr_error)
+                        {
+                            m_reporter->report(error_message);
+                            prev_chr_error = chr_error;
+                        }
+                        // only print sex chr error message if we haven't
+                        // already
+                        else if (chr_sex_error && !prev_chr_sex_error)
+                        {
+                            m_reporter->report(error_message);
+                            prev_chr_sex_error = chr_sex_error;
+                        }
+                        continue;
+                    }
+                    // only update the prev_chr after we have done the
+                    // checking this will help us to continue to skip all SNPs
+                    // that are supposed to be removed instead of the first
+                    // entry
+                    prev_chr = chr;
+                    chr_num = static_cast<size_t>(chr_code);
+                }
+                auto invalid = batch.invalid_loc.find(i_snp);
+                if (invalid != batch.invalid_loc.end())
+                {
+                    throw std::runtime_error(
+                        "Error: Invalid SNP coordinate: " + rs + ":"
+                        + invalid->second
+                        + "\nPlease check you have the correct input");
+                }
+                const size_t loc = static_cast<size_t>(batch.loc[i_snp]);
+                if (Genotype::within_region(exclusion_regions, chr_num, loc))
+                {
+                    ++m_num_xrange;
+                    continue;
+                }
+                if (match_by_pos)
+                {
+                    base_idx = genotype->find_by_position(chr_num, loc, a1, a2);
+                    if (base_idx == StringIndex::npos)
+                    {
+                        ++m_base_missed;
+                        continue;
+                    }
+                }
+                // check if this is a duplicated SNP
+                bool ambig = ambiguous(a1, a2);
+                // a SNP is only retained once it is processed
+                if (retain_snp[base_idx])
+                {
+                    duplicated_snp.insert(rs);
+                    continue;
+                }
+                else if (!ambig || m_keep_ambig)
+                {
+                    // if the SNP is not ambiguous (or if we want to keep
+                    // ambiguous SNPs)
+                    m_num_ambig += ambig;
+                    if (!genotype->m_existed_snps[base_idx].matching(
+                            chr_num, loc, a1, a2, flipping))
+                    {
+                        genotype->print_mismatch(
+                            mismatch_snp_record_name, mismatch_print_type,
+                            genotype->m_existed_snps[base_idx], rs, a1, a2,
+                            chr_num, loc);
+                        ++m_num_ref_target_mismatch;
+                    }
+                    else
+                    {
+                        byte_pos = static_cast<std::streampos>(
+                            batch.bed_offset + (i_snp * unfiltered_sample_ct4));
+                        if (ambig)
+                        {
+                            flipping = (a1
+                                        != genotype->m_existed_snps[base_idx]
+                                               .ref());
+                        }
+                        genotype->m_existed_snps[base_idx].add_snp_info(
+                            genotype->m_string_arena, idx, byte_pos, chr_num,
+                            loc, a1, a2, flipping, m_is_ref);
+                        retain_snp[base_idx] = true;
+                        ++num_retained;
+                    }
+                }
+                else
+                {
+                    ++m_num_ambig;
+                }
+            }
+            // release the memory before loading the next files
+            batch = BimBatch();
+        }
+    }
+    // try to release memory
+    genotype->m_position_index.clear();
+    genotype->m_position_index.shrink_to_fit();
+    if (num_retained != genotype->m_existed_snps.size())
     {
-        // go through each genotype file
-        prefix = m_genotype_file_names[idx];
-        bim_name = prefix + ".bim";
-        bed_name = prefix + ".bed";
-        // make sure we reset the flag of the ifstream by closing it before use
-        if (bim.is_open()) bim.close();
-        bim.clear();
-        bim.open(bim_name.c_str());
+        genotype->shrink_snp_vector(retain_snp);
+        // need to update index search after we updated the vector
+        genotype->update_snp_index();
+    }
+    if (duplicated_snp.size() != 0)
+    {
+        throw std::runtime_error(
+            genotype->print_duplicated_snps(duplicated_snp, out_prefix));
+    }
+}
+
+void BinaryPlink::load_bim(const size_t idx, BimBatch& batch)
+{
+    try
+    {
+        const std::string& prefix = m_genotype_file_names[idx];
+        const std::string bim_name = prefix + ".bim";
+        const std::string bed_name = prefix + ".bed";
+        bool use_cache = !m_cache_dir.empty();
+        const std::string cache_file =
+            use_cache ? misc::cache_file(m_cache_dir, bim_name, ".prsice.idx")
+                      : "";
+        std::ifstream bim(bim_name.c_str());
         if (!bim.is_open())
         {
             throw std::runtime_error("Error: Cannot open bim file: "
                                      + bim_name);
         }
-        // First pass, get the number of marker in bed & bim
-        // as we want the number for checking, num_snp_read will start at 0
-        num_snp_read = 0;
-        prev_chr = "";
-        while (std::getline(bim, line))
+        unsigned long long key = 0;
+        try
         {
-            misc::trim(line);
-            if (line.empty()) continue;
-            ++num_snp_read;
+            if (use_cache) key = bim_cache_key(prefix);
         }
-        bim.clear();
-        bim.seekg(0, bim.beg);
-        // check if the bed file is valid
-        check_bed(bed_name, num_snp_read, bed_offset);
-        // now go through the bim file and perform filtering
-        num_snp_read = 0;
+        catch (const std::runtime_error&)
+        {
+            // let check_bed report the missing .bed file
+            use_cache = false;
+        }
+        if (use_cache && load_bim_cache(cache_file, key, batch)) return;
+        std::vector<std::string> bim_token;
+        std::string line;
+        size_t num_snp_read = 0;
         while (std::getline(bim, line))
         {
             misc::trim(line);
@@ -286,64 +446,6 @@ void BinaryPlink::gen_snp_vector(
                     "line: "
                     + misc::to_string(num_snp_read) + "\n");
             }
-            auto&& base_idx =
-                genotype->m_existed_snps_index.find(bim_token[+BIM::RS]);
-            if (base_idx == genotype->m_existed_snps_index.end())
-            {
-                ++m_base_missed;
-                continue;
-            }
-            // read in the chromosome string
-            chr = bim_token[+BIM::CHR];
-            // check if this is a new chromosome. If this is a new chromosome,
-            // check if we want to remove it
-            if (chr != prev_chr)
-            {
-                // get the chromosome code using PLINK 2 function
-                chr_code = get_chrom_code_raw(chr.c_str());
-                // check if we want to skip this chromosome
-                if (chr_code_check(chr_code, chr_sex_error, chr_error,
-                                   error_message))
-                {
-                    // only print chr error message if we haven't already
-                    if (chr_error && !prev_chr_error)
-                    {
-                        m_reporter->report(error_message);
-                        prev_chr_error = chr_error;
-                    }
-                    // only print sex chr error message if we haven't already
-                    else if (chr_sex_error && !prev_chr_sex_error)
-                    {
-                        m_reporter->report(error_message);
-                        prev_chr_sex_error = chr_sex_error;
-                    }
-                    continue;
-                }
-                // only update the prev_chr after we have done the checking
-                // this will help us to continue to skip all SNPs that are
-                // supposed to be removed instead of the first entry
-                prev_chr = chr;
-                chr_num = static_cast<size_t>(chr_code);
-            }
-            // now read in the coordinate
-            size_t loc = ~size_t(0);
-            try
-            {
-                loc = misc::string_to_size_t(bim_token[+BIM::BP].c_str());
-            }
-            catch (...)
-            {
-                throw std::runtime_error(
-                    "Error: Invalid SNP coordinate: " + bim_token[+BIM::RS]
-                    + ":" + bim_token[+BIM::BP]
-                    + "\nPlease check you have the correct input");
-            }
-            if (Genotype::within_region(exclusion_regions, chr_num, loc))
-            {
-                ++m_num_xrange;
-                continue;
-            }
-
             // ensure all alleles are capitalized for easy matching
             std::transform(bim_token[+BIM::A1].begin(),
                            bim_token[+BIM::A1].end(),
@@ -351,67 +453,157 @@ void BinaryPlink::gen_snp_vector(
             std::transform(bim_token[+BIM::A2].begin(),
                            bim_token[+BIM::A2].end(),
                            bim_token[+BIM::A2].begin(), ::toupper);
-            // check if this is a duplicated SNP
-            bool ambig = ambiguous(bim_token[+BIM::A1], bim_token[+BIM::A2]);
-            if (processed_snps.find(bim_token[+BIM::RS])
-                != processed_snps.end())
-            {
-                duplicated_snp.insert(bim_token[+BIM::RS]);
-                continue;
-            }
-            else if (!ambig || m_keep_ambig)
-            {
-                // if the SNP is not ambiguous (or if we want to keep ambiguous
-                // SNPs)
-                m_num_ambig += ambig;
-                if (!genotype->m_existed_snps[base_idx->second].matching(
-                        chr_num, loc, bim_token[+BIM::A1], bim_token[+BIM::A2],
-                        flipping))
-                {
-                    genotype->print_mismatch(
-                        mismatch_snp_record_name, mismatch_print_type,
-                        genotype->m_existed_snps[base_idx->second],
-                        bim_token[+BIM::RS], bim_token[+BIM::A1],
-                        bim_token[+BIM::A2], chr_num, loc);
-                    ++m_num_ref_target_mismatch;
-                }
-                else
-                {
-                    byte_pos = static_cast<std::streampos>(
-                        bed_offset
-                        + ((num_snp_read - 1) * (unfiltered_sample_ct4)));
-                    if (ambig)
-                    {
-                        flipping = (bim_token[+BIM::A1]
-                                    != m_existed_snps[base_idx->second].ref());
-                    }
-                    genotype->m_existed_snps[base_idx->second].add_snp_info(
-                        idx, byte_pos, chr_num, loc, bim_token[+BIM::A1],
-                        bim_token[+BIM::A2], flipping, m_is_ref);
-                    processed_snps.insert(bim_token[+BIM::RS]);
-                    retain_snp[base_idx->second] = true;
-                    ++num_retained;
-                }
-            }
-            else
-            {
-                ++m_num_ambig;
-            }
+            size_t loc = ~size_t(0);
+            if (!misc::parse_value(bim_token[+BIM::BP], loc))
+            { batch.invalid_loc[batch.rs.size()] = bim_token[+BIM::BP]; }
+            batch.loc.push_back(loc);
+            batch.rs.push_back(std::move(bim_token[+BIM::RS]));
+            batch.chr.push_back(std::move(bim_token[+BIM::CHR]));
+            batch.a1.push_back(std::move(bim_token[+BIM::A1]));
+            batch.a2.push_back(std::move(bim_token[+BIM::A2]));
         }
         bim.close();
+        // check if the bed file is valid
+        check_bed(bed_name, num_snp_read, batch.bed_offset);
+        // the error message of invalid coordinates need the original input,
+        // so we don't cache those files
+        if (use_cache && batch.invalid_loc.empty()
+            && !save_bim_cache(cache_file, key, batch))
+        {
+            batch.warning = "Warning: Failed to write bim cache file "
+                            + cache_file;
+        }
     }
-    // try to release memory
-    if (num_retained != genotype->m_existed_snps.size())
+    catch (...)
     {
-        genotype->shrink_snp_vector(retain_snp);
-        // need to update index search after we updated the vector
-        genotype->update_snp_index();
+        batch.error = std::current_exception();
     }
-    if (duplicated_snp.size() != 0)
+}
+
+unsigned long long BinaryPlink::bim_cache_key(const std::string& prefix) const
+{
+    misc::Hasher hasher;
+    hasher.add(m_bim_cache_version)
+        .add_file_stat(prefix + ".bim")
+        .add_file_ends(prefix + ".bim")
+        .add_file_stat(prefix + ".bed")
+        .add_file_ends(prefix + ".bed")
+        .add(m_unfiltered_sample_ct);
+    return hasher.value();
+}
+
+bool BinaryPlink::load_bim_cache(const std::string& cache_file,
+                                 const unsigned long long key,
+                                 BimBatch& batch) const
+{
+    std::ifstream cache(cache_file.c_str(), std::ios::binary);
+    if (!cache.is_open()) return false;
+    cache.seekg(0, cache.end);
+    const unsigned long long file_length =
+        static_cast<unsigned long long>(cache.tellg());
+    cache.seekg(0, cache.beg);
+    auto read_vector = [&cache](auto& vec, const size_t size) {
+        vec.resize(size);
+        cache.read(reinterpret_cast<char*>(vec.data()),
+                   static_cast<std::streamsize>(
+                       size * sizeof(typename std::decay_t<decltype(vec)>::
+                                         value_type)));
+    };
+    std::string magic(m_bim_cache_magic.size(), '\0');
+    unsigned long long version = 0, cached_key = 0;
+    cache.read(&magic[0], static_cast<std::streamsize>(magic.size()));
+    cache.read(reinterpret_cast<char*>(&version), sizeof(version));
+    cache.read(reinterpret_cast<char*>(&cached_key), sizeof(cached_key));
+    if (!cache || magic != m_bim_cache_magic || version != m_bim_cache_version
+        || cached_key != key)
+    { return false; }
+    // header of the cache: number of SNPs, total length of all strings and
+    // the offset of the .bed file
+    std::vector<unsigned long long> header;
+    read_vector(header, 3);
+    // make sure the cache isn't truncated before we allocate the memory
+    const unsigned long long expected_length =
+        magic.size() + sizeof(version) + sizeof(cached_key)
+        + (header.size() + header[0]) * sizeof(uint64_t)
+        + 4 * header[0] * sizeof(uint32_t) + header[1];
+    if (!cache || expected_length != file_length) return false;
+    const size_t num_snp = header[0];
+    std::vector<uint32_t> str_length;
+    std::string str_blob;
+    read_vector(batch.loc, num_snp);
+    // rs, chr, a1 and a2 of all SNPs
+    read_vector(str_length, 4 * num_snp);
+    str_blob.resize(header[1]);
+    cache.read(&str_blob[0], static_cast<std::streamsize>(str_blob.size()));
+    if (!cache) return false;
+    size_t offset = 0;
+    auto next_str = [&str_blob, &str_length, &offset](size_t idx) {
+        std::string res = str_blob.substr(offset, str_length[idx]);
+        offset += str_length[idx];
+        return res;
+    };
+    for (auto* column : {&batch.rs, &batch.chr, &batch.a1, &batch.a2})
+    { column->reserve(num_snp); }
+    for (size_t i = 0; i < num_snp; ++i)
     {
-        throw std::runtime_error(
-            genotype->print_duplicated_snps(duplicated_snp, out_prefix));
+        batch.rs.push_back(next_str(4 * i));
+        batch.chr.push_back(next_str(4 * i + 1));
+        batch.a1.push_back(next_str(4 * i + 2));
+        batch.a2.push_back(next_str(4 * i + 3));
     }
+    batch.bed_offset = static_cast<uintptr_t>(header[2]);
+    return true;
+}
+
+bool BinaryPlink::save_bim_cache(const std::string& cache_file,
+                                 const unsigned long long key,
+                                 const BimBatch& batch) const
+{
+    const size_t num_snp = batch.rs.size();
+    std::vector<uint32_t> str_length;
+    str_length.reserve(4 * num_snp);
+    std::string str_blob;
+    auto add_str = [&str_blob, &str_length](std::string_view str) {
+        str_length.push_back(static_cast<uint32_t>(str.size()));
+        str_blob.append(str);
+    };
+    for (size_t i = 0; i < num_snp; ++i)
+    {
+        add_str(batch.rs[i]);
+        add_str(batch.chr[i]);
+        add_str(batch.a1[i]);
+        add_str(batch.a2[i]);
+    }
+    std::vector<unsigned long long> header = {num_snp, str_blob.size(),
+                                              batch.bed_offset};
+    // write to a temporary file first so that an interrupted run won't leave
+    // behind a corrupted cache
+    const std::string tmp_name = misc::tmp_file(cache_file);
+    std::ofstream cache(tmp_name.c_str(), std::ios::binary);
+    if (!cache.is_open()) return false;
+    auto write_vector = [&cache](const auto& vec) {
+        cache.write(reinterpret_cast<const char*>(vec.data()),
+                    static_cast<std::streamsize>(
+                        vec.size()
+                        * sizeof(typename std::decay_t<decltype(vec)>::
+                                     value_type)));
+    };
+    const unsigned long long version = m_bim_cache_version;
+    cache.write(m_bim_cache_magic.data(),
+                static_cast<std::streamsize>(m_bim_cache_magic.size()));
+    cache.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    cache.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    write_vector(header);
+    write_vector(batch.loc);
+    write_vector(str_length);
+    write_vector(str_blob);
+    cache.close();
+    if (!cache || std::rename(tmp_name.c_str(), cache_file.c_str()) != 0)
+    {
+        std::remove(tmp_name.c_str());
+        return false;
+    }
+    return true;
 }
 
 void BinaryPlink::check_bed(const std::string& bed_name, size_t num_marker,
@@ -502,6 +694,26 @@ void BinaryPlink::check_bed(const std::string& bed_name, size_t num_marker,
 
 BinaryPlink::~BinaryPlink() {}
 
+std::unique_ptr<Prefetcher>
+BinaryPlink::prefetch_bed(std::vector<Prefetcher::Request>&& requests)
+{
+    // starting a thread is not free, only worth it for longer runs of SNPs
+    const size_t min_prefetch = 64;
+    if (requests.size() < min_prefetch) return nullptr;
+    const size_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
+    // limit the read ahead to around 64MB
+    const size_t max_depth = 256;
+    const size_t depth =
+        std::min(max_depth, (size_t(1) << 26) / unfiltered_sample_ct4);
+    std::vector<std::string> bed_names;
+    bed_names.reserve(m_genotype_file_names.size());
+    for (auto&& name : m_genotype_file_names)
+    { bed_names.push_back(name + ".bed"); }
+    return std::make_unique<Prefetcher>(std::move(bed_names),
+                                        std::move(requests),
+                                        unfiltered_sample_ct4, depth);
+}
+
 void BinaryPlink::read_score(
     std::vector<PRS>& prs_list,
     const std::vector<size_t>::const_iterator& start_idx,
@@ -531,12 +743,6 @@ void BinaryPlink::read_score(
     double homcom_weight = m_homcom_weight;
     double het_weight = m_het_weight;
     double homrar_weight = m_homrar_weight;
-    // this is required if we want to calculate the MAF from the genotype (for
-    // imputation of missing genotype)
-    // if we want to set the missing score to zero, miss_count will equal to 0,
-    // 1 otherwise
-    const size_t miss_count =
-        (m_prs_calculation.missing_score != MISSING_SCORE::SET_ZERO) * ploidy;
     // this indicate if we want the mean of the genotype to be 0 (missingness =
     // 0)
     const bool is_centre =
@@ -555,24 +761,47 @@ void BinaryPlink::read_score(
     std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
     std::vector<size_t>::const_iterator cur_idx = start_idx;
     std::streampos cur_line;
-    std::string file_name;
     size_t file_idx;
+    // the SNPs are sorted by their file position, so we can read ahead the
+    // genotypes that are not already stored in memory
+    std::vector<Prefetcher::Request> requests;
     for (; cur_idx != end_idx; ++cur_idx)
+    {
+        auto&& cur_snp = m_existed_snps[(*cur_idx)];
+        if (!cur_snp.stored_genotype())
+        {
+            requests.push_back(
+                {cur_snp.get_file_idx(), cur_snp.get_byte_pos()});
+        }
+    }
+    auto prefetch = prefetch_bed(std::move(requests));
+    for (cur_idx = start_idx; cur_idx != end_idx; ++cur_idx)
     {
         auto&& cur_snp = m_existed_snps[(*cur_idx)];
         if (!cur_snp.stored_genotype())
         {
             cur_snp.get_file_info(file_idx, cur_line, false);
-            file_name = m_genotype_file_names[file_idx] + ".bed";
             // we now read the genotype from the file by calling
             // load_and_collapse_incl
             // important point to note here is the use of m_sample_include and
             // m_sample_ct instead of using the m_founder m_founder_info as the
             // founder vector is for LD calculation whereas the sample_include
-            // is for PRS
-            m_genotype_file.read(
-                file_name, cur_line, unfiltered_sample_ct4,
-                reinterpret_cast<char*>(m_tmp_genotype.data()));
+            // is for PRS. When no sample is filtered, we can read directly
+            // into the genotype vector and avoid the extra copy
+            uintptr_t* geno_buffer = (m_unfiltered_sample_ct != m_sample_ct)
+                                         ? m_tmp_genotype.data()
+                                         : genotype.data();
+            if (prefetch)
+            {
+                std::memcpy(geno_buffer, prefetch->next(),
+                            unfiltered_sample_ct4);
+            }
+            else
+            {
+                m_genotype_file.read(bed_handle(file_idx), cur_line,
+                                     unfiltered_sample_ct4,
+                                     reinterpret_cast<char*>(geno_buffer));
+            }
             if (!cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
                                     m_prs_calculation.use_ref_maf))
             {
@@ -580,7 +809,7 @@ void BinaryPlink::read_score(
                 // if we want to use reference, we will always have calculated
                 // the MAF
                 single_marker_freqs_and_hwe(
-                    unfiltered_sample_ctv2, m_tmp_genotype.data(),
+                    unfiltered_sample_ctv2, geno_buffer,
                     m_sample_include2.data(), m_founder_include2.data(),
                     m_sample_ct, &ll_ct, &lh_ct, &hh_ct, m_founder_ct, &ll_ctf,
                     &lh_ctf, &hh_ctf);
@@ -601,10 +830,7 @@ void BinaryPlink::read_score(
                     static_cast<uint32_t>(m_sample_ct), genotype.data());
             }
             else
-            {
-                genotype = m_tmp_genotype;
-                genotype[(m_unfiltered_sample_ct - 1) / BITCT2] &= final_mask;
-            }
+            { genotype[(m_unfiltered_sample_ct - 1) / BITCT2] &= final_mask; }
             if (read_only) { cur_snp.assign_genotype(genotype); }
         }
         else
@@ -642,8 +868,7 @@ void BinaryPlink::read_score(
         if (!read_only)
         {
             read_prs(genotype, prs_list, ploidy, stat, adj_score, miss_score,
-                     miss_count, homcom_weight, het_weight, homrar_weight,
-                     not_first);
+                     homcom_weight, het_weight, homrar_weight, not_first);
         }
         // indicate that we've already read in the first SNP and no longer need
         // to reset the PRS
@@ -87,6 +87,8 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"index", no_argument, &m_base_info.is_index, 1},
         {"keep-ambig", no_argument, &m_keep_ambig, 1},
         {"logit-perm", no_argument, &m_perm_info.logit_perm, 1},
+        {"match-by-pos", no_argument, &m_match_by_pos, 1},
+        {"no-cache", no_argument, &m_no_cache, 1},
         {"no-clump", no_argument, &m_clump_info.no_clump, 1},
         {"non-cumulate", no_argument, &m_prs_info.non_cumulate, 1},
         {"no-default", no_argument, &m_user_no_default, 1},
@@ -104,10 +106,12 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"a2", required_argument, nullptr, 0},
         {"background", required_argument, nullptr, 0},
         {"bar-levels", required_argument, nullptr, 0},
+        {"base-cache", required_argument, nullptr, 0},
         {"base-info", required_argument, nullptr, 0},
         {"base-maf", required_argument, nullptr, 0},
         {"binary-target", required_argument, nullptr, 0},
         {"bp", required_argument, nullptr, 0},
+        {"cache-dir", required_argument, nullptr, 0},
         {"chr", required_argument, nullptr, 0},
         {"clump-kb", required_argument, nullptr, 0},
         {"clump-p", required_argument, nullptr, 0},
@@ -117,12 +121,14 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"exclude", required_argument, nullptr, 0},
         {"extract", required_argument, nullptr, 0},
         {"feature", required_argument, nullptr, 0},
+        {"freq-count", required_argument, nullptr, 0},
         {"geno", required_argument, nullptr, 0},
         {"hard-thres", required_argument, nullptr, 0},
         {"id-delim", required_argument, nullptr, 0},
         {"info", required_argument, nullptr, 0},
         {"keep", required_argument, nullptr, 0},
         {"ld-dose-thres", required_argument, nullptr, 0},
+        {"ld-freq-count", required_argument, nullptr, 0},
         {"ld-keep", required_argument, nullptr, 0},
         {"ld-list", required_argument, nullptr, 0},
         {"ld-type", required_argument, nullptr, 0},
@@ -133,14 +139,17 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"ld-info", required_argument, nullptr, 0},
         {"maf", required_argument, nullptr, 0},
         {"memory", required_argument, nullptr, 0},
+        {"merge-shard", required_argument, nullptr, 0},
         {"missing", required_argument, nullptr, 0},
         {"model", required_argument, nullptr, 0},
         {"num-auto", required_argument, nullptr, 0},
         {"perm", required_argument, nullptr, 0},
         {"proxy", required_argument, nullptr, 0},
+        {"read-gap", required_argument, nullptr, 0},
         {"remove", required_argument, nullptr, 0},
         {"score", required_argument, nullptr, 0},
         {"set-perm", required_argument, nullptr, 0},
+        {"shard-chr", required_argument, nullptr, 0},
         {"snp", required_argument, nullptr, 0},
         {"snp-set", required_argument, nullptr, 0},
         {"stat", required_argument, nullptr, 0},
@@ -186,6 +195,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                     optarg, command, m_p_thresholds.bar_levels);
                 m_p_thresholds.set_threshold = true;
             }
+            else if (command == "base-cache")
+                set_string(optarg, command, m_base_info.cache_file);
             else if (command == "base-info")
                 set_string(optarg, command, +BASE_INDEX::INFO);
             else if (command == "base-maf")
@@ -195,6 +206,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                     !parse_binary_vector(optarg, command, m_pheno_info.binary);
             else if (command == "bp")
                 set_string(optarg, command, +BASE_INDEX::BP);
+            else if (command == "cache-dir")
+                set_string(optarg, command, m_cache_dir);
             else if (command == "chr")
                 set_string(optarg, command, +BASE_INDEX::CHR);
             else if (command == "clump-kb")
@@ -219,6 +232,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                 set_string(optarg, command, m_extract_file);
             else if (command == "feature")
                 load_string_vector(optarg, command, m_prset.feature);
+            else if (command == "freq-count")
+                set_string(optarg, command, m_target.freq_count);
             else if (command.compare("geno") == 0)
                 error |=
                     !set_numeric<double>(optarg, command, m_target_filter.geno);
@@ -235,6 +250,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
             else if (command == "ld-dose-thres")
                 error |= !set_numeric<double>(optarg, command,
                                               m_ref_filter.dose_threshold);
+            else if (command == "ld-freq-count")
+                set_string(optarg, command, m_reference.freq_count);
             else if (command == "ld-geno")
                 error |=
                     !set_numeric<double>(optarg, command, m_ref_filter.geno);
@@ -260,6 +277,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                     !set_numeric<double>(optarg, command, m_target_filter.maf);
             else if (command == "memory")
                 error |= !set_memory(optarg);
+            else if (command == "merge-shard")
+                load_string_vector(optarg, command, m_merge_shard);
             else if (command == "missing")
                 error |= !set_missing(optarg);
             else if (command == "model")
@@ -286,6 +305,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                 error |=
                     !set_numeric<double>(optarg, command, m_clump_info.proxy,
                                          m_clump_info.use_proxy);
+            else if (command == "read-gap")
+                error |= !set_numeric<size_t>(optarg, command, m_read_gap);
             else if (command == "remove")
                 set_string(optarg, command, m_target.remove);
             else if (command == "score")
@@ -296,6 +317,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                                               m_perm_info.num_permutation);
                 m_perm_info.run_set_perm = true;
             }
+            else if (command == "shard-chr")
+                set_string(optarg, command, m_shard_chr);
             else if (command == "snp")
                 set_string(optarg, command, +BASE_INDEX::RS);
             else if (command == "snp-set")
@@ -402,6 +425,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
     if (m_base_info.is_index) m_parameter_log["index"] = "";
     if (m_keep_ambig) m_parameter_log["keep-ambig"] = "";
     if (m_perm_info.logit_perm) m_parameter_log["logit-perm"] = "";
+    if (m_match_by_pos) m_parameter_log["match-by-pos"] = "";
+    if (m_no_cache) m_parameter_log["no-cache"] = "";
     if (m_clump_info.no_clump) m_parameter_log["no-clump"] = "";
     if (m_p_thresholds.no_full) m_parameter_log["no-full"] = "";
     if (m_prs_info.no_regress) m_parameter_log["no-regress"] = "";
@@ -494,6 +519,12 @@ void Commander::set_help_message()
         "(non-effective allele)\n"
         "                            Default: A2\n"
         "    --base          | -b    Base association file\n"
+        "    --base-cache            Binary cache file of the filtered base\n"
+        "                            SNPs. Will be generated if not found, or\n"
+        "                            if the base file or any base filtering\n"
+        "                            parameter has changed. Subsequent runs\n"
+        "                            will load the cache instead of parsing\n"
+        "                            the base file\n"
         "    --base-info             Base INFO score filtering. Format should "
         "be\n"
         "                            <Column name>:<Threshold>. SNPs with info "
@@ -568,6 +599,16 @@ void Commander::set_help_message()
         "                            separated by comma without space. \n"
         "                            Default: T if --beta and F if --beta is "
         "not\n"
+        "    --freq-count            PLINK 2 .gcount (--geno-counts) or "
+        ".acount\n"
+        "                            (--freq counts) file of the target. "
+        "Used\n"
+        "                            instead of the genotypes for the MAF "
+        "and\n"
+        "                            missingness filtering. Must be "
+        "calculated\n"
+        "                            from the same samples. Only for bed and "
+        "pgen\n"
         "    --geno                  Filter SNPs based on gentype missingness\n"
         "    --info                  Filter SNPs based on info score. Only "
         "used\n"
@@ -638,8 +679,9 @@ void Commander::set_help_message()
         "                            at the moment\n"
         "    --type                  File type of the target file. Support bed "
         "\n"
-        "                            (binary plink) and bgen format. Default: "
-        "bed\n"
+        "                            (binary plink), pgen (PLINK 2) and bgen "
+        "format.\n"
+        "                            Default: bed\n"
         // dosage
         "\nDosage:\n"
         "    --allow-inter           Allow the generate of intermediate file. "
@@ -648,6 +690,9 @@ void Commander::set_help_message()
         "clumping\n"
         "                            reference and for hard coding PRS "
         "calculation\n"
+        "                            The hard calls are cached in --cache-dir "
+        "and\n"
+        "                            reused by later runs\n"
         "    --dose-thres            Translate any SNPs with highest genotype "
         "probability\n"
         "                            less than this threshold to missing call\n"
@@ -690,6 +735,11 @@ void Commander::set_help_message()
           "genotype probability\n"
           "                            less than this threshold to missing "
           "call\n"
+          "    --ld-freq-count         PLINK 2 .gcount or .acount file of "
+          "the LD\n"
+          "                            reference. Please see --freq-count "
+          "for more\n"
+          "                            information\n"
           "    --ld-geno               Filter SNPs based on genotype "
           "missingness\n"
           "    --ld-hard-thres         A hardcall is saved when the distance "
@@ -730,7 +780,8 @@ void Commander::set_help_message()
           "                            Mutually exclusive from --ld-keep\n"
           "    --ld-type               File type of the LD file. Support bed "
           "(binary plink)\n"
-          "                            and bgen format. Default: bed\n"
+          "                            pgen (PLINK 2) and bgen format. "
+          "Default: bed\n"
           "    --no-clump              Stop PRSice from performing clumping\n"
           "    --proxy                 Proxy threshold for index SNP to be "
           "considered\n"
@@ -900,6 +951,11 @@ void Commander::set_help_message()
           "    --all-score             Output PRS for ALL threshold. WARNING: "
           "This\n"
           "                            will generate a huge file\n"
+          "    --cache-dir             Directory of the genotype caches (bgen "
+          "and bim\n"
+          "                            index, genotype counts and hard calls). "
+          "Default is\n"
+          "                            the directory of the output prefix\n"
           "    --exclude               File contains SNPs to be excluded from "
           "the\n"
           "                            analysis\n"
@@ -927,9 +983,27 @@ void Commander::set_help_message()
           "                            regression instead of linear "
           "regression. This\n"
           "                            will substantially slow down PRSice\n"
+          "    --match-by-pos          Match SNPs in the base, target and "
+          "reference\n"
+          "                            by their chromosome, coordinate and "
+          "alleles\n"
+          "                            instead of their ID. Useful when the "
+          "files\n"
+          "                            use different ID. Require the CHR and "
+          "BP column\n"
+          "                            in the base file\n"
           "    --memory                Maximum memory usage allowed (in Mb). "
           "PRSice will try\n"
           "                            its best to honor this setting\n"
+          "    --merge-shard           Comma separated list of partial score "
+          "files\n"
+          "                            generated by --shard-chr. The scores "
+          "are summed\n"
+          "                            and the regression performed as if "
+          "PRSice\n"
+          "                            was run on the whole genome\n"
+          "    --no-cache              Do not read or write the genotype "
+          "caches\n"
           "    --non-cumulate          Calculate non-cumulative PRS. PRS will "
           "be reset\n"
           "                            to 0 for each new P-value threshold "
@@ -954,6 +1028,13 @@ void Commander::set_help_message()
           "                            \"Base\" will be presented with all "
           "entries\n"
           "                            marked as Y\n"
+          "    --read-gap              Genotype reads that start within this "
+          "many bytes\n"
+          "                            of the previous read are served from "
+          "one larger\n"
+          "                            read. Only used when the genotype file "
+          "cannot be\n"
+          "                            memory mapped. Default: 65536\n"
           "    --seed          | -s    Seed used for permutation. If not "
           "provided,\n"
           "                            system time will be used as seed. When "
@@ -961,6 +1042,13 @@ void Commander::set_help_message()
           "                            seed and same input is provided, same "
           "result\n"
           "                            can be generated\n"
+          "    --shard-chr             Only process SNPs on this chromosome "
+          "and write\n"
+          "                            the partial scores to <out>.shard. No "
+          "regression\n"
+          "                            is performed. Use --merge-shard to "
+          "combine\n"
+          "                            the shards\n"
           "    --thread        | -n    Number of thread use\n"
           "    --use-ref-maf           When specified, missingness imputation "
           "will be\n"
@@ -983,31 +1071,9 @@ std::vector<std::string> get_base_header(const std::string& file)
     { throw std::runtime_error("Error: You must provide a base file\n"); }
     // get input header
     std::string header;
-    const bool is_gz = misc::is_gz_file(file);
-    if (is_gz)
-    {
-        GZSTREAM_NAMESPACE::igzstream in(file.c_str());
-        if (!in.good())
-        {
-            throw std::runtime_error(
-                "Error: Cannot open base file (gz) to read!\n");
-        }
-        std::getline(in, header);
-        in.close();
-    }
-    else
-    {
-        std::ifstream base_test;
-        base_test.open(file.c_str());
-        if (!base_test.is_open())
-        {
-            throw std::runtime_error("Error: Cannot open base file: " + file
-                                     + " to read!\n"
-                                     + std::string(strerror(errno)) + "\n");
-        }
-        std::getline(base_test, header);
-        base_test.close();
-    }
+    bool compressed;
+    auto input = misc::load_stream(file, compressed);
+    std::getline(*input, header);
     misc::trim(header);
     return misc::split(header);
 }
@@ -1092,6 +1158,17 @@ bool Commander::get_statistic_flag()
 bool Commander::base_check()
 {
     m_ran_base_check = true;
+    struct stat base_stat;
+    // the cache is keyed on the file size and modification time, and a pipe
+    // can only be read once
+    if (!m_base_info.cache_file.empty()
+        && (stat(m_base_info.file_name.c_str(), &base_stat) != 0
+            || !S_ISREG(base_stat.st_mode)))
+    {
+        m_error_message.append("Error: --base-cache can only be used when the "
+                               "base file is a regular file\n");
+        return false;
+    }
     std::vector<std::string> column_names =
         get_base_header(m_base_info.file_name);
     return base_column_check(column_names);
@@ -1164,6 +1241,14 @@ bool Commander::base_column_check(std::vector<std::string>& column_names)
         if (!(m_base_info.is_or || m_base_info.is_beta))
         { error |= !get_statistic_flag(); }
     }
+    if (m_match_by_pos
+        && !(m_base_info.has_column[+BASE_INDEX::CHR]
+             && m_base_info.has_column[+BASE_INDEX::BP]))
+    {
+        error = true;
+        m_error_message.append("Error: --match-by-pos requires the CHR and BP "
+                               "column of the base file!\n");
+    }
     m_base_info.column_index[+BASE_INDEX::MAX] = *max_element(
         m_base_info.column_index.begin(), m_base_info.column_index.end());
     return !error;
@@ -1523,17 +1608,20 @@ std::unordered_set<std::string> Commander::get_cov_names()
 
 std::vector<std::string> Commander::get_covariate_header()
 {
-    std::ifstream cov_file;
-    cov_file.open(m_pheno_info.cov_file.c_str());
-    if (!cov_file.is_open())
+    std::unique_ptr<std::istream> cov_file;
+    try
+    {
+        bool compressed;
+        cov_file = misc::load_stream(m_pheno_info.cov_file, compressed);
+    }
+    catch (const std::runtime_error&)
     {
         m_error_message.append("Error: Cannot open covariate file: "
                                + m_pheno_info.cov_file + "\n");
         throw std::runtime_error("Cannot open");
     }
     std::string line;
-    std::getline(cov_file, line);
-    cov_file.close();
+    std::getline(*cov_file, line);
     misc::trim(line);
     if (line.empty())
     {
@@ -1736,6 +1824,22 @@ bool Commander::misc_check()
             "Error: Can only use --extract or --exclude but not both\n");
     }
 
+    if (m_no_cache && !m_cache_dir.empty())
+    {
+        error = true;
+        m_error_message.append(
+            "Error: Can only use --cache-dir or --no-cache but not both\n");
+    }
+    struct stat dir_stat;
+    if (!m_cache_dir.empty()
+        && (stat(m_cache_dir.c_str(), &dir_stat) != 0
+            || !S_ISDIR(dir_stat.st_mode)))
+    {
+        error = true;
+        m_error_message.append("Error: Cache directory " + m_cache_dir
+                               + " does not exist\n");
+    }
+
     m_parameter_log["seed"] = misc::to_string(m_perm_info.seed);
     if (m_prs_info.thread <= 0)
     {
@@ -1801,12 +1905,37 @@ bool Commander::misc_check()
             "phenotype provided. As regression isn't performed, we will not "
             "utilize any of the phenotype information\n");
     }
-    if (m_target.type == "bgen" && !m_target.hard_coded && m_ultra_aggressive)
+    for (auto* geno : {&m_target, &m_reference})
+    {
+        if (!geno->freq_count.empty() && geno->type == "bgen")
+        {
+            m_error_message.append(
+                "Warning: Counts from " + geno->freq_count
+                + " are only used for bed and pgen input. Will ignore it\n");
+            geno->freq_count.clear();
+        }
+    }
+    if ((m_target.type == "bgen" || m_target.type == "pgen")
+        && !m_target.hard_coded && m_ultra_aggressive)
     {
         m_error_message.append("Warning: --ultra does not work with none "
-                               "hard-coded bgen file. Will disable it\n");
+                               "hard-coded bgen or pgen file. Will disable "
+                               "it\n");
         m_ultra_aggressive = false;
     }
+    if (!m_shard_chr.empty() && !m_merge_shard.empty())
+    {
+        error = true;
+        m_error_message.append(
+            "Error: Cannot use --shard-chr together with --merge-shard\n");
+    }
+    if (!m_merge_shard.empty() && m_perm_info.run_set_perm)
+    {
+        error = true;
+        m_error_message.append("Error: Competitive permutation (--set-perm) "
+                               "requires the genotype and is not supported "
+                               "with --merge-shard\n");
+    }
     return !error;
 }
 
@@ -15,6 +15,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "genotype.hpp"
+#include "radix_sort.hpp"
 
 std::string Genotype::print_duplicated_snps(
     const std::unordered_set<std::string>& duplicated_snp,
@@ -31,7 +32,7 @@ std::string Genotype::print_duplicated_snps(
     for (auto&& snp : m_existed_snps)
     {
         // we only output the valid SNPs.
-        if (duplicated_snp.find(snp.rs()) == duplicated_snp.end())
+        if (duplicated_snp.find(std::string(snp.rs())) == duplicated_snp.end())
             log_file_stream << snp.rs() << "\t" << snp.chr() << "\t"
                             << snp.loc() << "\t" << snp.ref() << "\t"
                             << snp.alt() << "\n";
@@ -50,91 +51,174 @@ std::string Genotype::print_duplicated_snps(
 void Genotype::build_clump_windows(const unsigned long long& clump_distance)
 {
     // should sort w.r.t reference
-    std::sort(begin(m_existed_snps), end(m_existed_snps),
-              [](SNP const& t1, SNP const& t2) {
-                  if (t1.chr() == t2.chr())
-                  {
-                      if (t1.loc() == t2.loc())
-                      {
-                          if (t1.get_file_idx(true) == t2.get_file_idx(true))
-                          {
-                              return t1.get_byte_pos(true)
-                                     < t2.get_byte_pos(true);
-                          }
-                          return t1.get_file_idx(true) < t2.get_file_idx(true);
-                      }
-                      else
-                          return (t1.loc() < t2.loc());
-                  }
-                  else
-                      return (t1.chr() < t2.chr());
-              });
+    sort_snps({snp_key([](const SNP& snp) { return snp.chr(); }),
+               snp_key([](const SNP& snp) { return snp.loc(); }),
+               snp_key([](const SNP& snp) { return snp.get_file_idx(true); }),
+               snp_key([](const SNP& snp) {
+                   return static_cast<std::streamoff>(snp.get_byte_pos(true));
+               })});
+    build_variant_table();
     // we do it here such that the m_existed_snps is sorted correctly
     // low_bound is where the current snp should read from and last_snp is where
     // the last_snp in the vector which doesn't have the up_bound set
-    size_t low_bound = 0, last_snp = 0, prev_loc = 0, vector_index = 0,
-           diff = 0;
+    const size_t num_snp = m_variants.size();
+    const auto& chr = m_variants.chr;
+    const auto& loc = m_variants.loc;
+    auto& low = m_variants.low_bound;
+    auto& up = m_variants.up_bound;
+    size_t low_bound = 0, last_snp = 0, prev_loc = 0, diff = 0;
     size_t prev_chr = ~size_t(0);
-    bool first_snp = true;
     m_max_window_size = 0;
     // now we iterate thorugh all the SNPs to define the clumping window
-    for (auto&& cur_snp : m_existed_snps)
+    for (size_t i_snp = 0; i_snp < num_snp; ++i_snp)
     {
-        if (first_snp || prev_chr != cur_snp.chr())
+        if (i_snp == 0 || prev_chr != chr[i_snp])
         {
-            prev_chr = cur_snp.chr();
-            prev_loc = cur_snp.loc();
-            low_bound = vector_index;
-            first_snp = false;
+            prev_chr = chr[i_snp];
+            prev_loc = loc[i_snp];
+            low_bound = i_snp;
         }
         // we can safely assume current location always bigger than prev_loc
         // as we have sorted the vector
-        else if (cur_snp.loc() - prev_loc > clump_distance)
+        else if (loc[i_snp] - prev_loc > clump_distance)
         {
             // now the chromosome didn't change, and the distance of our current
             // SNP is further away from the previous SNP than our required
             // threshold
-            while (cur_snp.loc() - prev_loc > clump_distance
-                   && low_bound < vector_index)
+            while (loc[i_snp] - prev_loc > clump_distance && low_bound < i_snp)
             {
                 ++low_bound;
-                prev_loc = m_existed_snps[low_bound].loc();
+                prev_loc = loc[low_bound];
             }
         }
 
         // now low_bound should be the first SNP where the core index SNP need
         // to read from
-        cur_snp.set_low_bound(low_bound);
+        low[i_snp] = low_bound;
         // set the end of the vector as the default up bound
-        cur_snp.set_up_bound(m_existed_snps.size());
+        up[i_snp] = num_snp;
         // update all previous SNPs that are out bounud
-        while ((m_existed_snps[last_snp].chr() != cur_snp.chr())
-               || (cur_snp.loc() - m_existed_snps[last_snp].loc()
-                   > clump_distance))
+        while ((chr[last_snp] != chr[i_snp])
+               || (loc[i_snp] - loc[last_snp] > clump_distance))
         {
             // if the last SNP is on a differenet chromosome or it is to far
             // from the current SNP
-            diff = vector_index - m_existed_snps[last_snp].low_bound();
+            diff = i_snp - low[last_snp];
             // we will set the up bound of that SNP to the current SNP
-            m_existed_snps[last_snp].set_up_bound(vector_index);
+            up[last_snp] = i_snp;
             ++last_snp;
             if (m_max_window_size < diff) { m_max_window_size = diff; }
         }
-        // assign the index
-        ++vector_index;
     }
-    size_t idx = m_existed_snps.size() - 1;
+    size_t idx = num_snp - 1;
     while (true)
     {
-        auto&& cur_snp = m_existed_snps[idx];
-        if (cur_snp.up_bound() != m_existed_snps.size()) break;
-        if (m_max_window_size < cur_snp.up_bound() - cur_snp.low_bound())
-        { m_max_window_size = cur_snp.up_bound() - cur_snp.low_bound(); }
+        if (up[idx] != num_snp) break;
+        if (m_max_window_size < up[idx] - low[idx])
+        { m_max_window_size = up[idx] - low[idx]; }
         if (idx == 0) break;
         --idx;
     }
+    for (size_t i_snp = 0; i_snp < num_snp; ++i_snp)
+    {
+        m_existed_snps[i_snp].set_low_bound(low[i_snp]);
+        m_existed_snps[i_snp].set_up_bound(up[i_snp]);
+    }
+}
+
+void Genotype::sort_snps(const std::vector<std::vector<uint64_t>>& keys)
+{
+    reorder_snps(radix::sort_index(keys, m_thread));
+}
+
+void Genotype::sort_snps_by_file(const bool is_ref)
+{
+    sort_snps({snp_key([is_ref](const SNP& snp) {
+                   return snp.get_file_idx(is_ref);
+               }),
+               snp_key([is_ref](const SNP& snp) {
+                   return static_cast<std::streamoff>(snp.get_byte_pos(is_ref));
+               })});
+}
+
+void Genotype::reorder_snps(const std::vector<size_t>& order)
+{
+    assert(order.size() == m_existed_snps.size());
+    std::vector<SNP> sorted;
+    sorted.reserve(m_existed_snps.size());
+    for (auto&& idx : order)
+    { sorted.push_back(std::move(m_existed_snps[idx])); }
+    m_existed_snps.swap(sorted);
+    // the rows no longer match m_existed_snps
+    m_variants.clear();
+}
+
+void Genotype::build_position_index()
+{
+    m_position_index.clear();
+    m_position_index.reserve(m_existed_snps.size());
+    for (size_t i_snp = 0; i_snp < m_existed_snps.size(); ++i_snp)
+    {
+        auto&& snp = m_existed_snps[i_snp];
+        const uint64_t key =
+            SNP::position_key(snp.chr(), snp.loc(), snp.ref(), snp.alt());
+        if (key != ~uint64_t(0)) { m_position_index.emplace_back(key, i_snp); }
+    }
+    std::sort(m_position_index.begin(), m_position_index.end());
+}
+
+size_t Genotype::find_by_position(const size_t chr, const size_t loc,
+                                  std::string_view ref,
+                                  std::string_view alt) const
+{
+    const uint64_t key = SNP::position_key(chr, loc, ref, alt);
+    if (key == ~uint64_t(0)) return StringIndex::npos;
+    // all variants on the same position are adjacent, as the allele code
+    // occupy the lowest 8 bits of the key
+    auto start = std::lower_bound(
+        m_position_index.begin(), m_position_index.end(),
+        std::make_pair(key & ~uint64_t(0xFF), size_t(0)));
+    auto end = start;
+    while (end != m_position_index.end() && (end->first >> 8) == (key >> 8))
+        ++end;
+    bool flipped;
+    // prefer the SNP with identical allele code, then any variant on the
+    // same position with compatible alleles (e.g. indels or missing alleles)
+    for (auto it = start; it != end; ++it)
+    {
+        if (it->first == key
+            && m_existed_snps[it->second].matching(chr, loc, ref, alt, flipped))
+        { return it->second; }
+    }
+    for (auto it = start; it != end; ++it)
+    {
+        if (m_existed_snps[it->second].matching(chr, loc, ref, alt, flipped))
+        { return it->second; }
+    }
+    return StringIndex::npos;
+}
+
+void Genotype::build_variant_table()
+{
+    const size_t num_snp = m_existed_snps.size();
+    m_variants.resize(num_snp);
+    for (size_t i_snp = 0; i_snp < num_snp; ++i_snp)
+    {
+        auto&& snp = m_existed_snps[i_snp];
+        m_variants.p_value[i_snp] = snp.p_value();
+        m_variants.threshold[i_snp] = snp.get_threshold();
+        m_variants.category[i_snp] = snp.category();
+        m_variants.chr[i_snp] = snp.chr();
+        m_variants.loc[i_snp] = snp.loc();
+        m_variants.low_bound[i_snp] = snp.low_bound();
+        m_variants.up_bound[i_snp] = snp.up_bound();
+        snp.get_file_info(m_variants.target[i_snp].name_idx,
+                          m_variants.target[i_snp].byte_pos, false);
+        snp.get_file_info(m_variants.reference[i_snp].name_idx,
+                          m_variants.reference[i_snp].byte_pos, true);
+    }
 }
-// std::mutex Genotype::m_mutex;
+
 std::vector<std::string> Genotype::set_genotype_files(const std::string& prefix)
 {
     std::vector<std::string> genotype_files;
@@ -190,131 +274,263 @@ void Genotype::snp_extraction(const std::string& extract_snps,
     }
 }
 
-std::tuple<std::vector<size_t>, std::unordered_set<std::string>>
-Genotype::transverse_base_file(
+void Genotype::parse_base_chunk(
+    std::vector<std::string>& lines, const size_t start, const size_t end,
     const BaseFile& base_file, const QCFiltering& base_qc,
     const PThresholding& threshold_info,
     const std::vector<IITree<size_t, size_t>>& exclusion_regions,
-    const std::streampos file_length, const bool gz_input,
-    std::unique_ptr<std::istream> input)
+    const double max_threshold, std::vector<BaseRecord>& records)
 {
     const unsigned long long max_index =
         base_file.column_index[+BASE_INDEX::MAX];
-    const double max_threshold =
-        threshold_info.no_full
-            ? (threshold_info.fastscore ? threshold_info.bar_levels.back()
-                                        : threshold_info.upper)
-            : 1.0;
-    double progress, prev_progress = 0.0;
-    std::vector<std::string_view> token;
-    std::string rs_id;
-    std::string ref_allele;
-    std::string alt_allele;
-    double pvalue = 2.0;
-    double stat = 0.0;
-    double pthres = 0.0;
-    size_t chr = 0;
-    size_t loc = 0;
-    unsigned long long category = 0;
-    std::unordered_set<std::string> processed_rs, dup_rs;
+    // each parse function increment exactly one counter upon failure, we use
+    // this local counter to find out which filter the SNP fails
     std::vector<size_t> filter_count(+FILTER_COUNT::MAX, 0);
-    std::string line;
-    while (std::getline(*input, line))
-    {
-        if (!gz_input)
+    auto failed_filter = [&filter_count]() {
+        for (size_t i = 0; i < filter_count.size(); ++i)
         {
-            progress = static_cast<double>(input->tellg())
-                       / static_cast<double>(file_length) * 100;
-            if (progress - prev_progress > 0.01)
+            if (filter_count[i] != 0)
             {
-                fprintf(stderr, "\rReading %03.2f%%", progress);
-                prev_progress = progress;
+                filter_count[i] = 0;
+                return i;
             }
         }
+        return static_cast<size_t>(+FILTER_COUNT::MAX);
+    };
+    std::vector<std::string_view> token;
+    for (size_t i = start; i < end; ++i)
+    {
+        auto&& record = records[i];
+        record = BaseRecord();
+        std::string& line = lines[i];
         misc::trim(line);
-        if (line.empty()) continue;
-
-        ++filter_count[+FILTER_COUNT::NUM_LINE];
+        if (line.empty())
+        {
+            record.empty = true;
+            continue;
+        }
         token = misc::tokenize(line);
         for (auto&& t : token) { misc::trim(t); }
         if (token.size() <= max_index)
         {
-            throw std::runtime_error(line
-                                     + "\nMore index than column in data\n");
+            record.column_error = true;
+            record.error = line + "\nMore index than column in data\n";
+            continue;
         }
-        if (!parse_rs_id(token, base_file, processed_rs, dup_rs, filter_count,
-                         rs_id))
-        { continue; }
-        if (!parse_chr(token, base_file, filter_count, chr)) { continue; }
-        parse_allele(token, base_file, +BASE_INDEX::EFFECT, ref_allele);
-        parse_allele(token, base_file, +BASE_INDEX::NONEFFECT, alt_allele);
-        if (!parse_loc(token, base_file, loc))
+        if (!base_file.has_column[+BASE_INDEX::RS])
         {
-            throw std::runtime_error(
-                "Error: Invalid loci for " + rs_id + ": "
+            record.column_error = true;
+            record.error = "Error: RS ID column not provided!";
+            continue;
+        }
+        record.rs_id = token[base_file.column_index[+BASE_INDEX::RS]];
+        auto&& selection = m_snp_selection_list.find(record.rs_id);
+        if ((!m_exclude_snp && selection == m_snp_selection_list.end())
+            || (m_exclude_snp && selection != m_snp_selection_list.end()))
+        {
+            record.selected = false;
+            continue;
+        }
+        if (!parse_chr(token, base_file, filter_count, record.chr))
+        {
+            record.filter = failed_filter();
+            continue;
+        }
+        parse_allele(token, base_file, +BASE_INDEX::EFFECT, record.ref_allele);
+        parse_allele(token, base_file, +BASE_INDEX::NONEFFECT,
+                     record.alt_allele);
+        if (!parse_loc(token, base_file, record.loc))
+        {
+            record.error =
+                "Error: Invalid loci for " + record.rs_id + ": "
                 + std::string(token[base_file.column_index[+BASE_INDEX::BP]])
-                + "\n");
+                + "\n";
+            continue;
         }
         if (base_file.has_column[+BASE_INDEX::BP]
             && base_file.has_column[+BASE_INDEX::CHR])
         {
-            if (Genotype::within_region(exclusion_regions, chr, loc))
+            if (Genotype::within_region(exclusion_regions, record.chr,
+                                        record.loc))
             {
-                ++filter_count[+FILTER_COUNT::REGION];
+                record.filter = +FILTER_COUNT::REGION;
                 continue;
             }
         }
-        if (base_filter_by_value(token, base_file, base_qc.maf, filter_count,
-                                 +FILTER_COUNT::MAF, +BASE_INDEX::MAF))
+        // don't need to test case filtering if we have already filtered the
+        // SNP with the control MAF
+        if (!base_filter_by_value(token, base_file, base_qc.maf, filter_count,
+                                  +FILTER_COUNT::MAF, +BASE_INDEX::MAF)
+            || !base_filter_by_value(token, base_file, base_qc.maf_case,
+                                     filter_count, +FILTER_COUNT::MAF,
+                                     +BASE_INDEX::MAF_CASE)
+            || !base_filter_by_value(token, base_file, base_qc.info_score,
+                                     filter_count, +FILTER_COUNT::INFO,
+                                     +BASE_INDEX::INFO))
         {
-            // don't need to test case filtering if we have already filtered the
-            // SNP with the control MAF
-            if (!base_filter_by_value(token, base_file, base_qc.maf_case,
-                                      filter_count, +FILTER_COUNT::MAF,
-                                      +BASE_INDEX::MAF_CASE))
-            { continue; }
+            record.filter = failed_filter();
+            continue;
         }
-        else
+        try
         {
+            if (!parse_pvalue(token[base_file.column_index[+BASE_INDEX::P]],
+                              max_threshold, filter_count, record.pvalue))
+            {
+                record.filter = failed_filter();
+                continue;
+            }
+        }
+        catch (const std::runtime_error& e)
+        {
+            record.error = e.what();
             continue;
         }
-        if (!base_filter_by_value(token, base_file, base_qc.info_score,
-                                  filter_count, +FILTER_COUNT::INFO,
-                                  +BASE_INDEX::INFO))
-        { continue; }
-        if (!parse_pvalue(token[base_file.column_index[+BASE_INDEX::P]],
-                          max_threshold, filter_count, pvalue))
-        { continue; }
         if (!parse_stat(token[base_file.column_index[+BASE_INDEX::STAT]],
-                        base_file.is_or, filter_count, stat))
-        { continue; }
-        if (!alt_allele.empty() && ambiguous(ref_allele, alt_allele))
+                        base_file.is_or, filter_count, record.stat))
+        {
+            record.filter = failed_filter();
+            continue;
+        }
+        if (!record.alt_allele.empty()
+            && ambiguous(record.ref_allele, record.alt_allele))
         {
-            ++filter_count[+FILTER_COUNT::AMBIG];
+            record.ambiguous = true;
             if (!m_keep_ambig) continue;
         }
-        category = 0;
-        pthres = 0.0;
         if (threshold_info.fastscore)
         {
-            category =
-                cal_bar_category(pvalue, threshold_info.bar_levels, pthres);
+            record.category = cal_bar_category(
+                record.pvalue, threshold_info.bar_levels, record.pthres);
         }
         else
         {
             try
             {
-                category = calculate_category(threshold_info, pvalue, pthres);
+                record.category = calculate_category(
+                    threshold_info, record.pvalue, record.pthres);
             }
             catch (const std::runtime_error&)
             {
-                m_very_small_thresholds = true;
-                category = 0;
+                record.very_small = true;
+                record.category = 0;
+            }
+        }
+    }
+}
+
+std::tuple<std::vector<size_t>, std::unordered_set<std::string>>
+Genotype::transverse_base_file(
+    const BaseFile& base_file, const QCFiltering& base_qc,
+    const PThresholding& threshold_info,
+    const std::vector<IITree<size_t, size_t>>& exclusion_regions,
+    const std::streampos file_length, const bool stream_input,
+    std::unique_ptr<std::istream> input)
+{
+    const double max_threshold =
+        threshold_info.no_full
+            ? (threshold_info.fastscore ? threshold_info.bar_levels.back()
+                                        : threshold_info.upper)
+            : 1.0;
+    // number of lines read in before we hand them to the worker threads.
+    // Large enough to keep the threads busy, small enough to not blow up the
+    // memory usage
+    const size_t batch_size = 1 << 16;
+    const size_t num_thread = std::max(m_thread, size_t(1));
+    double progress, prev_progress = 0.0;
+    std::unordered_set<std::string> dup_rs;
+    std::vector<size_t> filter_count(+FILTER_COUNT::MAX, 0);
+    std::vector<std::string> lines(batch_size);
+    std::vector<BaseRecord> records(batch_size);
+    std::vector<std::thread> workers;
+    size_t num_line = 0;
+    while (input->good())
+    {
+        // read in a batch of lines. Parsing is done in parallel, but the
+        // merging is done sequentially to ensure the order of SNPs and the
+        // duplication check are identical to a single threaded run
+        for (num_line = 0;
+             num_line < batch_size && std::getline(*input, lines[num_line]);
+             ++num_line)
+            ;
+        if (num_line == 0) break;
+        if (!stream_input)
+        {
+            progress = (input->eof() ? 1.0
+                                     : static_cast<double>(input->tellg())
+                                           / static_cast<double>(file_length))
+                       * 100;
+            if (progress - prev_progress > 0.01)
+            {
+                fprintf(stderr, "\rReading %03.2f%%", progress);
+                prev_progress = progress;
+            }
+        }
+        const size_t num_worker = std::min(num_thread, num_line);
+        const size_t job_size = num_line / num_worker;
+        const size_t remain = num_line % num_worker;
+        size_t start = 0;
+        workers.clear();
+        for (size_t i_thread = 0; i_thread < num_worker; ++i_thread)
+        {
+            const size_t end = start + job_size + (i_thread < remain);
+            if (i_thread + 1 == num_worker)
+            {
+                // let the main thread do the last chunk of work
+                parse_base_chunk(lines, start, end, base_file, base_qc,
+                                 threshold_info, exclusion_regions,
+                                 max_threshold, records);
+            }
+            else
+            {
+                workers.push_back(std::thread(
+                    &Genotype::parse_base_chunk, this, std::ref(lines), start,
+                    end, std::cref(base_file), std::cref(base_qc),
+                    std::cref(threshold_info), std::cref(exclusion_regions),
+                    max_threshold, std::ref(records)));
+            }
+            start = end;
+        }
+        for (auto&& worker : workers) worker.join();
+        for (size_t i = 0; i < num_line; ++i)
+        {
+            auto&& record = records[i];
+            if (record.empty) continue;
+            ++filter_count[+FILTER_COUNT::NUM_LINE];
+            if (record.column_error) throw std::runtime_error(record.error);
+            if (m_existed_snps_index.contains(record.rs_id))
+            {
+                ++filter_count[+FILTER_COUNT::DUP_SNP];
+                dup_rs.insert(record.rs_id);
+                continue;
+            }
+            if (!record.selected)
+            {
+                ++filter_count[+FILTER_COUNT::SELECT];
+                continue;
+            }
+            if (!record.error.empty()) throw std::runtime_error(record.error);
+            bool keep = (record.filter == +FILTER_COUNT::MAX);
+            if (!keep) { ++filter_count[record.filter]; }
+            else if (record.ambiguous)
+            {
+                ++filter_count[+FILTER_COUNT::AMBIG];
+                keep = m_keep_ambig;
+            }
+            if (!keep)
+            {
+                // still need to remember the ID for the duplication check
+                m_existed_snps_index.insert(
+                    m_string_arena.store(record.rs_id), StringIndex::npos);
+                continue;
             }
+            if (record.very_small) m_very_small_thresholds = true;
+            m_existed_snps.emplace_back(
+                SNP(m_string_arena, record.rs_id, record.chr, record.loc,
+                    record.ref_allele, record.alt_allele, record.stat,
+                    record.pvalue, record.category, record.pthres));
+            m_existed_snps_index.insert(m_existed_snps.back().rs(),
+                                        m_existed_snps.size() - 1);
         }
-        m_existed_snps_index[rs_id] = m_existed_snps.size();
-        m_existed_snps.emplace_back(SNP(rs_id, chr, loc, ref_allele, alt_allele,
-                                        stat, pvalue, category, pthres));
     }
     fprintf(stderr, "\rReading %03.2f%%\n", 100.0);
     input.reset();
@@ -328,19 +544,38 @@ Genotype::read_base(
 {
     std::string line;
     std::string message = "Base file: " + base_file.file_name + "\n";
+    unsigned long long cache_key = 0;
+    if (!base_file.cache_file.empty())
+    {
+        cache_key = base_cache_key(base_file, base_qc, threshold_info,
+                                   exclusion_regions);
+        std::vector<size_t> filter_count;
+        std::unordered_set<std::string> dup_rs;
+        if (load_base_cache(base_file.cache_file, cache_key, filter_count,
+                            dup_rs))
+        {
+            message.append("Loaded " + misc::to_string(m_existed_snps.size())
+                           + " base SNPs from cache: " + base_file.cache_file
+                           + "\n");
+            m_reporter->report(message);
+            return {filter_count, dup_rs};
+        }
+    }
     std::streampos file_length = 0;
-    bool gz_input;
-    auto stream = misc::load_stream(base_file.file_name, gz_input);
-    if (!gz_input)
+    bool compressed;
+    auto stream = misc::load_stream(base_file.file_name, compressed, m_thread);
+    // compressed input and pipes (e.g. process substitution) are not seekable,
+    // we will then skip the progress report
+    bool seekable = !compressed;
+    if (compressed) { message.append("Compressed file detected. "); }
+    else
     {
         stream->seekg(0, stream->end);
         file_length = stream->tellg();
+        seekable = !stream->fail() && file_length > 0;
         stream->clear();
         stream->seekg(0, stream->beg);
-    }
-    else
-    {
-        message.append("GZ file detected. ");
+        stream->clear();
     }
     if (!base_file.is_index)
     {
@@ -349,9 +584,213 @@ Genotype::read_base(
     }
     m_reporter->report(message);
     message.clear();
-    return transverse_base_file(base_file, base_qc, threshold_info,
-                                exclusion_regions, file_length, gz_input,
-                                std::move(stream));
+    auto result = transverse_base_file(base_file, base_qc, threshold_info,
+                                       exclusion_regions, file_length,
+                                       !seekable, std::move(stream));
+    if (!base_file.cache_file.empty())
+    {
+        save_base_cache(base_file.cache_file, cache_key, std::get<0>(result),
+                        std::get<1>(result));
+    }
+    return result;
+}
+
+unsigned long long Genotype::base_cache_key(
+    const BaseFile& base_file, const QCFiltering& base_qc,
+    const PThresholding& threshold_info,
+    const std::vector<IITree<size_t, size_t>>& exclusion_regions)
+{
+    misc::Hasher hasher;
+    // hashing the whole base file would cost as much as parsing it
+    hasher.add(m_base_cache_version)
+        .add(misc::canonical_path(base_file.file_name))
+        .add_file_stat(base_file.file_name)
+        .add_file_ends(base_file.file_name);
+    hasher.add(base_file.column_index)
+        .add(base_file.has_column)
+        .add(base_file.is_index)
+        .add(base_file.is_beta)
+        .add(base_file.is_or);
+    hasher.add(base_qc.maf).add(base_qc.maf_case).add(base_qc.info_score);
+    hasher.add(threshold_info.bar_levels)
+        .add(threshold_info.lower)
+        .add(threshold_info.inter)
+        .add(threshold_info.upper)
+        .add(threshold_info.fastscore)
+        .add(threshold_info.no_full);
+    hasher.add(exclusion_regions.size());
+    for (auto&& region : exclusion_regions)
+    {
+        hasher.add(region.size());
+        for (size_t i = 0; i < region.size(); ++i)
+        { hasher.add(region.start(i)).add(region.end(i)); }
+    }
+    // the selection list is unordered, use a commutative combination
+    unsigned long long selection = 0;
+    for (auto&& snp : m_snp_selection_list)
+    { selection += misc::Hasher().add(snp).value(); }
+    hasher.add(selection).add(m_snp_selection_list.size()).add(m_exclude_snp);
+    hasher.add(m_keep_ambig).add(m_autosome_ct).add(m_haploid_mask);
+    return hasher.value();
+}
+
+bool Genotype::load_base_cache(const std::string& cache_file,
+                               const unsigned long long key,
+                               std::vector<size_t>& filter_count,
+                               std::unordered_set<std::string>& dup_rs)
+{
+    std::ifstream cache(cache_file.c_str(), std::ios::binary);
+    if (!cache.is_open()) return false;
+    cache.seekg(0, cache.end);
+    const unsigned long long file_length =
+        static_cast<unsigned long long>(cache.tellg());
+    cache.seekg(0, cache.beg);
+    auto read_vector = [&cache](auto& vec, const size_t size) {
+        vec.resize(size);
+        cache.read(reinterpret_cast<char*>(vec.data()),
+                   static_cast<std::streamsize>(
+                       size * sizeof(typename std::decay_t<decltype(vec)>::
+                                         value_type)));
+    };
+    std::string magic(m_base_cache_magic.size(), '\0');
+    unsigned long long version = 0, cached_key = 0;
+    cache.read(&magic[0], static_cast<std::streamsize>(magic.size()));
+    cache.read(reinterpret_cast<char*>(&version), sizeof(version));
+    cache.read(reinterpret_cast<char*>(&cached_key), sizeof(cached_key));
+    if (!cache || magic != m_base_cache_magic
+        || version != m_base_cache_version || cached_key != key)
+    { return false; }
+    // header of the cache: number of filter count, number of duplicated SNPs,
+    // number of SNPs, total length of all strings and very small threshold
+    // flag
+    std::vector<unsigned long long> header;
+    read_vector(header, 5);
+    // make sure the cache isn't truncated before we allocate the memory
+    const unsigned long long expected_length =
+        magic.size() + sizeof(version) + sizeof(cached_key)
+        + (header.size() + header[0] + 6 * header[2]) * sizeof(uint64_t)
+        + (3 * header[2] + header[1]) * sizeof(uint32_t) + header[3];
+    if (!cache || header[0] != +FILTER_COUNT::MAX
+        || expected_length != file_length)
+    { return false; }
+    std::vector<unsigned long long> counts;
+    read_vector(counts, header[0]);
+    std::vector<unsigned long long> chr, loc, category;
+    std::vector<double> stat, pvalue, pthres;
+    std::vector<uint32_t> str_length;
+    std::string str_blob;
+    const size_t num_snp = header[2];
+    read_vector(chr, num_snp);
+    read_vector(loc, num_snp);
+    read_vector(category, num_snp);
+    read_vector(stat, num_snp);
+    read_vector(pvalue, num_snp);
+    read_vector(pthres, num_snp);
+    // rs, ref and alt of all SNPs, then all duplicated SNPs
+    read_vector(str_length, 3 * num_snp + header[1]);
+    str_blob.resize(header[3]);
+    cache.read(&str_blob[0], static_cast<std::streamsize>(str_blob.size()));
+    if (!cache) return false;
+    size_t offset = 0;
+    auto next_str = [&str_blob, &str_length, &offset](size_t idx) {
+        std::string res = str_blob.substr(offset, str_length[idx]);
+        offset += str_length[idx];
+        return res;
+    };
+    std::vector<SNP> snps;
+    snps.reserve(num_snp);
+    for (size_t i = 0; i < num_snp; ++i)
+    {
+        std::string rs = next_str(3 * i);
+        std::string ref = next_str(3 * i + 1);
+        std::string alt = next_str(3 * i + 2);
+        snps.emplace_back(SNP(m_string_arena, rs, chr[i], loc[i], ref, alt,
+                              stat[i], pvalue[i], category[i], pthres[i]));
+    }
+    dup_rs.clear();
+    for (size_t i = 0; i < header[1]; ++i)
+    { dup_rs.insert(next_str(3 * num_snp + i)); }
+    filter_count.assign(counts.begin(), counts.end());
+    m_very_small_thresholds = m_very_small_thresholds || header[4];
+    m_existed_snps = std::move(snps);
+    update_snp_index();
+    return true;
+}
+
+void Genotype::save_base_cache(const std::string& cache_file,
+                               const unsigned long long key,
+                               const std::vector<size_t>& filter_count,
+                               const std::unordered_set<std::string>& dup_rs)
+{
+    const size_t num_snp = m_existed_snps.size();
+    std::vector<unsigned long long> chr(num_snp), loc(num_snp),
+        category(num_snp);
+    std::vector<double> stat(num_snp), pvalue(num_snp), pthres(num_snp);
+    std::vector<uint32_t> str_length;
+    str_length.reserve(3 * num_snp + dup_rs.size());
+    std::string str_blob;
+    auto add_str = [&str_blob, &str_length](std::string_view str) {
+        str_length.push_back(static_cast<uint32_t>(str.size()));
+        str_blob.append(str);
+    };
+    for (size_t i = 0; i < num_snp; ++i)
+    {
+        auto&& snp = m_existed_snps[i];
+        chr[i] = snp.chr();
+        loc[i] = snp.loc();
+        category[i] = snp.category();
+        stat[i] = snp.stat();
+        pvalue[i] = snp.p_value();
+        pthres[i] = snp.get_threshold();
+        add_str(snp.rs());
+        add_str(snp.ref());
+        add_str(snp.alt());
+    }
+    for (auto&& rs : dup_rs) { add_str(rs); }
+    std::vector<unsigned long long> counts(filter_count.begin(),
+                                           filter_count.end());
+    std::vector<unsigned long long> header = {
+        counts.size(), dup_rs.size(), num_snp, str_blob.size(),
+        m_very_small_thresholds};
+    // write to a temporary file first so that an interrupted run won't leave
+    // behind a corrupted cache
+    const std::string tmp_name = cache_file + ".tmp";
+    std::ofstream cache(tmp_name.c_str(), std::ios::binary);
+    if (!cache.is_open())
+    {
+        m_reporter->report("Warning: Cannot open base cache file " + tmp_name
+                           + " for write. Base cache will not be generated\n");
+        return;
+    }
+    auto write_vector = [&cache](const auto& vec) {
+        cache.write(reinterpret_cast<const char*>(vec.data()),
+                    static_cast<std::streamsize>(
+                        vec.size()
+                        * sizeof(typename std::decay_t<decltype(vec)>::
+                                     value_type)));
+    };
+    const unsigned long long version = m_base_cache_version;
+    cache.write(m_base_cache_magic.data(),
+                static_cast<std::streamsize>(m_base_cache_magic.size()));
+    cache.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    cache.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    write_vector(header);
+    write_vector(counts);
+    write_vector(chr);
+    write_vector(loc);
+    write_vector(category);
+    write_vector(stat);
+    write_vector(pvalue);
+    write_vector(pthres);
+    write_vector(str_length);
+    write_vector(str_blob);
+    cache.close();
+    if (!cache || std::rename(tmp_name.c_str(), cache_file.c_str()) != 0)
+    {
+        std::remove(tmp_name.c_str());
+        m_reporter->report("Warning: Failed to write base cache file "
+                           + cache_file + "\n");
+    }
 }
 
 
@@ -789,6 +1228,302 @@ void Genotype::calc_freqs_and_intermediate(const QCFiltering& filter_info,
     }
 }
 
+std::vector<Genotype::CountSource>
+Genotype::load_known_counts(Genotype* genotype, const std::string& suffix,
+                            std::vector<count_cache::Cache>& caches,
+                            std::vector<MarkerCounts>& counts)
+{
+    const size_t total_snp = genotype->m_existed_snps.size();
+    std::vector<CountSource> source(total_snp, CountSource::READ);
+    counts.assign(total_snp, MarkerCounts());
+    if (!m_freq_count_file.empty())
+    { import_freq_count(genotype, counts, source); }
+    // the cache is named by the samples used, such that runs with different
+    // --keep or --remove don't overwrite each other
+    const unsigned long long setting_key = count_cache::setting_key(
+        m_unfiltered_sample_ct, m_calculate_prs, m_sample_for_ld);
+    caches.clear();
+    if (!m_cache_dir.empty()) caches.resize(m_genotype_file_names.size());
+    for (size_t i = 0; i < caches.size(); ++i)
+    {
+        const std::string name = m_genotype_file_names[i] + suffix;
+        caches[i].open(count_cache::cache_name(m_cache_dir, name, setting_key),
+                       count_cache::file_key(name));
+    }
+    size_t file_idx, num_cached = 0;
+    std::streampos byte_pos;
+    for (size_t i = 0; i < total_snp && !caches.empty(); ++i)
+    {
+        if (source[i] != CountSource::READ) continue;
+        genotype->m_existed_snps[i].get_file_info(file_idx, byte_pos,
+                                                  m_is_ref);
+        auto&& entry = caches[file_idx].find(byte_pos);
+        if (entry == nullptr) continue;
+        auto&& count = counts[i];
+        count.ll_ct = entry->ll_ct;
+        count.lh_ct = entry->lh_ct;
+        count.hh_ct = entry->hh_ct;
+        count.ll_ctf = entry->ll_ctf;
+        count.lh_ctf = entry->lh_ctf;
+        count.hh_ctf = entry->hh_ctf;
+        source[i] = CountSource::CACHE;
+        ++num_cached;
+    }
+    if (num_cached != 0)
+    {
+        m_reporter->report(std::to_string(num_cached)
+                           + " variant(s) with genotype counts from cache");
+    }
+    return source;
+}
+
+void Genotype::import_freq_count(Genotype* genotype,
+                                 std::vector<MarkerCounts>& counts,
+                                 std::vector<CountSource>& source)
+{
+    if (m_sample_ct != m_founder_ct)
+    {
+        // the PRS use all samples but the MAF only use the founders, a single
+        // set of counts can't give us both
+        m_reporter->report(
+            "Warning: Counts from " + m_freq_count_file
+            + " are only used when all samples are founders. Will calculate "
+              "the counts from the genotypes");
+        return;
+    }
+    bool compressed = false;
+    auto input = misc::load_stream(m_freq_count_file, compressed, m_thread);
+    std::string line;
+    // skip the meta information lines
+    while (std::getline(*input, line) && line.rfind("##", 0) == 0) {}
+    const count_cache::Columns columns = count_cache::parse_header(line);
+    if (line.empty() || line.front() != '#' || !columns.valid())
+    {
+        throw std::runtime_error(
+            "Error: " + m_freq_count_file
+            + " is not a PLINK 2 .gcount or .acount file! Must contain the ID, "
+              "REF, ALT and either the genotype counts (--geno-counts) or "
+              "the ALT_CTS and OBS_CT columns (--freq counts)\n");
+    }
+    const bool genotype_counts = columns.genotype_counts();
+    std::unordered_map<std::string_view, size_t> snp_index;
+    snp_index.reserve(genotype->m_existed_snps.size());
+    for (size_t i = 0; i < genotype->m_existed_snps.size(); ++i)
+    { snp_index[genotype->m_existed_snps[i].rs()] = i; }
+    auto to_upper = [](std::string_view allele) {
+        std::string res(allele);
+        std::transform(res.begin(), res.end(), res.begin(), ::toupper);
+        return res;
+    };
+    auto parse_count = [&](const std::vector<std::string_view>& token,
+                           const size_t col, uint64_t& value) {
+        if (col == count_cache::Columns::npos)
+        {
+            value = 0;
+            return;
+        }
+        if (!misc::parse_value(token[col], value))
+        {
+            throw std::runtime_error("Error: Invalid count in "
+                                     + m_freq_count_file + ": "
+                                     + std::string(token[col]) + "\n");
+        }
+    };
+    std::vector<std::string_view> token;
+    std::string a1, a2;
+    uint64_t hom_ref, het, two_alt, hap_ref, hap_alt, missing, alt_ct, obs_ct;
+    size_t num_imported = 0, num_skipped = 0, num_other_sample = 0, idx;
+    bool a1_is_alt;
+    while (std::getline(*input, line))
+    {
+        misc::trim(line);
+        if (line.empty()) continue;
+        token = misc::tokenize(line);
+        if (token.size() != columns.num_col)
+        {
+            throw std::runtime_error("Error: Malformed count file: "
+                                     + m_freq_count_file
+                                     + ". Number of column differ from the "
+                                       "header on line: "
+                                     + line + "\n");
+        }
+        auto&& found = snp_index.find(token[columns.id]);
+        if (found == snp_index.end()) continue;
+        idx = found->second;
+        auto&& snp = genotype->m_existed_snps[idx];
+        // alleles of the genotype file, where the reference can be flipped
+        // with respect to the target
+        a1 = snp.ref();
+        a2 = snp.alt();
+        if (m_is_ref && snp.is_ref_flipped()) std::swap(a1, a2);
+        const std::string ref = to_upper(token[columns.ref]),
+                          alt = to_upper(token[columns.alt]);
+        if (ref == a2 && alt == a1) { a1_is_alt = true; }
+        else if (ref == a1 && alt == a2)
+        {
+            a1_is_alt = false;
+        }
+        else
+        {
+            ++num_skipped;
+            continue;
+        }
+        auto&& count = counts[idx];
+        if (genotype_counts)
+        {
+            parse_count(token, columns.hom_ref, hom_ref);
+            parse_count(token, columns.het, het);
+            parse_count(token, columns.two_alt, two_alt);
+            parse_count(token, columns.hap_ref, hap_ref);
+            parse_count(token, columns.hap_alt, hap_alt);
+            parse_count(token, columns.missing, missing);
+            // haploid calls are not counted by PRSice, and the counts must be
+            // calculated from the same samples. Without MISSING_CT, we can't
+            // tell missing calls from a smaller sample set
+            if (hap_ref + hap_alt != 0
+                || hom_ref + het + two_alt + missing != m_founder_ct)
+            {
+                ++num_other_sample;
+                continue;
+            }
+            count.ll_ct = static_cast<uint32_t>(a1_is_alt ? two_alt : hom_ref);
+            count.lh_ct = static_cast<uint32_t>(het);
+            count.hh_ct = static_cast<uint32_t>(a1_is_alt ? hom_ref : two_alt);
+            source[idx] = CountSource::GENOTYPE;
+        }
+        else
+        {
+            parse_count(token, columns.alt_ct, alt_ct);
+            parse_count(token, columns.obs_ct, obs_ct);
+            // there is no missing count in an .acount file, so only variants
+            // without missing calls are known to come from the same samples
+            if (obs_ct != 2 * m_founder_ct || alt_ct > obs_ct)
+            {
+                ++num_other_sample;
+                continue;
+            }
+            // only the allele counts are known, so we use counts that give
+            // the same MAF and missingness
+            const uint64_t a2_ct = a1_is_alt ? obs_ct - alt_ct : alt_ct;
+            count.hh_ct = static_cast<uint32_t>(a2_ct / 2);
+            count.lh_ct = static_cast<uint32_t>(a2_ct % 2);
+            count.ll_ct =
+                static_cast<uint32_t>(obs_ct / 2) - count.hh_ct - count.lh_ct;
+            source[idx] = CountSource::ALLELE;
+        }
+        count.ll_ctf = count.ll_ct;
+        count.lh_ctf = count.lh_ct;
+        count.hh_ctf = count.hh_ct;
+        ++num_imported;
+    }
+    std::string message = std::to_string(num_imported)
+                          + " variant(s) with counts from "
+                          + m_freq_count_file;
+    if (num_skipped != 0)
+    {
+        message.append("\n" + std::to_string(num_skipped)
+                       + " variant(s) with mismatched alleles will be counted "
+                         "from the genotypes");
+    }
+    if (num_other_sample != 0)
+    {
+        message.append(
+            "\n" + std::to_string(num_other_sample)
+            + " variant(s) with missing calls or counts that don't match the "
+              "number of founders will be counted from the genotypes");
+    }
+    m_reporter->report(message);
+}
+
+void Genotype::cache_counts(const MarkerCounts& count, const SNP& snp,
+                            std::vector<count_cache::Cache>& caches) const
+{
+    count_cache::Entry entry;
+    size_t file_idx;
+    std::streampos byte_pos;
+    snp.get_file_info(file_idx, byte_pos, m_is_ref);
+    entry.pos = count_cache::Cache::to_pos(byte_pos);
+    entry.ll_ct = count.ll_ct;
+    entry.lh_ct = count.lh_ct;
+    entry.hh_ct = count.hh_ct;
+    entry.ll_ctf = count.ll_ctf;
+    entry.lh_ctf = count.lh_ctf;
+    entry.hh_ctf = count.hh_ctf;
+    caches[file_idx].add(entry);
+}
+
+bool Genotype::filter_by_counts(const QCFiltering& filter_info,
+                                const MarkerCounts& count,
+                                const CountSource source, SNP& snp)
+{
+    const double sample_ct_recip = 1.0 / (static_cast<double>(m_sample_ct));
+    uint32_t uii = count.ll_ct + count.lh_ct + count.hh_ct;
+    const double cur_geno =
+        1.0 - (static_cast<int32_t>(uii)) * sample_ct_recip;
+    uii = 2 * (count.ll_ctf + count.lh_ctf + count.hh_ctf);
+    const uint32_t tmp_total = (count.ll_ctf + count.lh_ctf + count.hh_ctf);
+    assert(m_founder_ct >= tmp_total);
+    const uint32_t missing = static_cast<uint32_t>(m_founder_ct) - tmp_total;
+    double cur_maf = 0.5;
+    if (uii)
+    {
+        cur_maf = (static_cast<double>(2 * count.hh_ctf + count.lh_ctf))
+                  / (static_cast<double>(uii));
+        cur_maf = (cur_maf > 0.5) ? 1 - cur_maf : cur_maf;
+    }
+    if (misc::logically_equal(cur_maf, 0.0)
+        || misc::logically_equal(cur_maf, 1.0))
+    {
+        // none of the sample contain this SNP
+        // still count as MAF filtering (for now)
+        ++m_num_maf_filter;
+        return false;
+    }
+    // filter by genotype missingness
+    if (filter_info.geno < cur_geno)
+    {
+        ++m_num_geno_filter;
+        return false;
+    }
+    if (cur_maf < filter_info.maf)
+    {
+        ++m_num_maf_filter;
+        return false;
+    }
+    // if we can reach here, it is not removed. Allele counts don't give us
+    // the genotype counts, those will be calculated when the genotypes are
+    // read
+    if (source != CountSource::ALLELE)
+    {
+        snp.set_counts(count.ll_ctf, count.lh_ctf, count.hh_ctf, missing,
+                       m_is_ref);
+    }
+    return true;
+}
+
+void Genotype::close_count_caches(std::vector<count_cache::Cache>& caches)
+{
+    for (auto&& cache : caches)
+    {
+        if (!cache.close())
+        {
+            cache_warning("Warning: Failed to write count cache file "
+                          + cache.name());
+        }
+    }
+}
+
+void Genotype::cache_warning(const std::string& message) const
+{
+    // shared by the target and reference
+    static std::atomic<bool> warned(false);
+    if (warned.exchange(true)) return;
+    m_reporter->report(message
+                       + ". Other cache failures of this run will not be "
+                         "reported. Use --cache-dir to move the caches or "
+                         "--no-cache to disable them\n");
+}
+
 void Genotype::print_mismatch(const std::string& out, const std::string& type,
                               const SNP& target, const std::string& rs,
                               const std::string& a1, const std::string& a2,
@@ -959,6 +1694,9 @@ void Genotype::efficient_clumping(const Clumping& clump_info,
                                   Genotype& reference)
 {
     m_reporter->report("Start performing clumping");
+    // clumping jumps back and forth within the window, read ahead will mostly
+    // fetch pages we don't need
+    reference.m_genotype_file.advise(FileRead::Access::RANDOM);
     const double min_r2 = clump_info.use_proxy
                               ? std::min(clump_info.proxy, clump_info.r2)
                               : clump_info.r2;
@@ -992,9 +1730,51 @@ void Genotype::efficient_clumping(const Clumping& clump_info,
     };
     double prev_progress = -1.0;
     const auto num_snp = m_existed_snps.size();
-    double r2 = -1.0;
-    uintptr_t* clump_geno_idx = nullptr;
     size_t num_core_snps = 0;
+    // the filtering of SNPs within the window only need the clump status and
+    // p-value, use the variant table such that we don't need to touch the
+    // SNP objects unless clumping is required. The clump status is only
+    // tracked here, the SNP objects only keep the set membership
+    std::vector<uint8_t> clumped(num_snp, false);
+    const auto& p_value = m_variants.p_value;
+    const auto& ref_file = m_variants.reference;
+    auto skip = [&clumped, &p_value, &clump_info](const size_t idx) {
+        return clumped[idx] || p_value[idx] > clump_info.pvalue;
+    };
+    // the SNPs within the window are read and compared to the core SNP on
+    // the worker pool, which need the thread safe read of the reference
+    WorkerPool& pool = worker_pool();
+    const size_t num_thread = pool.num_thread();
+    if (num_thread > 1) reference.prepare_concurrent_read();
+    auto read_ref = [&reference, &ref_file, num_thread](uintptr_t* geno,
+                                                        const size_t idx) {
+        if (num_thread > 1)
+        {
+            reference.read_genotype_concurrent(geno, ref_file[idx].byte_pos,
+                                               ref_file[idx].name_idx);
+        }
+        else
+        {
+            reference.read_genotype(geno, ref_file[idx].byte_pos,
+                                    ref_file[idx].name_idx);
+        }
+    };
+    // SNPs of the current window that are not yet clumped and their r2 with
+    // the core SNP
+    std::vector<size_t> window;
+    std::vector<double> window_r2;
+    // the core SNP is stored at the front of the storage, followed by the
+    // SNPs of the window. Each task only touch its own part of the storage
+    uintptr_t* core_geno = geno_storage.data();
+    auto compute_r2 = [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            uintptr_t* geno = &geno_storage[(i + 1) * unfiltered_sample_ctv2];
+            read_ref(geno, window[i]);
+            window_r2[i] = get_r2(founder_ctl2, founder_ctv2, geno,
+                                  index_data, index_tots);
+        }
+    };
     for (size_t i_snp = 0; i_snp < num_snp; ++i_snp)
     {
         double progress =
@@ -1005,79 +1785,45 @@ void Genotype::efficient_clumping(const Clumping& clump_info,
             prev_progress = progress;
         }
         auto&& core_snp_idx = m_sort_by_p_index[i_snp];
+        if (skip(core_snp_idx)) { continue; }
         auto&& core_snp = m_existed_snps[core_snp_idx];
-        if (core_snp.clumped() || core_snp.p_value() > clump_info.pvalue)
-        { continue; }
-        const size_t clump_start_idx = core_snp.low_bound();
-        const size_t clump_end_idx = core_snp.up_bound();
-        // we are reusing the genotype storage. So the idx starts at 1
-        // the reason this is a two part process is so that we can reduce the
-        // number of fseek
-        clump_geno_idx = geno_storage.data();
-        for (size_t clump_idx = clump_start_idx; clump_idx < core_snp_idx;
-             ++clump_idx)
-        {
-            auto&& clump_snp = m_existed_snps[clump_idx];
-            if (clump_snp.clumped() || clump_snp.p_value() > clump_info.pvalue)
-            { continue; }
-            reference.read_genotype(clump_geno_idx,
-                                    clump_snp.get_byte_pos(true),
-                                    clump_snp.get_file_idx(true));
-            //++clump_geno_idx;
-            clump_geno_idx = &(clump_geno_idx[unfiltered_sample_ctv2]);
-        }
-        // now read in core snp
-        reference.read_genotype(clump_geno_idx, core_snp.get_byte_pos(true),
-                                core_snp.get_file_idx(true));
-
+        read_ref(core_geno, core_snp_idx);
         update_index_tot(founder_ctl2, founder_ctv2, reference.m_founder_ct,
-                         index_data, index_tots, founder_include2,
-                         clump_geno_idx);
-
-        clump_geno_idx = geno_storage.data();
-        for (size_t clump_idx = clump_start_idx; clump_idx < core_snp_idx;
-             ++clump_idx)
+                         index_data, index_tots, founder_include2, core_geno);
+        window.clear();
+        for (size_t clump_idx = m_variants.low_bound[core_snp_idx];
+             clump_idx < m_variants.up_bound[core_snp_idx]; ++clump_idx)
         {
-            auto&& clump_snp = m_existed_snps[clump_idx];
-            if (clump_snp.clumped() || clump_snp.p_value() > clump_info.pvalue)
-                // Again, ignore unwanted SNP
-                continue;
-            r2 = get_r2(founder_ctl2, founder_ctv2, clump_geno_idx, index_data,
-                        index_tots);
-            if (r2 >= min_r2)
-            {
-                // if the R2 between two SNP is higher than the minim threshold,
-                // we will perform clumping
-                // use the core SNP to clump the pair_target_snp
-                core_snp.clump(clump_snp, r2, clump_info.use_proxy,
-                               clump_info.proxy);
-            }
-            // travel to the next snp
-            clump_geno_idx = &(clump_geno_idx[unfiltered_sample_ctv2]);
+            if (clump_idx != core_snp_idx && !skip(clump_idx))
+            { window.push_back(clump_idx); }
         }
-        // now we can read the SNPs that come after the index SNP in the file
-
-        for (size_t clump_idx = core_snp_idx + 1; clump_idx < clump_end_idx;
-             ++clump_idx)
+        window_r2.resize(window.size());
+        // only worth starting the workers when each get a few SNPs
+        if (num_thread == 1 || window.size() < 4 * num_thread)
+        { compute_r2(0, window.size()); }
+        else
         {
-            clump_geno_idx = geno_storage.data();
-            auto&& clump_snp = m_existed_snps[clump_idx];
-            if (clump_snp.clumped() || clump_snp.p_value() > clump_info.pvalue)
-                continue;
-            // read in the genotype information
-            reference.read_genotype(clump_geno_idx,
-                                    clump_snp.get_byte_pos(true),
-                                    clump_snp.get_file_idx(true));
-            r2 = get_r2(founder_ctl2, founder_ctv2, clump_geno_idx, index_data,
-                        index_tots);
-            // now perform clumping if required
-            if (r2 >= min_r2)
+            const size_t num_task = std::min(window.size(), num_thread * 4);
+            const size_t step = (window.size() + num_task - 1) / num_task;
+            pool.start(num_task, [&, step](size_t task) {
+                const size_t begin = std::min(window.size(), task * step);
+                compute_r2(begin, std::min(window.size(), begin + step));
+            });
+            pool.wait();
+        }
+        // clump in SNP order, such that the result doesn't depend on the
+        // number of thread
+        for (size_t i = 0; i < window.size(); ++i)
+        {
+            if (window_r2[i] >= min_r2)
             {
-                core_snp.clump(clump_snp, r2, clump_info.use_proxy,
-                               clump_info.proxy);
+                // use the core SNP to clump the SNP
+                clumped[window[i]] = core_snp.clump_flags(
+                    m_existed_snps[window[i]], window_r2[i],
+                    clump_info.use_proxy, clump_info.proxy);
             }
         }
-        core_snp.set_clumped();
+        clumped[core_snp_idx] = true;
         // we set the remain_core to true so that we will keep it at the end
         remain_snps[core_snp_idx] = true;
         ++num_core_snps;
@@ -1087,8 +1833,10 @@ void Genotype::efficient_clumping(const Clumping& clump_info,
     { shrink_snp_vector(remain_snps); }
 
     // we no longer require the index. might as well clear it (and hope it will
-    // release the memory)
+    // release the memory). The variant table will be rebuilt once the SNPs
+    // are ordered for PRS calculation
     m_existed_snps_index.clear();
+    m_variants.clear();
     m_reporter->report("Number of variant(s) after clumping : "
                        + misc::to_string(m_existed_snps.size()));
 }
@@ -1369,23 +2117,28 @@ void Genotype::plink_clumping(const Clumping& clump_info, Genotype& reference)
 }
 void Genotype::recalculate_categories(const PThresholding& p_info)
 { // need to loop through the SNPs to check
-    std::sort(begin(m_existed_snps), end(m_existed_snps),
-              [](SNP const& t1, SNP const& t2) {
-                  if (misc::logically_equal(t1.p_value(), t2.p_value()))
-                  {
-                      if (t1.chr() == t2.chr())
-                      {
-                          if (t1.loc() == t2.loc())
-                          { return t1.rs() < t2.rs(); }
-                          else
-                              return t1.loc() < t2.loc();
-                      }
-                      else
-                          return t1.chr() < t2.chr();
-                  }
-                  else
-                      return t1.p_value() < t2.p_value();
-              });
+    // p-values are compared with a tolerance, which can't be expressed as a
+    // radix key. Still sort the index such that the SNPs are only moved once
+    std::vector<size_t> order(m_existed_snps.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](size_t i1, size_t i2) {
+        auto&& t1 = m_existed_snps[i1];
+        auto&& t2 = m_existed_snps[i2];
+        if (misc::logically_equal(t1.p_value(), t2.p_value()))
+        {
+            if (t1.chr() == t2.chr())
+            {
+                if (t1.loc() == t2.loc()) { return t1.rs() < t2.rs(); }
+                else
+                    return t1.loc() < t2.loc();
+            }
+            else
+                return t1.chr() < t2.chr();
+        }
+        else
+            return t1.p_value() < t2.p_value();
+    });
+    reorder_snps(order);
     unsigned long long cur_category = 0;
     double prev_p = p_info.lower;
     bool has_warned = false, cur_warn;
@@ -1409,18 +2162,14 @@ bool Genotype::prepare_prsice(const PThresholding& p_info)
 {
     if (m_existed_snps.size() == 0) return false;
     if (m_very_small_thresholds) { recalculate_categories(p_info); }
-    std::sort(begin(m_existed_snps), end(m_existed_snps),
-              [](SNP const& t1, SNP const& t2) {
-                  if (t1.category() == t2.category())
-                  {
-                      if (t1.get_file_idx() == t2.get_file_idx())
-                      { return t1.get_byte_pos() < t2.get_byte_pos(); }
-                      else
-                          return t1.get_file_idx() < t2.get_file_idx();
-                  }
-                  else
-                      return t1.category() < t2.category();
-              });
+    sort_snps({snp_key([](const SNP& snp) { return snp.category(); }),
+               snp_key([](const SNP& snp) { return snp.get_file_idx(); }),
+               snp_key([](const SNP& snp) {
+                   return static_cast<std::streamoff>(snp.get_byte_pos());
+               })});
+    build_variant_table();
+    // SNPs are now read in file order within each threshold
+    m_genotype_file.advise(FileRead::Access::SEQUENTIAL);
     return true;
 }
 
@@ -1531,13 +2280,7 @@ void Genotype::get_null_score(std::vector<PRS>& prs_list,
 void Genotype::load_genotype_to_memory()
 {
     // first, sort the SNPs for easy reading
-    std::sort(begin(m_existed_snps), end(m_existed_snps),
-              [](SNP const& t1, SNP const& t2) {
-                  if (t1.get_file_idx() == t2.get_file_idx())
-                  { return t1.get_byte_pos() < t2.get_byte_pos(); }
-                  else
-                      return t1.get_file_idx() < t2.get_file_idx();
-              });
+    sort_snps_by_file(false);
     // now iterate and read each SNP one by one, get the counts too
     std::vector<size_t> idx(m_existed_snps.size());
     std::iota(std::begin(idx), std::end(idx), 0);
@@ -1554,18 +2297,17 @@ bool Genotype::get_score(std::vector<size_t>::const_iterator& start_index,
     if (m_existed_snps.size() == 0 || start_index == end_index
         || (*start_index) == m_existed_snps.size())
         return false;
+    // the table is cleared whenever m_existed_snps is reordered or shrunk
+    if (m_variants.size() != m_existed_snps.size()) build_variant_table();
     // reset number of SNPs if we don't need cumulative PRS
     if (m_prs_calculation.non_cumulate) num_snp_included = 0;
-    unsigned long long cur_category = m_existed_snps[(*start_index)].category();
-    cur_threshold = m_existed_snps[(*start_index)].get_threshold();
+    const auto& category = m_variants.category;
+    const unsigned long long cur_category = category[(*start_index)];
+    cur_threshold = m_variants.threshold[(*start_index)];
     std::vector<size_t>::const_iterator region_end = start_index;
     for (; region_end != end_index; ++region_end)
     {
-        if (m_existed_snps[(*region_end)].category() != cur_category)
-        {
-            cur_category = m_existed_snps[(*region_end)].category();
-            break;
-        }
+        if (category[(*region_end)] != cur_category) break;
         ++num_snp_included;
     }
     read_score(start_index, region_end,
@@ -1579,6 +2321,289 @@ bool Genotype::get_score(std::vector<size_t>::const_iterator& start_index,
     return true;
 }
 
+void Genotype::save_partial_score(
+    const std::string& out,
+    const std::vector<std::vector<size_t>>& region_membership,
+    const std::vector<std::string>& region_names)
+{
+    const std::string shard_name = out + ".shard";
+    std::ofstream shard(shard_name.c_str(), std::ios::binary);
+    if (!shard.is_open())
+    {
+        throw std::runtime_error("Error: Cannot open file: " + shard_name
+                                 + " to write!\n");
+    }
+    auto write_value = [&shard](const auto& value) {
+        shard.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    const size_t num_prs = m_prs_info.size();
+    const unsigned long long version = m_partial_version;
+    shard.write(m_partial_magic.data(),
+                static_cast<std::streamsize>(m_partial_magic.size()));
+    write_value(version);
+    write_value(sample_hash());
+    write_value(static_cast<unsigned long long>(num_prs));
+    write_value(
+        static_cast<unsigned long long>(m_prs_calculation.non_cumulate));
+    // each record contains the threshold, the number of SNPs included and the
+    // score and number of SNPs of each sample. Regions are written one after
+    // another, with a table of their offsets at the end of the file
+    const size_t num_region = region_names.size();
+    std::vector<unsigned long long> offset(num_region, 0),
+        num_threshold(num_region, 0);
+    std::vector<double> score(num_prs);
+    std::vector<unsigned long long> snp_count(num_prs);
+    for (size_t i_region = 0; i_region < num_region; ++i_region)
+    {
+        offset[i_region] = static_cast<unsigned long long>(shard.tellp());
+        // background region is never scored
+        if (i_region == 1 || i_region >= region_membership.size()) continue;
+        auto&& member = region_membership[i_region];
+        std::vector<size_t>::const_iterator start = member.cbegin();
+        double cur_threshold = 0.0;
+        uint32_t num_snp_included = 0;
+        bool first_run = true;
+        while (get_score(start, member.cend(), cur_threshold, num_snp_included,
+                         first_run))
+        {
+            first_run = false;
+            for (size_t i = 0; i < num_prs; ++i)
+            {
+                score[i] = m_prs_info[i].prs;
+                snp_count[i] = m_prs_info[i].num_snp;
+            }
+            write_value(cur_threshold);
+            write_value(static_cast<unsigned long long>(num_snp_included));
+            shard.write(reinterpret_cast<const char*>(score.data()),
+                        static_cast<std::streamsize>(num_prs * sizeof(double)));
+            shard.write(reinterpret_cast<const char*>(snp_count.data()),
+                        static_cast<std::streamsize>(
+                            num_prs * sizeof(unsigned long long)));
+            ++num_threshold[i_region];
+        }
+    }
+    const unsigned long long table_offset =
+        static_cast<unsigned long long>(shard.tellp());
+    for (size_t i_region = 0; i_region < num_region; ++i_region)
+    {
+        auto&& name = region_names[i_region];
+        write_value(static_cast<unsigned long long>(name.size()));
+        shard.write(name.data(), static_cast<std::streamsize>(name.size()));
+        write_value(num_threshold[i_region]);
+        write_value(offset[i_region]);
+    }
+    write_value(static_cast<unsigned long long>(num_region));
+    write_value(table_offset);
+    shard.close();
+    if (!shard)
+    {
+        throw std::runtime_error("Error: Failed to write partial score file: "
+                                 + shard_name + "\n");
+    }
+    m_reporter->report("Partial scores written to " + shard_name + "\n");
+}
+
+std::vector<std::string>
+Genotype::load_partial_score(const std::vector<std::string>& shard_files)
+{
+    const size_t num_prs = m_prs_info.size();
+    const unsigned long long expected_hash = sample_hash();
+    const unsigned long long record_size = partial_record_size(num_prs);
+    std::vector<std::string> region_names;
+    m_partial_shards.clear();
+    for (auto&& name : shard_files)
+    {
+        PartialShard shard;
+        shard.name = name;
+        shard.file.open(name.c_str(), std::ios::binary);
+        if (!shard.file.is_open())
+        {
+            throw std::runtime_error("Error: Cannot open partial score file: "
+                                     + name + "\n");
+        }
+        auto read_value = [&shard](auto& value) {
+            shard.file.read(reinterpret_cast<char*>(&value), sizeof(value));
+        };
+        std::string magic(m_partial_magic.size(), '\0');
+        unsigned long long version = 0, hash = 0, sample_ct = 0,
+                           non_cumulate = 0, num_region = 0, table_offset = 0;
+        shard.file.read(&magic[0], static_cast<std::streamsize>(magic.size()));
+        read_value(version);
+        if (!shard.file || magic != m_partial_magic
+            || version != m_partial_version)
+        {
+            throw std::runtime_error("Error: " + name
+                                     + " is not a valid partial score file\n");
+        }
+        read_value(hash);
+        read_value(sample_ct);
+        read_value(non_cumulate);
+        if (hash != expected_hash || sample_ct != num_prs)
+        {
+            throw std::runtime_error(
+                "Error: Samples in " + name
+                + " do not match the target samples. All shards must be "
+                  "generated with the same target and sample filters\n");
+        }
+        if (non_cumulate
+            != static_cast<unsigned long long>(m_prs_calculation.non_cumulate))
+        {
+            throw std::runtime_error(
+                "Error: " + name
+                + " was generated with a different --non-cumulate setting\n");
+        }
+        shard.file.seekg(-2 * static_cast<std::streamoff>(sizeof(num_region)),
+                         std::ios::end);
+        read_value(num_region);
+        read_value(table_offset);
+        shard.file.seekg(static_cast<std::streamoff>(table_offset));
+        std::vector<std::string> names(num_region);
+        std::vector<unsigned long long> num_threshold(num_region);
+        shard.offset.resize(num_region);
+        for (size_t i_region = 0; i_region < num_region && shard.file;
+             ++i_region)
+        {
+            unsigned long long length = 0;
+            read_value(length);
+            names[i_region].resize(length);
+            shard.file.read(&names[i_region][0],
+                            static_cast<std::streamsize>(length));
+            read_value(num_threshold[i_region]);
+            read_value(shard.offset[i_region]);
+        }
+        if (!shard.file)
+        {
+            throw std::runtime_error("Error: " + name
+                                     + " is truncated or corrupted\n");
+        }
+        if (m_partial_shards.empty()) { region_names = names; }
+        else if (names != region_names)
+        {
+            throw std::runtime_error("Error: Regions in " + name
+                                     + " do not match those of "
+                                     + m_partial_shards.front().name + "\n");
+        }
+        shard.thresholds.resize(num_region);
+        for (size_t i_region = 0; i_region < num_region; ++i_region)
+        {
+            auto&& thresholds = shard.thresholds[i_region];
+            thresholds.resize(num_threshold[i_region]);
+            for (size_t i = 0; i < thresholds.size(); ++i)
+            {
+                shard.file.seekg(static_cast<std::streamoff>(
+                    shard.offset[i_region] + i * record_size));
+                read_value(thresholds[i]);
+            }
+        }
+        if (!shard.file)
+        {
+            throw std::runtime_error("Error: " + name
+                                     + " is truncated or corrupted\n");
+        }
+        shard.current.resize(num_prs);
+        m_partial_shards.push_back(std::move(shard));
+    }
+    // the thresholds of the merged score is the union of all shards
+    m_set_thresholds.clear();
+    m_set_thresholds.resize(region_names.size());
+    for (auto&& shard : m_partial_shards)
+    {
+        for (size_t i_region = 0; i_region < region_names.size(); ++i_region)
+        {
+            m_set_thresholds[i_region].insert(
+                shard.thresholds[i_region].begin(),
+                shard.thresholds[i_region].end());
+        }
+    }
+    m_partial_thresholds.clear();
+    for (auto&& thresholds : m_set_thresholds)
+    { m_partial_thresholds.emplace_back(thresholds.begin(), thresholds.end()); }
+    m_reporter->report("Merging partial scores from "
+                       + std::to_string(m_partial_shards.size())
+                       + " shard(s)\n");
+    return region_names;
+}
+
+void Genotype::read_partial_record(PartialShard& shard, const size_t region_idx,
+                                   const size_t idx)
+{
+    const size_t num_prs = shard.current.size();
+    const unsigned long long record_size = partial_record_size(num_prs);
+    std::vector<double> score(num_prs);
+    std::vector<unsigned long long> snp_count(num_prs);
+    // skip the threshold
+    shard.file.seekg(static_cast<std::streamoff>(
+        shard.offset[region_idx] + idx * record_size + sizeof(double)));
+    shard.file.read(reinterpret_cast<char*>(&shard.num_snp),
+                    sizeof(shard.num_snp));
+    shard.file.read(reinterpret_cast<char*>(score.data()),
+                    static_cast<std::streamsize>(num_prs * sizeof(double)));
+    shard.file.read(
+        reinterpret_cast<char*>(snp_count.data()),
+        static_cast<std::streamsize>(num_prs * sizeof(unsigned long long)));
+    if (!shard.file)
+    {
+        throw std::runtime_error("Error: " + shard.name
+                                 + " is truncated or corrupted\n");
+    }
+    for (size_t i = 0; i < num_prs; ++i)
+    {
+        shard.current[i].prs = score[i];
+        shard.current[i].num_snp = snp_count[i];
+    }
+}
+
+bool Genotype::get_partial_score(const size_t region_idx,
+                                 const size_t threshold_idx,
+                                 double& cur_threshold,
+                                 uint32_t& num_snp_included)
+{
+    if (region_idx >= m_partial_thresholds.size()
+        || threshold_idx >= m_partial_thresholds[region_idx].size())
+        return false;
+    const double threshold = m_partial_thresholds[region_idx][threshold_idx];
+    const bool cumulate = !m_prs_calculation.non_cumulate;
+    std::fill(m_prs_info.begin(), m_prs_info.end(), PRS());
+    num_snp_included = 0;
+    for (auto&& shard : m_partial_shards)
+    {
+        auto&& shard_thresholds = shard.thresholds[region_idx];
+        if (threshold_idx == 0)
+        {
+            // new region, reset the shard
+            shard.next = 0;
+            shard.num_snp = 0;
+            std::fill(shard.current.begin(), shard.current.end(), PRS());
+        }
+        const size_t prev = shard.next;
+        while (shard.next < shard_thresholds.size()
+               && shard_thresholds[shard.next] <= threshold)
+        { ++shard.next; }
+        if (shard.next != prev)
+        {
+            // cumulative scores are stored as running sums, so we only need
+            // the last record within the current threshold
+            read_partial_record(shard, region_idx, shard.next - 1);
+        }
+        else if (!cumulate || shard.next == 0)
+        {
+            // this shard has no SNP within the current threshold
+            continue;
+        }
+        for (size_t i = 0; i < m_prs_info.size(); ++i)
+        {
+            m_prs_info[i].prs += shard.current[i].prs;
+            m_prs_info[i].num_snp += shard.current[i].num_snp;
+        }
+        num_snp_included += static_cast<uint32_t>(shard.num_snp);
+    }
+    cur_threshold = threshold;
+    if (m_prs_calculation.scoring_method == SCORING::STANDARDIZE
+        || m_prs_calculation.scoring_method == SCORING::CONTROL_STD)
+    { standardize_prs(); }
+    return true;
+}
+
 /**
  * DON'T TOUCH AREA
  *
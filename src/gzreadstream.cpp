@@ -0,0 +1,119 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "gzreadstream.hpp"
+#include <stdexcept>
+
+GZReader::GZReader(std::unique_ptr<std::istream> source,
+                   const std::string& file_name)
+    : m_file(std::move(source))
+    , m_in(m_zlib_buffer_size)
+    , m_file_name(file_name)
+{
+    setg(nullptr, nullptr, nullptr);
+    m_stream.zalloc = Z_NULL;
+    m_stream.zfree = Z_NULL;
+    m_stream.opaque = Z_NULL;
+    m_stream.next_in = Z_NULL;
+    m_stream.avail_in = 0;
+    // 15 + 16 for a gzip wrapped deflate stream
+    if (m_file == nullptr || inflateInit2(&m_stream, 15 + 16) != Z_OK) return;
+    m_initialized = true;
+    m_next = std::async(std::launch::async, &GZReader::read_chunk, this,
+                        std::vector<char>());
+}
+
+GZReader::~GZReader()
+{
+    // wait for the background thread before releasing the zlib stream
+    if (m_next.valid()) m_next.wait();
+    if (m_initialized) inflateEnd(&m_stream);
+}
+
+bool GZReader::fill_input()
+{
+    if (m_input_end) return false;
+    m_file->read(m_in.data(), static_cast<std::streamsize>(m_in.size()));
+    const std::streamsize num_read = m_file->gcount();
+    if (num_read <= 0)
+    {
+        m_input_end = true;
+        return false;
+    }
+    m_stream.next_in = reinterpret_cast<Bytef*>(m_in.data());
+    m_stream.avail_in = static_cast<uInt>(num_read);
+    return true;
+}
+
+GZReader::Chunk GZReader::read_chunk(std::vector<char> buffer)
+{
+    Chunk chunk;
+    chunk.data = std::move(buffer);
+    chunk.data.resize(m_buffer_size);
+    m_stream.next_out = reinterpret_cast<Bytef*>(chunk.data.data());
+    m_stream.avail_out = static_cast<uInt>(m_buffer_size);
+    while (m_stream.avail_out != 0)
+    {
+        if (m_stream.avail_in == 0 && !fill_input())
+        {
+            // the input must not end half way through a gzip member
+            chunk.error = !m_member_end;
+            break;
+        }
+        if (m_member_end)
+        {
+            // same as gzread, anything after a gzip member that isn't another
+            // gzip member is ignored
+            if (*m_stream.next_in != 0x1f)
+            {
+                m_stream.avail_in = 0;
+                m_input_end = true;
+                continue;
+            }
+            inflateReset(&m_stream);
+            m_member_end = false;
+        }
+        const int ret = inflate(&m_stream, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) { m_member_end = true; }
+        else if (ret != Z_OK)
+        {
+            chunk.error = true;
+            break;
+        }
+    }
+    chunk.data.resize(m_buffer_size - m_stream.avail_out);
+    return chunk;
+}
+
+GZReader::int_type GZReader::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (!m_next.valid()) return traits_type::eof();
+    Chunk chunk = m_next.get();
+    if (chunk.error)
+    {
+        throw std::runtime_error("Error: " + m_file_name
+                                 + " is corrupted or truncated!\n");
+    }
+    if (chunk.data.empty()) return traits_type::eof();
+    // recycle the consumed buffer for the next chunk
+    m_current.swap(chunk.data);
+    m_next = std::async(std::launch::async, &GZReader::read_chunk, this,
+                        std::move(chunk.data));
+    setg(m_current.data(), m_current.data(),
+         m_current.data() + m_current.size());
+    return traits_type::to_int_type(*gptr());
+}
@@ -26,16 +26,16 @@
 #include "reporter.hpp"
 #include <cstdlib>
 #include <iostream>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include <utility>
 
 
-void print_empty_region(
-    const std::string& out,
-    const std::vector<std::vector<size_t>>& region_membership,
-    std::vector<std::string>& region_names);
+void print_empty_region(const std::string& out,
+                        const std::vector<std::set<double>>& set_thresholds,
+                        std::vector<std::string>& region_names);
 
 int main(int argc, char* argv[])
 {
@@ -65,6 +65,12 @@ int main(int argc, char* argv[])
         std::vector<IITree<size_t, size_t>> exclusion_regions;
         Region::generate_exclusion(exclusion_regions,
                                    commander.exclusion_range());
+        // only process SNPs on the shard chromosome
+        if (!commander.shard_chr().empty())
+        {
+            Region::restrict_to_chromosome(exclusion_regions,
+                                           commander.shard_chr());
+        }
         bool init_ref = false;
         GenomeFactory factory;
         Genotype *target_file = nullptr, *reference_file = nullptr;
@@ -77,128 +83,178 @@ int main(int argc, char* argv[])
             target_file =
                 &target_file->keep_nonfounder(commander.nonfounders())
                      .keep_ambig(commander.keep_ambig())
+                     .match_by_pos(commander.match_by_pos())
+                     .read_gap(commander.read_gap())
                      .intermediate(commander.use_inter())
+                     .cache_dir(commander.cache_dir())
                      .set_prs_instruction(commander.get_prs_instruction())
                      .set_weight();
-            const std::string base_name = commander.get_base_name();
-            std::string message = "Start processing " + base_name + "\n";
-            message.append(separator);
-            reporter.report(message);
-            target_file->snp_extraction(commander.extract_file(),
-                                        commander.exclude_file());
-            auto [filter_count, dup_rs_id] = target_file->read_base(
-                commander.get_base(), commander.get_base_qc(),
-                commander.get_p_threshold(), exclusion_regions);
-            target_file->print_base_stat(filter_count, dup_rs_id,
-                                         commander.out(),
-                                         commander.get_base_qc().info_score);
-            // then we will read in the sample information
-            message = "Loading Genotype info from target\n";
-            message.append(separator);
-            reporter.report(message);
-            // Need to know if we use the reference
-            // When reference isn't used, we will need to generate the
-            // intermediate file for LD calculation if user used --allow-inter
-            // and --type bge
-            if (commander.use_ref()) target_file->expect_reference();
-            target_file->load_samples();
-            target_file->load_snps(commander.out(), exclusion_regions, verbose);
-            // now load the reference file
-            // initialize the memory map file
-            if (commander.use_ref() && commander.need_ref())
-            {
-                message = "Start processing reference\n";
-                reporter.report(message);
-                reference_file = factory.createGenotype(
-                    commander.get_reference(), commander.get_pheno(),
-                    commander.delim(), reporter);
-                reference_file = &reference_file->reference().intermediate(
-                    commander.use_inter());
-                init_ref = true;
-                message = "Loading Genotype info from reference\n";
-                message.append(separator);
-                reporter.report(message);
-                reference_file->load_samples();
-                // load the reference file
-                reference_file->load_snps(commander.out(), exclusion_regions,
-                                          verbose, target_file);
-            }
-            exclusion_regions.clear();
-            // with the reference file read, we can start doing filtering and
-            // calculate relevent metric
-            // set the hard coding threshold and dosage threshold which are
-            // required for handling dosage
-            target_file->set_thresholds(commander.get_target_qc());
-            // only calculate the MAF if we need to
-            target_file->calc_freqs_and_intermediate(commander.get_target_qc(),
-                                                     commander.out(), true);
-            if (init_ref)
-            {
-                reference_file->set_thresholds(commander.get_ref_qc());
-                reference_file->calc_freqs_and_intermediate(
-                    commander.get_ref_qc(), commander.out(), true, target_file);
-            }
-            // now should get the correct MAF and should have filtered the
-            // SNPs accordingly Generate Region flag information
-            Region region(commander.get_set(), &reporter);
-            const size_t num_regions =
-                region.generate_regions(target_file->max_chr());
-            std::vector<std::string> region_names = region.get_names();
-            target_file->add_flags(region.get_gene_sets(),
-                                   region.get_snp_sets(), num_regions,
-                                   commander.get_set().full_as_background);
             // start processing other files before doing clumping
             PRSice prsice(commander.get_prs_instruction(),
                           commander.get_p_threshold(), commander.get_pheno(),
                           commander.get_perm(), commander.out(), &reporter);
-            // Do phenotype check. If phenotype info is wrong, don't bother to
-            // do clumping
-            prsice.pheno_check();
-            // Store relevant parameters to the target object
-            if (!commander.get_clump_info().no_clump)
+            std::vector<std::vector<size_t>> region_membership;
+            std::vector<std::string> region_names;
+            size_t num_regions = 0;
+            if (!commander.merge_shard().empty())
             {
-                // now go through the snp vector an define the
-                // windows so that we can jump directly to the
-                // relevant SNPs immediately during clumping
-                target_file->build_clump_windows(
-                    commander.get_clump_info().distance);
-                // get the sort by p index vector for target
-                // so that we can still find out the relative coordinates of
-                // each SNPs This is only required for clumping
-                if (!target_file->sort_by_p())
-                {
-                    reporter.report("No SNPs left for PRSice processing");
-                    return -1;
-                }
-                // now perform clumping
-                target_file->efficient_clumping(
-                    commander.get_clump_info(),
-                    commander.use_ref() ? *reference_file : *target_file);
-                // immediately free the memory
+                // the scores were calculated by the --shard-chr runs, we only
+                // need the samples to perform the regression
+                prsice.pheno_check();
+                reporter.report("Loading sample info from target\n"
+                                + separator);
+                target_file->load_samples();
+                region_names =
+                    target_file->load_partial_score(commander.merge_shard());
+                num_regions = region_names.size();
+                region_membership.resize(num_regions);
             }
-            if (init_ref) { delete reference_file; }
-            if (commander.ultra_aggressive())
+            else
             {
-                // we will do something ultra aggressive here: To load all SNP
-                // information into memory (does not work for bgen if hard
-                // coding isn't used)
-                target_file->load_genotype_to_memory();
-            }
+                const std::string base_name = commander.get_base_name();
+                std::string message = "Start processing " + base_name + "\n";
+                message.append(separator);
+                reporter.report(message);
+                target_file->snp_extraction(commander.extract_file(),
+                                            commander.exclude_file());
+                auto [filter_count, dup_rs_id] = target_file->read_base(
+                    commander.get_base(), commander.get_base_qc(),
+                    commander.get_p_threshold(), exclusion_regions);
+                target_file->print_base_stat(
+                    filter_count, dup_rs_id, commander.out(),
+                    commander.get_base_qc().info_score);
+                // then we will read in the sample information
+                message = "Loading Genotype info from target\n";
+                message.append(separator);
+                reporter.report(message);
+                // Need to know if we use the reference
+                // When reference isn't used, we will need to generate the
+                // intermediate file for LD calculation if user used
+                // --allow-inter and --type bge
+                if (commander.use_ref()) target_file->expect_reference();
+                target_file->load_samples();
+                target_file->load_snps(commander.out(), exclusion_regions,
+                                       verbose);
+                // now load the reference file
+                // initialize the memory map file
+                if (commander.use_ref() && commander.need_ref())
+                {
+                    message = "Start processing reference\n";
+                    reporter.report(message);
+                    reference_file = factory.createGenotype(
+                        commander.get_reference(), commander.get_pheno(),
+                        commander.delim(), reporter);
+                    reference_file =
+                        &reference_file->reference()
+                             .intermediate(commander.use_inter())
+                             .cache_dir(commander.cache_dir())
+                             .read_gap(commander.read_gap())
+                             .set_thread(static_cast<size_t>(std::max(
+                                 commander.get_prs_instruction().thread, 1)));
+                    init_ref = true;
+                    message = "Loading Genotype info from reference\n";
+                    message.append(separator);
+                    reporter.report(message);
+                    reference_file->load_samples();
+                    // load the reference file
+                    reference_file->load_snps(commander.out(),
+                                              exclusion_regions, verbose,
+                                              target_file);
+                }
+                exclusion_regions.clear();
+                // with the reference file read, we can start doing filtering
+                // and calculate relevent metric
+                // set the hard coding threshold and dosage threshold which are
+                // required for handling dosage
+                target_file->set_thresholds(commander.get_target_qc());
+                // only calculate the MAF if we need to
+                target_file->calc_freqs_and_intermediate(
+                    commander.get_target_qc(), commander.out(), true);
+                if (init_ref)
+                {
+                    reference_file->set_thresholds(commander.get_ref_qc());
+                    reference_file->calc_freqs_and_intermediate(
+                        commander.get_ref_qc(), commander.out(), true,
+                        target_file);
+                }
+                // now should get the correct MAF and should have filtered the
+                // SNPs accordingly Generate Region flag information
+                Region region(commander.get_set(), &reporter,
+                              commander.get_prs_instruction().thread);
+                num_regions = region.generate_regions(target_file->max_chr());
+                target_file->add_flags(region.get_gene_sets(),
+                                       region.get_snp_sets(), num_regions,
+                                       commander.get_set().full_as_background);
+                region_names = region.get_names();
+                if (!commander.shard_chr().empty()
+                    && target_file->num_snps() == 0)
+                {
+                    // nothing left on this chromosome, still generate the
+                    // shard so that the merge can proceed
+                    region_membership.resize(num_regions);
+                    target_file->save_partial_score(
+                        commander.out(), region_membership, region_names);
+                    if (init_ref) { delete reference_file; }
+                    delete target_file;
+                    return 0;
+                }
+                // Do phenotype check. If phenotype info is wrong, don't bother
+                // to do clumping. Shards do not perform regression
+                if (commander.shard_chr().empty()) prsice.pheno_check();
+                // Store relevant parameters to the target object
+                if (!commander.get_clump_info().no_clump)
+                {
+                    // now go through the snp vector an define the
+                    // windows so that we can jump directly to the
+                    // relevant SNPs immediately during clumping
+                    target_file->build_clump_windows(
+                        commander.get_clump_info().distance);
+                    // get the sort by p index vector for target
+                    // so that we can still find out the relative coordinates
+                    // of each SNPs This is only required for clumping
+                    if (!target_file->sort_by_p())
+                    {
+                        reporter.report("No SNPs left for PRSice processing");
+                        return -1;
+                    }
+                    // now perform clumping
+                    target_file->efficient_clumping(
+                        commander.get_clump_info(),
+                        commander.use_ref() ? *reference_file : *target_file);
+                    // immediately free the memory
+                }
+                if (init_ref) { delete reference_file; }
+                if (commander.ultra_aggressive())
+                {
+                    // we will do something ultra aggressive here: To load all
+                    // SNP information into memory (does not work for bgen if
+                    // hard coding isn't used)
+                    target_file->load_genotype_to_memory();
+                }
 
-            // can do the update structure here
-            // Use sparse matrix for space and speed
-            // Column = set, row = SNPs (because EIGEN is column major)
-            // need to also know the number of threshold included
-            std::vector<std::vector<size_t>> region_membership;
-            target_file->prepare_prsice(commander.get_p_threshold());
-            // from now on, we are not allow to sort the m_existed_snps
-            target_file->build_membership_matrix(region_membership, num_regions,
-                                                 commander.out(), region_names,
-                                                 commander.print_snp());
+                // can do the update structure here
+                // Use sparse matrix for space and speed
+                // Column = set, row = SNPs (because EIGEN is column major)
+                // need to also know the number of threshold included
+                target_file->prepare_prsice(commander.get_p_threshold());
+                // from now on, we are not allow to sort the m_existed_snps
+                target_file->build_membership_matrix(
+                    region_membership, num_regions, commander.out(),
+                    region_names, commander.print_snp());
+                if (!commander.shard_chr().empty())
+                {
+                    // scores of the shards are combined with --merge-shard
+                    target_file->save_partial_score(
+                        commander.out(), region_membership, region_names);
+                    delete target_file;
+                    return 0;
+                }
+            }
             // we can now quickly check if any of the region are empty
             try
             {
-                print_empty_region(commander.out(), region_membership,
+                print_empty_region(commander.out(),
+                                   target_file->get_set_thresholds(),
                                    region_names);
             }
             catch (const std::runtime_error& er)
@@ -304,20 +360,19 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-void print_empty_region(
-    const std::string& out,
-    const std::vector<std::vector<size_t>>& region_membership,
-    std::vector<std::string>& region_names)
+void print_empty_region(const std::string& out,
+                        const std::vector<std::set<double>>& set_thresholds,
+                        std::vector<std::string>& region_names)
 {
     bool has_empty_region = false;
     std::ofstream empty_region;
     std::string empty_region_name = out + ".xregion";
     // region_start_idx size always = num_regions
     // check regions to see if there are any empty regions
-    for (size_t region_idx = 2; region_idx < region_membership.size();
+    for (size_t region_idx = 2; region_idx < set_thresholds.size();
          ++region_idx)
     {
-        if (region_membership[region_idx].empty())
+        if (set_thresholds[region_idx].empty())
         {
             if (!has_empty_region)
             {
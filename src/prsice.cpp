@@ -36,22 +36,17 @@ void PRSice::pheno_check()
     else
     {
         // user provided the phenotype file
-        std::ifstream pheno;
-        pheno.open(m_pheno_info.pheno_file.c_str());
-        if (!pheno.is_open())
-        {
-            throw std::runtime_error("Cannot open phenotype file: "
-                                     + m_pheno_info.pheno_file);
-        }
+        bool compressed;
+        auto pheno = misc::load_stream(m_pheno_info.pheno_file, compressed);
         std::string line;
         // read in the header line to check if the phenotype is here
-        std::getline(pheno, line);
+        std::getline(*pheno, line);
         if (line.empty())
         {
             throw std::runtime_error(
                 "Cannot have empty header line for phenotype file!");
         }
-        pheno.close();
+        pheno.reset();
         misc::trim(line);
         std::vector<std::string> col = misc::split(line);
         // we need at least 2 columns (IID + Phenotype)
@@ -349,7 +344,7 @@ void PRSice::update_sample_included(const std::string& delim, const bool binary,
     }
 }
 
-void PRSice::parse_pheno(const bool binary, const std::string& pheno,
+bool PRSice::parse_pheno(const bool binary, const std::string& pheno,
                          std::vector<double>& pheno_store, double& first_pheno,
                          bool& more_than_one_pheno, size_t& num_case,
                          size_t& num_control, int& max_pheno_code)
@@ -358,25 +353,22 @@ void PRSice::parse_pheno(const bool binary, const std::string& pheno,
     {
         // if trait is binary
         // we first convert it to a temporary
-        int temp = misc::convert<int>(pheno);
+        int temp;
         // so taht we can check if the input is valid
-        if (temp >= 0 && temp <= 2)
-        {
-            pheno_store.push_back(temp);
-            if (max_pheno_code < temp) max_pheno_code = temp;
-            if (temp == 1)
-                ++num_case;
-            else
-                ++num_control;
-        }
+        if (!misc::parse_value(pheno, temp) || temp < 0 || temp > 2)
+        { return false; }
+        pheno_store.push_back(temp);
+        if (max_pheno_code < temp) max_pheno_code = temp;
+        if (temp == 1)
+            ++num_case;
         else
-        {
-            throw std::runtime_error("Invalid binary phenotype format!");
-        }
+            ++num_control;
     }
     else
     {
-        pheno_store.push_back(misc::convert<double>(pheno));
+        double temp;
+        if (!misc::parse_value(pheno, temp)) { return false; }
+        pheno_store.push_back(temp);
         if (pheno_store.size() == 1) { first_pheno = pheno_store[0]; }
         else if (!more_than_one_pheno
                  && !misc::logically_equal(first_pheno, pheno_store.back()))
@@ -384,26 +376,22 @@ void PRSice::parse_pheno(const bool binary, const std::string& pheno,
             more_than_one_pheno = true;
         }
     }
+    return true;
 }
 
 std::unordered_map<std::string, std::string>
 PRSice::load_pheno_map(const size_t idx, const std::string& delim)
 {
     const size_t pheno_col_index = m_pheno_info.pheno_col_idx[idx];
-    std::ifstream pheno_file;
-    pheno_file.open(m_pheno_info.pheno_file.c_str());
-    if (!pheno_file.is_open())
-    {
-        throw std::runtime_error("Cannot open phenotype file: "
-                                 + m_pheno_info.pheno_file);
-    }
+    bool compressed;
+    auto pheno_file = misc::load_stream(m_pheno_info.pheno_file, compressed);
     // we first store everything into a map. This allow the phenotype and
     // genotype file to have completely different ordering and allow
     // different samples to be included in each file
     std::unordered_map<std::string, std::string> phenotype_info;
     std::vector<std::string> token;
     std::string line, id;
-    while (std::getline(pheno_file, line))
+    while (std::getline(*pheno_file, line))
     {
         misc::trim(line);
         if (line.empty()) continue;
@@ -429,7 +417,6 @@ PRSice::load_pheno_map(const size_t idx, const std::string& delim)
         }
         phenotype_info[id] = token[pheno_col_index];
     }
-    pheno_file.close();
     return phenotype_info;
 }
 void PRSice::gen_pheno_vec(Genotype& target, const size_t pheno_index,
@@ -467,15 +454,14 @@ void PRSice::gen_pheno_vec(Genotype& target, const size_t pheno_index,
             if (phenotype_info.find(id) != phenotype_info.end()
                 && phenotype_info[id] != "NA" && target.in_regression(i_sample))
             {
-                try
-                {
-                    parse_pheno(binary, phenotype_info[id], pheno_store,
+                if (parse_pheno(binary, phenotype_info[id], pheno_store,
                                 first_pheno, more_than_one_pheno, num_case,
-                                num_control, max_pheno_code);
+                                num_control, max_pheno_code))
+                {
                     m_sample_with_phenotypes[id] = sample_index_ct;
                     ++sample_index_ct;
                 }
-                catch (...)
+                else
                 {
                     ++invalid_pheno;
                 }
@@ -497,16 +483,15 @@ void PRSice::gen_pheno_vec(Genotype& target, const size_t pheno_index,
                 // it is ok to skip NA as default = sample.has_pheno = false
                 continue;
             }
-            try
-            {
-                parse_pheno(binary, target.pheno(i_sample), pheno_store,
+            if (parse_pheno(binary, target.pheno(i_sample), pheno_store,
                             first_pheno, more_than_one_pheno, num_case,
-                            num_control, max_pheno_code);
+                            num_control, max_pheno_code))
+            {
                 m_sample_with_phenotypes[target.sample_id(i_sample, delim)] =
                     sample_index_ct;
                 ++sample_index_ct;
             }
-            catch (const std::runtime_error&)
+            else
             {
                 ++invalid_pheno;
             }
@@ -633,11 +618,8 @@ bool PRSice::validate_covariate(const std::string& covariate,
              || idx != m_pheno_info.col_index_of_factor_cov[factor_level_idx])
     {
         // not a factor. Check if this is a valid covariate
-        try
-        {
-            misc::convert<double>(covariate);
-        }
-        catch (const std::runtime_error&)
+        double value;
+        if (!misc::parse_value(covariate, value))
         {
             ++missing_count[idx];
             return false;
@@ -742,7 +724,7 @@ void PRSice::process_cov_file(
     Eigen::Index& num_column, const std::string& delim)
 {
     // first, go through the covariate and generate the factor level vector
-    std::ifstream cov;
+    std::unique_ptr<std::istream> cov;
     // we will generate a vector containing the information of all samples
     // with valid covariate. The pair contain Sample Name and the index
     // before removal
@@ -768,16 +750,12 @@ void PRSice::process_cov_file(
     const size_t num_factors = m_pheno_info.factor_cov.size();
     factor_levels.resize(num_factors);
     // open the covariate file
-    cov.open(m_pheno_info.cov_file.c_str());
-    if (!cov.is_open())
-    {
-        throw std::runtime_error("Error: Cannot open covariate file: "
-                                 + m_pheno_info.cov_file);
-    }
+    bool compressed;
+    cov = misc::load_stream(m_pheno_info.cov_file, compressed);
     // the number of factor is used to guard against array out of bound
 
 
-    while (std::getline(cov, line))
+    while (std::getline(*cov, line))
     {
         misc::trim(line);
         if (line.empty()) continue;
@@ -841,7 +819,7 @@ void PRSice::process_cov_file(
             }
         }
     }
-    cov.close();
+    cov.reset();
 
     if (dup_id_count != 0)
     {
@@ -947,13 +925,8 @@ void PRSice::gen_cov_matrix(const std::string& delim)
     m_independent_variables.col(1).setOnes();
     // now we only need to fill in the independent matrix without worry
     // about other stuff
-    std::ifstream cov;
-    cov.open(m_pheno_info.cov_file.c_str());
-    if (!cov.is_open())
-    {
-        throw std::runtime_error("Error: Cannot open covariate file: "
-                                 + m_pheno_info.cov_file);
-    }
+    bool compressed;
+    auto cov = misc::load_stream(m_pheno_info.cov_file, compressed);
     std::vector<std::string> token;
     std::string line, id;
     size_t max_index = m_pheno_info.col_index_of_cov.back() + 1;
@@ -961,7 +934,7 @@ void PRSice::gen_cov_matrix(const std::string& delim)
     uint32_t cur_factor_index = 0;
     size_t num_factor = m_pheno_info.col_index_of_factor_cov.size(),
            num_cov = m_pheno_info.col_index_of_cov.size();
-    while (std::getline(cov, line))
+    while (std::getline(*cov, line))
     {
         misc::trim(line);
         if (line.empty()) continue;
@@ -980,23 +953,28 @@ void PRSice::gen_cov_matrix(const std::string& delim)
             cur_factor_index = 0;
             // get the row number
             index = static_cast<Eigen::Index>(m_sample_with_phenotypes[id]);
-            std::string covariate;
+            double value;
             for (size_t i_cov = 0; i_cov < num_cov; ++i_cov)
             {
-                covariate = token[m_pheno_info.col_index_of_cov[i_cov]];
+                const std::string& covariate =
+                    token[m_pheno_info.col_index_of_cov[i_cov]];
                 if (cur_factor_index >= num_factor
                     || m_pheno_info.col_index_of_cov[i_cov]
                            != m_pheno_info
                                   .col_index_of_factor_cov[cur_factor_index])
                 {
                     // noraml covariate
-                    // we don't need to deal with invalid conversion
-                    // situation as those should be taken cared of by the
-                    // process_cov_file function
+                    // invalid conversion should already be taken cared of by
+                    // the process_cov_file function
+                    if (!misc::parse_value(covariate, value))
+                    {
+                        throw std::runtime_error("Error: Invalid covariate: "
+                                                 + covariate);
+                    }
                     m_independent_variables(
                         index,
                         static_cast<Eigen::Index>(cov_start_index[i_cov])) =
-                        misc::convert<double>(covariate);
+                        value;
                 }
                 else
                 {
@@ -1065,8 +1043,13 @@ bool PRSice::run_prsice(
     // only print out all scores if this is the first phenotype
     const bool print_all_scores = all_scores && pheno_index == 0;
     const size_t num_samples_included = target.num_sample();
+    // when merging chromosome shards, the scores are read from the partial
+    // score files instead of the genotypes
+    const bool use_partial = target.has_partial_score();
     auto set_snp_idx = region_membership[region_index];
-    if (set_snp_idx.empty()) { return false; }
+    if (use_partial ? target.num_threshold(region_index) == 0
+                    : set_snp_idx.empty())
+    { return false; }
 
     Eigen::initParallel();
     Eigen::setNbThreads(m_prs_info.thread);
@@ -1083,8 +1066,12 @@ bool PRSice::run_prsice(
     // get_score will perform assignment instead of addition
     bool first_run = true;
     std::vector<size_t>::const_iterator start = set_snp_idx.begin();
-    while (target.get_score(start, set_snp_idx.cend(), cur_threshold,
-                            m_num_snp_included, first_run))
+    while (use_partial ? target.get_partial_score(region_index, prs_result_idx,
+                                                  cur_threshold,
+                                                  m_num_snp_included)
+                       : target.get_score(start, set_snp_idx.cend(),
+                                          cur_threshold, m_num_snp_included,
+                                          first_run))
     {
         ++m_analysis_done;
         print_progress();
@@ -127,6 +127,26 @@ void Region::generate_exclusion(std::vector<IITree<size_t, size_t>>& cr,
     for (auto&& tree : cr) { tree.index(); }
 }
 
+void Region::restrict_to_chromosome(std::vector<IITree<size_t, size_t>>& cr,
+                                    const std::string& chr)
+{
+    const int chr_code = get_chrom_code_raw(chr.c_str());
+    if (chr_code < 0 || chr_code >= MAX_POSSIBLE_CHROM)
+    {
+        throw std::runtime_error("Error: Invalid chromosome for --shard-chr: "
+                                 + chr + "\n");
+    }
+    const size_t keep = static_cast<size_t>(chr_code);
+    // cover the whole chromosome, overlap is tested using [loc, loc+1)
+    const size_t max_loc = ~size_t(0);
+    if (cr.size() < MAX_POSSIBLE_CHROM) { cr.resize(MAX_POSSIBLE_CHROM); }
+    for (size_t i_chr = 0; i_chr < cr.size(); ++i_chr)
+    {
+        if (i_chr != keep) { cr[i_chr].add(0, max_loc, 0); }
+        cr[i_chr].index();
+    }
+}
+
 
 size_t Region::generate_regions(const size_t max_chr)
 {
@@ -369,38 +389,8 @@ void Region::load_gtf(
     const bool provided_background = !m_background.empty();
     if (msigdb_list.empty() && m_genome_wide_background) return;
     bool gz_input = false;
-    try
-    {
-        gz_input = misc::is_gz_file(m_gtf);
-    }
-    catch (const std::runtime_error& er)
-    {
-        throw std::runtime_error(er.what());
-    }
-    misc::is_gz_file(m_gtf);
     // we want to allow gz file input (as GTF file can be big)
-    GZSTREAM_NAMESPACE::igzstream gz_gtf_file;
-    std::ifstream gtf_file;
-    if (gz_input)
-    {
-        gz_gtf_file.open(m_gtf.c_str());
-        if (!gz_gtf_file.good())
-        {
-            throw std::runtime_error("Error: Cannot open GTF (gz) to read!\n");
-        }
-    }
-    else
-    {
-        gtf_file.open(m_gtf.c_str());
-        if (!gtf_file.is_open())
-        { throw std::runtime_error("Cannot open gtf file: " + m_gtf); }
-    }
-    std::istream* stream;
-    if (gz_input) { stream = &(gz_gtf_file); }
-    else
-    {
-        stream = &(gtf_file);
-    }
+    auto stream = misc::load_stream(m_gtf, gz_input, m_thread);
     std::vector<std::string_view> token(9), attribute, extract;
     std::string chr_str, name, id, line;
     int chr_code;
@@ -0,0 +1,91 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "zstdstream.hpp"
+
+#ifdef USE_ZSTD
+#include <algorithm>
+#include <stdexcept>
+
+ZSTDReader::ZSTDReader(std::unique_ptr<std::istream> source,
+                       const std::string& file_name)
+    : m_file(std::move(source))
+    , m_in(ZSTD_DStreamInSize())
+    , m_file_name(file_name)
+    , m_out(std::max(ZSTD_DStreamOutSize(), m_buffer_size))
+{
+    setg(nullptr, nullptr, nullptr);
+    if (m_file == nullptr) return;
+    m_stream = ZSTD_createDStream();
+    if (m_stream != nullptr) ZSTD_initDStream(m_stream);
+    m_in_buffer.src = m_in.data();
+}
+
+ZSTDReader::~ZSTDReader()
+{
+    if (m_stream != nullptr) ZSTD_freeDStream(m_stream);
+}
+
+void ZSTDReader::throw_error() const
+{
+    throw std::runtime_error("Error: " + m_file_name
+                             + " is corrupted or truncated!\n");
+}
+
+ZSTDReader::int_type ZSTDReader::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (m_stream == nullptr) return traits_type::eof();
+    ZSTD_outBuffer output = {m_out.data(), m_out.size(), 0};
+    while (output.pos < output.size)
+    {
+        if (m_in_buffer.pos == m_in_buffer.size && !m_file_end)
+        {
+            m_file->read(m_in.data(),
+                         static_cast<std::streamsize>(m_in.size()));
+            const size_t num_read = static_cast<size_t>(m_file->gcount());
+            if (num_read == 0) { m_file_end = true; }
+            else
+            {
+                m_in_buffer.src = m_in.data();
+                m_in_buffer.size = num_read;
+                m_in_buffer.pos = 0;
+            }
+        }
+        const size_t prev_pos = output.pos;
+        const size_t prev_in_pos = m_in_buffer.pos;
+        const size_t ret =
+            ZSTD_decompressStream(m_stream, &output, &m_in_buffer);
+        if (ZSTD_isError(ret)) throw_error();
+        const bool progress =
+            (output.pos != prev_pos || m_in_buffer.pos != prev_in_pos);
+        // once a frame is done, calling without input return the size hint of
+        // the next frame, so only keep the return value of calls that did
+        // something
+        if (progress) m_last_ret = ret;
+        if (m_file_end && m_in_buffer.pos == m_in_buffer.size && !progress)
+        {
+            // nothing left to flush. A non-zero return means the last frame
+            // is incomplete
+            if (m_last_ret != 0) throw_error();
+            break;
+        }
+    }
+    if (output.pos == 0) return traits_type::eof();
+    setg(m_out.data(), m_out.data(), m_out.data() + output.pos);
+    return traits_type::to_int_type(*gptr());
+}
+#endif // USE_ZSTD
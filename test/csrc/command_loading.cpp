@@ -38,6 +38,7 @@ TEST_CASE("Commander Initialization")
         REQUIRE(base_commander.extract_file().empty());
         REQUIRE(base_commander.max_memory(1.0) == Approx(1.0));
         REQUIRE(base_commander.max_memory(2.0) == Approx(2.0));
+        REQUIRE(base_commander.cache_dir() == ".");
     }
 }
 
@@ -74,6 +75,19 @@ TEST_CASE("Commander set flag")
         REQUIRE(commander.parse_command_wrapper("--allow-inter"));
         REQUIRE(commander.use_inter());
     }
+    SECTION("no-cache")
+    {
+        REQUIRE(commander.parse_command_wrapper("--no-cache"));
+        REQUIRE(commander.cache_dir().empty());
+    }
+    SECTION("cache-dir")
+    {
+        // default to the directory of the output
+        REQUIRE(commander.parse_command_wrapper("--out result/prs"));
+        REQUIRE(commander.cache_dir() == "result");
+        REQUIRE(commander.parse_command_wrapper("--cache-dir cache"));
+        REQUIRE(commander.cache_dir() == "cache");
+    }
     SECTION("nonfounders")
     {
         REQUIRE_FALSE(commander.nonfounders());
@@ -516,6 +530,12 @@ TEST_CASE("Target parameter loading")
             REQUIRE(commander.parse_command_wrapper("--remove depression"));
             REQUIRE(commander.get_target().remove == "depression");
         }
+        SECTION("freq-count")
+        {
+            REQUIRE(commander.get_target().freq_count.empty());
+            REQUIRE(commander.parse_command_wrapper("--freq-count gcount"));
+            REQUIRE(commander.get_target().freq_count == "gcount");
+        }
         SECTION("dose-thres")
         {
             REQUIRE(commander.get_target_qc().dose_threshold == 0.0);
@@ -1197,6 +1217,12 @@ TEST_CASE("Reference parameter loading")
             REQUIRE(commander.parse_command_wrapper("--ld-remove depress"));
             REQUIRE(commander.get_reference().remove == "depress");
         }
+        SECTION("freq-count")
+        {
+            REQUIRE(commander.get_reference().freq_count.empty());
+            REQUIRE(commander.parse_command_wrapper("--ld-freq-count acount"));
+            REQUIRE(commander.get_reference().freq_count == "acount");
+        }
     }
     SECTION("filtering")
     {
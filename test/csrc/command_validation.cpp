@@ -288,6 +288,21 @@ TEST_CASE("Reference validation")
 TEST_CASE("Misc validation")
 {
     mockCommander commander;
+    SECTION("cache-dir")
+    {
+        REQUIRE(commander.parse_command_wrapper("--cache-dir ."));
+        REQUIRE(commander.misc_check_wrapper());
+        SECTION("with no-cache")
+        {
+            REQUIRE(commander.parse_command_wrapper("--no-cache"));
+            REQUIRE_FALSE(commander.misc_check_wrapper());
+        }
+    }
+    SECTION("missing cache-dir")
+    {
+        REQUIRE(commander.parse_command_wrapper("--cache-dir not_a_dir"));
+        REQUIRE_FALSE(commander.misc_check_wrapper());
+    }
     SECTION("Negative thread")
     {
         REQUIRE(commander.parse_command_wrapper("--thread -10"));
@@ -683,6 +698,13 @@ TEST_CASE("Base validaation")
             "--base /home/bin/Base.gz.summary"));
         REQUIRE(commander.get_base_name() == "Base.gz");
     }
+    SECTION("base cache requires a regular file")
+    {
+        REQUIRE(commander.parse_command_wrapper("--base . --base-cache cache"));
+        REQUIRE_FALSE(commander.base_check_wrapper());
+        REQUIRE_THAT(commander.get_error(),
+                     Catch::Contains("--base-cache can only be used"));
+    }
     REQUIRE(commander.parse_command_wrapper("--base Base"));
     SECTION("check auto loading works")
     {
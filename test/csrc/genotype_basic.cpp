@@ -1,9 +1,13 @@
 #include "catch.hpp"
 #include "genotype.hpp"
 #include "mock_genotype.hpp"
+#include "pgen.hpp"
 #include "plink_common.hpp"
 #include "reporter.hpp"
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <random>
 
 TEST_CASE("CHR_CONVERTION")
@@ -168,6 +172,85 @@ TEST_CASE("Check ambiguous")
             == std::get<2>(settings));
 }
 
+// string based allele matching, used to check the encoded matching
+bool string_matching(const std::string& ref, const std::string& alt,
+                     const std::string& target_ref,
+                     const std::string& target_alt, bool& flipped)
+{
+    auto complement = [](const std::string& a) -> std::string {
+        if (a == "A") return "T";
+        if (a == "T") return "A";
+        if (a == "G") return "C";
+        if (a == "C") return "G";
+        return a;
+    };
+    flipped = false;
+    const bool has_alt = !alt.empty() && !target_alt.empty();
+    if (ref == target_ref) return !has_alt || alt == target_alt;
+    if (complement(ref) == target_ref)
+        return !has_alt || complement(alt) == target_alt;
+    if (!has_alt) return false;
+    flipped = (ref == target_alt && alt == target_ref)
+              || (complement(ref) == target_alt
+                  && complement(alt) == target_ref);
+    return flipped;
+}
+
+TEST_CASE("SNP allele matching")
+{
+    const std::vector<std::string> alleles = {"A", "C", "G", "T",
+                                              "",  "AT", "N"};
+    StringArena arena;
+    for (auto&& ref : alleles)
+    {
+        for (auto&& alt : alleles)
+        {
+            SNP snp(arena, "rs1", 1, 10, ref, alt, 0, 0.1, 0, 0.1);
+            for (auto&& target_ref : alleles)
+            {
+                for (auto&& target_alt : alleles)
+                {
+                    bool flipped = true, expected_flipped = false;
+                    const bool expected =
+                        string_matching(ref, alt, target_ref, target_alt,
+                                        expected_flipped);
+                    REQUIRE(snp.matching(1, 10, target_ref, target_alt,
+                                         flipped)
+                            == expected);
+                    if (expected) { REQUIRE(flipped == expected_flipped); }
+                }
+            }
+            bool flipped;
+            REQUIRE_FALSE(snp.matching(2, 10, ref, alt, flipped));
+            REQUIRE_FALSE(snp.matching(1, 11, ref, alt, flipped));
+        }
+    }
+}
+
+TEST_CASE("Position key")
+{
+    // same SNV regardless of allele order and strand
+    const uint64_t key = SNP::position_key(1, 1234, "A", "C");
+    REQUIRE(SNP::position_key(1, 1234, "C", "A") == key);
+    REQUIRE(SNP::position_key(1, 1234, "T", "G") == key);
+    REQUIRE(SNP::position_key(1, 1234, "G", "T") == key);
+    REQUIRE(SNP::position_key(1, 1234, "A", "G") != key);
+    REQUIRE(SNP::position_key(1, 1235, "A", "C") != key);
+    REQUIRE(SNP::position_key(2, 1234, "A", "C") != key);
+    // non SNV share the same allele code, and only differ from the SNV in the
+    // lowest 8 bits
+    const uint64_t indel = SNP::position_key(1, 1234, "A", "AT");
+    REQUIRE(indel == SNP::position_key(1, 1234, "A", ""));
+    REQUIRE((indel >> 8) == (key >> 8));
+    // keys are ordered by chromosome then coordinate
+    REQUIRE(SNP::position_key(1, 1235, "A", "C")
+            > SNP::position_key(1, 1234, "T", "G"));
+    REQUIRE(SNP::position_key(2, 1, "A", "C")
+            > SNP::position_key(1, 1234, "T", "G"));
+    REQUIRE(SNP::position_key(~size_t(0), 1, "A", "C") == ~uint64_t(0));
+    REQUIRE(SNP::position_key(1, ~size_t(0), "A", "C") == ~uint64_t(0));
+}
+
 TEST_CASE("load snp selection")
 {
     mockGenotype geno;
@@ -328,3 +411,401 @@ TEST_CASE("initialize masks")
             REQUIRE(geno.max_chr() == static_cast<uint32_t>(n_auto));
     }
 }
+
+TEST_CASE("Bgen specialised decoder")
+{
+    // the specialised decoder must give identical results as the callbacks
+    auto bits = GENERATE(8, 16);
+    auto phased = GENERATE(false, true);
+    const uint32_t num_sample = 77;
+    std::mt19937 gen(static_cast<uint32_t>(bits + phased));
+    std::uniform_real_distribution<double> prob(0.0, 1.0);
+    genfile::bgen::Context context;
+    context.number_of_samples = num_sample;
+    context.flags = genfile::bgen::e_Layout2;
+    std::vector<genfile::byte_t> data;
+    auto add_int = [&data](uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i)
+        { data.push_back(static_cast<genfile::byte_t>(value >> (8 * i))); }
+    };
+    add_int(num_sample, 4);
+    add_int(2, 2);
+    // minimum and maximum ploidy
+    add_int(2, 1);
+    add_int(2, 1);
+    for (uint32_t i = 0; i < num_sample; ++i)
+    { add_int(prob(gen) < 0.1 ? 0x82 : 2, 1); }
+    add_int(phased, 1);
+    add_int(static_cast<uint64_t>(bits), 1);
+    const uint64_t max_value = (uint64_t(1) << bits) - 1;
+    for (uint32_t i = 0; i < num_sample; ++i)
+    {
+        const uint64_t first =
+            static_cast<uint64_t>(prob(gen) * static_cast<double>(max_value));
+        const uint64_t second =
+            phased ? static_cast<uint64_t>(prob(gen)
+                                           * static_cast<double>(max_value))
+                   : static_cast<uint64_t>(
+                       prob(gen) * static_cast<double>(max_value - first));
+        add_int(first, static_cast<size_t>(bits / 8));
+        add_int(second, static_cast<size_t>(bits / 8));
+    }
+    std::vector<uintptr_t> inclusion(BITCT_TO_WORDCT(num_sample), 0);
+    for (uint32_t i = 0; i < num_sample; ++i)
+    {
+        if (i % 5 != 3) SET_BIT(i, inclusion.data());
+    }
+    SECTION("dosage")
+    {
+        std::vector<double> dosage, expected_dosage;
+        std::vector<uint8_t> missing, expected_missing;
+        mockBinaryGen::test_dosage(context, data, inclusion, true, dosage,
+                                   missing);
+        mockBinaryGen::test_dosage(context, data, inclusion, false,
+                                   expected_dosage, expected_missing);
+        // only the included samples are returned
+        REQUIRE(dosage.size() == num_sample - (num_sample + 1) / 5);
+        REQUIRE(dosage == expected_dosage);
+        REQUIRE(missing == expected_missing);
+    }
+    SECTION("hard coded")
+    {
+        const size_t num_word = BITCT_TO_WORDCT(num_sample) * 2;
+        std::vector<uintptr_t> genotype(num_word, 0),
+            expected_genotype(num_word, 0);
+        std::vector<size_t> counts, expected_counts;
+        double info, expected_info;
+        mockBinaryGen::test_hard_coded(context, data, inclusion, true,
+                                       genotype, counts, info);
+        mockBinaryGen::test_hard_coded(context, data, inclusion, false,
+                                       expected_genotype, expected_counts,
+                                       expected_info);
+        REQUIRE(genotype == expected_genotype);
+        REQUIRE(counts == expected_counts);
+        REQUIRE(std::memcmp(&info, &expected_info, sizeof(info)) == 0);
+    }
+}
+
+TEST_CASE("Bgen zstd genotype block")
+{
+    genfile::bgen::Context context;
+    context.number_of_samples = 10;
+    context.flags =
+        genfile::bgen::e_Layout2 | genfile::bgen::e_ZstdCompression;
+    std::vector<genfile::byte_t> data(1000);
+    for (size_t i = 0; i < data.size(); ++i)
+    { data[i] = static_cast<genfile::byte_t>(i % 7); }
+    // uncompressed size followed by the compressed data
+    std::vector<genfile::byte_t> block(4);
+    for (size_t i = 0; i < block.size(); ++i)
+    { block[i] = static_cast<genfile::byte_t>(data.size() >> (8 * i)); }
+    std::vector<genfile::byte_t> buffer;
+#ifdef USE_ZSTD
+    block.resize(4 + ZSTD_compressBound(data.size()));
+    const size_t size = ZSTD_compress(block.data() + 4, block.size() - 4,
+                                      data.data(), data.size(), 1);
+    REQUIRE_FALSE(ZSTD_isError(size));
+    block.resize(4 + size);
+    genfile::bgen::uncompress_probability_data(context, block, &buffer);
+    REQUIRE(buffer == data);
+    // truncated block
+    block.pop_back();
+    REQUIRE_THROWS(
+        genfile::bgen::uncompress_probability_data(context, block, &buffer));
+#else
+    block.push_back(0);
+    REQUIRE_THROWS(
+        genfile::bgen::uncompress_probability_data(context, block, &buffer));
+#endif
+}
+
+TEST_CASE("Bgen score with multiple threads")
+{
+    // more SNPs than a window, such that the read, decode and fold of
+    // different windows overlap
+    const uint32_t num_sample = 37;
+    const size_t num_snp = 300;
+    const std::string prefix = "thread_test";
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> prob(0.0, 1.0);
+    genfile::bgen::Context context;
+    context.number_of_samples = num_sample;
+    context.flags = genfile::bgen::e_Layout2;
+    StringArena arena;
+    std::vector<SNP> snps;
+    std::ofstream bgen(prefix + ".bgen", std::ios::binary);
+    for (size_t i_snp = 0; i_snp < num_snp; ++i_snp)
+    {
+        std::vector<genfile::byte_t> data;
+        auto add_int = [&data](uint64_t value, size_t size) {
+            for (size_t i = 0; i < size; ++i)
+            { data.push_back(static_cast<genfile::byte_t>(value >> (8 * i))); }
+        };
+        add_int(num_sample, 4);
+        add_int(2, 2);
+        add_int(2, 1);
+        add_int(2, 1);
+        for (uint32_t i = 0; i < num_sample; ++i)
+        { add_int(prob(gen) < 0.05 ? 0x82 : 2, 1); }
+        add_int(0, 1);
+        add_int(8, 1);
+        for (uint32_t i = 0; i < num_sample; ++i)
+        {
+            const uint64_t first = static_cast<uint64_t>(prob(gen) * 255);
+            add_int(first, 1);
+            add_int(static_cast<uint64_t>(prob(gen) * (255 - first)), 1);
+        }
+        const std::streampos byte_pos = bgen.tellp();
+        const uint32_t size = static_cast<uint32_t>(data.size());
+        bgen.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        bgen.write(reinterpret_cast<const char*>(data.data()),
+                   static_cast<std::streamsize>(data.size()));
+        const std::string rs = "rs" + std::to_string(i_snp);
+        snps.emplace_back(arena, rs, 1, i_snp + 1, "A", "C", prob(gen) - 0.5,
+                          0.01, 0, 0.01);
+        snps.back().add_snp_info(arena, 0, byte_pos, 1, i_snp + 1, "A", "C",
+                                 i_snp % 3 == 0, false);
+    }
+    bgen.close();
+    const bool hard_coded = GENERATE(false, true);
+    const size_t thread = GENERATE(2, 3, 8);
+    mockBinaryGen single, multi;
+    auto expected =
+        single.test_score(prefix, context, snps, 1, hard_coded);
+    auto result = multi.test_score(prefix, context, snps, thread, hard_coded);
+    REQUIRE(result.size() == expected.size());
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        // the SNPs are added in the same order, so the scores should be
+        // bitwise identical
+        REQUIRE(std::memcmp(&result[i].prs, &expected[i].prs,
+                            sizeof(double))
+                == 0);
+        REQUIRE(result[i].num_snp == expected[i].num_snp);
+    }
+    std::remove((prefix + ".bgen").c_str());
+}
+
+TEST_CASE("Pgen record decoder")
+{
+    const uint32_t num_sample = 10;
+    std::vector<uintptr_t> genotype(QUATERCT_TO_WORDCT(num_sample), 0);
+    auto decoded = [&genotype, num_sample]() {
+        std::vector<uint32_t> res;
+        for (uint32_t i = 0; i < num_sample; ++i)
+        { res.push_back(pgen::get_geno(genotype.data(), i)); }
+        return res;
+    };
+    auto decode = [&genotype, num_sample](const std::vector<uint8_t>& record,
+                                          const uint8_t vrtype,
+                                          std::vector<uint16_t>* dosage) {
+        const uint8_t* end = record.data() + record.size();
+        REQUIRE(pgen::decode_record(record.data(), end, vrtype, num_sample,
+                                    genotype.data(), dosage)
+                == end);
+    };
+    const std::vector<uint8_t> raw = {0xE4, 0xE4, 0x06};
+    SECTION("two bit")
+    {
+        decode(raw, 0, nullptr);
+        REQUIRE(decoded()
+                == std::vector<uint32_t> {0, 1, 2, 3, 0, 1, 2, 3, 2, 1});
+        // the trailing bits are zero
+        REQUIRE(genotype.back() >> (2 * num_sample) == 0);
+    }
+    SECTION("one bit")
+    {
+        // sample 1 and 3 are homozygous ALT, the others homozygous REF,
+        // except sample 5 which is missing
+        decode({0x02, 0x0A, 0x00, 0x01, 0x05, 0x03}, 1, nullptr);
+        REQUIRE(decoded()
+                == std::vector<uint32_t> {0, 2, 0, 2, 0, 3, 0, 0, 0, 0});
+    }
+    SECTION("difflist and LD compressed")
+    {
+        decode({0x02, 0x00, 0x0D, 0x07}, 6, nullptr);
+        REQUIRE(decoded()
+                == std::vector<uint32_t> {1, 2, 2, 2, 2, 2, 2, 3, 2, 2});
+        // LD compressed against the previous record, with REF and ALT swapped
+        decode({0x01, 0x01, 0x00}, 3, nullptr);
+        REQUIRE(decoded()
+                == std::vector<uint32_t> {1, 2, 0, 0, 0, 0, 0, 3, 0, 0});
+    }
+    SECTION("dosage")
+    {
+        std::vector<uint16_t> dosage;
+        SECTION("all samples")
+        {
+            std::vector<uint8_t> record = raw;
+            std::vector<uint16_t> expected;
+            for (uint16_t i = 0; i < num_sample; ++i)
+            {
+                expected.push_back(
+                    (i == 3) ? pgen::dosage_missing
+                             : static_cast<uint16_t>(i * 3000 + 1));
+                record.push_back(static_cast<uint8_t>(expected.back()));
+                record.push_back(static_cast<uint8_t>(expected.back() >> 8));
+            }
+            decode(record, 0x40, &dosage);
+            REQUIRE(dosage == expected);
+        }
+        SECTION("bit array")
+        {
+            decode({0x00, 0x04, 0x02, 0x00, 0x20, 0x00, 0x60}, 0x64, &dosage);
+            REQUIRE(decoded() == std::vector<uint32_t>(num_sample, 0));
+            REQUIRE(dosage
+                    == std::vector<uint16_t> {0, 0, 8192, 0, 0, 0, 0, 0, 0,
+                                              24576});
+        }
+        SECTION("list with phased heterozygous")
+        {
+            std::vector<uint8_t> record = raw;
+            // all three heterozygous samples are phased
+            record.insert(record.end(), {0x00, 0x01, 0x04, 0x64, 0x40});
+            decode(record, 0x30, &dosage);
+            REQUIRE(dosage
+                    == std::vector<uint16_t> {0, 16384, 32768,
+                                              pgen::dosage_missing, 16484,
+                                              16384, 32768,
+                                              pgen::dosage_missing, 32768,
+                                              16384});
+        }
+    }
+    SECTION("PLINK 1 conversion")
+    {
+        decode(raw, 0, nullptr);
+        pgen::to_plink1(genotype.data(), num_sample);
+        // PLINK 1 use 0 for homozygous A1, 1 for missing and 2 for
+        // heterozygous
+        std::vector<uint32_t> expected = {3, 2, 0, 1, 3, 2, 0, 1, 0, 2};
+        REQUIRE(decoded() == expected);
+        pgen::from_plink1(genotype.data(), num_sample);
+        REQUIRE(decoded()
+                == std::vector<uint32_t> {0, 1, 2, 3, 0, 1, 2, 3, 2, 1});
+    }
+    SECTION("malformed record")
+    {
+        const std::vector<uint8_t> truncated = {0xE4, 0xE4};
+        REQUIRE_THROWS(pgen::decode_record(truncated.data(),
+                                           truncated.data() + truncated.size(),
+                                           0, num_sample, genotype.data(),
+                                           nullptr));
+        // sample index out of bound
+        const std::vector<uint8_t> invalid = {0x01, 0x0A, 0x00};
+        REQUIRE_THROWS(pgen::decode_record(invalid.data(),
+                                           invalid.data() + invalid.size(), 4,
+                                           num_sample, genotype.data(),
+                                           nullptr));
+        // the subset of phased heterozygous samples runs past the record
+        std::vector<uint8_t> phased = raw;
+        phased.push_back(0x0F);
+        std::vector<uint16_t> dosage;
+        REQUIRE_THROWS(pgen::decode_record(phased.data(),
+                                           phased.data() + phased.size(), 0x70,
+                                           num_sample, genotype.data(),
+                                           &dosage));
+    }
+}
+
+TEST_CASE("PRS scoring kernel")
+{
+    mockGenotype geno;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uintptr_t> dist;
+    // score of each inverted genotype, with stat of 0.5 and centred by 0.25
+    const double miss_score = 0.75;
+    const std::vector<double> expected_score = {-0.25, 0.25, miss_score,
+                                                0.75};
+    // cover partial, complete and multiple genotype blocks, with and without
+    // the byte score table
+    for (const size_t num_sample : {1, 32, 37, 70, 1024, 1061})
+    {
+        std::vector<uintptr_t> genotype(QUATERCT_TO_WORDCT(num_sample));
+        for (auto&& word : genotype) { word = dist(rng); }
+        for (const auto missing : {MISSING_SCORE::MEAN_IMPUTE,
+                                   MISSING_SCORE::SET_ZERO})
+        {
+            const size_t miss_count =
+                (missing == MISSING_SCORE::SET_ZERO) ? 0 : 2;
+            std::vector<PRS> prs_list(num_sample);
+            for (auto&& prs : prs_list)
+            {
+                prs.prs = 10;
+                prs.num_snp = 10;
+            }
+            geno.test_read_prs(genotype, prs_list, missing, miss_score, false);
+            std::vector<PRS> accumulated = prs_list;
+            geno.test_read_prs(genotype, accumulated, missing, miss_score,
+                               true);
+            for (size_t i = 0; i < num_sample; ++i)
+            {
+                const uintptr_t ukk =
+                    (~genotype[i / BITCT2] >> (2 * (i % BITCT2))) & 3;
+                const size_t count = (ukk == 2) ? miss_count : 2;
+                REQUIRE(prs_list[i].prs == Approx(expected_score[ukk]));
+                REQUIRE(prs_list[i].num_snp == count);
+                REQUIRE(accumulated[i].prs
+                        == Approx(2 * expected_score[ukk]));
+                REQUIRE(accumulated[i].num_snp == 2 * count);
+            }
+        }
+    }
+}
+
+TEST_CASE("PLINK 2 count import")
+{
+    Reporter reporter("LOG", 60, true);
+    mockGenotype geno;
+    geno.set_reporter(&reporter);
+    const std::string name = "import_count_test.count";
+    StringArena arena;
+    std::vector<SNP> snps;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        snps.emplace_back(arena, "rs" + std::to_string(i), 1, i + 1, "A", "C",
+                          0, 0.01, 0, 0.01);
+    }
+    const uintptr_t num_founder = 10;
+    SECTION("acount")
+    {
+        {
+            std::ofstream out(name.c_str());
+            // rs1 has missing calls or is from fewer samples, rs2 has
+            // mismatched alleles and rs3 is from more samples
+            out << "#CHROM\tID\tREF\tALT\tALT_CTS\tOBS_CT\n"
+                << "1\trs0\tA\tC\t3\t20\n"
+                << "1\trs1\tA\tC\t3\t18\n"
+                << "1\trs2\tA\tG\t3\t20\n"
+                << "1\trs3\tA\tC\t3\t22\n";
+        }
+        REQUIRE(geno.test_import_freq_count(name, snps, num_founder)
+                == std::vector<bool> {true, false, false, false});
+    }
+    SECTION("gcount without missing count")
+    {
+        {
+            std::ofstream out(name.c_str());
+            out << "#CHROM\tID\tREF\tALT\tHOM_REF_CT\tHET_REF_ALT_CTS\t"
+                   "TWO_ALT_GENO_CTS\n"
+                << "1\trs0\tA\tC\t5\t3\t2\n"
+                << "1\trs1\tC\tA\t5\t3\t1\n"
+                << "1\trs3\tA\tC\t5\t3\t3\n";
+        }
+        REQUIRE(geno.test_import_freq_count(name, snps, num_founder)
+                == std::vector<bool> {true, false, false, false});
+    }
+    SECTION("gcount with missing count")
+    {
+        {
+            std::ofstream out(name.c_str());
+            out << "#CHROM\tID\tREF\tALT\tHOM_REF_CT\tHET_REF_ALT_CTS\t"
+                   "TWO_ALT_GENO_CTS\tMISSING_CT\n"
+                << "1\trs0\tA\tC\t5\t3\t1\t1\n"
+                << "1\trs1\tC\tA\t5\t3\t1\t1\n"
+                << "1\trs3\tA\tC\t5\t3\t1\t0\n";
+        }
+        REQUIRE(geno.test_import_freq_count(name, snps, num_founder)
+                == std::vector<bool> {true, true, false, false});
+    }
+    std::remove(name.c_str());
+}
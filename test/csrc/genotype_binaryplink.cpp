@@ -0,0 +1,239 @@
+#include "catch.hpp"
+#include "mock_genotype.hpp"
+#include "reporter.hpp"
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sys/stat.h>
+#include <utime.h>
+
+namespace
+{
+// 4 samples, such that each SNP takes one byte in the .bed file
+const uintptr_t num_sample = 4;
+void write_bim(const std::string& prefix, const std::vector<std::string>& rs,
+               const size_t chr)
+{
+    std::ofstream bim(prefix + ".bim");
+    for (size_t i = 0; i < rs.size(); ++i)
+    {
+        bim << chr << "\t" << rs[i] << "\t0\t" << (i + 1) * 100 << "\tA\tC\n";
+    }
+    bim.close();
+    std::ofstream bed(prefix + ".bed", std::ios::binary);
+    bed << "l\x1b\x01" << std::string(rs.size(), '\0');
+}
+void remove_files(const std::string& prefix)
+{
+    std::remove((prefix + ".bim").c_str());
+    std::remove((prefix + ".bed").c_str());
+    std::remove(
+        misc::cache_file(".", prefix + ".bim", ".prsice.idx").c_str());
+}
+} // namespace
+
+TEST_CASE("Parallel bim loading")
+{
+    Reporter reporter("LOG", 60, true);
+    const std::vector<std::string> prefix = {"bim_order_0", "bim_order_1",
+                                             "bim_order_2"};
+    StringArena arena;
+    std::vector<SNP> base;
+    for (size_t file = 0; file < prefix.size(); ++file)
+    {
+        std::vector<std::string> rs;
+        for (size_t i = 0; i < 2; ++i)
+        {
+            rs.push_back("rs" + std::to_string(file * 2 + i));
+            base.emplace_back(arena, rs.back(), file + 1, (i + 1) * 100, "A",
+                              "C", 0, 0.01, 0, 0.01);
+        }
+        write_bim(prefix[file], rs, file + 1);
+    }
+    // no cache, such that every thread parse its own file
+    const size_t thread = GENERATE(1, 2, 3, 4);
+    SECTION("variants are merged in file order")
+    {
+        mockBinaryPlink geno(prefix, num_sample, thread, "", &reporter);
+        geno.set_base(base);
+        geno.test_gen_snp_vector();
+        auto&& snps = geno.existed_snps();
+        REQUIRE(snps.size() == base.size());
+        for (size_t i = 0; i < snps.size(); ++i)
+        {
+            REQUIRE(snps[i].rs() == base[i].rs());
+            REQUIRE(snps[i].get_file_idx() == i / 2);
+            REQUIRE(snps[i].get_byte_pos() == std::streampos(3 + i % 2));
+        }
+    }
+    SECTION("error of the first file is reported")
+    {
+        {
+            std::ofstream bim(prefix[1] + ".bim");
+            bim << "1\trs2\t0\n";
+        }
+        std::remove((prefix[2] + ".bed").c_str());
+        mockBinaryPlink geno(prefix, num_sample, thread, "", &reporter);
+        geno.set_base(base);
+        REQUIRE_THROWS_WITH(geno.test_gen_snp_vector(),
+                            Catch::Contains("Malformed bim file"));
+    }
+    for (auto&& p : prefix) remove_files(p);
+}
+
+TEST_CASE("Bim cache")
+{
+    Reporter reporter("LOG", 60, true);
+    const std::string prefix = "bim_cache";
+    write_bim(prefix, {"rs1", "rs2"}, 1);
+    mockBinaryPlink geno({prefix}, num_sample, 1, ".", &reporter);
+    REQUIRE(geno.test_load_bim(0) == std::vector<std::string> {"rs1", "rs2"});
+    const std::string cache =
+        misc::cache_file(".", prefix + ".bim", ".prsice.idx");
+    struct stat cache_stat;
+    REQUIRE(stat(cache.c_str(), &cache_stat) == 0);
+    SECTION("cache is used when the files are unchanged")
+    {
+        REQUIRE(geno.test_load_bim(0)
+                == std::vector<std::string> {"rs1", "rs2"});
+    }
+    SECTION("cache is invalidated with the same size and modification time")
+    {
+        struct stat bim_stat;
+        REQUIRE(stat((prefix + ".bim").c_str(), &bim_stat) == 0);
+        write_bim(prefix, {"rs3", "rs4"}, 1);
+        struct utimbuf time;
+        time.actime = bim_stat.st_atime;
+        time.modtime = bim_stat.st_mtime;
+        REQUIRE(utime((prefix + ".bim").c_str(), &time) == 0);
+        REQUIRE(geno.test_load_bim(0)
+                == std::vector<std::string> {"rs3", "rs4"});
+    }
+    SECTION("no cache is written when disabled")
+    {
+        std::remove(cache.c_str());
+        mockBinaryPlink no_cache({prefix}, num_sample, 1, "", &reporter);
+        REQUIRE(no_cache.test_load_bim(0)
+                == std::vector<std::string> {"rs1", "rs2"});
+        REQUIRE(stat(cache.c_str(), &cache_stat) != 0);
+    }
+    remove_files(prefix);
+}
+
+TEST_CASE("Allele frequency filtering with multiple threads")
+{
+    Reporter reporter("LOG", 60, true);
+    const uintptr_t freq_sample = 37;
+    const uintptr_t bytes_per_snp = (freq_sample + 3) / 4;
+    // enough SNPs for multiple windows
+    const size_t snp_per_file = 6000;
+    const std::vector<std::string> prefix = {"freq_0", "freq_1"};
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> prob(0.0, 1.0);
+    StringArena arena;
+    std::vector<SNP> base;
+    for (size_t file = 0; file < prefix.size(); ++file)
+    {
+        std::vector<std::string> rs;
+        std::ofstream bed(prefix[file] + ".bed", std::ios::binary);
+        bed << "l\x1b\x01";
+        for (size_t i = 0; i < snp_per_file; ++i)
+        {
+            rs.push_back("rs" + std::to_string(file * snp_per_file + i));
+            base.emplace_back(arena, rs.back(), file + 1, (i + 1) * 100, "A",
+                              "C", 0, 0.01, 0, 0.01);
+            // include monomorphic and mostly missing SNPs, such that all
+            // filters are used
+            const double maf = prob(gen) * 0.5, missing = prob(gen) * 0.2;
+            std::string geno(bytes_per_snp, '\0');
+            for (uintptr_t s = 0; s < freq_sample; ++s)
+            {
+                uint32_t code = (prob(gen) < maf) + (prob(gen) < maf);
+                // PLINK encoding: 0 homozygous, 1 missing, 2 heterozygous
+                // and 3 homozygous alternative
+                code = (prob(gen) < missing) ? 1 : (code == 0 ? 0 : code + 1);
+                const uint32_t cur = static_cast<uint8_t>(geno[s / 4]);
+                geno[s / 4] = static_cast<char>(cur | (code << (2 * (s % 4))));
+            }
+            bed << geno;
+        }
+        bed.close();
+        std::ofstream bim(prefix[file] + ".bim");
+        for (size_t i = 0; i < rs.size(); ++i)
+        {
+            bim << file + 1 << "\t" << rs[i] << "\t0\t" << (i + 1) * 100
+                << "\tA\tC\n";
+        }
+    }
+    QCFiltering filter;
+    filter.geno = 0.1;
+    filter.maf = 0.05;
+    auto run = [&](const size_t thread) {
+        auto geno = std::make_unique<mockBinaryPlink>(prefix, freq_sample,
+                                                      thread, "", &reporter);
+        geno->set_base(base);
+        geno->test_gen_snp_vector();
+        geno->set_samples();
+        REQUIRE(geno->test_calc_freq(filter));
+        return geno;
+    };
+    auto expected = run(1);
+    REQUIRE(expected->num_maf_filter() > 0);
+    REQUIRE(expected->num_geno_filter() > 0);
+    REQUIRE(expected->existed_snps().size() > 0);
+    const size_t thread = GENERATE(2, 3, 8);
+    auto result = run(thread);
+    REQUIRE(result->num_maf_filter() == expected->num_maf_filter());
+    REQUIRE(result->num_geno_filter() == expected->num_geno_filter());
+    auto&& snps = result->existed_snps();
+    auto&& expected_snps = expected->existed_snps();
+    REQUIRE(snps.size() == expected_snps.size());
+    std::vector<size_t> counts(4), expected_counts(4);
+    for (size_t i = 0; i < snps.size(); ++i)
+    {
+        REQUIRE(snps[i].rs() == expected_snps[i].rs());
+        snps[i].get_counts(counts[0], counts[1], counts[2], counts[3], false);
+        expected_snps[i].get_counts(expected_counts[0], expected_counts[1],
+                                    expected_counts[2], expected_counts[3],
+                                    false);
+        REQUIRE(counts == expected_counts);
+    }
+    for (auto&& p : prefix) remove_files(p);
+}
+
+TEST_CASE("Concurrent genotype read")
+{
+    Reporter reporter("LOG", 60, true);
+    const uintptr_t read_sample = 37;
+    const uintptr_t bytes_per_snp = (read_sample + 3) / 4;
+    const size_t snp_per_file = 500;
+    const std::vector<std::string> prefix = {"read_0", "read_1"};
+    std::mt19937 gen(11);
+    std::uniform_int_distribution<int> byte(0, 255);
+    StringArena arena;
+    std::vector<SNP> base;
+    for (size_t file = 0; file < prefix.size(); ++file)
+    {
+        std::vector<std::string> rs;
+        for (size_t i = 0; i < snp_per_file; ++i)
+        {
+            rs.push_back("rs" + std::to_string(file * snp_per_file + i));
+            base.emplace_back(arena, rs.back(), file + 1, (i + 1) * 100, "A",
+                              "C", 0, 0.01, 0, 0.01);
+        }
+        write_bim(prefix[file], rs, file + 1);
+        std::ofstream bed(prefix[file] + ".bed", std::ios::binary);
+        bed << "l\x1b\x01";
+        for (size_t i = 0; i < snp_per_file * bytes_per_snp; ++i)
+        { bed.put(static_cast<char>(byte(gen))); }
+    }
+    mockBinaryPlink geno(prefix, read_sample, 1, "", &reporter);
+    geno.set_base(base);
+    geno.test_gen_snp_vector();
+    geno.set_samples();
+    auto expected = geno.test_read_all(1);
+    REQUIRE(expected.size() > 0);
+    const size_t thread = GENERATE(2, 3, 8);
+    REQUIRE(geno.test_read_all(thread) == expected);
+    for (auto&& p : prefix) remove_files(p);
+}
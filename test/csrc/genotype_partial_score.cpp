@@ -0,0 +1,148 @@
+#include "catch.hpp"
+#include "genotype.hpp"
+#include "mock_genotype.hpp"
+#include "reporter.hpp"
+#include <cstdio>
+
+// Genotype where the contribution of each SNP to a sample is stat * (sample
+// index + 1), such that we can calculate PRS without any genotype file
+class PartialGenotype : public mockGenotype
+{
+public:
+    PartialGenotype(const size_t num_sample, const std::vector<SNP>& snps,
+                    Reporter* reporter, const bool non_cumulate = false)
+    {
+        for (size_t i = 0; i < num_sample; ++i)
+        {
+            m_sample_id.emplace_back("F" + std::to_string(i),
+                                     "I" + std::to_string(i), "1", true);
+        }
+        m_prs_info.resize(num_sample);
+        m_existed_snps = snps;
+        m_reporter = reporter;
+        m_prs_calculation.non_cumulate = non_cumulate;
+    }
+    const std::vector<PRS>& prs() const { return m_prs_info; }
+
+protected:
+    void read_score(std::vector<PRS>& prs_list,
+                    const std::vector<size_t>::const_iterator& start,
+                    const std::vector<size_t>::const_iterator& end,
+                    bool reset_zero, bool /*ultra*/) override
+    {
+        if (reset_zero) std::fill(prs_list.begin(), prs_list.end(), PRS());
+        for (auto it = start; it != end; ++it)
+        {
+            for (size_t i = 0; i < prs_list.size(); ++i)
+            {
+                prs_list[i].prs +=
+                    m_existed_snps[*it].stat() * static_cast<double>(i + 1);
+                ++prs_list[i].num_snp;
+            }
+        }
+    }
+};
+
+TEST_CASE("Merging chromosome shards")
+{
+    Reporter reporter("LOG", 60, true);
+    const size_t num_sample = 5;
+    StringArena arena;
+    SNP a(arena, "a", 1, 10, "A", "C", 0.5, 0.05, 0, 0.1),
+        b(arena, "b", 1, 20, "A", "C", 1.5, 0.15, 1, 0.2),
+        c(arena, "c", 2, 10, "A", "C", -2, 0.08, 0, 0.1),
+        d(arena, "d", 2, 20, "A", "C", 3, 0.25, 2, 0.3);
+    const std::vector<std::string> region_names = {"Base", "Background"};
+    const bool non_cumulate = GENERATE(false, true);
+    // whole genome run, SNPs are sorted by their category
+    PartialGenotype whole(num_sample, {a, c, b, d}, &reporter, non_cumulate);
+    REQUIRE(whole.prepare_prsice(PThresholding()));
+    std::vector<std::vector<double>> expected_score;
+    std::vector<double> expected_threshold;
+    std::vector<uint32_t> expected_num_snp;
+    std::vector<size_t> all_snps = {0, 1, 2, 3};
+    std::vector<size_t>::const_iterator start = all_snps.cbegin();
+    double threshold;
+    uint32_t num_snp = 0;
+    bool first_run = true;
+    while (whole.get_score(start, all_snps.cend(), threshold, num_snp,
+                           first_run))
+    {
+        first_run = false;
+        expected_threshold.push_back(threshold);
+        expected_num_snp.push_back(num_snp);
+        std::vector<double> score;
+        for (size_t i = 0; i < num_sample; ++i)
+        { score.push_back(whole.calculate_score(i)); }
+        expected_score.push_back(score);
+    }
+    REQUIRE(expected_threshold == std::vector<double> {0.1, 0.2, 0.3});
+    PartialGenotype chr1(num_sample, {a, b}, &reporter, non_cumulate);
+    PartialGenotype chr2(num_sample, {c, d}, &reporter, non_cumulate);
+    REQUIRE(chr1.prepare_prsice(PThresholding()));
+    REQUIRE(chr2.prepare_prsice(PThresholding()));
+    chr1.save_partial_score("chr1", {{0, 1}, {}}, region_names);
+    chr2.save_partial_score("chr2", {{0, 1}, {}}, region_names);
+    SECTION("merged score identical to whole genome run")
+    {
+        PartialGenotype merged(num_sample, {}, &reporter, non_cumulate);
+        REQUIRE(merged.load_partial_score({"chr1.shard", "chr2.shard"})
+                == region_names);
+        REQUIRE(merged.has_partial_score());
+        REQUIRE(merged.num_threshold(0) == 3);
+        REQUIRE(merged.num_threshold(1) == 0);
+        size_t idx = 0;
+        while (merged.get_partial_score(0, idx, threshold, num_snp))
+        {
+            REQUIRE(threshold == Approx(expected_threshold[idx]));
+            REQUIRE(num_snp == expected_num_snp[idx]);
+            for (size_t i = 0; i < num_sample; ++i)
+            {
+                REQUIRE(merged.calculate_score(i)
+                        == Approx(expected_score[idx][i]));
+            }
+            ++idx;
+        }
+        REQUIRE(idx == 3);
+    }
+    SECTION("mismatched samples")
+    {
+        PartialGenotype merged(num_sample + 1, {}, &reporter, non_cumulate);
+        REQUIRE_THROWS(merged.load_partial_score({"chr1.shard", "chr2.shard"}));
+    }
+    SECTION("mismatched cumulation")
+    {
+        PartialGenotype merged(num_sample, {}, &reporter, !non_cumulate);
+        REQUIRE_THROWS(merged.load_partial_score({"chr1.shard"}));
+    }
+    std::remove("chr1.shard");
+    std::remove("chr2.shard");
+}
+
+TEST_CASE("Scoring without a prebuilt variant table")
+{
+    Reporter reporter("LOG", 60, true);
+    const size_t num_sample = 3;
+    StringArena arena;
+    SNP a(arena, "a", 1, 10, "A", "C", 0.5, 0.05, 0, 0.1),
+        b(arena, "b", 1, 20, "A", "C", 1.5, 0.15, 1, 0.2);
+    // the variant table is never built explicitly, get_score should build it
+    // instead of reading out of bound
+    PartialGenotype geno(num_sample, {a, b}, &reporter);
+    std::vector<size_t> all_snps = {0, 1};
+    std::vector<size_t>::const_iterator start = all_snps.cbegin();
+    double threshold;
+    uint32_t num_snp = 0;
+    std::vector<double> thresholds;
+    bool first_run = true;
+    while (geno.get_score(start, all_snps.cend(), threshold, num_snp,
+                          first_run))
+    {
+        first_run = false;
+        thresholds.push_back(threshold);
+    }
+    REQUIRE(thresholds == std::vector<double> {0.1, 0.2});
+    REQUIRE(num_snp == 2);
+    // average score of the third sample
+    REQUIRE(geno.calculate_score(2) == Approx((0.5 + 1.5) * 3 / 2));
+}
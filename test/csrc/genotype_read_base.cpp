@@ -6,6 +6,8 @@
 #include "region.hpp"
 #include "reporter.hpp"
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <limits>
 #include <random>
 TEST_CASE("base file read")
@@ -365,6 +367,9 @@ TEST_CASE("base file read")
     SECTION("full parse")
     {
         // just need to ensure the subroutines are working as expected
+        // result should be identical regardless of number of thread used
+        auto n_thread = GENERATE(1, 2, 3, 32);
+        geno.set_thread(n_thread);
         geno.add_select_snp("exclude", true);
         base_file.is_or = true;
         QCFiltering base_qc;
@@ -426,8 +431,113 @@ TEST_CASE("base file read")
         REQUIRE(dup_idx.size() == 1);
         auto idx = geno.existed_snps_idx();
         auto find = idx.find("normal");
-        REQUIRE_FALSE(find == idx.end());
+        REQUIRE_FALSE(find == StringIndex::npos);
+        // filtered SNPs are kept in the index for the duplication check
+        REQUIRE(idx.contains("ambiguous"));
+        REQUIRE(idx.find("ambiguous") == StringIndex::npos);
         auto snps = geno.existed_snps();
-        REQUIRE(snps[find->second].rs() == "normal");
+        REQUIRE(snps[find].rs() == "normal");
+        // SNPs should be stored in the input order
+        std::vector<std::string> rs_order;
+        for (auto&& s : snps) { rs_order.emplace_back(s.rs()); }
+        REQUIRE_THAT(rs_order, Catch::Equals<std::string>(
+                                   {"normal", "dup"}));
     }
 }
+
+TEST_CASE("base cache")
+{
+    Reporter reporter("log", 60, true);
+    BaseFile base_file;
+    base_file.file_name = "base_cache_test.assoc";
+    base_file.cache_file = "base_cache_test.cache";
+    std::remove(base_file.cache_file.c_str());
+    {
+        std::ofstream base(base_file.file_name.c_str());
+        base << "CHR BP SNP A1 A2 P OR\n"
+             << "1 1234 rs1 A C 0.05 1.2\n"
+             << "1 1235 rs2 A G 0.5 0.8\n"
+             << "1 1235 rs2 A G 0.5 0.8\n"
+             << "2 1236 rs3 T C NA 1.1\n"
+             << "3 1237 rs4 A C 0.01 1.3\n";
+    }
+    std::fill(base_file.has_column.begin(), base_file.has_column.end(), false);
+    std::vector<size_t> index = {+BASE_INDEX::CHR, +BASE_INDEX::BP,
+                                 +BASE_INDEX::RS,  +BASE_INDEX::EFFECT,
+                                 +BASE_INDEX::NONEFFECT, +BASE_INDEX::P,
+                                 +BASE_INDEX::STAT};
+    for (size_t i = 0; i < index.size(); ++i)
+    {
+        base_file.has_column[index[i]] = true;
+        base_file.column_index[index[i]] = i;
+    }
+    base_file.column_index[+BASE_INDEX::MAX] = index.size() - 1;
+    base_file.is_or = true;
+    QCFiltering base_qc;
+    PThresholding threshold_info;
+    std::vector<IITree<size_t, size_t>> exclusion_regions;
+    mockGenotype ori;
+    ori.test_init_chr();
+    ori.set_reporter(&reporter);
+    auto [ori_count, ori_dup] =
+        ori.read_base(base_file, base_qc, threshold_info, exclusion_regions);
+    std::ifstream check(base_file.cache_file.c_str());
+    REQUIRE(check.is_open());
+    check.close();
+    SECTION("load from cache")
+    {
+        // nothing changed, should load the same SNPs from the cache
+        mockGenotype cached;
+        cached.test_init_chr();
+        cached.set_reporter(&reporter);
+        auto [count, dup] = cached.read_base(base_file, base_qc, threshold_info,
+                                             exclusion_regions);
+        REQUIRE_THAT(count, Catch::Equals<size_t>(ori_count));
+        REQUIRE(dup == ori_dup);
+        auto expected = ori.existed_snps();
+        auto snps = cached.existed_snps();
+        REQUIRE(snps.size() == expected.size());
+        for (size_t i = 0; i < snps.size(); ++i)
+        {
+            REQUIRE(snps[i].rs() == expected[i].rs());
+            REQUIRE(snps[i].ref() == expected[i].ref());
+            REQUIRE(snps[i].alt() == expected[i].alt());
+            REQUIRE(snps[i].chr() == expected[i].chr());
+            REQUIRE(snps[i].loc() == expected[i].loc());
+            REQUIRE(snps[i].stat() == Approx(expected[i].stat()));
+            REQUIRE(snps[i].p_value() == Approx(expected[i].p_value()));
+            REQUIRE(snps[i].category() == expected[i].category());
+            REQUIRE(snps[i].get_threshold()
+                    == Approx(expected[i].get_threshold()));
+        }
+        auto cached_idx = cached.existed_snps_idx();
+        REQUIRE(cached_idx.size() == snps.size());
+        for (size_t i = 0; i < snps.size(); ++i)
+        { REQUIRE(cached_idx.find(snps[i].rs()) == i); }
+    }
+    SECTION("invalidate cache")
+    {
+        mockGenotype cached;
+        cached.test_init_chr();
+        cached.set_reporter(&reporter);
+        SECTION("parameter changed")
+        {
+            threshold_info.upper = 0.04;
+            threshold_info.no_full = true;
+        }
+        SECTION("base changed")
+        {
+            std::ofstream base(base_file.file_name.c_str(), std::ios::app);
+            base << "4 1238 rs5 A C 0.001 1.3\n";
+        }
+        SECTION("snp selection changed")
+        {
+            cached.add_select_snp("rs1", true);
+        }
+        cached.read_base(base_file, base_qc, threshold_info,
+                         exclusion_regions);
+        REQUIRE(cached.existed_snps().size() != ori.existed_snps().size());
+    }
+    std::remove(base_file.file_name.c_str());
+    std::remove(base_file.cache_file.c_str());
+}
@@ -1,5 +1,23 @@
+#include "bgen_index.hpp"
 #include "catch.hpp"
+#include "count_cache.hpp"
+#include "hardcall_cache.hpp"
+#include "memoryread.hpp"
 #include "misc.hpp"
+#include "prefetcher.hpp"
+#include "radix_sort.hpp"
+#include "scratch_pool.hpp"
+#include "string_index.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <thread>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <utime.h>
+#endif
+#include <zlib.h>
 
 
 TEST_CASE("Convertor")
@@ -43,6 +61,56 @@ TEST_CASE("Convertor")
         REQUIRE_THROWS(misc::Convertor::convert<double>("1e400"));
     }
 }
+TEST_CASE("parse_value")
+{
+    SECTION("size_t")
+    {
+        auto i = GENERATE(take(100, random(-10000, 10000)));
+        size_t value = 0;
+        if (i < 0)
+        { REQUIRE_FALSE(misc::parse_value(std::to_string(i), value)); }
+        else
+        {
+            REQUIRE(misc::parse_value(std::to_string(i), value));
+            REQUIRE(value == static_cast<size_t>(i));
+        }
+    }
+    SECTION("int")
+    {
+        auto i = GENERATE(take(100, random(-10000, 10000)));
+        int value = 0;
+        REQUIRE(misc::parse_value(std::to_string(i), value));
+        REQUIRE(value == i);
+    }
+    SECTION("double")
+    {
+        using record = std::tuple<std::string, double>;
+        auto extent = GENERATE(table<std::string, double>(
+            {record {"0.5", 0.5}, record {"1e-10", 1e-10},
+             record {"-1e20", -1e20}, record {"+3", 3}, record {" 1.5", 1.5},
+             record {"0", 0}}));
+        double value = 0;
+        REQUIRE(misc::parse_value(std::get<0>(extent), value));
+        REQUIRE(value == Approx(std::get<1>(extent)));
+    }
+    SECTION("invalid input")
+    {
+        auto input = GENERATE("NA", "", "1e-400", "1e400", "1.5x", "nan",
+                              "inf", "1 ", "+-1", "0x10");
+        double value = -1;
+        REQUIRE_FALSE(misc::parse_value(input, value));
+        // value should be untouched
+        REQUIRE(value == Approx(-1));
+        size_t loc = 10;
+        REQUIRE_FALSE(misc::parse_value(input, loc));
+        REQUIRE(loc == 10);
+    }
+    SECTION("partial integer")
+    {
+        int value = 0;
+        REQUIRE_FALSE(misc::parse_value("1.5", value));
+    }
+}
 TEST_CASE("stringview trimming")
 {
     std::string ref = " testing \n";
@@ -97,3 +165,820 @@ TEST_CASE("split")
                                 {"sure-it", "works", "well", "ok"}));
     }
 }
+
+void write_le(std::ofstream& out, uint32_t value, size_t num_byte)
+{
+    for (size_t i = 0; i < num_byte; ++i)
+    {
+        out.put(static_cast<char>(value & 0xff));
+        value >>= 8;
+    }
+}
+
+misc::Compression compression_of(const std::string& name)
+{
+    std::ifstream in(name.c_str(), std::ios::binary);
+    std::string head(BGZFReader::header_size(), '\0');
+    in.read(&head[0], static_cast<std::streamsize>(head.size()));
+    head.resize(static_cast<size_t>(in.gcount()));
+    return misc::detect_compression(head);
+}
+// copy the first half of a file
+void truncate_copy(const std::string& name, const std::string& out_name)
+{
+    std::ifstream in(name.c_str(), std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(in)),
+                        std::istreambuf_iterator<char>());
+    std::ofstream out(out_name.c_str(), std::ios::binary);
+    out.write(content.data(),
+              static_cast<std::streamsize>(content.size() / 2));
+}
+std::string read_all(std::istream& input)
+{
+    std::string line, result;
+    while (std::getline(input, line)) { result.append(line + "\n"); }
+    return result;
+}
+void write_bgzf_block(std::ofstream& out, const std::string& data)
+{
+    std::vector<unsigned char> compressed(compressBound(data.size()) + 64);
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    REQUIRE(deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                         Z_DEFAULT_STRATEGY)
+            == Z_OK);
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    strm.avail_in = static_cast<uInt>(data.size());
+    strm.next_out = compressed.data();
+    strm.avail_out = static_cast<uInt>(compressed.size());
+    REQUIRE(deflate(&strm, Z_FINISH) == Z_STREAM_END);
+    const size_t compressed_size = strm.total_out;
+    deflateEnd(&strm);
+    const unsigned char header[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff,
+                                    6,    0,    'B', 'C', 2, 0};
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    write_le(out, static_cast<uint32_t>(compressed_size + 25), 2);
+    out.write(reinterpret_cast<const char*>(compressed.data()),
+              static_cast<std::streamsize>(compressed_size));
+    write_le(out,
+             static_cast<uint32_t>(crc32(
+                 crc32(0L, Z_NULL, 0),
+                 reinterpret_cast<const Bytef*>(data.data()),
+                 static_cast<uInt>(data.size()))),
+             4);
+    write_le(out, static_cast<uint32_t>(data.size()), 4);
+}
+
+TEST_CASE("BGZF input")
+{
+    const std::string name = "bgzf_test.gz";
+    std::string expected;
+    {
+        std::ofstream out(name.c_str(), std::ios::binary);
+        // use enough blocks to span multiple batches
+        for (size_t i_block = 0; i_block < 300; ++i_block)
+        {
+            std::string block;
+            for (size_t i = 0; i < 20; ++i)
+            {
+                block.append("rs" + std::to_string(i_block * 20 + i)
+                             + "\tA\tC\t0.5\n");
+            }
+            expected.append(block);
+            write_bgzf_block(out, block);
+        }
+        // EOF marker
+        write_bgzf_block(out, "");
+    }
+    REQUIRE(compression_of(name) == misc::Compression::BGZF);
+    auto thread = GENERATE(size_t(1), size_t(2), size_t(3), size_t(8));
+    bool gz_input = false;
+    auto stream = misc::load_stream(name, gz_input, thread);
+    REQUIRE(gz_input);
+    REQUIRE(dynamic_cast<BGZFStream*>(stream.get()) != nullptr);
+    std::string line, result;
+    while (std::getline(*stream, line)) { result.append(line + "\n"); }
+    REQUIRE(result == expected);
+    // a truncated file must not be read as a shorter file
+    const std::string truncated = "bgzf_truncated.gz";
+    truncate_copy(name, truncated);
+    stream = misc::load_stream(truncated, gz_input, thread);
+    REQUIRE_THROWS(read_all(*stream));
+    // or a file truncated at a block boundary
+    {
+        std::ofstream out(truncated.c_str(), std::ios::binary);
+        write_bgzf_block(out, "rs1\tA\tC\t0.5\n");
+    }
+    stream = misc::load_stream(truncated, gz_input, thread);
+    REQUIRE_THROWS(read_all(*stream));
+    // a block can't be larger than 64kb once inflated
+    {
+        std::ofstream out(truncated.c_str(), std::ios::binary);
+        write_bgzf_block(out, "rs1\tA\tC\t0.5\n");
+        write_bgzf_block(out, "");
+    }
+    {
+        std::fstream out(truncated.c_str(),
+                         std::ios::binary | std::ios::in | std::ios::out);
+        // ISIZE of the first block is right before the EOF marker
+        out.seekp(-32, std::ios::end);
+        out.write("\x01\x00\x01\x00", 4);
+    }
+    stream = misc::load_stream(truncated, gz_input, thread);
+    REQUIRE_THROWS(read_all(*stream));
+    std::remove(truncated.c_str());
+    std::remove(name.c_str());
+}
+
+TEST_CASE("Plain gzip input")
+{
+    const std::string name = "plain_gz_test.gz";
+    // large enough to span multiple inflated buffers
+    std::string expected;
+    for (size_t i = 0; i < 400000; ++i)
+    { expected.append("rs" + std::to_string(i) + "\tA\tC\t0.5\n"); }
+    {
+        GZSTREAM_NAMESPACE::ogzstream out(name.c_str());
+        out << expected;
+    }
+    REQUIRE(compression_of(name) == misc::Compression::GZ);
+    bool gz_input = false;
+    auto stream = misc::load_stream(name, gz_input, 4);
+    REQUIRE(gz_input);
+    REQUIRE(dynamic_cast<GZStream*>(stream.get()) != nullptr);
+    REQUIRE(read_all(*stream) == expected);
+    const std::string truncated = "plain_gz_truncated.gz";
+    truncate_copy(name, truncated);
+    stream = misc::load_stream(truncated, gz_input, 4);
+    REQUIRE_THROWS(read_all(*stream));
+    std::remove(truncated.c_str());
+    std::remove(name.c_str());
+}
+
+TEST_CASE("zstd input")
+{
+    const std::string name = "zstd_test.zst";
+    const std::string expected = "rs1\tA\tC\nrs2\tG\tT\n";
+#ifdef USE_ZSTD
+    {
+        std::vector<char> compressed(ZSTD_compressBound(expected.size()));
+        const size_t size =
+            ZSTD_compress(compressed.data(), compressed.size(),
+                          expected.data(), expected.size(), 1);
+        REQUIRE_FALSE(ZSTD_isError(size));
+        std::ofstream out(name.c_str(), std::ios::binary);
+        out.write(compressed.data(), static_cast<std::streamsize>(size));
+    }
+    REQUIRE(compression_of(name) == misc::Compression::ZSTD);
+    bool compressed = false;
+    auto stream = misc::load_stream(name, compressed);
+    REQUIRE(compressed);
+    REQUIRE(read_all(*stream) == expected);
+    const std::string truncated = "zstd_truncated.zst";
+    truncate_copy(name, truncated);
+    stream = misc::load_stream(truncated, compressed);
+    REQUIRE_THROWS(read_all(*stream));
+    std::remove(truncated.c_str());
+#else
+    {
+        // zstd frame magic number followed by garbage
+        std::ofstream out(name.c_str(), std::ios::binary);
+        out << "\x28\xb5\x2f\xfd" << expected;
+    }
+    REQUIRE(compression_of(name) == misc::Compression::ZSTD);
+    bool compressed = false;
+    REQUIRE_THROWS(misc::load_stream(name, compressed));
+#endif
+    REQUIRE_FALSE(misc::is_gz_file(name));
+    std::remove(name.c_str());
+}
+
+#ifndef _WIN32
+TEST_CASE("Compressed input from a pipe")
+{
+    const std::string name = "pipe_test.gz";
+    std::string expected, compressed;
+    for (size_t i = 0; i < 1000; ++i)
+    { expected.append("rs" + std::to_string(i) + "\tA\tC\t0.5\n"); }
+    {
+        GZSTREAM_NAMESPACE::ogzstream out(name.c_str());
+        out << expected;
+    }
+    {
+        std::ifstream in(name.c_str(), std::ios::binary);
+        compressed.assign(std::istreambuf_iterator<char>(in),
+                          std::istreambuf_iterator<char>());
+    }
+    std::remove(name.c_str());
+    // the leading bytes used for the format detection must not be lost
+    auto plain = GENERATE(true, false);
+    const std::string& content = plain ? expected : compressed;
+    REQUIRE(mkfifo(name.c_str(), 0600) == 0);
+    std::thread writer([&name, &content]() {
+        std::ofstream out(name.c_str(), std::ios::binary);
+        out.write(content.data(), static_cast<std::streamsize>(content.size()));
+    });
+    bool is_compressed = false;
+    auto stream = misc::load_stream(name, is_compressed);
+    REQUIRE(is_compressed == !plain);
+    REQUIRE(read_all(*stream) == expected);
+    writer.join();
+    std::remove(name.c_str());
+}
+#endif
+
+TEST_CASE("String index")
+{
+    StringArena arena;
+    StringIndex index;
+    const size_t num_key = 10000;
+    std::vector<std::string_view> keys;
+    for (size_t i = 0; i < num_key; ++i)
+    {
+        std::string key = "rs" + std::to_string(i);
+        keys.push_back(arena.store(key));
+        REQUIRE(keys.back() == key);
+        REQUIRE(index.insert(keys.back(), i));
+    }
+    REQUIRE(index.size() == num_key);
+    // existing keys are not updated
+    REQUIRE_FALSE(index.insert(keys[10], 0));
+    for (size_t i = 0; i < num_key; ++i)
+    {
+        // look up with a different copy of the key
+        REQUIRE(index.find("rs" + std::to_string(i)) == i);
+    }
+    REQUIRE(index.find("rs") == StringIndex::npos);
+    REQUIRE_FALSE(index.contains("missing"));
+    REQUIRE(index.insert("", 1));
+    REQUIRE(index.find("") == 1);
+    // alleles are only stored once
+    std::string allele = "A";
+    auto a = arena.intern(allele);
+    REQUIRE(arena.intern(std::string("A")).data() == a.data());
+    REQUIRE(arena.intern("C") != a);
+    // long strings are stored in their own block
+    std::string long_str(1 << 20, 'G');
+    REQUIRE(arena.store(long_str) == long_str);
+    REQUIRE(keys.front() == "rs0");
+    index.clear();
+    REQUIRE(index.empty());
+    REQUIRE(index.find("rs0") == StringIndex::npos);
+}
+
+TEST_CASE("Radix sort")
+{
+    // large enough to use multiple threads
+    const size_t num_item = GENERATE(0, 1, 100, 100000);
+    const size_t thread = GENERATE(1, 3);
+    std::mt19937_64 rng(num_item);
+    std::vector<uint64_t> chr(num_item), loc(num_item), pos(num_item);
+    for (size_t i = 0; i < num_item; ++i)
+    {
+        chr[i] = rng() % 23;
+        loc[i] = rng() % 1000;
+        // large values to make sure all digits are used
+        pos[i] = rng() >> (rng() % 64);
+    }
+    auto order = radix::sort_index({chr, loc, pos}, thread);
+    std::vector<size_t> expected(num_item);
+    std::iota(expected.begin(), expected.end(), 0);
+    std::stable_sort(expected.begin(), expected.end(),
+                     [&](size_t a, size_t b) {
+                         return std::tie(chr[a], loc[a], pos[a])
+                                < std::tie(chr[b], loc[b], pos[b]);
+                     });
+    REQUIRE(order == expected);
+    // stable when keys are tied
+    std::vector<size_t> tied_order = radix::sort_index({chr}, thread);
+    std::iota(expected.begin(), expected.end(), 0);
+    std::stable_sort(expected.begin(), expected.end(),
+                     [&](size_t a, size_t b) { return chr[a] < chr[b]; });
+    REQUIRE(tied_order == expected);
+}
+
+TEST_CASE("Memory mapped file read")
+{
+    const std::string name = "file_read_test.bin";
+    std::string content;
+    for (size_t i = 0; i < 5000; ++i) { content.push_back(char(i % 251)); }
+    {
+        std::ofstream out(name.c_str(), std::ios::binary);
+        out.write(content.data(), static_cast<std::streamsize>(content.size()));
+    }
+    auto map_file = GENERATE(true, false);
+    FileRead reader(map_file);
+    const size_t handle = reader.open(name);
+    REQUIRE(reader.open(name) == handle);
+    reader.advise(FileRead::Access::RANDOM);
+    std::vector<char> buffer(100);
+    for (size_t pos : {size_t(4900), size_t(0), size_t(1234)})
+    {
+        reader.read(handle, static_cast<std::streampos>(pos), 100,
+                    buffer.data());
+        REQUIRE(std::string(buffer.data(), 100) == content.substr(pos, 100));
+        // old interface using the file name
+        reader.read(name, static_cast<std::streampos>(pos), 100,
+                    buffer.data());
+        REQUIRE(std::string(buffer.data(), 100) == content.substr(pos, 100));
+    }
+    const char* mapped = reader.data(handle, 10, 20);
+    if (map_file)
+    {
+        REQUIRE(mapped != nullptr);
+        REQUIRE(std::string(mapped, 20) == content.substr(10, 20));
+    }
+    else
+    {
+        REQUIRE(mapped == nullptr);
+    }
+    // near contiguous reads are served from one larger read, with and
+    // without a gap between the reads
+    for (size_t gap : {size_t(0), size_t(5), size_t(40)})
+    {
+        reader.coalesce(256, 16);
+        for (size_t pos = 7; pos + 30 <= content.size(); pos += 30 + gap)
+        {
+            reader.read(handle, static_cast<std::streampos>(pos), 30,
+                        buffer.data());
+            REQUIRE(std::string(buffer.data(), 30) == content.substr(pos, 30));
+        }
+    }
+    // content appended after the file was opened should still be readable
+    {
+        std::ofstream out(name.c_str(), std::ios::binary | std::ios::app);
+        out.write(content.data(), 100);
+    }
+    reader.read(handle, static_cast<std::streampos>(content.size()), 100,
+                buffer.data());
+    REQUIRE(std::string(buffer.data(), 100) == content.substr(0, 100));
+    REQUIRE_THROWS(reader.read(handle, 10000, 100, buffer.data()));
+    reader.close();
+    std::remove(name.c_str());
+    REQUIRE_THROWS(reader.read(name, 0, 100, buffer.data()));
+}
+
+TEST_CASE("Concurrent positional read")
+{
+    const std::string name = "pread_test.bin";
+    std::string content;
+    for (size_t i = 0; i < 20000; ++i) { content.push_back(char(i % 241)); }
+    {
+        std::ofstream out(name.c_str(), std::ios::binary);
+        out.write(content.data(), static_cast<std::streamsize>(content.size()));
+    }
+    auto map_file = GENERATE(true, false);
+    FileRead reader(map_file);
+    const size_t handle = reader.open(name);
+    REQUIRE(reader.find(name) == handle);
+    REQUIRE(reader.find("not_opened") == FileRead::npos);
+    ScratchPool<std::vector<char>> pool;
+    const size_t num_thread = 4, read_size = 77;
+    // catch isn't thread safe, so only count the mismatches in the threads
+    std::vector<size_t> mismatch(num_thread, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_thread; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (size_t pos = t; pos + read_size <= content.size(); pos += 13)
+            {
+                auto buffer = pool.acquire();
+                buffer->resize(read_size);
+                reader.pread(handle, static_cast<std::streampos>(pos),
+                             read_size, buffer->data());
+                if (std::string(buffer->data(), read_size)
+                    != content.substr(pos, read_size))
+                { ++mismatch[t]; }
+            }
+        });
+    }
+    for (auto&& thread : threads) thread.join();
+    REQUIRE(mismatch == std::vector<size_t>(num_thread, 0));
+    // buffers are returned to the pool and reused
+    REQUIRE(pool.idle() >= 1);
+    REQUIRE(pool.idle() <= num_thread);
+    {
+        auto buffer = pool.acquire();
+        REQUIRE(buffer->size() == read_size);
+    }
+    // content appended after the file was mapped is read from the file
+    {
+        std::ofstream out(name.c_str(), std::ios::binary | std::ios::app);
+        out.write(content.data(), 100);
+    }
+    std::vector<char> buffer(100);
+    reader.pread(handle, static_cast<std::streampos>(content.size()), 100,
+                 buffer.data());
+    REQUIRE(std::string(buffer.data(), 100) == content.substr(0, 100));
+    REQUIRE_THROWS(reader.pread(handle, 30000, 100, buffer.data()));
+    reader.close();
+    std::remove(name.c_str());
+}
+
+TEST_CASE("Cache file names")
+{
+    REQUIRE(misc::dir_name("out") == ".");
+    REQUIRE(misc::dir_name("result/out") == "result");
+    REQUIRE(misc::dir_name("/out") == "/");
+    const std::string name = "cache_name_test.bed";
+    {
+        std::ofstream out(name.c_str());
+        out << "x";
+    }
+    const std::string cache = misc::cache_file("cache", name, ".count");
+    REQUIRE(cache.rfind("cache/" + name + ".", 0) == 0);
+    REQUIRE(cache.size() == std::string("cache/").size() + name.size() + 17
+                                + std::string(".count").size());
+    // the same file referred to by a different path share the cache
+    REQUIRE(misc::cache_file("cache", "./" + name, ".count") == cache);
+    // but not a file with the same name in another directory
+    REQUIRE(misc::cache_file("cache", "other/" + name, ".count") != cache);
+    REQUIRE(misc::tmp_file("a.idx") != "a.idx.tmp");
+    std::remove(name.c_str());
+}
+
+TEST_CASE("Hasher")
+{
+    std::vector<uint64_t> words(4, 0);
+    const auto hash = [&words]() {
+        return misc::Hasher()
+            .add(words.data(), words.size() * sizeof(uint64_t))
+            .value();
+    };
+    const unsigned long long original = hash();
+    const uint64_t high = 1ULL << 63;
+    SECTION("high bit flips don't cancel")
+    {
+        words[0] ^= high;
+        words[2] ^= high;
+        REQUIRE(hash() != original);
+    }
+    SECTION("a high bit flip changes the low bits")
+    {
+        words[1] ^= high;
+        REQUIRE((hash() & 0xffffffffULL) != (original & 0xffffffffULL));
+    }
+    SECTION("word order matters")
+    {
+        words[0] = 1;
+        const unsigned long long first = hash();
+        std::swap(words[0], words[1]);
+        REQUIRE(hash() != first);
+    }
+}
+
+TEST_CASE("Bgen sidecar index")
+{
+    const std::string bgen_name = "index_test.bgen";
+    const std::string name = bgen_index::index_name(".", bgen_name);
+    {
+        std::ofstream out(bgen_name.c_str(), std::ios::binary);
+        out << std::string(3000, 'x');
+    }
+    const unsigned long long key = bgen_index::key(bgen_name, 100);
+    REQUIRE(key == bgen_index::key(bgen_name, 100));
+    const size_t num_variant = 1000;
+    {
+        // index not completed should be removed
+        bgen_index::Writer writer;
+        REQUIRE(writer.open(name, key, num_variant));
+        writer.write("SNP", "rs1", "1", 10, "A", "C", 100);
+    }
+    bgen_index::Reader reader;
+    REQUIRE_FALSE(reader.open(name, key, num_variant));
+    {
+        bgen_index::Writer writer;
+        REQUIRE(writer.open(name, key, num_variant));
+        for (size_t i = 0; i < num_variant; ++i)
+        {
+            writer.write("SNP" + std::to_string(i), "rs" + std::to_string(i),
+                         std::to_string(i % 22 + 1), static_cast<uint32_t>(i),
+                         "A", i % 2 ? "" : "TTG",
+                         static_cast<std::streamoff>(i * 1000 + 7));
+        }
+        REQUIRE(writer.close());
+    }
+    REQUIRE_FALSE(bgen_index::Reader().open(name, key + 1, num_variant));
+    REQUIRE_FALSE(bgen_index::Reader().open(name, key, num_variant + 1));
+    REQUIRE(reader.open(name, key, num_variant));
+    std::string snp_id, rs_id, chr, a1, a2;
+    uint32_t loc;
+    std::streampos byte_pos;
+    for (size_t i = 0; i < num_variant; ++i)
+    {
+        reader.read(snp_id, rs_id, chr, loc, a1, a2, byte_pos);
+        REQUIRE(snp_id == "SNP" + std::to_string(i));
+        REQUIRE(rs_id == "rs" + std::to_string(i));
+        REQUIRE(chr == std::to_string(i % 22 + 1));
+        REQUIRE(loc == i);
+        REQUIRE(a1 == "A");
+        REQUIRE(a2 == (i % 2 ? "" : "TTG"));
+        REQUIRE(static_cast<std::streamoff>(byte_pos)
+                == static_cast<std::streamoff>(i * 1000 + 7));
+    }
+    REQUIRE_THROWS(reader.read(snp_id, rs_id, chr, loc, a1, a2, byte_pos));
+    // key change once the bgen file is modified
+    {
+        std::ofstream out(bgen_name.c_str(), std::ios::binary | std::ios::app);
+        out << "y";
+    }
+    REQUIRE(bgen_index::key(bgen_name, 100) != key);
+    std::remove(name.c_str());
+    std::remove(bgen_name.c_str());
+}
+
+TEST_CASE("File lock")
+{
+    const std::string name = "file_lock_test.lock";
+    // the holder removes the lock file every time, the lock must still be
+    // exclusive
+    std::atomic<size_t> holders(0), max_holders(0);
+    std::atomic<bool> failed(false);
+    auto work = [&]() {
+        for (size_t i = 0; i < 200; ++i)
+        {
+            misc::FileLock lock;
+            if (!lock.lock(name)) failed = true;
+            const size_t cur = ++holders;
+            if (cur > max_holders) max_holders = cur;
+            std::this_thread::yield();
+            --holders;
+            lock.remove();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < 4; ++i) workers.emplace_back(work);
+    for (auto&& worker : workers) worker.join();
+    REQUIRE_FALSE(failed);
+    REQUIRE(max_holders == 1);
+    struct stat lock_stat;
+    REQUIRE(stat(name.c_str(), &lock_stat) != 0);
+}
+
+TEST_CASE("Hard call cache")
+{
+    const std::string bgen_name = "hardcall_test.bgen";
+    {
+        std::ofstream out(bgen_name.c_str(), std::ios::binary);
+        out << std::string(3000, 'x');
+    }
+    const std::vector<uintptr_t> sample_include = {0x5, 0x3};
+    const unsigned long long setting_key =
+        hardcall_cache::setting_key(0.1, 0.0, 70, sample_include);
+    REQUIRE(setting_key
+            != hardcall_cache::setting_key(0.2, 0.0, 70, sample_include));
+    REQUIRE(setting_key
+            != hardcall_cache::setting_key(0.1, 0.0, 70, {0x5, 0x1}));
+    const std::string name =
+        hardcall_cache::cache_name(".", bgen_name, setting_key);
+    const unsigned long long key = hardcall_cache::file_key(bgen_name);
+    // the key doesn't depend on how the file is reached
+    REQUIRE(hardcall_cache::file_key("./" + bgen_name) == key);
+    const size_t row_bytes = 18;
+    std::vector<uintptr_t> genotype(3, 0);
+    auto add = [&genotype](hardcall_cache::Cache& cache, size_t i) {
+        hardcall_cache::Entry entry;
+        entry.bgen_pos = i * 100 + 7;
+        entry.homcom_ct = i;
+        entry.info_score = 0.5 * static_cast<double>(i);
+        std::fill(genotype.begin(), genotype.end(), i * 0x0101010101010101);
+        return cache.append(entry, genotype.data()).row;
+    };
+    {
+        // cache not completed should be removed
+        hardcall_cache::Cache cache;
+        REQUIRE(cache.open(name, key, row_bytes));
+        add(cache, 1);
+    }
+    {
+        hardcall_cache::Cache cache;
+        REQUIRE(cache.open(name, key, row_bytes));
+        REQUIRE(cache.find(107) == nullptr);
+        for (size_t i = 0; i < 10; ++i) { REQUIRE(add(cache, i) == i); }
+        REQUIRE(cache.close());
+    }
+    {
+        // variants not in the cache are appended
+        hardcall_cache::Cache cache;
+        REQUIRE(cache.open(name, key, row_bytes));
+        REQUIRE(cache.find(10 * 100 + 7) == nullptr);
+        REQUIRE(add(cache, 10) == 10);
+        REQUIRE(cache.close());
+    }
+    hardcall_cache::Cache cache;
+    REQUIRE(cache.open(name, key, row_bytes));
+    std::ifstream bed(name.c_str(), std::ios::binary);
+    std::string row(row_bytes, '\0');
+    bed.read(&row[0], 3);
+    REQUIRE(row.substr(0, 3) == std::string(hardcall_cache::bed_magic, 3));
+    for (size_t i = 0; i <= 10; ++i)
+    {
+        auto&& entry = cache.find(static_cast<std::streamoff>(i * 100 + 7));
+        REQUIRE(entry != nullptr);
+        REQUIRE(entry->homcom_ct == i);
+        REQUIRE(entry->info_score == Approx(0.5 * static_cast<double>(i)));
+        REQUIRE(static_cast<std::streamoff>(cache.byte_pos(*entry))
+                == static_cast<std::streamoff>(3 + i * row_bytes));
+        REQUIRE(static_cast<std::streamoff>(
+                    cache.bgen_pos(cache.byte_pos(*entry)))
+                == static_cast<std::streamoff>(i * 100 + 7));
+        bed.read(&row[0], static_cast<std::streamsize>(row_bytes));
+        REQUIRE(row == std::string(row_bytes, static_cast<char>(i)));
+    }
+    {
+        // a second user of the cache waits until the cache is closed
+        std::atomic<bool> opened(false);
+        std::thread other([&]() {
+            hardcall_cache::Cache other_cache;
+            opened = other_cache.open(name, key, row_bytes);
+            other_cache.close();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        REQUIRE_FALSE(opened);
+        REQUIRE(cache.close());
+        other.join();
+        REQUIRE(opened);
+        // the lock file is removed once the cache is closed
+        struct stat lock_stat;
+        REQUIRE(stat((name + ".lock").c_str(), &lock_stat) != 0);
+    }
+    // the cache is rebuilt once the bgen file is modified
+    {
+        std::ofstream out(bgen_name.c_str(), std::ios::binary | std::ios::app);
+        out << "y";
+    }
+    REQUIRE(hardcall_cache::file_key(bgen_name) != key);
+    REQUIRE(cache.open(name, hardcall_cache::file_key(bgen_name), row_bytes));
+    REQUIRE(cache.find(107) == nullptr);
+    REQUIRE(cache.close());
+    // or rewritten with the same size and modification time
+    const unsigned long long modified_key = hardcall_cache::file_key(bgen_name);
+    struct stat bgen_stat;
+    REQUIRE(stat(bgen_name.c_str(), &bgen_stat) == 0);
+    {
+        std::ofstream out(bgen_name.c_str(), std::ios::binary);
+        out << std::string(3000, 'z') << "y";
+    }
+    struct utimbuf time;
+    time.actime = bgen_stat.st_atime;
+    time.modtime = bgen_stat.st_mtime;
+    REQUIRE(utime(bgen_name.c_str(), &time) == 0);
+    REQUIRE(hardcall_cache::file_key(bgen_name) != modified_key);
+    std::remove(name.c_str());
+    std::remove((name + ".idx").c_str());
+    std::remove(bgen_name.c_str());
+}
+
+TEST_CASE("Count cache")
+{
+    const std::string geno_name = "count_test.bed";
+    {
+        std::ofstream out(geno_name.c_str(), std::ios::binary);
+        out << std::string(300, 'x');
+    }
+    const std::vector<uintptr_t> sample_include = {0x5, 0x3};
+    const std::vector<uintptr_t> founder_include = {0x5, 0x1};
+    const unsigned long long setting_key =
+        count_cache::setting_key(70, sample_include, founder_include);
+    REQUIRE(setting_key
+            != count_cache::setting_key(70, sample_include, sample_include));
+    REQUIRE(setting_key
+            != count_cache::setting_key(71, sample_include, founder_include));
+    const std::string name =
+        count_cache::cache_name(".", geno_name, setting_key);
+    const unsigned long long key = count_cache::file_key(geno_name);
+    {
+        count_cache::Cache cache;
+        cache.open(name, key);
+        REQUIRE(cache.size() == 0);
+        for (uint32_t i = 0; i < 10; ++i)
+        {
+            count_cache::Entry entry;
+            entry.pos = i * 18 + 3;
+            entry.ll_ct = i;
+            entry.hh_ctf = 2 * i;
+            cache.add(entry);
+        }
+        REQUIRE(cache.close());
+    }
+    count_cache::Cache cache;
+    cache.open(name, key);
+    REQUIRE(cache.size() == 10);
+    REQUIRE(cache.find(4) == nullptr);
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        auto&& entry = cache.find(static_cast<std::streamoff>(i * 18 + 3));
+        REQUIRE(entry != nullptr);
+        REQUIRE(entry->ll_ct == i);
+        REQUIRE(entry->hh_ctf == 2 * i);
+    }
+    // the cache is not used once the genotype file is modified
+    {
+        std::ofstream out(geno_name.c_str(), std::ios::binary | std::ios::app);
+        out << "y";
+    }
+    REQUIRE(count_cache::file_key(geno_name) != key);
+    cache.open(name, count_cache::file_key(geno_name));
+    REQUIRE(cache.size() == 0);
+    REQUIRE(cache.find(3) == nullptr);
+    // nor when it is rewritten with the same size and modification time
+    const unsigned long long modified_key = count_cache::file_key(geno_name);
+    REQUIRE(count_cache::file_key("./" + geno_name) == modified_key);
+    struct stat geno_stat;
+    REQUIRE(stat(geno_name.c_str(), &geno_stat) == 0);
+    {
+        std::ofstream out(geno_name.c_str(), std::ios::binary);
+        out << std::string(300, 'z') << "y";
+    }
+    struct utimbuf time;
+    time.actime = geno_stat.st_atime;
+    time.modtime = geno_stat.st_mtime;
+    REQUIRE(utime(geno_name.c_str(), &time) == 0);
+    REQUIRE(count_cache::file_key(geno_name) != modified_key);
+    std::remove(name.c_str());
+    std::remove(geno_name.c_str());
+}
+
+TEST_CASE("PLINK 2 count header")
+{
+    SECTION("gcount")
+    {
+        auto columns = count_cache::parse_header(
+            "#CHROM\tID\tREF\tALT\tHOM_REF_CT\tHET_REF_ALT_CTS\t"
+            "TWO_ALT_GENO_CTS\tHAP_REF_CT\tHAP_ALT_CTS\tMISSING_CT");
+        REQUIRE(columns.valid());
+        REQUIRE(columns.genotype_counts());
+        REQUIRE(columns.id == 1);
+        REQUIRE(columns.hom_ref == 4);
+        REQUIRE(columns.two_alt == 6);
+        REQUIRE(columns.missing == 9);
+        REQUIRE(columns.num_col == 10);
+    }
+    SECTION("acount")
+    {
+        auto columns =
+            count_cache::parse_header("#ID\tREF\tALT\tALT_CTS\tOBS_CT");
+        REQUIRE(columns.valid());
+        REQUIRE_FALSE(columns.genotype_counts());
+        REQUIRE(columns.allele_counts());
+        REQUIRE(columns.id == 0);
+        REQUIRE(columns.obs_ct == 4);
+    }
+    SECTION("invalid")
+    {
+        REQUIRE_FALSE(count_cache::parse_header(
+                          "#CHROM\tID\tREF\tALT\tALT_FREQS\tOBS_CT")
+                          .valid());
+        REQUIRE_FALSE(
+            count_cache::parse_header("#CHROM\tREF\tALT\tALT_CTS\tOBS_CT")
+                .valid());
+    }
+}
+
+TEST_CASE("Genotype prefetch")
+{
+    const std::vector<std::string> names = {"prefetch_test_1.bin",
+                                            "prefetch_test_2.bin"};
+    const size_t block_size = 13;
+    const size_t num_block = 200;
+    std::vector<std::string> content(names.size());
+    for (size_t i_file = 0; i_file < names.size(); ++i_file)
+    {
+        for (size_t i = 0; i < block_size * num_block; ++i)
+        { content[i_file].push_back(char((i * (i_file + 3)) % 127)); }
+        std::ofstream out(names[i_file].c_str(), std::ios::binary);
+        out << content[i_file];
+    }
+    std::vector<Prefetcher::Request> requests;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        requests.push_back(
+            {i % 2, static_cast<std::streampos>(((i * 7) % num_block)
+                                                * block_size)});
+    }
+    auto depth = GENERATE(size_t(1), size_t(3), size_t(64));
+    Prefetcher prefetch(names, requests, block_size, depth);
+    for (auto&& request : requests)
+    {
+        const char* block = reinterpret_cast<const char*>(prefetch.next());
+        REQUIRE(std::string(block, block_size)
+                == content[request.file_idx].substr(
+                    static_cast<size_t>(request.byte_pos), block_size));
+    }
+    REQUIRE_THROWS(prefetch.next());
+    // errors on the I/O thread are reported when the block is requested
+    Prefetcher invalid(names,
+                       {{0, 0}, {1, static_cast<std::streampos>(
+                                        block_size * num_block)}},
+                       block_size, depth);
+    REQUIRE_NOTHROW(invalid.next());
+    REQUIRE_THROWS(invalid.next());
+    // stop before all blocks are read
+    {
+        Prefetcher unused(names, requests, block_size, depth);
+        REQUIRE_NOTHROW(unused.next());
+    }
+    for (auto&& name : names) std::remove(name.c_str());
+}
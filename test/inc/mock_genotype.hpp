@@ -1,9 +1,14 @@
 #ifndef MOCK_GENOTYPE_H
 #define MOCK_GENOTYPE_H
 
+#include "binarygen.hpp"
+#include "binaryplink.hpp"
 #include "genotype.hpp"
 #include "reporter.hpp"
+#include <atomic>
 #include <memory>
+#include <numeric>
+#include <thread>
 
 class mockGenotype : public Genotype
 {
@@ -154,7 +159,7 @@ public:
         return m_genotype_file_names;
     }
     std::vector<SNP> existed_snps() const { return m_existed_snps; }
-    std::unordered_map<std::string, size_t> existed_snps_idx() const
+    StringIndex existed_snps_idx() const
     {
         return m_existed_snps_index;
     }
@@ -167,6 +172,7 @@ public:
     void set_sample(uintptr_t n_sample) { m_unfiltered_sample_ct = n_sample; }
     void set_delim(const std::string& delim) { m_delim = delim; }
     void set_ignore_fid(const bool ignore_fid) { m_ignore_fid = ignore_fid; }
+    void set_thread(const size_t thread) { m_thread = thread; }
     size_t num_male() const { return m_num_male; }
     size_t num_female() const { return m_num_female; }
     size_t num_ambig_sex() const { return m_num_ambig_sex; }
@@ -175,6 +181,198 @@ public:
     uintptr_t num_sample() const { return m_sample_ct; }
     std::vector<uintptr_t> sample_for_ld() const { return m_sample_for_ld; }
     std::vector<uintptr_t> calculate_prs() const { return m_calculate_prs; }
+    void test_read_prs(const std::vector<uintptr_t>& genotype,
+                       std::vector<PRS>& prs_list, MISSING_SCORE missing,
+                       const double miss_score, const bool not_first)
+    {
+        m_sample_ct = prs_list.size();
+        m_prs_calculation.missing_score = missing;
+        read_prs(genotype, prs_list, 2, 0.5, 0.25, miss_score, 0, 1, 2,
+                 not_first);
+    }
+    // return if the counts of each SNP are taken from the count file
+    std::vector<bool> test_import_freq_count(const std::string& file,
+                                             const std::vector<SNP>& snps,
+                                             const uintptr_t num_founder)
+    {
+        m_freq_count_file = file;
+        m_existed_snps = snps;
+        m_sample_ct = m_founder_ct = num_founder;
+        std::vector<MarkerCounts> counts(snps.size());
+        std::vector<CountSource> source(snps.size(), CountSource::READ);
+        import_freq_count(this, counts, source);
+        std::vector<bool> imported;
+        for (auto&& s : source) { imported.push_back(s != CountSource::READ); }
+        return imported;
+    }
+};
+
+class mockBinaryGen : public BinaryGen
+{
+public:
+    // decode the probability data either with the specialised decoder or the
+    // callbacks of the bgen library
+    static void test_dosage(const genfile::bgen::Context& context,
+                            const std::vector<genfile::byte_t>& data,
+                            const std::vector<uintptr_t>& inclusion,
+                            bool specialised, std::vector<double>& dosage,
+                            std::vector<uint8_t>& missing)
+    {
+        Dosage_Decoder setter(&inclusion, &dosage, &missing);
+        setter.set_weight(0, 1, 2, true);
+        parse(context, data, setter, specialised);
+    }
+    static void test_hard_coded(const genfile::bgen::Context& context,
+                                const std::vector<genfile::byte_t>& data,
+                                const std::vector<uintptr_t>& inclusion,
+                                bool specialised,
+                                std::vector<uintptr_t>& genotype,
+                                std::vector<size_t>& counts, double& info)
+    {
+        PLINK_generator setter(&inclusion, genotype.data(), 0.1, 0.0);
+        parse(context, data, setter, specialised);
+        counts.resize(4);
+        setter.get_count(counts[0], counts[1], counts[2], counts[3]);
+        info = setter.info_score();
+    }
+
+    // score the SNPs with all samples included. The genotype blocks are
+    // read from prefix.bgen with the byte position of the SNPs
+    std::vector<PRS> test_score(const std::string& prefix,
+                                const genfile::bgen::Context& context,
+                                const std::vector<SNP>& snps,
+                                const size_t thread, const bool hard_coded)
+    {
+        m_genotype_file_names = {prefix};
+        m_context_map = {context};
+        m_unfiltered_sample_ct = context.number_of_samples;
+        m_sample_ct = m_unfiltered_sample_ct;
+        m_calculate_prs.assign(BITCT_TO_WORDCT(m_sample_ct), 0);
+        for (uint32_t i = 0; i < m_sample_ct; ++i)
+        { SET_BIT(i, m_calculate_prs.data()); }
+        m_existed_snps = snps;
+        m_thread = thread;
+        m_hard_coded = hard_coded;
+        m_hard_threshold = 0.1;
+        std::vector<size_t> idx(snps.size());
+        std::iota(idx.begin(), idx.end(), 0);
+        std::vector<PRS> prs(m_sample_ct);
+        read_score(prs, idx.cbegin(), idx.cend(), true);
+        return prs;
+    }
+
+private:
+    template <typename Setter>
+    static void parse(const genfile::bgen::Context& context,
+                      const std::vector<genfile::byte_t>& data, Setter& setter,
+                      bool specialised)
+    {
+        if (specialised) { parse_probability(context, data, setter); }
+        else
+        {
+            genfile::bgen::parse_probability_data(
+                data.data(), data.data() + data.size(), context, setter);
+        }
+    }
+};
+
+class mockBinaryPlink : public BinaryPlink
+{
+public:
+    mockBinaryPlink(const std::vector<std::string>& prefix,
+                    const uintptr_t num_sample, const size_t thread,
+                    const std::string& cache_dir, Reporter* reporter)
+    {
+        m_genotype_file_names = prefix;
+        m_unfiltered_sample_ct = num_sample;
+        m_thread = thread;
+        m_cache_dir = cache_dir;
+        m_reporter = reporter;
+        init_chr();
+    }
+    void set_base(const std::vector<SNP>& snps)
+    {
+        m_existed_snps = snps;
+        update_snp_index();
+    }
+    void test_gen_snp_vector()
+    {
+        gen_snp_vector(std::vector<IITree<size_t, size_t>>(), "bim_test");
+    }
+    std::vector<std::string> test_load_bim(const size_t idx)
+    {
+        BimBatch batch;
+        load_bim(idx, batch);
+        if (batch.error) std::rethrow_exception(batch.error);
+        return batch.rs;
+    }
+    // include all samples, every third sample is not a founder
+    void set_samples()
+    {
+        init_sample_vectors();
+        for (uint32_t i = 0; i < m_unfiltered_sample_ct; ++i)
+        {
+            SET_BIT(i, m_calculate_prs.data());
+            ++m_sample_ct;
+            if (i % 3 == 0) continue;
+            SET_BIT(i, m_sample_for_ld.data());
+            ++m_founder_ct;
+        }
+        post_sample_read_init();
+    }
+    bool test_calc_freq(const QCFiltering& filter)
+    {
+        return calc_freq_gen_inter(filter, "", nullptr, true);
+    }
+    size_t num_maf_filter() const { return m_num_maf_filter; }
+    size_t num_geno_filter() const { return m_num_geno_filter; }
+    const std::vector<SNP>& existed_snps() const { return m_existed_snps; }
+    /*!
+     * \brief Read the genotypes of all SNPs. With more than one thread, the
+     * SNPs are interleaved between the threads and read with
+     * read_genotype_concurrent
+     * \return the genotypes, empty if any of the read failed
+     */
+    std::vector<uintptr_t> test_read_all(const size_t thread)
+    {
+        const size_t stride = 2 * BITCT_TO_WORDCT(m_unfiltered_sample_ct);
+        std::vector<uintptr_t> result(stride * m_existed_snps.size(), 0);
+        if (thread == 1)
+        {
+            for (size_t i = 0; i < m_existed_snps.size(); ++i)
+            {
+                read_genotype(&result[i * stride],
+                              m_existed_snps[i].get_byte_pos(),
+                              m_existed_snps[i].get_file_idx());
+            }
+            return result;
+        }
+        prepare_concurrent_read();
+        std::atomic<bool> failed(false);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < thread; ++t)
+        {
+            workers.emplace_back([&, t]() {
+                try
+                {
+                    for (size_t i = t; i < m_existed_snps.size(); i += thread)
+                    {
+                        read_genotype_concurrent(
+                            &result[i * stride],
+                            m_existed_snps[i].get_byte_pos(),
+                            m_existed_snps[i].get_file_idx());
+                    }
+                }
+                catch (...)
+                {
+                    failed = true;
+                }
+            });
+        }
+        for (auto&& worker : workers) worker.join();
+        if (failed) result.clear();
+        return result;
+    }
 };
 
 #endif // MOCK_GENOTYPE_H